@@ -115,6 +115,10 @@ const pathtracer_objects = [
 	maek.CPP("src/pathtracer/pathtracer.cpp"),
 	maek.CPP("src/pathtracer/tri_mesh.cpp"),
 	maek.CPP("src/pathtracer/bvh.cpp"),
+	maek.CPP("src/pathtracer/tri_kernels.cpp"),
+	maek.CPP("src/pathtracer/mesh_cache.cpp"),
+	maek.CPP("src/pathtracer/ray_stats.cpp"),
+	maek.CPP("src/pathtracer/light_sampler.cpp"),
 	maek.CPP("src/pathtracer/samplers.cpp"),
 ];
 const util_objects = [
@@ -1287,6 +1287,7 @@ void Widget_Render::begin_window(Scene& scene, Undo& undo, Manager& manager, Vie
 
 	if (method == Method::path_trace) {
 		Checkbox("Use BVH", &use_bvh);
+		Checkbox("Wavefront", &wavefront);
 	}
 }
 
@@ -1349,7 +1350,7 @@ void Widget_Render::ui_animate(Scene& scene, Manager& manager, Undo& undo, View_
 				if (method == Method::path_trace) {
 					pathtracer.render(scene, render_cam.lock(), std::move(report_callback), &quit);
 				} else if(method == Method::software_raster) {
-					rasterizer.reset(new Rasterizer(scene, *render_cam.lock(), std::move(report_callback)));
+					rasterizer.reset(new Rasterizer(scene, *render_cam.lock(), std::move(report_callback), pathtracer.threads()));
 				}
 			}
 		}
@@ -1406,6 +1407,7 @@ bool Widget_Render::ui_render(Scene& scene, Manager& manager, Undo& undo, View_3
 				has_rendered = true;
 				rebuild_ray_log = true;
 				pathtracer.use_bvh(use_bvh);
+				pathtracer.use_wavefront(wavefront);
 				pathtracer.render(scene, render_cam.lock(), [this, report_callback](PT::Pathtracer::Render_Report &&report){
 					report_callback(std::move(report));
 					rebuild_ray_log = true;
@@ -1414,7 +1416,7 @@ bool Widget_Render::ui_render(Scene& scene, Manager& manager, Undo& undo, View_3
 			} else if (method == Method::software_raster) {
 
 				has_rendered = true;
-				rasterizer.reset(new Rasterizer(scene, *render_cam.lock(), std::move(report_callback)));
+				rasterizer.reset(new Rasterizer(scene, *render_cam.lock(), std::move(report_callback), pathtracer.threads()));
 
 			} else {
 
@@ -1611,6 +1613,7 @@ std::string Widget_Render::step_animation(Scene& scene, Animator& animator, Mana
 
 				render_progress = 0.0f;
 				pathtracer.use_bvh(use_bvh);
+				pathtracer.use_wavefront(wavefront);
 				pathtracer.render(scene, render_cam.lock(), std::move(report_callback), &quit);
 				next_frame++;
 			}
@@ -1642,7 +1645,7 @@ std::string Widget_Render::step_animation(Scene& scene, Animator& animator, Mana
 				}
 
 				render_progress = 0.0f;
-				rasterizer.reset(new Rasterizer(scene, *render_cam.lock(), std::move(report_callback)));
+				rasterizer.reset(new Rasterizer(scene, *render_cam.lock(), std::move(report_callback), pathtracer.threads()));
 				next_frame++;
 			}
 		}
@@ -236,6 +236,7 @@ private:
 
 	float exposure = 1.0f;
 	bool use_bvh = true;
+	bool wavefront = false;
 	bool has_rendered = false, rebuild_ray_log = false;
 	bool render_window = false, render_window_focus = false;
 	bool quit = false;
@@ -4,6 +4,8 @@
 
 #include "platform/platform.h"
 #include "util/rand.h"
+#include "util/thread_pool.h"
+#include "util/timer.h"
 #include "lib/log.h"
 
 #include "pathtracer/pathtracer.h"
@@ -14,6 +16,197 @@
 #include "test.h"
 
 #include <filesystem>
+#include <fstream>
+#include <optional>
+
+//print a progress bar (over the previous one):
+static void print_progress(float f) {
+	std::cout << "Progress: [";
+
+	int32_t console = static_cast<int32_t>(Platform::console_width());
+	int32_t width = std::clamp(console - 30, 0, 50);
+	if (width) {
+		int32_t bar = static_cast<int32_t>(width * f);
+		for (int32_t i = 0; i < bar; i++) std::cout << "-";
+		for (int32_t i = bar; i < width; i++) std::cout << " ";
+		std::cout << "] ";
+	}
+
+	float percent = 100.0f * f;
+	if (percent < 10.0f) std::cout << " ";
+	std::cout << std::setprecision(2) << std::fixed;
+	std::cout << percent << "%    \r";
+	std::cout.flush();
+}
+
+static bool read_file(std::string const &path, std::vector<uint8_t> &data) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) return false;
+	data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return !in.bad();
+}
+
+static bool write_png(std::string const &path, HDR_Image const &image, float exposure) {
+	std::vector<uint8_t> data;
+	image.tonemap_to(data, exposure);
+	stbi_flip_vertically_on_write(true);
+	return stbi_write_png(path.c_str(), image.w, image.h, 4, data.data(), image.w * 4);
+}
+
+//Merge the checkpoints of a render's shards into an image at output (and, if checkpoint is not
+// "", a checkpoint of the whole render), failing if some shards are missing unless allow_partial;
+// returns the exit code for main:
+static int merge_shards(std::vector<std::string> const &files, std::string const &output, std::string const &checkpoint,
+                        bool allow_partial, float exposure) {
+	std::vector<std::vector<uint8_t>> shards(files.size());
+	for (size_t i = 0; i < files.size(); i++) {
+		if (!read_file(files[i], shards[i])) {
+			warn("ERROR: Failed to read checkpoint '%s'.", files[i].c_str());
+			return 1;
+		}
+	}
+	std::vector<uint8_t> merged;
+	std::string error;
+	std::vector<uint32_t> missing;
+	if (!PT::Pathtracer::merge_checkpoints(shards, merged, &error, &missing)) {
+		warn("ERROR: Failed to merge checkpoints: %s.", error.c_str());
+		return 1;
+	}
+	if (!missing.empty()) {
+		std::string list;
+		for (uint32_t s : missing) list += (list.empty() ? "" : ", ") + std::to_string(s);
+		if (!allow_partial) {
+			warn("ERROR: Shards %s are missing (merge with --allow-partial to leave their tiles black).", list.c_str());
+			return 1;
+		}
+		warn("Shards %s are missing, so their tiles are black (resume the merged --checkpoint to trace them).", list.c_str());
+	}
+	info("Merged %u checkpoints.", uint32_t(files.size()));
+	if (checkpoint != "") {
+		if (!PT::Pathtracer::write_checkpoint(checkpoint, merged)) {
+			warn("ERROR: Failed to write checkpoint '%s'.", checkpoint.c_str());
+			return 1;
+		}
+		std::cout << "Wrote merged checkpoint to '" << checkpoint << "'." << std::endl;
+	}
+	if (output != "") {
+		if (!write_png(output, PT::Pathtracer::checkpoint_image(merged), exposure)) {
+			warn("ERROR: Failed to write output to '%s'", output.c_str());
+			return 1;
+		}
+		std::cout << "Wrote result to '" << output << "'." << std::endl;
+	}
+	return 0;
+}
+
+//Trace in 'shards' child processes (copies of this program, run with argv plus shard options),
+// showing their combined progress, then merge their checkpoints; returns the exit code for main.
+//The children split threads render threads (0: one per hardware thread) between them:
+static int trace_local_shards(int argc, char **argv, uint32_t shards, uint32_t threads, std::string const &output,
+                              std::string const &checkpoint, bool resume, float exposure) {
+
+	//arguments to pass on (without the ones set per shard):
+	std::vector<std::string> forward{argv[0]};
+	const std::vector<std::string> drop_values{"--local-shards", "-o", "--output", "--checkpoint", "--seed", "--threads",
+	                                           "--sample-counts", "--stats-json", "--shard-index", "--shard-count"};
+	const std::vector<std::string> drop_flags{"--resume", "--progress-lines"};
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		std::string name = arg.substr(0, arg.find('='));
+		if (std::find(drop_values.begin(), drop_values.end(), name) != drop_values.end()) {
+			if (name == arg) i++; //(value is the next argument)
+			continue;
+		}
+		if (std::find(drop_flags.begin(), drop_flags.end(), arg) != drop_flags.end()) continue;
+		forward.emplace_back(arg);
+	}
+
+	//shard checkpoints go next to --checkpoint (so --resume can pick them up), or in a temporary directory:
+	std::filesystem::path temp_dir;
+	auto shard_file = [&](uint32_t s) {
+		if (checkpoint != "") return checkpoint + ".shard" + std::to_string(s);
+		return (temp_dir / ("shard" + std::to_string(s) + ".ckpt")).generic_string();
+	};
+	if (checkpoint == "") {
+		std::error_code ec;
+		temp_dir = std::filesystem::temp_directory_path(ec) / ("scotty3d-shards-" + std::to_string(std::random_device()()));
+		if (ec || !std::filesystem::create_directories(temp_dir, ec)) {
+			warn("ERROR: Failed to create a directory for shard checkpoints.");
+			return 1;
+		}
+	}
+
+	struct Shard {
+		FILE *child = nullptr;
+		std::thread reader;
+		std::atomic<float> progress = 0.0f;
+		std::atomic<bool> done = false;
+		int exit_code = -1;
+		std::string output; //(everything but progress lines, shown if the shard fails)
+	};
+	std::vector<Shard> children(shards);
+	//(each child would otherwise start a thread per hardware thread, oversubscribing the machine shards times over)
+	if (threads == 0) threads = std::thread::hardware_concurrency();
+	info("Tracing in %u processes, with %u threads between them...", shards, threads);
+	for (uint32_t s = 0; s < shards; s++) {
+		uint32_t child_threads = std::max(1u, threads / shards + (s < threads % shards ? 1u : 0u));
+		std::vector<std::string> args = forward;
+		args.insert(args.end(), {"--seed", std::to_string(RNG::fixed_seed), "--shard-index", std::to_string(s),
+		                         "--shard-count", std::to_string(shards), "--threads", std::to_string(child_threads),
+		                         "--checkpoint", shard_file(s), "--output", "", "--progress-lines"});
+		if (resume) args.emplace_back("--resume");
+
+		Shard &shard = children[s];
+		shard.child = Platform::open_child(args);
+		if (!shard.child) {
+			shard.output = "(could not be started)";
+			shard.done = true;
+			continue;
+		}
+		shard.reader = std::thread([&shard]() {
+			char line[1024];
+			while (std::fgets(line, sizeof(line), shard.child)) {
+				float f;
+				if (std::sscanf(line, "progress %f", &f) == 1) shard.progress = f;
+				else shard.output += line;
+			}
+			shard.exit_code = Platform::close_child(shard.child);
+			shard.done = true;
+		});
+	}
+
+	for (;;) {
+		bool all_done = true;
+		float progress = 0.0f;
+		for (Shard &shard : children) {
+			all_done = all_done && shard.done;
+			progress += shard.progress / float(shards);
+		}
+		if (all_done) break;
+		print_progress(progress);
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	}
+	std::cout << std::endl;
+
+	int ret = 0;
+	std::vector<std::string> files;
+	for (uint32_t s = 0; s < shards; s++) {
+		Shard &shard = children[s];
+		if (shard.reader.joinable()) shard.reader.join();
+		if (shard.exit_code != 0) {
+			warn("ERROR: Shard %u failed:\n%s", s, shard.output.c_str());
+			ret = 1;
+		}
+		files.emplace_back(shard_file(s));
+	}
+	if (ret == 0) ret = merge_shards(files, output, checkpoint, false, exposure);
+
+	if (!temp_dir.empty()) {
+		std::error_code ec;
+		std::filesystem::remove_all(temp_dir, ec);
+	}
+	return ret;
+}
 
 int main(int argc, char** argv) {
 
@@ -27,6 +220,7 @@ int main(int argc, char** argv) {
 
 	bool pathtrace = false;
 	bool rasterize = false;
+	bool msaa = false; //rasterize with coverage-mask multisampling rather than supersampling
 
 	std::string output_file = "out.png";
 
@@ -37,6 +231,21 @@ int main(int argc, char** argv) {
 
 	float exp = 1.0f;
 	bool no_bvh = false;
+	bool wavefront = false;
+	std::string sampler = "sobol"; //random number sequence for the pathtracer
+	PT::Pathtracer::Adaptive adaptive;
+	std::string sample_counts_file = ""; //write per-pixel sample counts here (if not "")
+	std::string stats_json_file = ""; //write the pathtracer's ray statistics here (if not "")
+	std::string bvh_cache = ""; //directory to keep mesh BVHs in between runs (if not "")
+	std::string checkpoint_file = ""; //periodically save the render in progress here (if not "")
+	float checkpoint_interval = 60.0f;
+	bool resume = false;
+	uint32_t shard_index = 0, shard_count = 1; //trace only this shard of the render
+	uint32_t local_shards = 0; //trace in this many child processes, one shard each (if more than 1)
+	std::vector<std::string> merge_files; //checkpoints of a render's shards to merge
+	bool allow_partial = false; //merge even if some shards are missing
+	uint32_t threads = 0; //threads to render with (0: one per hardware thread)
+	bool progress_lines = false; //print progress as lines of 'progress <fraction>' (for trace_local_shards)
 
 	uint32_t film_width = -1U; //override film width (if not -1U)
 	uint32_t film_height = -1U; //override film height (if not -1U)
@@ -56,12 +265,32 @@ int main(int argc, char** argv) {
 	args.add_option("--write", write_file, "Re-save file and exit");
 	args.add_flag("--trace", pathtrace, "Path trace scene without opening the GUI");
 	args.add_flag("--rasterize", rasterize, "Rasterize scene without opening the GUI");
+	args.add_flag("--msaa", msaa, "Rasterize triangles once per pixel for all samples of the film's sample pattern, instead of once per sample (if headless)");
 	args.add_option("-c,--camera", camera_name, "Camera instance to render (if headless)");
 	args.add_option("-o,--output", output_file, "Image file to write (if headless) [for animation, can also be a directory]");
 	args.add_flag("--animate", animate, "Output animation frames [min_frame,max_frame] (if headless)");
 	args.add_option("--min-frame", min_frame, "First animation frame");
 	args.add_option("--max-frame", max_frame, "Last animation frame (-1 is last keyframe)");
 	args.add_flag("--no_bvh", no_bvh, "Don't use BVH (if headless)");
+	args.add_option("--sampler", sampler, "Random numbers for the pathtracer: sobol, independent or mersenne (if headless)");
+	args.add_flag("--wavefront", wavefront, "Trace paths breadth-first with the wavefront integrator (if headless)");
+	args.add_flag("--adaptive", adaptive.enabled, "Adaptive sampling: stop sampling pixels once their error is low enough (if headless)");
+	args.add_option("--adaptive-min-samples", adaptive.min_samples, "Samples every pixel takes before adaptive sampling starts");
+	args.add_option("--adaptive-error", adaptive.max_error, "Relative error at which adaptive sampling stops sampling a pixel");
+	args.add_option("--adaptive-time", adaptive.time_budget, "Seconds after which adaptive sampling stops adding samples (0 is no limit). A soft limit: the first --adaptive-min-samples pass always finishes, as do tiles already running when it runs out");
+	args.add_option("--sample-counts", sample_counts_file, "Image file to write per-pixel sample counts to (if headless) [scaled so the film's sample count is white]");
+	args.add_option("--stats-json", stats_json_file, "JSON file to write ray counts and render timings to (if headless) [for animation, can also be a directory]");
+	args.add_option("--bvh-cache", bvh_cache, "Directory to save mesh BVHs in and load them from (if headless)");
+	args.add_option("--checkpoint", checkpoint_file, "File to save the render in progress to, so it can be resumed (if headless) [for animation, can also be a directory]");
+	args.add_option("--checkpoint-interval", checkpoint_interval, "Seconds between checkpoints");
+	args.add_flag("--resume", resume, "Continue the render saved in the --checkpoint file, if there is one (a higher --film-samples adds samples to it)");
+	args.add_option("--shard-index", shard_index, "Trace only this shard of the render (see --shard-count)");
+	args.add_option("--shard-count", shard_count, "Number of shards the render is split into; merge their checkpoints with --merge");
+	args.add_option("--local-shards", local_shards, "Trace in this many processes, one shard each, and merge their results (if headless)");
+	args.add_option("--merge", merge_files, "Checkpoints of a render's shards to merge into --output (and --checkpoint, if given)");
+	args.add_flag("--allow-partial", allow_partial, "Merge even if some shards' checkpoints are missing (their tiles stay black)");
+	args.add_option("--threads", threads, "Threads to render with, split between processes with --local-shards (0 is one per hardware thread)");
+	args.add_flag("--progress-lines", progress_lines, "Print progress as lines of 'progress <fraction>'")->group("");
 	args.add_option("--exposure", exp, "Output exposure (if headless)");
 	args.add_option("--seed", RNG::fixed_seed, "Use fixed seed for RNG when rendering; (0 disables).");
 	args.add_option("--film-width",          film_width, "Override camera film width (pixels)");
@@ -87,6 +316,36 @@ int main(int argc, char** argv) {
 		return 1;
 	}
 
+	if (!merge_files.empty()) {
+		return merge_shards(merge_files, output_file, checkpoint_file, allow_partial, exp);
+	}
+
+	if (shard_count == 0 || shard_index >= shard_count) {
+		warn("ERROR: --shard-index must be less than --shard-count.");
+		return 1;
+	}
+
+	if ((shard_count > 1 || local_shards > 1) && adaptive.enabled) {
+		warn("ERROR: adaptive sampling can't be split into shards (its passes depend on every pixel's samples).");
+		return 1;
+	}
+
+	if (local_shards > 1) {
+		if (!pathtrace || animate || shard_count > 1) {
+			warn("ERROR: --local-shards only works with --trace of a single frame.");
+			return 1;
+		}
+		if (RNG::fixed_seed == 0) {
+			RNG::fixed_seed = (std::random_device())(); //(every shard needs the same seed)
+		}
+		return trace_local_shards(argc, argv, local_shards, threads, output_file, checkpoint_file, resume, exp);
+	}
+
+	if (resume && checkpoint_file == "") {
+		warn("ERROR: --resume needs a --checkpoint file to resume from.");
+		return 1;
+	}
+
 	if ((min_frame != 0 || max_frame != -1) && !animate) {
 		warn("ERROR: --min-frame and --max-frame should only be used with --animate");
 		return 1;
@@ -234,8 +493,9 @@ int main(int argc, char** argv) {
 		if (pathtrace) {
 			info("\tsamples: %d", camera->film.samples);
 			info("\tmax depth: %d", camera->film.max_ray_depth);
-			info("\trender threads: %u", std::thread::hardware_concurrency());
+			info("\trender threads: %u", threads ? threads : std::thread::hardware_concurrency());
 			if (no_bvh) info("\tusing object list instead of BVH");
+			if (!bvh_cache.empty()) info("\tBVH cache: %s", bvh_cache.c_str());
 			info("\tpathtracing...");
 		} else { assert(rasterize);
 			std::string name;
@@ -247,27 +507,57 @@ int main(int argc, char** argv) {
 			info("\tsample pattern: '%s' (%d)", name.c_str(), camera->film.sample_pattern);
 			info("\trasterizing...");
 		}
+		//(one pathtracer for all frames, so meshes that don't change keep their BVHs)
+		bool quit = false;
+		std::optional<PT::Pathtracer> pathtracer;
+		if (pathtrace) {
+			pathtracer.emplace(threads);
+			pathtracer->use_bvh(!no_bvh);
+			pathtracer->use_wavefront(wavefront);
+			if (sampler == "sobol") {
+				pathtracer->use_sequence(RNG::Sequence::Sobol);
+			} else if (sampler == "independent") {
+				pathtracer->use_sequence(RNG::Sequence::Independent);
+			} else if (sampler == "mersenne") {
+				pathtracer->use_sequence(RNG::Sequence::Mersenne);
+			} else {
+				warn("ERROR: unknown --sampler '%s' (expected sobol, independent or mersenne).", sampler.c_str());
+				return 1;
+			}
+			pathtracer->set_adaptive(adaptive);
+			pathtracer->set_shard(shard_index, shard_count);
+			pathtracer->use_bvh_cache(bvh_cache);
+			pathtracer->set_report_rate(0.0f); //(only the finished image is needed)
+		}
+		//(likewise one thread pool for all rasterized frames)
+		std::optional<Thread_Pool> raster_threads;
+		if (rasterize) raster_threads.emplace(threads ? threads : std::thread::hardware_concurrency());
+
 		for (int32_t frame = min_frame; frame <= max_frame; ++frame) {
 			//do the render:
 			info(" frame %d", frame);
 
-			auto print_progress = [](float f) {
-				std::cout << "Progress: [";
+			//file to write this frame to:
+			auto frame_file = [&](std::string const &file, char const *extension = ".png") {
+				std::filesystem::path filename(file);
 
-				int32_t console = static_cast<int32_t>(Platform::console_width());
-				int32_t width = std::clamp(console - 30, 0, 50);
-				if (width) {
-					int32_t bar = static_cast<int32_t>(width * f);
-					for (int32_t i = 0; i < bar; i++) std::cout << "-";
-					for (int32_t i = bar; i < width; i++) std::cout << " ";
-					std::cout << "] ";
-				}
+				if (animate) {
+					std::stringstream str;
+					str << std::setfill('0') << std::setw(4) << frame;
 
-				float percent = 100.0f * f;
-				if (percent < 10.0f) std::cout << " ";
-				std::cout << std::setprecision(2) << std::fixed;
-				std::cout << percent << "%    \r";
-				std::cout.flush();
+					std::error_code ec;
+					if (std::filesystem::is_directory(filename, ec) ) {
+						//numbered files within the directory:
+						filename = filename / (str.str() + extension);
+					} else {
+						//number goes after the stem:
+						std::filesystem::path ext = filename.extension();
+						filename.replace_extension("");
+						filename += str.str();
+						filename += ext;
+					}
+				}
+				return filename;
 			};
 
 			std::mutex report_mut;
@@ -283,21 +573,63 @@ int main(int argc, char** argv) {
 			};
 
 			if (pathtrace) {
-				bool quit = false;
-				PT::Pathtracer pathtracer;
-
-				pathtracer.use_bvh(!no_bvh);
-				pathtracer.render(scene, camera_instance.lock(), std::move(report_callback), &quit);
+				std::string checkpoint = checkpoint_file == "" ? "" : frame_file(checkpoint_file, ".ckpt").generic_string();
+
+				bool resumed = false;
+				if (resume) {
+					std::vector<uint8_t> data;
+					if (read_file(checkpoint, data)) {
+						resumed = pathtracer->resume(scene, camera_instance.lock(), std::move(report_callback), &quit, data);
+						if (resumed) info("\tresuming from checkpoint '%s'", checkpoint.c_str());
+						else warn("Ignoring checkpoint '%s' (malformed, or for another film size, sampler, shard or sampling mode).", checkpoint.c_str());
+					}
+				}
+				if (!resumed) {
+					pathtracer->render(scene, camera_instance.lock(), std::move(report_callback), &quit);
+				}
 
-				while (pathtracer.in_progress()) {
-					print_progress(percent_done);
+				Timer since_checkpoint;
+				while (pathtracer->in_progress()) {
+					if (progress_lines) std::cout << "progress " << pathtracer->progress() << std::endl;
+					else print_progress(pathtracer->progress());
 					std::this_thread::sleep_for(std::chrono::milliseconds(250));
+					if (checkpoint != "" && since_checkpoint.s() >= checkpoint_interval) {
+						if (!pathtracer->save_checkpoint(checkpoint)) warn("Could not write checkpoint '%s'.", checkpoint.c_str());
+						since_checkpoint.reset();
+					}
 				}
 				std::cout << std::endl;
+				//(the finished render is checkpointed too, so more samples can be added to it later)
+				if (checkpoint != "" && !pathtracer->save_checkpoint(checkpoint)) {
+					warn("Could not write checkpoint '%s'.", checkpoint.c_str());
+				}
+
+				PT::Mesh_Cache::Stats stats = pathtracer->bvh_cache_stats();
+				info("\tmesh BVHs: %u reused, %u loaded from cache, %u built", stats.hits, stats.loads,
+				     stats.misses);
+
+				if constexpr (PT::COLLECT_RAY_STATS) {
+					PT::Ray_Stats ray_stats = pathtracer->ray_stats();
+					std::istringstream summary(ray_stats.summary());
+					for (std::string line; std::getline(summary, line);) info("\t%s", line.c_str());
+
+					if (stats_json_file != "") {
+						std::filesystem::path filename = frame_file(stats_json_file, ".json");
+						std::ofstream out(filename, std::ios::binary);
+						out << ray_stats.json();
+						if (!out) {
+							warn("ERROR: Failed to write ray statistics to '%s'", filename.generic_string().c_str());
+							return 1;
+						}
+						std::cout << "Wrote ray statistics to '" << filename.generic_string() << "'." << std::endl;
+					}
+				} else if (stats_json_file != "") {
+					warn("Not writing '%s': ray statistics are compiled out (see PT::COLLECT_RAY_STATS).", stats_json_file.c_str());
+				}
 
 			} else { assert(rasterize);
 
-				Rasterizer rasterizer(scene, *camera_instance.lock(), std::move(report_callback));
+				Rasterizer rasterizer(scene, *camera_instance.lock(), std::move(report_callback), *raster_threads, msaa ? Rasterizer::Sampling::Multisample : Rasterizer::Sampling::Supersample);
 				while (rasterizer.in_progress()) {
 					print_progress(percent_done);
 					std::this_thread::sleep_for(std::chrono::milliseconds(250));
@@ -311,37 +643,39 @@ int main(int argc, char** argv) {
 				std::cout << "No output was requested, not writing any file." << std::endl;
 			} else {
 
-				std::filesystem::path filename(output_file);
+				std::filesystem::path filename = frame_file(output_file);
 
-				if (animate) {
-					std::stringstream str;
-					str << std::setfill('0') << std::setw(4) << frame;
-
-					std::error_code ec;
-					if (std::filesystem::is_directory(filename, ec) ) {
-						//numbered files within the directory:
-						filename = filename / (str.str() + ".png");
-					} else {
-						//number goes after the stem:
-						std::filesystem::path ext = filename.extension();
-						filename.replace_extension("");
-						filename += str.str();
-						filename += ext;
-					}
+				if (!write_png(filename.generic_string(), display_hdr, exp)) {
+					warn("ERROR: Failed to write output to '%s'", filename.generic_string().c_str());
+					return 1;
 				}
+				std::cout << "Wrote result to '" << filename.generic_string() << "'." << std::endl;
+			}
 
-				uint32_t data_w, data_h;
-				std::vector<uint8_t> data;
-				display_hdr.tonemap_to(data, exp);
-				data_w = display_hdr.w;
-				data_h = display_hdr.h;
+			//write sample counts (grayscale, with the film's sample count as white):
+			if (pathtrace && sample_counts_file != "") {
+				std::filesystem::path filename = frame_file(sample_counts_file);
+
+				HDR_Image counts = pathtracer->sample_counts();
+				float max_samples = float(camera_instance.lock()->camera.lock()->film.samples);
+				std::vector<uint8_t> data(size_t(4) * counts.w * counts.h);
+				double total = 0.0;
+				for (uint32_t i = 0; i < counts.w * counts.h; i++) {
+					float count = counts.at(i).r;
+					total += count;
+					uint8_t v = uint8_t(std::round(255.0f * std::clamp(count / max_samples, 0.0f, 1.0f)));
+					data[4 * i + 0] = data[4 * i + 1] = data[4 * i + 2] = v;
+					data[4 * i + 3] = 255;
+				}
+				size_t pixels = size_t(counts.w) * counts.h;
+				info("\tsamples per pixel: %.1f on average", pixels ? total / double(pixels) : 0.0);
 
 				stbi_flip_vertically_on_write(true);
-				if (!stbi_write_png(filename.generic_string().c_str(), data_w, data_h, 4, data.data(), data_w * 4)) {
-					warn("ERROR: Failed to write output to '%s'", filename.generic_string().c_str());
+				if (!stbi_write_png(filename.generic_string().c_str(), counts.w, counts.h, 4, data.data(), counts.w * 4)) {
+					warn("ERROR: Failed to write sample counts to '%s'", filename.generic_string().c_str());
 					return 1;
 				}
-				std::cout << "Wrote result to '" << filename.generic_string() << "'." << std::endl;
+				std::cout << "Wrote sample counts to '" << filename.generic_string() << "'." << std::endl;
 			}
 
 			//advance (if animating):
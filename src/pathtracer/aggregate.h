@@ -34,6 +34,11 @@ public:
 	Aggregate& operator=(Aggregate&& src) = default;
 	Aggregate(Aggregate&& src) = default;
 
+	//the underlying BVH, if this aggregate is a BVH over instances (otherwise nullptr):
+	BVH<Instance>* instance_bvh() {
+		return std::get_if<BVH<Instance>>(&underlying);
+	}
+
 	BBox bbox() const {
 		return std::visit([](const auto& o) { return o.bbox(); }, underlying);
 	}
@@ -42,6 +47,11 @@ public:
 		return std::visit([&](const auto& o) { return o.hit(ray); }, underlying);
 	}
 
+	//true if anything intersects ray within ray.dist_bounds (use for shadow rays):
+	bool occluded(Ray ray) const {
+		return std::visit([&](const auto& o) { return o.occluded(ray); }, underlying);
+	}
+
 	uint32_t visualize(GL::Lines& lines, GL::Lines& active, uint32_t level, Mat4 vtrans) const {
 		return std::visit(overloaded{[&](const BVH<Aggregate>& bvh) {
 										 return bvh.visualize(lines, active, level, vtrans);
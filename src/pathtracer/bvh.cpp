@@ -4,6 +4,8 @@
 #include "instance.h"
 #include "tri_mesh.h"
 
+#include "../util/thread_pool.h"
+
 #include <stack>
 
 #define X_AXIS 0
@@ -28,211 +30,622 @@ namespace PT
 	struct SAHBucketData
 	{
 		BBox bb;					///< bbox of all primitives
-		size_t num_prims; ///< number of primitives in the bucket
+		size_t num_prims = 0; ///< number of primitives in the bucket
+	};
+
+	struct BVHBuildPrim
+	{
+		BBox bbox;		///< cached bbox of the primitive
+		Vec3 center;	///< cached centroid of the bbox
+		size_t index; ///< index of the primitive in the input array
+	};
+
+	struct BVHBuildContext
+	{
+		std::vector<BVHBuildPrim> refs;		///< primitives being partitioned
+		std::vector<BVHBuildPrim> scratch; ///< partition buffer for parallel passes (same size as refs)
+		size_t max_leaf_size;
+		size_t n_buckets;
+		Thread_Pool *thread_pool; ///< if non-null, used to build in parallel
 	};
 
+	// Parallel construction parameters. These only depend on range sizes and tree depth (never on
+	// the number of threads or on scheduling), and every parallel pass produces exactly what its
+	// serial counterpart would, so a BVH comes out the same with or without a thread pool.
+
+	// ranges of at least 2 * PARALLEL_CHUNK primitives do bounds, binning, and partitioning in chunks:
+	constexpr size_t PARALLEL_CHUNK = size_t(1) << 14;
+	// subtrees of at least PARALLEL_SUBTREE primitives are built as separate tasks...
+	constexpr size_t PARALLEL_SUBTREE = size_t(1) << 12;
+	// ...down to this depth:
+	constexpr uint32_t PARALLEL_DEPTH = 8;
+
+	// call f(chunk) for every chunk in [0,n_chunks), using the thread pool if one is supplied:
+	template <typename F>
+	static void for_each_chunk(Thread_Pool *thread_pool, size_t n_chunks, const F &f)
+	{
+		if (!thread_pool || n_chunks <= 1)
+		{
+			for (size_t c = 0; c < n_chunks; c++)
+				f(c);
+			return;
+		}
+		Thread_Pool::Group group(*thread_pool);
+		for (size_t c = 1; c < n_chunks; c++)
+			group.run([&f, c]()
+					  { f(c); });
+		f(0);
+		group.wait();
+	}
+
+	static size_t chunks_for(const BVHBuildContext &ctx, size_t start, size_t end)
+	{
+		if (!ctx.thread_pool || end - start < 2 * PARALLEL_CHUNK)
+			return 1;
+		return (end - start + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+	}
+
+	// compute bbox and centroid bbox of refs[start,end):
+	static std::pair<BBox, BBox> range_bounds(BVHBuildContext &ctx, size_t start, size_t end)
+	{
+		size_t n_chunks = chunks_for(ctx, start, end);
+		std::vector<std::pair<BBox, BBox>> bounds(n_chunks);
+		for_each_chunk(ctx.thread_pool, n_chunks, [&](size_t c)
+									 {
+			size_t c_end = std::min(end, start + (c + 1) * PARALLEL_CHUNK);
+			if (n_chunks == 1) c_end = end;
+			for (size_t i = start + c * PARALLEL_CHUNK; i < c_end; i++) {
+				bounds[c].first.enclose(ctx.refs[i].bbox);
+				bounds[c].second.enclose(ctx.refs[i].center);
+			} });
+
+		// (enclose is just min/max, so the order of reduction doesn't matter)
+		for (size_t c = 1; c < n_chunks; c++)
+		{
+			bounds[0].first.enclose(bounds[c].first);
+			bounds[0].second.enclose(bounds[c].second);
+		}
+		return bounds[0];
+	}
+
+	// choose a split for refs[start,end) with the binned SAH, partition the range, and return the split point:
+	static size_t split_range(BVHBuildContext &ctx, size_t start, size_t end, const BBox &centroid_bb)
+	{
+		const size_t n_buckets = ctx.n_buckets;
+		const size_t n_chunks = chunks_for(ctx, start, end);
+		auto chunk_begin = [&](size_t c)
+		{ return start + c * PARALLEL_CHUNK; };
+		auto chunk_end = [&](size_t c)
+		{ return c + 1 == n_chunks ? end : start + (c + 1) * PARALLEL_CHUNK; };
+
+		Vec3 extent = centroid_bb.max - centroid_bb.min;
+
+		auto bucket_of = [&](const BVHBuildPrim &ref, int axis)
+		{
+			size_t b = size_t(float(n_buckets) * (ref.center[axis] - centroid_bb.min[axis]) / extent[axis]);
+			return std::min(b, n_buckets - 1);
+		};
+
+		// bin all three axes at once (per chunk, then reduce):
+		std::vector<std::vector<SAHBucketData>> chunk_buckets(n_chunks);
+		for_each_chunk(ctx.thread_pool, n_chunks, [&](size_t c)
+									 {
+			std::vector<SAHBucketData> &buckets = chunk_buckets[c];
+			buckets.resize(3 * n_buckets);
+			for (size_t i = chunk_begin(c); i < chunk_end(c); i++) {
+				for (int axis = X_AXIS; axis <= Z_AXIS; axis++) {
+					if (!(extent[axis] > 0.0f)) continue;
+					SAHBucketData &bucket = buckets[axis * n_buckets + bucket_of(ctx.refs[i], axis)];
+					bucket.bb.enclose(ctx.refs[i].bbox);
+					bucket.num_prims += 1;
+				}
+			} });
+		std::vector<SAHBucketData> &buckets = chunk_buckets[0];
+		for (size_t c = 1; c < n_chunks; c++)
+		{
+			for (size_t b = 0; b < buckets.size(); b++)
+			{
+				buckets[b].bb.enclose(chunk_buckets[c][b].bb);
+				buckets[b].num_prims += chunk_buckets[c][b].num_prims;
+			}
+		}
+
+		float cost_min = FLT_MAX;
+		size_t split_min = 0;
+		int best_axis = -1;
+
+		std::vector<float> right_cost(n_buckets);
+		for (int axis = X_AXIS; axis <= Z_AXIS; axis++)
+		{
+			if (!(extent[axis] > 0.0f))
+				continue;
+			const SAHBucketData *axis_buckets = &buckets[axis * n_buckets];
+
+			// sweep from the right to get the cost of everything above each split plane...
+			BBox right;
+			size_t right_count = 0;
+			for (size_t b = n_buckets - 1; b > 0; b--)
+			{
+				right.enclose(axis_buckets[b].bb);
+				right_count += axis_buckets[b].num_prims;
+				right_cost[b] = right_count ? right.surface_area() * float(right_count) : FLT_MAX;
+			}
+
+			// ...then from the left, evaluating the plane between bucket b-1 and b:
+			BBox left;
+			size_t left_count = 0;
+			for (size_t b = 1; b < n_buckets; b++)
+			{
+				left.enclose(axis_buckets[b - 1].bb);
+				left_count += axis_buckets[b - 1].num_prims;
+				if (left_count == 0 || right_cost[b] == FLT_MAX)
+					continue;
+				float cost = left.surface_area() * float(left_count) + right_cost[b];
+				if (cost < cost_min)
+				{
+					cost_min = cost;
+					split_min = b;
+					best_axis = axis;
+				}
+			}
+		}
+
+		if (best_axis < 0)
+		{
+			// all centroids coincide, so no plane separates them; split the range in half:
+			return start + (end - start) / 2;
+		}
+
+		auto goes_left = [&](const BVHBuildPrim &ref)
+		{ return bucket_of(ref, best_axis) < split_min; };
+
+		if (n_chunks == 1)
+		{
+			auto it = std::stable_partition(ctx.refs.begin() + start, ctx.refs.begin() + end, goes_left);
+			return size_t(it - ctx.refs.begin());
+		}
+
+		// chunked stable partition: count, scan, scatter into scratch, copy back:
+		std::vector<size_t> chunk_left(n_chunks, 0);
+		for_each_chunk(ctx.thread_pool, n_chunks, [&](size_t c)
+									 {
+			for (size_t i = chunk_begin(c); i < chunk_end(c); i++) {
+				if (goes_left(ctx.refs[i])) chunk_left[c] += 1;
+			} });
+		std::vector<size_t> left_at(n_chunks), right_at(n_chunks);
+		size_t total_left = 0;
+		for (size_t c = 0; c < n_chunks; c++)
+		{
+			left_at[c] = total_left;
+			total_left += chunk_left[c];
+		}
+		for (size_t c = 0; c < n_chunks; c++)
+		{
+			right_at[c] = total_left + (chunk_begin(c) - start) - left_at[c];
+		}
+		for_each_chunk(ctx.thread_pool, n_chunks, [&](size_t c)
+									 {
+			size_t l = start + left_at[c], r = start + right_at[c];
+			for (size_t i = chunk_begin(c); i < chunk_end(c); i++) {
+				if (goes_left(ctx.refs[i])) ctx.scratch[l++] = ctx.refs[i];
+				else ctx.scratch[r++] = ctx.refs[i];
+			} });
+		for_each_chunk(ctx.thread_pool, n_chunks, [&](size_t c)
+									 { std::copy(ctx.scratch.begin() + chunk_begin(c), ctx.scratch.begin() + chunk_end(c),
+													ctx.refs.begin() + chunk_begin(c)); });
+		return start + total_left;
+	}
+
 	template <typename Primitive>
-	void BVH<Primitive>::build(std::vector<Primitive> &&prims, size_t max_leaf_size)
+	void BVH<Primitive>::build(std::vector<Primitive> &&prims, size_t max_leaf_size, size_t n_buckets,
+														 Thread_Pool *thread_pool, uint32_t width_)
 	{
 		// A3T3 - build a bvh
 
 		// Keep these
 		nodes.clear();
+		flat_nodes.clear();
+		wide4_nodes.clear();
+		wide8_nodes.clear();
 		primitives = std::move(prims);
 
 		// Construct a BVH from the given vector of primitives and maximum leaf
 		// size configuration.
+		//
+		// Splits are chosen with a binned surface area heuristic: primitive centroids
+		// are dropped into n_buckets buckets along each axis, and only the boundaries
+		// between buckets are considered as split planes. Bounding boxes and centroids
+		// are computed once up front, so Primitive::bbox() is never called while splitting.
+		//
+		// With a thread pool, large subtrees are built as tasks and the top levels bin and
+		// partition in parallel; the resulting node array is identical to a serial build.
+		BVHBuildContext ctx;
+		ctx.max_leaf_size = std::max(max_leaf_size, size_t(1));
+		ctx.n_buckets = std::max(n_buckets, size_t(2));
+		ctx.thread_pool = thread_pool;
+		root_idx = 0;
+
+		ctx.refs.resize(primitives.size());
+		size_t n_chunks = chunks_for(ctx, 0, primitives.size());
+		for_each_chunk(thread_pool, n_chunks, [&](size_t c)
+									 {
+			size_t c_end = (c + 1 == n_chunks) ? primitives.size() : (c + 1) * PARALLEL_CHUNK;
+			for (size_t i = c * PARALLEL_CHUNK; i < c_end; i++) {
+				ctx.refs[i].bbox = primitives[i].bbox();
+				ctx.refs[i].center = ctx.refs[i].bbox.center();
+				ctx.refs[i].index = i;
+			} });
+		if (n_chunks > 1)
+			ctx.scratch.resize(ctx.refs.size());
+
+		nodes.reserve(2 * (primitives.size() / ctx.max_leaf_size) + 1);
+		build_subtree(ctx, 0, ctx.refs.size(), 0, nodes);
+
+		// put primitives in leaf order:
+		std::vector<Primitive> ordered;
+		ordered.reserve(primitives.size());
+		for (const auto &ref : ctx.refs)
+			ordered.emplace_back(std::move(primitives[ref.index]));
+		primitives = std::move(ordered);
+		order.resize(ctx.refs.size());
+		for (size_t i = 0; i < ctx.refs.size(); i++)
+			order[i] = static_cast<uint32_t>(ctx.refs[i].index);
+
+		width = width_ >= 8 ? 8 : width_ >= 4 ? 4 : 2;
+		build_traversal();
+	}
 
-		// TODO
-		std::function<void(size_t)> recursive_build_helper = [&](size_t node)
+	template <typename Primitive>
+	bool BVH<Primitive>::refit(std::vector<Primitive> &&prims)
+	{
+		if (prims.size() != primitives.size() || nodes.empty())
+			return false;
+
+		for (size_t i = 0; i < primitives.size(); i++)
+			primitives[i] = std::move(prims[order[i]]);
+
+		// children are always stored after their parent, so sweeping backwards
+		// updates both children before the parent that encloses them:
+		for (size_t n = nodes.size(); n-- > 0;)
 		{
-			if (nodes[node].size <= max_leaf_size)
+			Node &node = nodes[n];
+			node.bbox = BBox();
+			if (node.is_leaf())
 			{
-				return;
+				for (size_t i = node.start; i < node.start + node.size; i++)
+					node.bbox.enclose(primitives[i].bbox());
 			}
-
-			float SAH_min = FLT_MAX;
-			size_t index_min = size_t(-1);
-			int best_axis = -1;
-			for (int axis = X_AXIS; axis < 3; axis++)
+			else
 			{
-				std::sort(primitives.begin() + nodes[node].start, primitives.begin() + nodes[node].start + nodes[node].size,
-									[axis](const Primitive &a, const Primitive &b)
-									{ return a.bbox().center()[axis] < b.bbox().center()[axis]; });
+				node.bbox.enclose(nodes[node.l].bbox);
+				node.bbox.enclose(nodes[node.r].bbox);
+			}
+		}
+
+		build_traversal();
+		return true;
+	}
 
-				for (size_t i = nodes[node].start + 1; i < nodes[node].start + nodes[node].size; i++)
+	template <typename Primitive>
+	bool BVH<Primitive>::restore(std::vector<Primitive> &&prims, std::vector<Node> &&nodes_,
+															 std::vector<uint32_t> &&order_, size_t root, uint32_t width_)
+	{
+		clear();
+
+		// every node but the root must be the child of exactly one node stored before it, so
+		// the nodes form a single tree (of bounded depth) and refit()'s backward sweep works:
+		size_t n = nodes_.size();
+		if (order_.size() != prims.size() || (n == 0 && !prims.empty()) || (n != 0 && root >= n))
+			return false;
+		std::vector<uint32_t> depth(n, 0);
+		std::vector<uint8_t> parents(n, 0);
+		// and the leaves must hold non-empty runs of primitives that cover each one exactly once:
+		std::vector<uint8_t> covered(prims.size(), 0);
+		for (size_t i = 0; i < n; i++)
+		{
+			const Node &node = nodes_[i];
+			if (i != root && parents[i] != 1)
+				return false;
+			if (depth[i] >= max_depth)
+				return false;
+			if (node.is_leaf())
+			{
+				if (node.start > prims.size() || node.size > prims.size() - node.start)
+					return false;
+				if (node.size == 0 && !prims.empty())
+					return false;
+				for (size_t p = node.start; p < node.start + node.size; p++)
 				{
-					BBox left = BBox();
-					BBox right = BBox();
-					for (size_t j = nodes[node].start; j < nodes[node].start + nodes[node].size; j++)
-					{
-						if (j < i)
-							left.enclose(primitives[j].bbox());
-						else
-							right.enclose(primitives[j].bbox());
-					}
-					float SAH = left.surface_area() / nodes[node].bbox.surface_area() * float(i - nodes[node].start) + right.surface_area() / nodes[node].bbox.surface_area() * float(nodes[node].start + nodes[node].size - i);
-					if (SAH < SAH_min)
-					{
-						SAH_min = SAH;
-						index_min = i;
-						best_axis = axis;
-					}
+					if (covered[p]++ != 0)
+						return false;
 				}
+				continue;
 			}
+			for (size_t c : {node.l, node.r})
+			{
+				if (c <= i || c >= n || c == root || parents[c]++ != 0)
+					return false;
+				depth[c] = depth[i] + 1;
+			}
+		}
+		for (uint8_t c : covered)
+		{
+			if (c == 0)
+				return false;
+		}
+		for (uint32_t o : order_)
+		{
+			if (o >= prims.size())
+				return false;
+		}
 
-			std::sort(primitives.begin() + nodes[node].start, primitives.begin() + nodes[node].start + nodes[node].size,
-								[best_axis](const Primitive &a, const Primitive &b)
-								{ return a.bbox().center()[best_axis] < b.bbox().center()[best_axis]; });
-
-			BBox left_bb;
-			BBox right_bb;
-
-			for (size_t i = nodes[node].start; i < nodes[node].start + nodes[node].size; i++)
-				if (i < index_min)
-					left_bb.enclose(primitives[i].bbox());
-				else
-					right_bb.enclose(primitives[i].bbox());
-
-			size_t left_child = new_node(left_bb, nodes[node].start, index_min - nodes[node].start);
-			size_t right_child = new_node(right_bb, index_min, nodes[node].size - (index_min - nodes[node].start));
-			nodes[node].l = left_child;
-			nodes[node].r = right_child;
-			recursive_build_helper(left_child);
-			recursive_build_helper(right_child);
-		};
-		BBox root_bb;
-		for (size_t i = root_idx; i < primitives.size(); i++)
-			root_bb.enclose(primitives[i].bbox());
+		primitives = std::move(prims);
+		nodes = std::move(nodes_);
+		order = std::move(order_);
+		root_idx = root;
+		width = width_ >= 8 ? 8 : width_ >= 4 ? 4 : 2;
+		build_traversal();
+		return true;
+	}
 
-		size_t root = new_node(root_bb, root_idx, primitives.size());
-		recursive_build_helper(root);
+	template <typename Primitive>
+	float BVH<Primitive>::node_area() const
+	{
+		if (nodes.empty())
+			return 0.0f;
+		float area = 0.0f;
+		for (const Node &node : nodes)
+		{
+			if (!node.is_leaf())
+				area += node.bbox.surface_area();
+		}
+		float root_area = nodes[root_idx].bbox.surface_area();
+		return root_area > 0.0f ? area / root_area : 0.0f;
 	}
 
 	template <typename Primitive>
-	Trace BVH<Primitive>::hit(const Ray &ray) const
+	void BVH<Primitive>::build_traversal()
 	{
-		// A3T3 - traverse your BVH
+		flat_nodes.clear();
+		wide4_nodes.clear();
+		wide8_nodes.clear();
+		if (width == 8)
+		{
+			if (!primitives.empty())
+				collapse(root_idx, wide8_nodes);
+		}
+		else if (width == 4)
+		{
+			if (!primitives.empty())
+				collapse(root_idx, wide4_nodes);
+		}
+		else
+		{
+			flat_nodes.reserve(nodes.size());
+			flatten(root_idx, 0);
+		}
+	}
 
-		// Implement ray - BVH intersection test. A ray intersects
-		// with a BVH aggregate if and only if it intersects a primitive in
-		// the BVH that is not an aggregate.
+	template <typename Primitive>
+	void BVH<Primitive>::build_subtree(BVHBuildContext &ctx, size_t start, size_t end, uint32_t depth,
+															 std::vector<Node> &out)
+	{
+		// nodes are appended in depth-first order, so a node's left child always directly follows it:
+		auto [bb, centroid_bb] = range_bounds(ctx, start, end);
+		size_t node = out.size();
+		out.emplace_back();
+		out[node].bbox = bb;
+		out[node].start = start;
+		out[node].size = end - start;
+		out[node].l = out[node].r = 0;
+		if (end - start <= ctx.max_leaf_size)
+			return;
+
+		// (past a certain depth, split in half so the tree can't outgrow the traversal stack)
+		size_t mid = depth + 32 < max_depth ? split_range(ctx, start, end, centroid_bb) : start + (end - start) / 2;
+
+		bool fork = ctx.thread_pool && depth < PARALLEL_DEPTH && end - start >= PARALLEL_SUBTREE;
+		if (!fork)
+		{
+			size_t l = out.size();
+			build_subtree(ctx, start, mid, depth + 1, out);
+			size_t r = out.size();
+			build_subtree(ctx, mid, end, depth + 1, out);
+			out[node].l = l;
+			out[node].r = r;
+			return;
+		}
 
-		// The starter code simply iterates through all the primitives.
-		// Again, remember you can use hit() on any Primitive value.
+		// build the left subtree as a task while this thread builds the right one,
+		// then splice both (with indices offset) into the output in depth-first order:
+		std::vector<Node> left, right;
+		Thread_Pool::Group group(*ctx.thread_pool);
+		group.run([&]()
+				  { build_subtree(ctx, start, mid, depth + 1, left); });
+		build_subtree(ctx, mid, end, depth + 1, right);
+		group.wait();
 
-		// TODO: replace this code with a more efficient traversal:
-		std::function<Trace(const Ray &, size_t)> find_closest_hit = [&](const Ray &ray, size_t node)
+		auto splice = [&](const std::vector<Node> &sub)
 		{
-			if (nodes[node].is_leaf())
+			size_t base = out.size();
+			for (Node n : sub)
 			{
-				Trace ret;
-				for (size_t i = nodes[node].start; i < nodes[node].start + nodes[node].size; i++)
+				if (!n.is_leaf())
 				{
-					Trace hit = primitives[i].hit(ray);
-					ret = Trace::min(ret, hit);
+					n.l += base;
+					n.r += base;
 				}
-
-				return ret;
+				out.push_back(n);
 			}
-			Vec2 left_time = ray.dist_bounds;
-			Vec2 right_time = ray.dist_bounds;
+			return base;
+		};
+		out[node].l = splice(left);
+		out[node].r = splice(right);
+	}
 
-			bool left_hit = nodes[nodes[node].l].bbox.hit(ray, left_time);
-			bool right_hit = nodes[nodes[node].r].bbox.hit(ray, right_time);
-			if (left_hit && right_hit)
+	template <typename Primitive>
+	uint32_t BVH<Primitive>::flatten(size_t node, uint32_t depth)
+	{
+		assert(depth <= max_depth);
+		const Node &n = nodes[node];
+		uint32_t idx = static_cast<uint32_t>(flat_nodes.size());
+		flat_nodes.emplace_back();
+		flat_nodes[idx].min = n.bbox.min;
+		flat_nodes[idx].max = n.bbox.max;
+		if (n.is_leaf())
+		{
+			assert(n.start <= UINT32_MAX && n.size < (1u << 30));
+			flat_nodes[idx].offset = static_cast<uint32_t>(n.start);
+			flat_nodes[idx].count = static_cast<uint32_t>(n.size);
+			flat_nodes[idx].axis = 0;
+			return idx;
+		}
+
+		// order children along the axis that best separates them:
+		Vec3 sep = nodes[n.r].bbox.center() - nodes[n.l].bbox.center();
+		Vec3 abs_sep = Vec3(std::abs(sep.x), std::abs(sep.y), std::abs(sep.z));
+		uint32_t axis = abs_sep.x >= abs_sep.y ? (abs_sep.x >= abs_sep.z ? 0 : 2) : (abs_sep.y >= abs_sep.z ? 1 : 2);
+		bool flip = sep[axis] < 0.0f; // keep the "left" child on the low side of the axis
+
+		flatten(flip ? n.r : n.l, depth + 1);
+		uint32_t right = flatten(flip ? n.l : n.r, depth + 1);
+		flat_nodes[idx].offset = right;
+		flat_nodes[idx].count = 0;
+		flat_nodes[idx].axis = axis;
+		return idx;
+	}
+
+	template <typename Primitive>
+	template <uint32_t W>
+	uint32_t BVH<Primitive>::collapse(size_t node, std::vector<Wide_Node<W>> &out)
+	{
+		// Gather up to W descendants of node by repeatedly opening the interior child
+		// with the largest surface area (the one most likely to be hit).
+		size_t children[W];
+		uint32_t n = 0;
+		if (nodes[node].is_leaf())
+		{
+			children[n++] = node;
+		}
+		else
+		{
+			children[n++] = nodes[node].l;
+			children[n++] = nodes[node].r;
+		}
+		while (n < W)
+		{
+			int open = -1;
+			float open_area = -1.0f;
+			for (uint32_t c = 0; c < n; c++)
 			{
-				if (left_time.x < right_time.x)
+				const Node &child = nodes[children[c]];
+				if (!child.is_leaf() && child.bbox.surface_area() > open_area)
 				{
-					Trace left_trace = find_closest_hit(ray, nodes[node].l);
-					if (left_trace.hit && left_trace.distance < right_time.x)
-					{
-						return left_trace;
-					}
-					else if (left_trace.hit)
-					{
-						Trace right_trace = find_closest_hit(ray, nodes[node].r);
-						if (right_trace.hit && right_trace.distance < left_trace.distance)
-							return right_trace;
-						else
-							return left_trace;
-					}
-					else
-					{
-						return find_closest_hit(ray, nodes[node].r);
-					}
-				}
-				else
-				{
-					Trace right_trace = find_closest_hit(ray, nodes[node].r);
-					if (right_trace.hit && right_trace.distance < left_time.x)
-					{
-						return right_trace;
-					}
-					else if (right_trace.hit)
-					{
-						Trace left_trace = find_closest_hit(ray, nodes[node].l);
-						if (left_trace.hit && left_trace.distance < right_trace.distance)
-							return left_trace;
-						else
-							return right_trace;
-					}
-					else
-					{
-						return find_closest_hit(ray, nodes[node].l);
-					}
+					open = int(c);
+					open_area = child.bbox.surface_area();
 				}
 			}
-			else if (left_hit)
+			if (open < 0)
+				break;
+			size_t opened = children[open];
+			children[open] = nodes[opened].l;
+			children[n++] = nodes[opened].r;
+		}
+
+		uint32_t idx = static_cast<uint32_t>(out.size());
+		out.emplace_back();
+		out[idx].n_children = n;
+		for (uint32_t c = 0; c < W; c++)
+		{
+			for (int a = 0; a < 3; a++)
 			{
-				return find_closest_hit(ray, nodes[node].l);
+				out[idx].min[a][c] = c < n ? nodes[children[c]].bbox.min[a] : FLT_MAX;
+				out[idx].max[a][c] = c < n ? nodes[children[c]].bbox.max[a] : -FLT_MAX;
 			}
-			else if (right_hit)
+			out[idx].offset[c] = 0;
+			out[idx].count[c] = 0;
+		}
+		for (uint32_t c = 0; c < n; c++)
+		{
+			const Node &child = nodes[children[c]];
+			if (child.is_leaf())
 			{
-				return find_closest_hit(ray, nodes[node].r);
+				assert(child.start <= UINT32_MAX && child.size > 0);
+				out[idx].offset[c] = static_cast<uint32_t>(child.start);
+				out[idx].count[c] = static_cast<uint32_t>(child.size);
 			}
 			else
 			{
-				Trace ret;
-				ret.origin = ray.point;
-				ret.hit = false;
-				ret.distance = FLT_MAX;
-				ret.position = Vec3{};
-				ret.normal = Vec3{};
-				ret.uv = Vec2{};
-
-				return ret;
+				// (out may reallocate while the child is collapsed, so index it again afterwards)
+				uint32_t child_idx = collapse(children[c], out);
+				out[idx].offset[c] = child_idx;
 			}
-		};
-		Vec2 times = ray.dist_bounds;
-		if (nodes[root_idx].bbox.hit(ray, times))
-		{
-			auto hit = find_closest_hit(ray, root_idx);
-			return hit;
 		}
-		else
+		return idx;
+	}
+
+	template <typename Primitive>
+	Trace BVH<Primitive>::hit(const Ray &ray_) const
+	{
+		// A3T3 - traverse your BVH
+
+		// Implement ray - BVH intersection test. A ray intersects
+		// with a BVH aggregate if and only if it intersects a primitive in
+		// the BVH that is not an aggregate.
+
+		// The ray's far bound shrinks every time a closer hit is found so that
+		// farther subtrees and primitives are culled.
+
+		Trace closest;
+		closest.origin = ray_.point;
+		closest.distance = FLT_MAX;
+
+		Ray ray = ray_;
+		traverse(ray, [&](uint32_t start, uint32_t end)
 		{
-			Trace ret;
-			ret.origin = ray.point;
-			ret.hit = false;
-			ret.distance = FLT_MAX;
-			ret.position = Vec3{};
-			ret.normal = Vec3{};
-			ret.uv = Vec2{};
-			return ret;
-		}
+			for (uint32_t i = start; i < end; i++)
+			{
+				Trace hit = primitives[i].hit(ray);
+				if (hit.hit && (!closest.hit || hit.distance < closest.distance))
+				{
+					closest = std::move(hit);
+					ray.dist_bounds.y = closest.distance;
+				}
+			}
+			return false;
+		});
+		return closest;
+	}
+
+	template <typename Primitive>
+	bool BVH<Primitive>::occluded(const Ray &ray_) const
+	{
+		bool blocked = false;
+		Ray ray = ray_;
+		traverse(ray, [&](uint32_t start, uint32_t end)
+		{
+			for (uint32_t i = start; i < end && !blocked; i++)
+				blocked = primitives[i].occluded(ray);
+			return blocked;
+		});
+		return blocked;
 	}
 
 	template <typename Primitive>
-	BVH<Primitive>::BVH(std::vector<Primitive> &&prims, size_t max_leaf_size)
+	BVH<Primitive>::BVH(std::vector<Primitive> &&prims, size_t max_leaf_size, size_t n_buckets,
+											Thread_Pool *thread_pool, uint32_t width)
 	{
-		build(std::move(prims), max_leaf_size);
+		build(std::move(prims), max_leaf_size, n_buckets, thread_pool, width);
 	}
 
 	template <typename Primitive>
 	std::vector<Primitive> BVH<Primitive>::destructure()
 	{
 		nodes.clear();
+		order.clear();
+		flat_nodes.clear();
+		wide4_nodes.clear();
+		wide8_nodes.clear();
 		return std::move(primitives);
 	}
 
@@ -242,6 +655,11 @@ namespace PT
 	{
 		BVH<Primitive> ret;
 		ret.nodes = nodes;
+		ret.order = order;
+		ret.width = width;
+		ret.flat_nodes = flat_nodes;
+		ret.wide4_nodes = wide4_nodes;
+		ret.wide8_nodes = wide8_nodes;
 		ret.primitives = primitives;
 		ret.root_idx = root_idx;
 		return ret;
@@ -271,6 +689,10 @@ namespace PT
 	void BVH<Primitive>::clear()
 	{
 		nodes.clear();
+		order.clear();
+		flat_nodes.clear();
+		wide4_nodes.clear();
+		wide8_nodes.clear();
 		primitives.clear();
 	}
 
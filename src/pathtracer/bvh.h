@@ -4,12 +4,23 @@
 #include "../lib/mathlib.h"
 #include "../platform/gl.h"
 
+#include "ray_stats.h"
 #include "trace.h"
 
+#if defined(__SSE__) || defined(_M_X64)
+#define BVH_SSE 1
+#include <xmmintrin.h>
+#else
+#define BVH_SSE 0
+#endif
+
 struct RNG;
+class Thread_Pool;
 
 namespace PT {
 
+struct BVHBuildContext;
+
 template<typename Primitive> class BVH {
 public:
 	class Node {
@@ -22,9 +33,54 @@ public:
 		friend class BVH<Primitive>;
 	};
 
+	//Compact copy of a node used during traversal. Flat nodes are stored in depth-first
+	// order, so an interior node's left child is always the next node in the array:
+	struct Flat_Node {
+		Vec3 min, max;
+		uint32_t offset;    //leaf: index of first primitive; interior: index of right child
+		uint32_t count : 30; //leaf: number of primitives; interior: 0
+		uint32_t axis : 2;   //interior: axis along which the children are most separated
+	};
+	static_assert(sizeof(Flat_Node) == 32, "Flat_Node should fit in half a cache line.");
+
+	//Node of a W-wide BVH (built by collapsing the binary tree), with child boxes stored
+	// structure-of-arrays so that all children are slab-tested together:
+	template<uint32_t W> struct Wide_Node {
+		float min[3][W], max[3][W];
+		uint32_t offset[W]; //leaf child: index of first primitive; interior child: index of node
+		uint32_t count[W];  //leaf child: number of primitives; interior child: 0
+		uint32_t n_children;
+
+		//bitmask of children whose boxes overlap bounds; fills t_near for those children:
+		uint32_t hit(const float origin[3], const float inv_dir[3], Vec2 bounds, float t_near[W]) const;
+	};
+
+	//number of SAH buckets used per axis when choosing a split:
+	static constexpr size_t default_buckets = 16;
+	//maximum tree depth (bounds the size of the traversal stack):
+	static constexpr uint32_t max_depth = 128;
+
 	BVH() = default;
-	BVH(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1);
-	void build(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1);
+	//(if thread_pool is supplied, large subtrees are built in parallel; the result is the same either way)
+	//(width is the branching factor used for traversal: 2, 4, or 8)
+	BVH(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1, size_t n_buckets = default_buckets,
+	    Thread_Pool* thread_pool = nullptr, uint32_t width = 2);
+	void build(std::vector<Primitive>&& primitives, size_t max_leaf_size = 1, size_t n_buckets = default_buckets,
+	           Thread_Pool* thread_pool = nullptr, uint32_t width = 2);
+
+	//Replace the primitives with prims (the same number, in the order originally passed to build())
+	// and recompute node bounds without changing the tree's structure. Much cheaper than a rebuild
+	// when only transforms changed, but the tree gets worse as primitives move farther.
+	// Returns false (and does nothing) if the number of primitives differs.
+	bool refit(std::vector<Primitive>&& prims);
+	//total surface area of interior nodes relative to the root; grows as refits degrade the tree:
+	float node_area() const;
+
+	//Adopt a tree saved from an earlier build (primitives, nodes, order, and root_idx, e.g. read
+	// back from a file) instead of building one. Returns false (leaving the BVH empty) if the
+	// nodes don't form a valid tree whose leaves split prims into non-empty, disjoint runs.
+	bool restore(std::vector<Primitive>&& prims, std::vector<Node>&& nodes, std::vector<uint32_t>&& order,
+	             size_t root, uint32_t width = 2);
 
 	BVH(BVH&& src) = default;
 	BVH& operator=(BVH&& src) = default;
@@ -34,6 +90,13 @@ public:
 
 	BBox bbox() const;
 	Trace hit(const Ray& ray) const;
+	//true if any primitive intersects ray within ray.dist_bounds (cheaper than hit()):
+	bool occluded(const Ray& ray) const;
+
+	//Visit the leaves whose boxes overlap ray.dist_bounds, front to back, calling
+	// leaf(start, end) with each leaf's range of primitives. leaf may shrink
+	// ray.dist_bounds to cull farther nodes, or return true to stop early.
+	template<typename Leaf> void traverse(Ray& ray, Leaf&& leaf) const;
 
 	template<typename P = Primitive>
 	typename std::enable_if<std::is_copy_assignable_v<P>, BVH<P>>::type copy() const;
@@ -52,8 +115,168 @@ public:
 	std::vector<Node> nodes;
 	size_t root_idx = 0;
 
+	//order[i] is the index (in the vector passed to build()) of primitives[i]:
+	std::vector<uint32_t> order;
+
+	//traversal copy of nodes (rebuilt by build()); only one of these is filled, depending on width:
+	uint32_t width = 2;
+	std::vector<Flat_Node> flat_nodes;
+	std::vector<Wide_Node<4>> wide4_nodes;
+	std::vector<Wide_Node<8>> wide8_nodes;
+
 private:
+	void build_traversal();
+	uint32_t flatten(size_t node, uint32_t depth);
+	template<uint32_t W> uint32_t collapse(size_t node, std::vector<Wide_Node<W>>& out);
+	template<uint32_t W, typename Leaf>
+	void traverse_wide(const std::vector<Wide_Node<W>>& wide_nodes, Ray& ray, Leaf&& leaf) const;
+	void build_subtree(BVHBuildContext& ctx, size_t start, size_t end, uint32_t depth,
+	                   std::vector<Node>& out);
 	size_t new_node(BBox box = {}, size_t start = 0, size_t size = 0, size_t l = 0, size_t r = 0);
 };
 
+template<typename Primitive>
+template<typename Leaf>
+void BVH<Primitive>::traverse(Ray& ray, Leaf&& leaf) const {
+	if (width == 4) return traverse_wide(wide4_nodes, ray, leaf);
+	if (width == 8) return traverse_wide(wide8_nodes, ray, leaf);
+
+	// Nodes are visited using a fixed-size stack, nearer child first (by the sign of the
+	// ray direction along the node's split axis).
+
+	if (flat_nodes.empty() || primitives.empty()) return;
+
+	// (ray and node coordinates are read as plain floats; Vec3::operator[] asserts on every access)
+	float origin[3] = {ray.point.x, ray.point.y, ray.point.z};
+	float inv_dir[3] = {1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z};
+	bool dir_neg[3] = {inv_dir[0] < 0.0f, inv_dir[1] < 0.0f, inv_dir[2] < 0.0f};
+	const Flat_Node* nodes = flat_nodes.data();
+
+	// slab test against a flat node's box, clipped to the ray's current bounds:
+	auto hits_box = [&](const Flat_Node& node) {
+		float t_near = ray.dist_bounds.x, t_far = ray.dist_bounds.y;
+		for (uint32_t a = 0; a < 3; a++) {
+			float t0 = (node.min.data[a] - origin[a]) * inv_dir[a];
+			float t1 = (node.max.data[a] - origin[a]) * inv_dir[a];
+			// (written so that NaNs from axis-aligned rays leave the bounds unchanged)
+			t_near = std::max(t_near, std::min(t0, t1));
+			t_far = std::min(t_far, std::max(t0, t1));
+		}
+		return t_near <= t_far;
+	};
+
+	uint32_t stack[max_depth];
+	uint32_t top = 0;
+	uint32_t idx = 0;
+	uint32_t visited = 0; //(added to this thread's stats once, after the loop)
+	for (;;) {
+		const Flat_Node& node = nodes[idx];
+		visited++;
+		if (hits_box(node)) {
+			if (node.count == 0) {
+				// interior: visit the near child now, the far child later:
+				if (dir_neg[node.axis]) {
+					stack[top++] = idx + 1;
+					idx = node.offset;
+				} else {
+					stack[top++] = node.offset;
+					idx = idx + 1;
+				}
+				continue;
+			}
+			if (leaf(node.offset, node.offset + node.count)) break;
+		}
+		if (top == 0) break;
+		idx = stack[--top];
+	}
+	if constexpr (COLLECT_RAY_STATS) Ray_Stats::local.bvh_nodes += visited;
+}
+
+template<typename Primitive>
+template<uint32_t W>
+uint32_t BVH<Primitive>::Wide_Node<W>::hit(const float origin[3], const float inv_dir[3], Vec2 bounds,
+                                           float t_near[W]) const {
+	// Same slab test as the binary traversal (including its NaN behavior: SSE min/max
+	// return their second operand when either is NaN, hence the operand order).
+	uint32_t mask = 0;
+#if BVH_SSE
+	for (uint32_t base = 0; base < W; base += 4) {
+		__m128 tn = _mm_set1_ps(bounds.x), tf = _mm_set1_ps(bounds.y);
+		for (uint32_t a = 0; a < 3; a++) {
+			__m128 o = _mm_set1_ps(origin[a]), inv = _mm_set1_ps(inv_dir[a]);
+			__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&min[a][base]), o), inv);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&max[a][base]), o), inv);
+			tn = _mm_max_ps(_mm_min_ps(t1, t0), tn);
+			tf = _mm_min_ps(_mm_max_ps(t1, t0), tf);
+		}
+		_mm_storeu_ps(&t_near[base], tn);
+		mask |= uint32_t(_mm_movemask_ps(_mm_cmple_ps(tn, tf))) << base;
+	}
+#else
+	for (uint32_t c = 0; c < W; c++) {
+		float tn = bounds.x, tf = bounds.y;
+		for (uint32_t a = 0; a < 3; a++) {
+			float t0 = (min[a][c] - origin[a]) * inv_dir[a];
+			float t1 = (max[a][c] - origin[a]) * inv_dir[a];
+			tn = std::max(tn, std::min(t0, t1));
+			tf = std::min(tf, std::max(t0, t1));
+		}
+		t_near[c] = tn;
+		if (tn <= tf) mask |= 1u << c;
+	}
+#endif
+	return mask & ((1u << n_children) - 1);
+}
+
+template<typename Primitive>
+template<uint32_t W, typename Leaf>
+void BVH<Primitive>::traverse_wide(const std::vector<Wide_Node<W>>& wide_nodes, Ray& ray,
+                                   Leaf&& leaf) const {
+	// Stack entries are children that were hit but not yet visited (interior nodes and leaves
+	// alike). The children of each node are pushed far-to-near, so the nearest is popped first,
+	// and an entry is skipped if the ray's bounds have since shrunk past its box.
+
+	if (wide_nodes.empty() || primitives.empty()) return;
+
+	struct Entry {
+		uint32_t offset, count;
+		float t_near;
+	};
+
+	float origin[3] = {ray.point.x, ray.point.y, ray.point.z};
+	float inv_dir[3] = {1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z};
+
+	Entry stack[max_depth * (W - 1) + 1];
+	uint32_t top = 0;
+	stack[top++] = Entry{0, 0, ray.dist_bounds.x};
+	uint32_t visited = 0; //(added to this thread's stats once, after the loop)
+	while (top > 0) {
+		Entry e = stack[--top];
+		if (e.t_near > ray.dist_bounds.y) continue;
+		if (e.count > 0) {
+			if (leaf(e.offset, e.offset + e.count)) break;
+			continue;
+		}
+
+		const Wide_Node<W>& node = wide_nodes[e.offset];
+		visited++;
+		float t_near[W];
+		uint32_t mask = node.hit(origin, inv_dir, ray.dist_bounds, t_near);
+
+		// insertion sort the hit children by decreasing entry distance as they are pushed:
+		uint32_t first = top;
+		for (uint32_t c = 0; c < W; c++) {
+			if (!(mask & (1u << c))) continue;
+			Entry child{node.offset[c], node.count[c], t_near[c]};
+			uint32_t i = top++;
+			while (i > first && stack[i - 1].t_near < child.t_near) {
+				stack[i] = stack[i - 1];
+				i--;
+			}
+			stack[i] = child;
+		}
+	}
+	if constexpr (COLLECT_RAY_STATS) Ray_Stats::local.bvh_nodes += visited;
+}
+
 } // namespace PT
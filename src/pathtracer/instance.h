@@ -12,6 +12,34 @@
 
 namespace PT {
 
+//Affine transform stored as the top three rows of a Mat4 (column-major, like Mat4).
+// Applying it gives exactly the same result as the Mat4 it came from, in 48 bytes instead of 64
+// and without the divide by w.
+struct Affine {
+	Affine() = default;
+	explicit Affine(const Mat4& M) {
+		for (uint32_t i = 0; i < 4; i++) cols[i] = M.cols[i].xyz();
+	}
+
+	Vec3 point(Vec3 v) const {
+		return v.x * cols[0] + v.y * cols[1] + v.z * cols[2] + cols[3];
+	}
+	Vec3 vector(Vec3 v) const {
+		return v.x * cols[0] + v.y * cols[1] + v.z * cols[2];
+	}
+	//multiply by the transpose of the 3x3 part (used to carry normals with the inverse transform):
+	Vec3 transpose_vector(Vec3 v) const {
+		return Vec3(dot(v, cols[0]), dot(v, cols[1]), dot(v, cols[2]));
+	}
+
+	Mat4 to_mat4() const {
+		return Mat4{Vec4{cols[0], 0.0f}, Vec4{cols[1], 0.0f}, Vec4{cols[2], 0.0f},
+		            Vec4{cols[3], 1.0f}};
+	}
+
+	Vec3 cols[4];
+};
+
 class Instance {
 public:
 	Instance(Shape const * shape, Material* material, const Mat4& T)
@@ -25,22 +53,32 @@ public:
 
 	BBox bbox() const {
 		auto box = std::visit([](const auto& g) { return g->bbox(); }, geometry);
-		if (has_transform) box.transform(T);
+		if (has_transform) box.transform(T.to_mat4());
 		return box;
 	}
 
 	Trace hit(Ray ray) const {
-		if (has_transform) ray.transform(iT);
+		to_local(ray);
 		auto trace = std::visit([&](const auto& g) { return g->hit(ray); }, geometry);
 		if (trace.hit) {
 			trace.material = material;
-			if (has_transform) trace.transform(T, iT.T());
+			if (has_transform) {
+				trace.position = T.point(trace.position);
+				trace.origin = T.point(trace.origin);
+				trace.normal = iT.transpose_vector(trace.normal).unit();
+				trace.distance = (trace.position - trace.origin).norm();
+			}
 		}
 		return trace;
 	}
 
+	bool occluded(Ray ray) const {
+		to_local(ray);
+		return std::visit([&](const auto& g) { return g->occluded(ray); }, geometry);
+	}
+
 	uint32_t visualize(GL::Lines& lines, GL::Lines& active, uint32_t level, Mat4 vtrans) const {
-		if (has_transform) vtrans = vtrans * T;
+		if (has_transform) vtrans = vtrans * T.to_mat4();
 		return std::visit(overloaded{[&](const Tri_Mesh* mesh) {
 										 return mesh->visualize(lines, active, level, vtrans);
 									 },
@@ -49,22 +87,44 @@ public:
 	}
 
 	Vec3 sample(RNG &rng, Vec3 from) const {
-		if (has_transform) from = iT * from;
+		if (has_transform) from = iT.point(from);
 		auto dir = std::visit([&](const auto& g) { return g->sample(rng, from); }, geometry);
-		if (has_transform) dir = T.rotate(dir).unit();
+		if (has_transform) dir = T.vector(dir).unit();
 		return dir;
 	}
 
 	float pdf(Ray ray, Mat4 pdf_T = Mat4::I, Mat4 pdf_iT = Mat4::I) const {
 		if (has_transform) {
-			pdf_T = pdf_T * T;
-			pdf_iT = iT * pdf_iT;
+			pdf_T = pdf_T * T.to_mat4();
+			pdf_iT = iT.to_mat4() * pdf_iT;
 		}
 		return std::visit([&](const auto& g) { return g->pdf(ray, pdf_T, pdf_iT); }, geometry);
 	}
 
+	//(used by Light_Sampler to sample emissive meshes triangle-by-triangle)
+	const Tri_Mesh* mesh() const {
+		auto m = std::get_if<const Tri_Mesh*>(&geometry);
+		return m ? *m : nullptr;
+	}
+	const Material* surface() const {
+		return material;
+	}
+	const Affine& to_world() const {
+		return T;
+	}
+
+	//move a world-space ray into the instance's space (same as Ray::transform(iT)):
+	void to_local(Ray& ray) const {
+		if (!has_transform) return;
+		ray.point = iT.point(ray.point);
+		ray.dir = iT.vector(ray.dir);
+		float d = ray.dir.norm();
+		ray.dist_bounds *= d;
+		ray.dir /= d;
+	}
+
 private:
-	Mat4 T, iT;
+	Affine T, iT;
 	bool has_transform = false;
 
 	const Material* material = nullptr;
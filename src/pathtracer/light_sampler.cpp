@@ -0,0 +1,175 @@
+
+#include "light_sampler.h"
+
+#include "../scene/material.h"
+#include "../scene/texture.h"
+#include "../util/rand.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "samplers.h"
+
+namespace PT {
+
+//average luminance emitted by material (over its emissive texture):
+static float average_emission(const Material& material) {
+	if (auto emissive = std::get_if<Materials::Emissive>(&material.material)) {
+		if (auto texture = emissive->emissive.lock()) {
+			if (auto constant = std::get_if<Textures::Constant>(&texture->texture)) {
+				return (constant->color * constant->scale).luma();
+			}
+			if (auto image = std::get_if<Textures::Image>(&texture->texture)) {
+				const std::vector<Spectrum>& pixels = image->image.data();
+				if (pixels.empty()) return 0.0f;
+				double sum = 0.0;
+				for (const Spectrum& s : pixels) sum += s.luma();
+				return float(sum / pixels.size());
+			}
+		}
+	}
+	return material.emission(Vec2{0.5f, 0.5f}).luma();
+}
+
+Light_Sampler::Light_Sampler(std::vector<Instance>&& emitters, Thread_Pool* thread_pool)
+	: bvh(std::move(emitters), 1, BVH<Instance>::default_buckets, thread_pool, 4) {
+
+	std::unordered_map<const Tri_Mesh*, uint32_t> mesh_index;
+	std::unordered_map<const Material*, float> material_emission;
+
+	info.resize(bvh.primitives.size());
+	cdf.resize(bvh.primitives.size());
+	float total = 0.0f;
+	for (size_t i = 0; i < bvh.primitives.size(); i++) {
+		const Instance& inst = bvh.primitives[i];
+
+		auto emission = material_emission.find(inst.surface());
+		if (emission == material_emission.end()) {
+			emission = material_emission.emplace(inst.surface(), average_emission(*inst.surface())).first;
+		}
+
+		// weight by power: emission times world-space area. (Area is estimated from the local area and the
+		// transform's volume scale, which is exact for uniform scales; any positive weight is unbiased.)
+		if (const Tri_Mesh* mesh = inst.mesh()) {
+			auto [index, inserted] = mesh_index.emplace(mesh, uint32_t(mesh_areas.size()));
+			if (inserted) {
+				Mesh_Areas areas;
+				for (const Triangle& tri : triangles(*mesh)) {
+					Vec3 p0 = tri.vertex_list[tri.v0].position;
+					Vec3 p1 = tri.vertex_list[tri.v1].position;
+					Vec3 p2 = tri.vertex_list[tri.v2].position;
+					areas.total += 0.5f * cross(p1 - p0, p2 - p0).norm();
+					areas.cdf.push_back(areas.total);
+				}
+				mesh_areas.emplace_back(std::move(areas));
+			}
+			const Affine& T = inst.to_world();
+			float det = std::abs(dot(T.cols[0], cross(T.cols[1], T.cols[2])));
+			info[i].mesh = index->second;
+			info[i].weight = emission->second * mesh_areas[index->second].total * std::cbrt(det * det);
+		} else {
+			// (shapes do their own sampling; weigh them by bounding box area instead)
+			info[i].weight = emission->second * inst.bbox().surface_area();
+		}
+		if (!std::isfinite(info[i].weight) || info[i].weight < 0.0f) info[i].weight = 0.0f;
+		total += info[i].weight;
+		cdf[i] = total;
+	}
+}
+
+const std::vector<Triangle>& Light_Sampler::triangles(const Tri_Mesh& mesh) {
+	return mesh.use_bvh ? mesh.triangle_bvh.primitives : mesh.triangle_list.primitives();
+}
+
+bool Light_Sampler::empty() const {
+	return cdf.empty() || !(cdf.back() > 0.0f);
+}
+
+size_t Light_Sampler::n_emitters() const {
+	return info.size();
+}
+
+float Light_Sampler::probability(size_t emitter) const {
+	return empty() ? 0.0f : info[emitter].weight / cdf.back();
+}
+
+const std::vector<Instance>& Light_Sampler::emitters() const {
+	return bvh.primitives;
+}
+
+Vec3 Light_Sampler::sample(RNG& rng, Vec3 from) const {
+	if (empty()) return {};
+
+	// pick an emitter by weight (zero-weight emitters can't be picked, since their cdf entries repeat):
+	size_t e = std::upper_bound(cdf.begin(), cdf.end(), rng.unit() * cdf.back()) - cdf.begin();
+	e = std::min(e, cdf.size() - 1);
+	const Instance& inst = bvh.primitives[e];
+	if (info[e].mesh == -1U) return inst.sample(rng, from);
+
+	// pick a triangle by area, and a point on it:
+	const Mesh_Areas& areas = mesh_areas[info[e].mesh];
+	const std::vector<Triangle>& tris = triangles(*inst.mesh());
+	size_t t = std::upper_bound(areas.cdf.begin(), areas.cdf.end(), rng.unit() * areas.total) - areas.cdf.begin();
+	const Triangle& tri = tris[std::min(t, tris.size() - 1)];
+
+	const Affine& T = inst.to_world();
+	Samplers::Triangle sampler(T.point(tri.vertex_list[tri.v0].position), T.point(tri.vertex_list[tri.v1].position),
+	                           T.point(tri.vertex_list[tri.v2].position));
+	return (sampler.sample(rng) - from).unit();
+}
+
+float Light_Sampler::pdf(Vec3 from, Vec3 dir) const {
+	if (empty()) return 0.0f;
+
+	// sum, over every emitter point along the ray, the probability of having sampled it
+	// (converted from area to solid angle measure):
+	float total = cdf.back();
+	float pdf = 0.0f;
+	Ray ray(from, dir);
+	bvh.traverse(ray, [&](uint32_t start, uint32_t end) {
+		for (uint32_t e = start; e < end; e++) {
+			if (info[e].weight == 0.0f) continue;
+			const Instance& inst = bvh.primitives[e];
+			float p_emitter = info[e].weight / total;
+			if (info[e].mesh == -1U) {
+				pdf += p_emitter * inst.pdf(Ray(from, dir));
+				continue;
+			}
+
+			const Mesh_Areas& areas = mesh_areas[info[e].mesh];
+			const std::vector<Triangle>& tris = triangles(*inst.mesh());
+			const Affine& T = inst.to_world();
+			Ray local(from, dir);
+			inst.to_local(local);
+
+			auto add_triangle = [&](uint32_t t) {
+				const Triangle& tri = tris[t];
+				Trace trace = tri.hit(local);
+				if (!trace.hit) return;
+				Vec3 p0 = T.point(tri.vertex_list[tri.v0].position);
+				Vec3 p1 = T.point(tri.vertex_list[tri.v1].position);
+				Vec3 p2 = T.point(tri.vertex_list[tri.v2].position);
+				Vec3 n = cross(p1 - p0, p2 - p0);
+				float area = 0.5f * n.norm();
+				if (area == 0.0f) return;
+				float a_local = areas.cdf[t] - (t ? areas.cdf[t - 1] : 0.0f);
+				float p_point = p_emitter * (a_local / areas.total) / area;
+				float g = (T.point(trace.position) - from).norm_squared() / std::abs(dot(n.unit(), dir));
+				pdf += p_point * g;
+			};
+
+			if (inst.mesh()->use_bvh) {
+				inst.mesh()->triangle_bvh.traverse(local, [&](uint32_t t_start, uint32_t t_end) {
+					for (uint32_t t = t_start; t < t_end; t++) add_triangle(t);
+					return false;
+				});
+			} else {
+				for (uint32_t t = 0; t < uint32_t(tris.size()); t++) add_triangle(t);
+			}
+		}
+		return false;
+	});
+	return pdf;
+}
+
+} // namespace PT
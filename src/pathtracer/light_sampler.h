@@ -0,0 +1,64 @@
+
+#pragma once
+
+#include "../lib/mathlib.h"
+
+#include <vector>
+
+#include "bvh.h"
+#include "instance.h"
+
+class Thread_Pool;
+
+namespace PT {
+
+//Samples directions toward emissive instances for direct lighting. Emitters are picked with
+// probability proportional to their (approximate) emitted power, then a triangle of the
+// emitter by area, then a point uniformly on that triangle.
+//The matching pdf only visits emitters (and triangles) the ray actually passes through,
+// found with BVHs, instead of every emitter in the scene.
+class Light_Sampler {
+public:
+	Light_Sampler() = default;
+	Light_Sampler(std::vector<Instance>&& emitters, Thread_Pool* thread_pool = nullptr);
+
+	Light_Sampler(Light_Sampler&& src) = default;
+	Light_Sampler& operator=(Light_Sampler&& src) = default;
+	Light_Sampler(const Light_Sampler& src) = delete;
+	Light_Sampler& operator=(const Light_Sampler& src) = delete;
+
+	//direction from 'from' toward a point on one of the emitters:
+	Vec3 sample(RNG& rng, Vec3 from) const;
+	//(solid angle) density with which sample() produces direction dir from 'from':
+	float pdf(Vec3 from, Vec3 dir) const;
+
+	//true if there is nothing (with nonzero power) to sample:
+	bool empty() const;
+	size_t n_emitters() const;
+
+	//probability that sample() picks the emitter (the instance in emitter order, see bvh):
+	float probability(size_t emitter) const;
+	//the emitters, in the order used by probability():
+	const std::vector<Instance>& emitters() const;
+
+private:
+	//triangle areas of an emissive mesh (shared by all instances of it):
+	struct Mesh_Areas {
+		std::vector<float> cdf; //cdf[i]: total area of triangles [0,i]
+		float total = 0.0f;
+	};
+	struct Emitter {
+		uint32_t mesh = -1U; //index into mesh_areas (-1U for shapes)
+		float weight = 0.0f;
+	};
+
+	//triangles of mesh, in the order mesh_areas uses:
+	static const std::vector<Triangle>& triangles(const Tri_Mesh& mesh);
+
+	BVH<Instance> bvh;             //emitters (in leaf order)
+	std::vector<Emitter> info;     //per emitter in bvh.primitives
+	std::vector<float> cdf;        //cdf[i]: total weight of emitters [0,i]
+	std::vector<Mesh_Areas> mesh_areas;
+};
+
+} // namespace PT
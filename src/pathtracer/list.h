@@ -31,6 +31,13 @@ public:
 		return ret;
 	}
 
+	bool occluded(const Ray& ray) const {
+		for (const auto& p : prims) {
+			if (p.occluded(ray)) return true;
+		}
+		return false;
+	}
+
 	void append(Primitive&& prim) {
 		prims.push_back(std::move(prim));
 	}
@@ -65,6 +72,10 @@ public:
 		return prims.size();
 	}
 
+	const std::vector<Primitive>& primitives() const {
+		return prims;
+	}
+
 private:
 	std::vector<Primitive> prims;
 };
@@ -0,0 +1,375 @@
+
+#include "mesh_cache.h"
+
+#include "../lib/log.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace PT {
+
+namespace {
+
+// Cache file layout (native byte order):
+//  File_Header
+//  Tri_Mesh_Vert[n_verts]
+//  uint32_t[3 * n_tris]  (triangle vertex indices, in BVH leaf order)
+//  uint32_t[n_tris]      (BVH order)
+//  File_Node[n_nodes]
+struct File_Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint64_t hash[2];
+	uint64_t n_indices; //(of the mesh the file was made from; n_verts is too)
+	uint64_t n_verts, n_tris, n_nodes, root;
+};
+struct File_Node {
+	float min[3], max[3];
+	uint32_t start, size, l, r;
+};
+constexpr char file_magic[8] = {'S', '3', 'D', 'B', 'V', 'H', '\0', '\0'};
+
+static_assert(sizeof(File_Header) == 72);
+static_assert(sizeof(File_Node) == 40);
+static_assert(sizeof(Tri_Mesh_Vert) == 32);
+
+// Read-only view of a whole file, memory-mapped (data is nullptr if it couldn't be opened):
+struct Mapped_File {
+	explicit Mapped_File(const std::string& path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		                   FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return;
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) return;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) return;
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!view) return;
+		data = static_cast<const uint8_t*>(view);
+		size = static_cast<size_t>(file_size.QuadPart);
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (view != MAP_FAILED) {
+				data = static_cast<const uint8_t*>(view);
+				size = static_cast<size_t>(st.st_size);
+			}
+		}
+		close(fd);
+#endif
+	}
+	~Mapped_File() {
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+		if (data) munmap(const_cast<uint8_t*>(data), size);
+#endif
+	}
+	Mapped_File(const Mapped_File&) = delete;
+	Mapped_File& operator=(const Mapped_File&) = delete;
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+// Reads consecutive arrays out of a buffer, failing (rather than reading past the end) if it is short:
+struct Reader {
+	const uint8_t* at;
+	size_t left;
+
+	template<typename T> bool read(T* out, uint64_t count) {
+		if (count > left / sizeof(T)) return false;
+		size_t bytes = static_cast<size_t>(count) * sizeof(T);
+		if (bytes) std::memcpy(out, at, bytes);
+		at += bytes;
+		left -= bytes;
+		return true;
+	}
+};
+
+} // namespace
+
+void Mesh_Cache::set_directory(std::string dir_) {
+	std::lock_guard<std::mutex> lock(mut);
+	dir = std::move(dir_);
+	if (!dir.empty()) {
+		std::error_code ec;
+		std::filesystem::create_directories(dir, ec);
+		if (ec) warn("Could not create BVH cache directory '%s': %s", dir.c_str(), ec.message().c_str());
+	}
+}
+
+const std::string& Mesh_Cache::directory() const {
+	return dir;
+}
+
+std::shared_ptr<Tri_Mesh> Mesh_Cache::get(const Indexed_Mesh& mesh, bool use_bvh, Thread_Pool* thread_pool) {
+	Key k = key(mesh);
+	Entry_Key entry_key{k, use_bvh};
+
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		auto entry = entries.find(entry_key);
+		if (entry != entries.end()) {
+			entry->second.used = true;
+			counts.hits++;
+			return entry->second.mesh;
+		}
+		//(list-only meshes are cheap to make, so only meshes with BVHs go on disk)
+		if (use_bvh && !dir.empty()) path = file_for(k);
+	}
+
+	// load or build without holding the lock, so other meshes can be looked up meanwhile:
+	std::shared_ptr<Tri_Mesh> ret;
+	bool loaded = false;
+	if (!path.empty()) {
+		Mapped_File file(path);
+		if (file.data) {
+			auto from_disk = std::make_shared<Tri_Mesh>();
+			if (load(file.data, file.size, k, *from_disk)) {
+				ret = std::move(from_disk);
+				loaded = true;
+			} else {
+				warn("Ignoring malformed BVH cache file '%s'.", path.c_str());
+			}
+		}
+	}
+	if (!ret) {
+		ret = std::make_shared<Tri_Mesh>(mesh, use_bvh, thread_pool);
+		if (!path.empty()) {
+			// write to a uniquely-named file, then rename, so other threads or processes
+			// reading the cache never see a partial file:
+			std::vector<uint8_t> data = save(*ret, k);
+			std::string temp = path + "." + std::to_string(std::random_device()()) + ".tmp";
+			std::ofstream out(temp, std::ios::binary);
+			out.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+			out.close();
+			std::error_code ec;
+			if (out) std::filesystem::rename(temp, path, ec);
+			if (!out || ec) {
+				warn("Could not write BVH cache file '%s'.", path.c_str());
+				std::filesystem::remove(temp, ec);
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mut);
+	if (loaded) counts.loads++;
+	else counts.misses++;
+	auto [entry, inserted] = entries.emplace(entry_key, Entry{ret, true});
+	if (!inserted) { //(another thread got here first; share its copy)
+		entry->second.used = true;
+		ret = entry->second.mesh;
+	}
+	return ret;
+}
+
+void Mesh_Cache::evict_unused() {
+	std::lock_guard<std::mutex> lock(mut);
+	for (auto entry = entries.begin(); entry != entries.end();) {
+		if (!entry->second.used) {
+			entry = entries.erase(entry);
+		} else {
+			entry->second.used = false;
+			++entry;
+		}
+	}
+}
+
+void Mesh_Cache::clear() {
+	std::lock_guard<std::mutex> lock(mut);
+	entries.clear();
+}
+
+Mesh_Cache::Stats Mesh_Cache::stats() const {
+	std::lock_guard<std::mutex> lock(mut);
+	return counts;
+}
+
+void Mesh_Cache::reset_stats() {
+	std::lock_guard<std::mutex> lock(mut);
+	counts = Stats{};
+}
+
+std::string Mesh_Cache::file_for(const Key& k) const {
+	char name[48];
+	std::snprintf(name, sizeof(name), "%016llx%016llx.bvh", static_cast<unsigned long long>(k.hash[0]),
+	              static_cast<unsigned long long>(k.hash[1]));
+	return (std::filesystem::path(dir) / name).string();
+}
+
+Mesh_Cache::Key Mesh_Cache::key(const Indexed_Mesh& mesh) {
+	// two independent 64-bit lanes, eight bytes at a time: FNV-1a style, and multiply-rotate
+	// (as in xxHash), each with a final mix so nearby meshes spread out:
+	uint64_t h = 0xcbf29ce484222325ull;
+	uint64_t g = 0x27d4eb2f165667c5ull;
+	auto mix_word = [&h, &g](uint64_t word) {
+		h = (h ^ word) * 0x100000001b3ull;
+		g += word * 0xc2b2ae3d27d4eb4full;
+		g = ((g << 31) | (g >> 33)) * 0x9e3779b185ebca87ull;
+	};
+	auto mix = [&mix_word](const void* data, size_t bytes) {
+		const uint8_t* at = static_cast<const uint8_t*>(data);
+		for (; bytes >= 8; bytes -= 8, at += 8) {
+			uint64_t word;
+			std::memcpy(&word, at, 8);
+			mix_word(word);
+		}
+		for (; bytes > 0; bytes--, at++) {
+			mix_word(*at);
+		}
+	};
+	auto finish = [](uint64_t x) {
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdull;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ull;
+		x ^= x >> 33;
+		return x;
+	};
+
+	const auto& verts = mesh.vertices();
+	const auto& idxs = mesh.indices();
+	uint64_t sizes[2] = {verts.size(), idxs.size()};
+	mix(sizes, sizeof(sizes));
+	// (only the data a Tri_Mesh keeps is hashed; ids are ignored)
+	for (const auto& v : verts) {
+		float data[8] = {v.pos.x, v.pos.y, v.pos.z, v.norm.x, v.norm.y, v.norm.z, v.uv.x, v.uv.y};
+		mix(data, sizeof(data));
+	}
+	mix(idxs.data(), idxs.size() * sizeof(idxs[0]));
+
+	return Key{{finish(h), finish(g)}, verts.size(), idxs.size()};
+}
+
+std::vector<uint8_t> Mesh_Cache::save(const Tri_Mesh& mesh, const Key& k) {
+	const BVH<Triangle>& bvh = mesh.triangle_bvh;
+	assert(mesh.use_bvh);
+
+	File_Header header;
+	std::memcpy(header.magic, file_magic, sizeof(file_magic));
+	header.version = version;
+	header.width = bvh.width;
+	header.hash[0] = k.hash[0];
+	header.hash[1] = k.hash[1];
+	header.n_indices = k.n_indices;
+	header.n_verts = mesh.verts.size();
+	header.n_tris = bvh.primitives.size();
+	header.n_nodes = bvh.nodes.size();
+	header.root = bvh.root_idx;
+
+	std::vector<uint32_t> tris;
+	tris.reserve(3 * bvh.primitives.size());
+	for (const Triangle& tri : bvh.primitives) {
+		tris.insert(tris.end(), {tri.v0, tri.v1, tri.v2});
+	}
+	std::vector<File_Node> nodes;
+	nodes.reserve(bvh.nodes.size());
+	for (const auto& n : bvh.nodes) {
+		assert(n.start <= UINT32_MAX && n.size <= UINT32_MAX && n.l <= UINT32_MAX && n.r <= UINT32_MAX);
+		nodes.push_back(File_Node{{n.bbox.min.x, n.bbox.min.y, n.bbox.min.z},
+		                          {n.bbox.max.x, n.bbox.max.y, n.bbox.max.z},
+		                          uint32_t(n.start), uint32_t(n.size), uint32_t(n.l), uint32_t(n.r)});
+	}
+
+	std::vector<uint8_t> out;
+	auto append = [&out](const void* data, size_t bytes) {
+		const uint8_t* at = static_cast<const uint8_t*>(data);
+		out.insert(out.end(), at, at + bytes);
+	};
+	append(&header, sizeof(header));
+	append(mesh.verts.data(), mesh.verts.size() * sizeof(Tri_Mesh_Vert));
+	append(tris.data(), tris.size() * sizeof(uint32_t));
+	append(bvh.order.data(), bvh.order.size() * sizeof(uint32_t));
+	append(nodes.data(), nodes.size() * sizeof(File_Node));
+	return out;
+}
+
+bool Mesh_Cache::load(const uint8_t* data, size_t size, const Key& k, Tri_Mesh& mesh) {
+	Reader in{data, size};
+
+	File_Header header;
+	if (!in.read(&header, 1)) return false;
+	if (std::memcmp(header.magic, file_magic, sizeof(file_magic)) != 0) return false;
+	if (header.version != version) return false;
+	if (header.hash[0] != k.hash[0] || header.hash[1] != k.hash[1] || header.n_verts != k.n_verts ||
+	    header.n_indices != k.n_indices || header.n_tris != k.n_indices / 3) {
+		return false;
+	}
+
+	// check the counts against the data actually present before allocating anything:
+	if (header.n_verts > in.left / sizeof(Tri_Mesh_Vert)) return false;
+	if (header.n_tris > in.left / (4 * sizeof(uint32_t))) return false;
+	if (header.n_nodes > in.left / sizeof(File_Node)) return false;
+
+	Tri_Mesh ret;
+	ret.use_bvh = true;
+	ret.verts.resize(size_t(header.n_verts));
+	if (!in.read(ret.verts.data(), header.n_verts)) return false;
+
+	std::vector<uint32_t> idxs(size_t(3 * header.n_tris));
+	if (!in.read(idxs.data(), idxs.size())) return false;
+	std::vector<Triangle> tris;
+	tris.reserve(size_t(header.n_tris));
+	for (size_t i = 0; i < idxs.size(); i += 3) {
+		if (idxs[i] >= header.n_verts || idxs[i + 1] >= header.n_verts || idxs[i + 2] >= header.n_verts) {
+			return false;
+		}
+		tris.emplace_back(ret.verts.data(), idxs[i], idxs[i + 1], idxs[i + 2]);
+	}
+
+	std::vector<uint32_t> order(size_t(header.n_tris));
+	if (!in.read(order.data(), order.size())) return false;
+
+	std::vector<File_Node> file_nodes(size_t(header.n_nodes));
+	if (!in.read(file_nodes.data(), file_nodes.size())) return false;
+	if (in.left != 0) return false;
+
+	std::vector<BVH<Triangle>::Node> nodes(file_nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const File_Node& f = file_nodes[i];
+		nodes[i].bbox = BBox(Vec3{f.min[0], f.min[1], f.min[2]}, Vec3{f.max[0], f.max[1], f.max[2]});
+		nodes[i].start = f.start;
+		nodes[i].size = f.size;
+		nodes[i].l = f.l;
+		nodes[i].r = f.r;
+	}
+
+	if (!ret.triangle_bvh.restore(std::move(tris), std::move(nodes), std::move(order), size_t(header.root),
+	                              header.width)) {
+		return false;
+	}
+	ret.build_soa();
+
+	mesh = std::move(ret);
+	return true;
+}
+
+} // namespace PT
@@ -0,0 +1,91 @@
+
+#pragma once
+
+#include "../geometry/indexed.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "tri_mesh.h"
+
+class Thread_Pool;
+
+namespace PT {
+
+//Triangle meshes (with their BVHs), keyed by their sizes and a hash of their contents. Meshes stay
+// in memory while they keep being requested and, if a directory is set, are also saved there so
+// later runs can load them instead of building them again.
+class Mesh_Cache {
+public:
+	struct Stats {
+		uint32_t hits = 0;   //found in memory
+		uint32_t loads = 0;  //loaded from the cache directory
+		uint32_t misses = 0; //built (and saved, if there is a cache directory)
+	};
+
+	//Bump whenever the file layout or the way Tri_Mesh builds its BVH changes:
+	static constexpr uint32_t version = 2;
+
+	//What identifies a mesh: its vertex and index counts and a 128-bit hash of its data
+	// (so that a collision also needs meshes of the same size, and is astronomically unlikely):
+	struct Key {
+		uint64_t hash[2];
+		uint64_t n_verts, n_indices;
+		bool operator==(const Key& other) const {
+			return hash[0] == other.hash[0] && hash[1] == other.hash[1] && n_verts == other.n_verts &&
+			       n_indices == other.n_indices;
+		}
+	};
+
+	//Directory for cache files ("" keeps meshes in memory only):
+	void set_directory(std::string dir);
+	const std::string& directory() const;
+
+	//The Tri_Mesh for mesh: from memory, from disk, or freshly built. Safe to call from
+	// several threads at once.
+	std::shared_ptr<Tri_Mesh> get(const Indexed_Mesh& mesh, bool use_bvh, Thread_Pool* thread_pool = nullptr);
+
+	//Drop meshes that were not requested since the last call:
+	void evict_unused();
+	void clear();
+
+	Stats stats() const;
+	void reset_stats();
+
+	//Key for the mesh's vertex and index data:
+	static Key key(const Indexed_Mesh& mesh);
+
+	//Write / read a Tri_Mesh (built with a BVH) in the cache file layout. load() returns
+	// false if the data is truncated, from another version, for another key, or otherwise malformed.
+	static std::vector<uint8_t> save(const Tri_Mesh& mesh, const Key& key);
+	static bool load(const uint8_t* data, size_t size, const Key& key, Tri_Mesh& mesh);
+
+private:
+	struct Entry {
+		std::shared_ptr<Tri_Mesh> mesh;
+		bool used = true;
+	};
+	struct Entry_Key {
+		Key key;
+		bool use_bvh;
+		bool operator==(const Entry_Key& other) const {
+			return key == other.key && use_bvh == other.use_bvh;
+		}
+	};
+	struct Entry_Key_Hash {
+		size_t operator()(const Entry_Key& k) const {
+			return size_t(k.key.hash[0] ^ (k.use_bvh ? 0x9e3779b97f4a7c15ull : 0));
+		}
+	};
+
+	std::string file_for(const Key& key) const;
+
+	mutable std::mutex mut;
+	std::string dir;
+	std::unordered_map<Entry_Key, Entry, Entry_Key_Hash> entries;
+	Stats counts;
+};
+
+} // namespace PT
@@ -4,6 +4,9 @@
 #include "../test.h"
 
 #include <SDL.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <thread>
 
 namespace PT
@@ -13,6 +16,11 @@ namespace PT
 	constexpr bool RENDER_NORMALS = false;
 	constexpr bool LOG_CAMERA_RAYS = true;
 	constexpr bool LOG_AREA_LIGHT_RAYS = true;
+	// regions are (at most) TILE_WIDTH x TILE_HEIGHT pixels, traced TILE_SAMPLES samples per tile:
+	//  (tune these to your liking: lower values == quicker feedback but also generally more overhead)
+	constexpr uint32_t TILE_WIDTH = 100;
+	constexpr uint32_t TILE_HEIGHT = 100;
+	constexpr uint32_t TILE_SAMPLES = 50;
 	static thread_local RNG log_rng(0x15462662); // separate RNG for logging a fraction of rays to avoid changing result when logging enabled
 
 	Spectrum Pathtracer::sample_direct_lighting_task4(RNG &rng, const Shading_Info &hit)
@@ -39,6 +47,8 @@ namespace PT
 		// TODO: trace() the ray to get the emitted light (first part of the return value)
 		Spectrum emitted;
 		emitted = trace(rng, ray).first;
+		if constexpr (COLLECT_RAY_STATS)
+			Ray_Stats::local.shadow_rays++;
 		// TODO: weight properly depending on the probability of the sampled scattering direction and add to radiance
 		if (hit.bsdf.is_specular())
 			radiance += emitted * sctr.attenuation;
@@ -74,6 +84,8 @@ namespace PT
 		Ray ray = Ray(hit.pos, world_direction, Vec2(EPS_F, std::numeric_limits<float>::infinity()), 0);
 		Spectrum emitted;
 		emitted = trace(rng, ray).first;
+		if constexpr (COLLECT_RAY_STATS)
+			Ray_Stats::local.shadow_rays++;
 		float average_pdf = (hit.bsdf.pdf(hit.out_dir, hit.world_to_object.rotate(world_direction)) + area_lights_pdf(hit.pos, world_direction)) / 2.0f;
 		radiance += emitted * hit.bsdf.evaluate(hit.out_dir, hit.world_to_object.rotate(world_direction), hit.uv) / average_pdf;
 		// Example of using log_ray():
@@ -106,6 +118,8 @@ namespace PT
 		// TODO: trace() the ray to get the reflected light (the second part of the return value)
 		Spectrum reflected;
 		reflected = trace(rng, ray).second;
+		if constexpr (COLLECT_RAY_STATS)
+			Ray_Stats::local.indirect_rays++;
 		// TODO: weight properly depending on the probability of the sampled scattering direction and set radiance
 		Spectrum radiance;
 		if (hit.bsdf.is_specular())
@@ -119,7 +133,11 @@ namespace PT
 	std::pair<Spectrum, Spectrum> Pathtracer::trace(RNG &rng, const Ray &ray)
 	{
 
-		Trace result = scene.hit(ray);
+		Trace result;
+		{
+			Ray_Stats::Traverse_Timer timer;
+			result = scene.hit(ray);
+		}
 		if (!result.hit)
 		{
 			if (env_lights.size())
@@ -162,6 +180,8 @@ namespace PT
 		// if no recursion was requested, or the material doesn't scatter light (i.e., is Materials::Emissive), don't recurse:
 		if (ray.depth == 0 || bsdf->is_emissive())
 			return {emissive, {}};
+		if constexpr (COLLECT_RAY_STATS)
+			Ray_Stats::local.bounces++;
 
 		Spectrum direct;
 		if constexpr (SAMPLE_AREA_LIGHTS)
@@ -176,7 +196,7 @@ namespace PT
 		return {emissive, direct + sample_indirect_lighting(rng, info)};
 	}
 
-	Pathtracer::Pathtracer() : thread_pool(std::thread::hardware_concurrency())
+	Pathtracer::Pathtracer(uint32_t threads) : thread_pool(threads ? threads : std::thread::hardware_concurrency())
 	{
 	}
 
@@ -186,6 +206,54 @@ namespace PT
 		thread_pool.stop();
 	}
 
+	// hash of an image's size and every one of its pixels (so any change to the image, even one
+	// that keeps its size and storage, rebuilds the alias table; this costs a few milliseconds
+	// for a large environment map, far less than building the table):
+	static uint64_t image_fingerprint(const HDR_Image &image)
+	{
+		const std::vector<Spectrum> &pixels = image.data();
+		uint64_t h = 0xcbf29ce484222325ull;
+		auto mix = [&](uint64_t v)
+		{
+			h = (h ^ v) * 0x100000001b3ull;
+		};
+		auto [w, ht] = image.dimension();
+		mix(w);
+		mix(ht);
+		static_assert(sizeof(Spectrum) == 3 * sizeof(float), "Spectrum is three packed floats.");
+		const uint8_t *at = reinterpret_cast<const uint8_t *>(pixels.data());
+		size_t bytes = pixels.size() * sizeof(Spectrum);
+		for (; bytes >= 8; bytes -= 8, at += 8)
+		{
+			uint64_t word;
+			std::memcpy(&word, at, 8);
+			mix(word);
+		}
+		for (; bytes > 0; bytes--, at++)
+		{
+			mix(*at);
+		}
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		return h;
+	}
+
+	Samplers::Sphere::Image Pathtracer::env_importance(const std::shared_ptr<Texture> &texture)
+	{
+		const HDR_Image &image = std::get<Textures::Image>(texture->texture).image;
+		uint64_t fingerprint = image_fingerprint(image);
+		auto found = env_importance_cache.find(texture.get());
+		if (found != env_importance_cache.end() && found->second.texture.lock() == texture &&
+		    found->second.fingerprint == fingerprint)
+		{
+			return found->second.sampler;
+		}
+		Env_Importance entry{texture, fingerprint, Samplers::Sphere::Image{image, &thread_pool}};
+		env_importance_cache[texture.get()] = entry;
+		return entry.sampler;
+	}
+
 	void Pathtracer::build_scene(Scene &scene_)
 	{
 
@@ -197,8 +265,10 @@ namespace PT
 		// of a deal, as BVH building should take at most a few seconds
 		// even with many big meshes.
 
-		// We could also do instancing instead of duplicating the bvh
-		// for big meshes, but that's something to add in the future
+		// Meshes are instanced: every instance (and particle) of a mesh shares one Tri_Mesh,
+		// and Tri_Meshes are kept in mesh_cache (keyed by content, optionally on disk) so
+		// unchanged meshes don't rebuild their BVHs. If only transforms changed, the
+		// top-level BVH is refit.
 
 		delta_lights.clear();
 		env_lights.clear();
@@ -217,20 +287,24 @@ namespace PT
 		std::string default_texture_name, default_material_name;
 
 		{ // copy scene data into path tracing formats
-			std::vector<std::future<std::pair<std::string, Tri_Mesh>>> mesh_futs;
+			// (meshes are converted as tasks, each into its own slot of converted)
+			std::vector<std::pair<std::string, std::shared_ptr<Tri_Mesh>>> converted(scene_.meshes.size() + scene_.skinned_meshes.size());
+			Thread_Pool::Group mesh_tasks(thread_pool);
+			mesh_cache.reset_stats();
 
+			size_t slot = 0;
 			for (const auto &[name, mesh] : scene_.meshes)
 			{
 				mesh_names[mesh] = name;
-				mesh_futs.emplace_back(thread_pool.enqueue([name = name, mesh = mesh, this]()
-																									 { return std::pair{name, Tri_Mesh(Indexed_Mesh::from_halfedge_mesh(*mesh, Indexed_Mesh::SplitEdges), scene_use_bvh)}; }));
+				mesh_tasks.run([&out = converted[slot++], name = name, mesh = mesh, use_bvh = scene_use_bvh, this]()
+							   { out = std::pair{name, mesh_cache.get(Indexed_Mesh::from_halfedge_mesh(*mesh, Indexed_Mesh::SplitEdges), use_bvh, &thread_pool)}; });
 			}
 
 			for (const auto &[name, mesh] : scene_.skinned_meshes)
 			{
 				skinned_mesh_names[mesh] = name;
-				mesh_futs.emplace_back(thread_pool.enqueue([name = name, mesh = mesh, this]()
-																									 { return std::pair{name, Tri_Mesh(mesh->posed_mesh(), scene_use_bvh)}; }));
+				mesh_tasks.run([&out = converted[slot++], name = name, mesh = mesh, use_bvh = scene_use_bvh, this]()
+							   { out = std::pair{name, mesh_cache.get(mesh->posed_mesh(), use_bvh, &thread_pool)}; });
 			}
 
 			for (const auto &[name, shape] : scene_.shapes)
@@ -268,13 +342,12 @@ namespace PT
 				delta_lights.emplace(name, std::make_shared<Delta_Light>(*delta_light));
 			}
 
+			std::unordered_map<const Texture *, Env_Importance> prev_importance = std::move(env_importance_cache);
+			env_importance_cache.clear();
 			for (const auto &[name, env_light] : scene_.env_lights)
 			{
 				env_light_names[env_light] = name;
 				auto light = std::make_shared<Environment_Light>(*env_light);
-				light->for_each([&](std::weak_ptr<Texture> &tex)
-												{
-				if (!tex.expired()) tex = texture_to_copy[tex.lock()]; });
 				if (light->is<Environment_Lights::Sphere>())
 				{
 					auto &sphere_map = std::get<Environment_Lights::Sphere>(light->light);
@@ -282,19 +355,27 @@ namespace PT
 					{
 						if (radiance->is<Textures::Image>())
 						{
-							sphere_map.importance = Samplers::Sphere::Image{
-									std::get<Textures::Image>(radiance->texture).image};
+							// (samplers for textures no longer used by an environment light are dropped)
+							auto prev = prev_importance.find(radiance.get());
+							if (prev != prev_importance.end())
+								env_importance_cache.emplace(*prev);
+							sphere_map.importance = env_importance(radiance);
 						}
 					}
 				}
+				light->for_each([&](std::weak_ptr<Texture> &tex)
+												{
+				if (!tex.expired()) tex = texture_to_copy[tex.lock()]; });
 				env_lights.emplace(name, std::move(light));
 			}
 
-			for (auto &f : mesh_futs)
+			mesh_tasks.wait();
+			for (auto &[name, mesh] : converted)
 			{
-				auto [name, mesh] = f.get();
-				meshes.emplace(name, std::make_shared<Tri_Mesh>(std::move(mesh)));
+				meshes.emplace(name, std::move(mesh));
 			}
+			// (meshes no longer in the scene drop out of the cache here)
+			mesh_cache.evict_unused();
 		}
 
 		{ // create scene instances
@@ -411,12 +492,26 @@ namespace PT
 				lights.emplace_back(light.get(), T);
 			}
 
-			emissive_objects = List(std::move(area_lights));
+			emissive_objects = Light_Sampler(std::move(area_lights), &thread_pool);
 			point_lights = std::move(lights);
 
 			if (scene_use_bvh)
 			{
-				scene = Aggregate(BVH<Instance>(std::move(objects)));
+				// if the instances are the same as last time up to their transforms, refitting
+				// the old tree is much cheaper than a rebuild -- unless it has degraded too far:
+				BVH<Instance> *prev = scene.instance_bvh();
+				bool refit = prev && prev->refit(std::move(objects));
+				if (refit && prev->node_area() > 1.5f * scene_bvh_area)
+				{
+					objects = prev->destructure();
+					refit = false;
+				}
+				if (!refit)
+				{
+					BVH<Instance> bvh(std::move(objects), 1, BVH<Instance>::default_buckets, &thread_pool, 4);
+					scene_bvh_area = bvh.node_area();
+					scene = Aggregate(std::move(bvh));
+				}
 			}
 			else
 			{
@@ -440,69 +535,147 @@ namespace PT
 		scene_use_bvh = bvh;
 	}
 
-	void Pathtracer::log_ray(const Ray &ray, float t, Spectrum color)
+	void Pathtracer::use_bvh_cache(std::string dir)
 	{
-		std::lock_guard<std::mutex> lock(ray_log_mut);
-		ray_log.push_back(Ray_Log{ray, t, color});
+		mesh_cache.set_directory(std::move(dir));
 	}
 
-	void Pathtracer::accumulate(Tile const &tile, const HDR_Image &data)
+	Mesh_Cache::Stats Pathtracer::bvh_cache_stats() const
 	{
+		return mesh_cache.stats();
+	}
 
-		std::lock_guard<std::mutex> lock(accumulator_mut);
+	void Pathtracer::log_ray(const Ray &ray, float t, Spectrum color)
+	{
+		ray_log.add(Ray_Log{ray, t, color});
+	}
 
+	void Pathtracer::accumulate(Tile const &tile, const std::vector<Spectrum> &data, const std::vector<float> &moment)
+	{
+		// tiles covering the same pixels (with different samples) may finish at the same time,
+		// so pixels are added to atomically; integer addition keeps the sum order-independent:
+		auto started = Ray_Stats::now();
+		std::shared_lock<std::shared_mutex> lock(checkpoint_mut);
+		uint32_t tile_w = tile.x_end - tile.x_begin;
 		for (uint32_t py = tile.y_begin; py < tile.y_end; ++py)
 		{
 			for (uint32_t px = tile.x_begin; px < tile.x_end; ++px)
 			{
 				uint32_t idx = py * accumulator_w + px;
-				uint32_t &samples = accumulator_samples[idx];
-				std::array<int64_t, 3> &spectrum = accumulator[idx];
+				if (!pixel_active.empty() && !pixel_active[idx])
+					continue;
+				std::atomic<int64_t> *spectrum = &accumulator[3 * idx];
 
 				// convert to 40.24 fixed point and add:
-				const Spectrum &n = data.at(px, py);
-				spectrum[0] += int64_t(n.r * (1ll << 24ll));
-				spectrum[1] += int64_t(n.g * (1ll << 24ll));
-				spectrum[2] += int64_t(n.b * (1ll << 24ll));
+				const Spectrum &n = data[(py - tile.y_begin) * tile_w + (px - tile.x_begin)];
+				spectrum[0].fetch_add(int64_t(n.r * (1ll << 24ll)), std::memory_order_relaxed);
+				spectrum[1].fetch_add(int64_t(n.g * (1ll << 24ll)), std::memory_order_relaxed);
+				spectrum[2].fetch_add(int64_t(n.b * (1ll << 24ll)), std::memory_order_relaxed);
+				// (squared luma only steers adaptive sampling, so clamp it well inside the fixed point range)
+				float m = std::min(moment[(py - tile.y_begin) * tile_w + (px - tile.x_begin)], 1e9f);
+				accumulator_moment[idx].fetch_add(int64_t(m * (1ll << 24ll)), std::memory_order_relaxed);
 
 				// add appropriate weight:
-				samples += (tile.s_end - tile.s_begin);
+				accumulator_samples[idx].fetch_add(tile.s_end - tile.s_begin, std::memory_order_relaxed);
 			}
 		}
+		pass_done[tile.slot] = 1;
+		if constexpr (COLLECT_RAY_STATS)
+			Ray_Stats::local.accumulate_s += Ray_Stats::seconds_since(started);
 	}
 
-	HDR_Image Pathtracer::accumulator_to_image() const
+	void Pathtracer::add_tile_stats(double tile_s)
 	{
-		HDR_Image image(accumulator_w, accumulator_h, Spectrum(0.0f, 0.0f, 0.0f));
-		for (uint32_t i = 0; i < uint32_t(accumulator.size()); ++i)
+		// (traverse_s is an estimate, so shading gets whatever else the tile took, if anything)
+		Ray_Stats &local = Ray_Stats::local;
+		local.shade_s = std::max(0.0, tile_s - local.traverse_s - local.accumulate_s);
+		std::lock_guard<std::mutex> lock(stats_mut);
+		stats += local;
+	}
+
+	void Pathtracer::update_preview()
+	{
+		for (uint32_t r = 0; r < uint32_t(regions.size()); ++r)
 		{
-			//(doing the conversion in double precision is probably overkill)
-			if (accumulator_samples[i] > 0)
+			if (!region_dirty[r].exchange(false))
+				continue;
+			const Region &region = regions[r];
+			for (uint32_t py = region.y_begin; py < region.y_end; ++py)
 			{
-				image.at(i) = Spectrum(
-						float(accumulator[i][0] / double(1ll << 24ll) / double(accumulator_samples[i])),
-						float(accumulator[i][1] / double(1ll << 24ll) / double(accumulator_samples[i])),
-						float(accumulator[i][2] / double(1ll << 24ll) / double(accumulator_samples[i])));
+				for (uint32_t px = region.x_begin; px < region.x_end; ++px)
+				{
+					uint32_t i = py * accumulator_w + px;
+					//(doing the conversion in double precision is probably overkill)
+					double samples = double(accumulator_samples[i].load(std::memory_order_relaxed));
+					if (samples > 0)
+					{
+						preview.at(i) = Spectrum(
+								float(accumulator[3 * i + 0].load(std::memory_order_relaxed) / double(1ll << 24ll) / samples),
+								float(accumulator[3 * i + 1].load(std::memory_order_relaxed) / double(1ll << 24ll) / samples),
+								float(accumulator[3 * i + 2].load(std::memory_order_relaxed) / double(1ll << 24ll) / samples));
+					}
+				}
 			}
 		}
-		return image;
+	}
+
+	void Pathtracer::report(uint32_t traced)
+	{
+		if (traced == total_tiles)
+		{
+			// every other tile has been accumulated by now, so this image is exact:
+			std::lock_guard<std::mutex> lock(accumulator_mut);
+			render_timer.pause();
+			update_preview();
+			last_report = std::chrono::steady_clock::now();
+			report_fn({1.0f, preview.copy()});
+			return;
+		}
+
+		// partial reports are skipped if another worker is already reporting or it's too soon:
+		if (report_rate <= 0.0f)
+			return;
+		std::unique_lock<std::mutex> lock(accumulator_mut, std::try_to_lock);
+		if (!lock.owns_lock())
+			return;
+		auto now = std::chrono::steady_clock::now();
+		if (now - last_report < std::chrono::duration<float>(1.0f / report_rate))
+			return;
+		if (traced_tiles.load() == total_tiles)
+			return; //(the final report is already out or on its way)
+		last_report = now;
+		update_preview();
+		report_fn({traced / float(total_tiles), preview.copy()});
 	}
 
 	void Pathtracer::do_trace(RNG &rng, Tile const &tile)
 	{
 		// A3T1 - Step 0: understand this function!
 
-		HDR_Image sample(camera.film.width, camera.film.height, Spectrum(0.0f, 0.0f, 0.0f));
+		// samples for this tile's pixels go in tile-sized buffers, reused by this thread's later tiles:
+		static thread_local std::vector<Spectrum> sample;
+		static thread_local std::vector<float> moment;
+		uint32_t tile_w = tile.x_end - tile.x_begin;
+		sample.assign(size_t(tile_w) * (tile.y_end - tile.y_begin), Spectrum(0.0f, 0.0f, 0.0f));
+		moment.assign(sample.size(), 0.0f);
 		for (uint32_t py = tile.y_begin; py < tile.y_end; ++py)
 		{
 			for (uint32_t px = tile.x_begin; px < tile.x_end; ++px)
 			{
+				// (with adaptive sampling, pixels that have converged are skipped)
+				if (!pixel_active.empty() && !pixel_active[py * accumulator_w + px])
+					continue;
+				Spectrum &pixel = sample[(py - tile.y_begin) * tile_w + (px - tile.x_begin)];
+				float &pixel_moment = moment[(py - tile.y_begin) * tile_w + (px - tile.x_begin)];
 				for (uint32_t s = tile.s_begin; s < tile.s_end; ++s)
 				{
 
 					// generate a camera ray for this pixel:
+					rng.start_sample(sample_seed, px, py, s);
 					auto [ray, pdf] = camera.sample_ray(rng, px, py);
 					ray.transform(camera_to_world);
+					if constexpr (COLLECT_RAY_STATS)
+						Ray_Stats::local.camera_rays++;
 
 					// if LOG_CAMERA_RAYS is set, add ray to the debug log with some small probability:
 					if constexpr (LOG_CAMERA_RAYS)
@@ -520,20 +693,695 @@ namespace PT
 
 					if (p.valid())
 					{
-						sample.at(px, py) += p;
+						pixel += p;
+						pixel_moment += p.luma() * p.luma();
 					}
 
-					if (cancel_flag && *cancel_flag)
+					if (cancelled())
 						return;
 				}
 			}
 		}
-		accumulate(tile, sample);
+		accumulate(tile, sample, moment);
+	}
+
+	// Rays for the wavefront integrator, stored by field. Each belongs to one path of the batch, and
+	// whatever it finds is added to that path's radiance scaled by weight:
+	struct Ray_Queue
+	{
+		std::vector<Vec3> point, dir;
+		std::vector<Vec2> dist_bounds;
+		std::vector<uint32_t> depth;
+		std::vector<uint32_t> path;
+		std::vector<Spectrum> weight;
+
+		size_t size() const
+		{
+			return path.size();
+		}
+		void clear()
+		{
+			point.clear();
+			dir.clear();
+			dist_bounds.clear();
+			depth.clear();
+			path.clear();
+			weight.clear();
+		}
+		void push(const Ray &ray, uint32_t p, Spectrum w = Spectrum{1.0f})
+		{
+			point.emplace_back(ray.point);
+			dir.emplace_back(ray.dir);
+			dist_bounds.emplace_back(ray.dist_bounds);
+			depth.emplace_back(ray.depth);
+			path.emplace_back(p);
+			weight.emplace_back(w);
+		}
+		Ray ray(size_t i) const
+		{
+			Ray r;
+			r.point = point[i];
+			r.dir = dir[i];
+			r.dist_bounds = dist_bounds[i];
+			r.depth = depth[i];
+			return r;
+		}
+	};
+
+	// Per-thread state of the wavefront integrator (kept between tiles to reuse allocations):
+	struct Wavefront
+	{
+		std::vector<uint32_t> active; // pixels of the tile (indices in it) to trace
+
+		// per path in the batch:
+		std::vector<uint32_t> pixel;      // index of the path's pixel in the tile
+		std::vector<float> pdf;           // of its camera ray
+		std::vector<RNG::Sample> sample;  // where its random draws continue from
+		std::vector<Spectrum> throughput; // weight of light found by its next bounce
+		std::vector<Spectrum> radiance;   // gathered so far
+
+		Ray_Queue rays;   // path rays of the current bounce
+		Ray_Queue next;   // path rays of the next bounce
+		Ray_Queue light;  // rays toward sampled lights (add the emission they hit)
+		Ray_Queue shadow; // rays toward delta lights (add their weight if unoccluded)
+
+		std::vector<Trace> hits;      // per ray in rays
+		std::vector<uint8_t> type;    // material type of each hit (or NONE if its path is done)
+		std::vector<uint32_t> order;  // hits to shade, grouped by material type
+
+		static constexpr uint8_t NONE = 0xff;
+	};
+
+	void Pathtracer::do_trace_wavefront(RNG &rng, Tile const &tile)
+	{
+		// The same estimator as do_trace() / trace(), evaluated breadth-first: a batch of camera rays
+		// is intersected together, hits are shaded grouped by material type, and the light, shadow
+		// and continuation rays this produces are each intersected together in turn.
+		constexpr uint32_t BATCH = 8192; // paths traced together
+		constexpr uint32_t N_TYPES = uint32_t(std::variant_size_v<decltype(Material::material)>);
+
+		static thread_local std::vector<Spectrum> sample;
+		static thread_local std::vector<float> moment;
+		static thread_local Wavefront wf;
+		uint32_t tile_w = tile.x_end - tile.x_begin;
+		uint32_t n_samples = tile.s_end - tile.s_begin;
+		sample.assign(size_t(tile_w) * (tile.y_end - tile.y_begin), Spectrum(0.0f, 0.0f, 0.0f));
+		moment.assign(sample.size(), 0.0f);
+
+		// (with adaptive sampling, pixels that have converged are skipped)
+		wf.active.clear();
+		for (uint32_t py = tile.y_begin; py < tile.y_end; ++py)
+		{
+			for (uint32_t px = tile.x_begin; px < tile.x_end; ++px)
+			{
+				if (pixel_active.empty() || pixel_active[py * accumulator_w + px])
+					wf.active.emplace_back((py - tile.y_begin) * tile_w + (px - tile.x_begin));
+			}
+		}
+
+		auto env_radiance = [&](Vec3 dir)
+		{
+			Spectrum radiance;
+			for (const auto &light : env_lights)
+			{
+				radiance += light.second->evaluate(dir);
+			}
+			return radiance;
+		};
+		const Spectrum invalid(std::numeric_limits<float>::quiet_NaN());
+
+		uint64_t n_paths = uint64_t(wf.active.size()) * n_samples;
+		for (uint64_t batch_begin = 0; batch_begin < n_paths; batch_begin += BATCH)
+		{
+			uint32_t n = uint32_t(std::min<uint64_t>(BATCH, n_paths - batch_begin));
+
+			// generate camera rays (pixel by pixel, as do_trace does):
+			wf.pixel.resize(n);
+			wf.pdf.resize(n);
+			wf.sample.resize(n);
+			wf.throughput.assign(n, Spectrum{1.0f});
+			wf.radiance.assign(n, Spectrum{});
+			wf.rays.clear();
+			for (uint32_t p = 0; p < n; p++)
+			{
+				uint32_t pixel = wf.active[(batch_begin + p) / n_samples];
+				uint32_t px = tile.x_begin + pixel % tile_w;
+				uint32_t py = tile.y_begin + pixel / tile_w;
+				rng.start_sample(sample_seed, px, py, tile.s_begin + uint32_t((batch_begin + p) % n_samples));
+				auto [ray, pdf] = camera.sample_ray(rng, px, py);
+				ray.transform(camera_to_world);
+				if constexpr (LOG_CAMERA_RAYS)
+				{
+					if (log_rng.coin_flip(0.00001f))
+					{
+						log_ray(ray, 10.0f, Spectrum{1.0f});
+					}
+				}
+				wf.pixel[p] = pixel;
+				wf.pdf[p] = pdf;
+				wf.sample[p] = rng.sample();
+				wf.rays.push(ray, p);
+			}
+			if constexpr (COLLECT_RAY_STATS)
+				Ray_Stats::local.camera_rays += n;
+
+			for (bool camera_rays = true; wf.rays.size() > 0; camera_rays = false)
+			{
+				// intersect every path ray:
+				size_t m = wf.rays.size();
+				wf.hits.resize(m);
+				{
+					Ray_Stats::Traverse_Timer timer(false);
+					for (size_t i = 0; i < m; i++)
+					{
+						wf.hits[i] = scene.hit(wf.rays.ray(i));
+					}
+				}
+
+				// finish paths that leave the scene or stop here; bucket the rest by material type.
+				// (as in trace(), light found directly along a path ray only counts for camera rays;
+				//  after that it was already gathered by the light rays of the previous bounce)
+				uint32_t count[N_TYPES + 1] = {};
+				wf.type.resize(m);
+				for (size_t i = 0; i < m; i++)
+				{
+					const Trace &hit = wf.hits[i];
+					uint32_t p = wf.rays.path[i];
+					wf.type[i] = Wavefront::NONE;
+					if (!hit.hit)
+					{
+						if (camera_rays)
+							wf.radiance[p] += env_radiance(wf.rays.dir[i]);
+						continue;
+					}
+					if (!hit.material)
+						continue;
+					if (wf.rays.depth[i] == 0 || hit.material->is_emissive())
+					{
+						if (camera_rays)
+							wf.radiance[p] += hit.material->emission(hit.uv);
+						continue;
+					}
+					wf.type[i] = uint8_t(hit.material->material.index());
+					count[wf.type[i] + 1]++;
+				}
+				for (uint32_t t = 0; t < N_TYPES; t++)
+					count[t + 1] += count[t];
+				wf.order.resize(count[N_TYPES]);
+				for (size_t i = 0; i < m; i++)
+				{
+					if (wf.type[i] != Wavefront::NONE)
+						wf.order[count[wf.type[i]]++] = uint32_t(i);
+				}
+
+				// shade, queueing rays instead of tracing them:
+				wf.next.clear();
+				wf.light.clear();
+				wf.shadow.clear();
+				for (uint32_t i : wf.order)
+				{
+					Trace &hit = wf.hits[i];
+					uint32_t p = wf.rays.path[i];
+					const Material &bsdf = *hit.material;
+					if (!bsdf.is_sided() && dot(hit.normal, wf.rays.dir[i]) > 0.0f)
+					{
+						hit.normal = -hit.normal;
+					}
+					Mat4 object_to_world = Mat4::rotate_to(hit.normal);
+					Mat4 world_to_object = object_to_world.T();
+					Vec3 out_dir = world_to_object.rotate(wf.rays.point[i] - hit.position).unit();
+					Spectrum beta = wf.throughput[p];
+					rng.resume(wf.sample[p]);
+
+					// delta lights (see sum_delta_lights):
+					if (!bsdf.is_specular())
+					{
+						for (auto &light : point_lights)
+						{
+							Delta_Lights::Incoming incoming = light.incoming(hit.position);
+							Spectrum attenuation = bsdf.evaluate(out_dir, world_to_object.rotate(incoming.direction), hit.uv);
+							if (attenuation.luma() == 0.0f)
+								continue;
+							wf.shadow.push(Ray(hit.position, incoming.direction, Vec2{EPS_F, incoming.distance - EPS_F}), p,
+														 beta * attenuation * incoming.radiance);
+						}
+					}
+
+					// direct lighting (see sample_direct_lighting_task4/6):
+					{
+						Materials::Scatter sctr = bsdf.scatter(rng, out_dir, hit.uv);
+						Vec3 world_direction;
+						Spectrum weight;
+						if (SAMPLE_AREA_LIGHTS && !bsdf.is_specular())
+						{
+							if (rng.coin_flip(0.5f))
+								world_direction = object_to_world.rotate(sctr.direction).unit();
+							else
+								world_direction = sample_area_lights(rng, hit.position);
+							Vec3 in_dir = world_to_object.rotate(world_direction);
+							float average_pdf = (bsdf.pdf(out_dir, in_dir) + area_lights_pdf(hit.position, world_direction)) / 2.0f;
+							weight = beta * bsdf.evaluate(out_dir, in_dir, hit.uv) / average_pdf;
+							if constexpr (LOG_AREA_LIGHT_RAYS)
+							{
+								if (log_rng.coin_flip(0.001f))
+									log_ray(Ray(), 100.0f);
+							}
+						}
+						else
+						{
+							world_direction = object_to_world.rotate(sctr.direction).unit();
+							if (bsdf.is_specular())
+								weight = beta * sctr.attenuation;
+							else
+								weight = beta * sctr.attenuation / bsdf.pdf(out_dir, sctr.direction);
+						}
+						wf.light.push(Ray(hit.position, world_direction, Vec2(EPS_F, std::numeric_limits<float>::infinity()), 0), p, weight);
+					}
+
+					// continue the path (see sample_indirect_lighting):
+					{
+						Materials::Scatter sctr = bsdf.scatter(rng, out_dir, hit.uv);
+						wf.sample[p] = rng.sample(); // (the last draw of this bounce)
+						Spectrum factor = sctr.attenuation;
+						if (!bsdf.is_specular())
+							factor = factor / bsdf.pdf(out_dir, sctr.direction);
+						if (!factor.valid())
+						{
+							wf.radiance[p] = invalid; // (the recursive estimate would not be finite either)
+							continue;
+						}
+						wf.throughput[p] = beta * factor;
+						// (a path ray with depth 0 would only gather light already gathered by this bounce's light ray)
+						uint32_t depth = wf.rays.depth[i] - 1;
+						if (depth > 0 && wf.throughput[p] != Spectrum{})
+						{
+							Vec3 world_direction = object_to_world.rotate(sctr.direction).unit();
+							wf.next.push(Ray(hit.position, world_direction, Vec2(EPS_F, std::numeric_limits<float>::infinity()), depth), p);
+						}
+					}
+				}
+
+				if constexpr (COLLECT_RAY_STATS)
+				{
+					Ray_Stats::local.bounces += wf.order.size();
+					Ray_Stats::local.shadow_rays += wf.light.size() + wf.shadow.size();
+					Ray_Stats::local.indirect_rays += wf.next.size();
+				}
+
+				// gather light along light rays:
+				for (size_t i = 0; i < wf.light.size(); i++)
+				{
+					Trace hit;
+					{
+						Ray_Stats::Traverse_Timer timer;
+						hit = scene.hit(wf.light.ray(i));
+					}
+					Spectrum emitted;
+					if (!hit.hit)
+						emitted = env_radiance(wf.light.dir[i]);
+					else if (hit.material)
+						emitted = hit.material->emission(hit.uv);
+					wf.radiance[wf.light.path[i]] += wf.light.weight[i] * emitted;
+				}
+
+				// and from unoccluded delta lights:
+				{
+					Ray_Stats::Traverse_Timer timer(false);
+					for (size_t i = 0; i < wf.shadow.size(); i++)
+					{
+						if (!scene.occluded(wf.shadow.ray(i)))
+							wf.radiance[wf.shadow.path[i]] += wf.shadow.weight[i];
+					}
+				}
+
+				std::swap(wf.rays, wf.next);
+
+				if (cancelled())
+					return;
+			}
+
+			for (uint32_t p = 0; p < n; p++)
+			{
+				Spectrum s = wf.radiance[p] / wf.pdf[p];
+				if (s.valid())
+				{
+					sample[wf.pixel[p]] += s;
+					moment[wf.pixel[p]] += s.luma() * s.luma();
+				}
+			}
+		}
+		accumulate(tile, sample, moment);
 	}
 
 	bool Pathtracer::in_progress() const
 	{
-		return traced_tiles.load() < total_tiles;
+		return reported_tiles.load() < total_tiles;
+	}
+
+	float Pathtracer::progress() const
+	{
+		return total_tiles ? traced_tiles.load() / float(total_tiles) : 1.0f;
+	}
+
+	void Pathtracer::use_wavefront(bool breadth_first)
+	{
+		wavefront = breadth_first;
+	}
+
+	void Pathtracer::use_sequence(RNG::Sequence rng_sequence)
+	{
+		sequence = rng_sequence;
+	}
+
+	void Pathtracer::set_adaptive(Adaptive const &settings)
+	{
+		adaptive = settings;
+	}
+
+	HDR_Image Pathtracer::sample_counts() const
+	{
+		HDR_Image counts(accumulator_w, accumulator_h);
+		for (uint32_t i = 0; i < accumulator_w * accumulator_h; i++)
+		{
+			counts.at(i) = Spectrum(float(accumulator_samples[i].load(std::memory_order_relaxed)));
+		}
+		return counts;
+	}
+
+	// Checkpoint layout (native byte order):
+	//  Checkpoint_Header
+	//  int64_t[3 * width * height]  (accumulator)
+	//  uint32_t[width * height]     (accumulator_samples)
+	//  int64_t[width * height]      (accumulator_moment)
+	//  uint8_t[n_regions]           (region_active)
+	//  uint8_t[n_slots]             (pass_done)
+	//  uint8_t[width * height]      (pixel_active, if has_pixel_active)
+	struct Checkpoint_Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t width, height;
+		uint32_t sequence;
+		uint32_t sample_seed;
+		uint32_t pass_begin, pass_end, samples_end;
+		uint32_t n_regions, n_slots;
+		uint32_t has_pixel_active;
+		uint32_t shard_index, shard_count;
+		uint32_t reserved;
+		uint64_t seeds_drawn;
+	};
+	static_assert(sizeof(Checkpoint_Header) == 72);
+	constexpr char checkpoint_magic[8] = {'S', '3', 'D', 'C', 'K', 'P', 'T', '\0'};
+	constexpr uint32_t checkpoint_version = 2;
+
+	// size of a checkpoint with header's counts:
+	static size_t checkpoint_size(Checkpoint_Header const &header)
+	{
+		size_t pixels = size_t(header.width) * header.height;
+		return sizeof(header) + pixels * (3 * sizeof(int64_t) + sizeof(uint32_t) + sizeof(int64_t)) +
+					 size_t(header.n_regions) + size_t(header.n_slots) + (header.has_pixel_active ? pixels : 0);
+	}
+
+	// read data's header, checking that data is (structurally) a whole checkpoint:
+	static bool read_checkpoint_header(std::vector<uint8_t> const &data, Checkpoint_Header &header)
+	{
+		if (data.size() < sizeof(header))
+			return false;
+		std::memcpy(&header, data.data(), sizeof(header));
+		if (std::memcmp(header.magic, checkpoint_magic, sizeof(checkpoint_magic)) != 0 || header.version != checkpoint_version)
+			return false;
+		if (header.pass_begin > header.pass_end || header.pass_end > header.samples_end)
+			return false;
+		if (header.shard_count == 0 || header.shard_index >= header.shard_count)
+			return false;
+		return data.size() == checkpoint_size(header);
+	}
+
+	std::vector<uint8_t> Pathtracer::checkpoint()
+	{
+		std::unique_lock<std::shared_mutex> lock(checkpoint_mut);
+
+		Checkpoint_Header header;
+		std::memcpy(header.magic, checkpoint_magic, sizeof(checkpoint_magic));
+		header.version = checkpoint_version;
+		header.width = accumulator_w;
+		header.height = accumulator_h;
+		header.sequence = uint32_t(sequence);
+		header.sample_seed = sample_seed;
+		header.pass_begin = pass_begin;
+		header.pass_end = pass_end;
+		header.samples_end = samples_end;
+		header.n_regions = uint32_t(regions.size());
+		header.n_slots = uint32_t(pass_done.size());
+		header.has_pixel_active = !pixel_active.empty();
+		header.shard_index = shard_index;
+		header.shard_count = shard_count;
+		header.reserved = 0;
+		header.seeds_drawn = seeds_drawn;
+
+		std::vector<uint8_t> out;
+		out.reserve(checkpoint_size(header));
+		auto append = [&out](const void *data, size_t bytes)
+		{
+			const uint8_t *at = static_cast<const uint8_t *>(data);
+			out.insert(out.end(), at, at + bytes);
+		};
+		// (the accumulator's atomics are read one at a time; nothing adds to them while the lock is held)
+		auto append_all = [&](const auto &values)
+		{
+			for (const auto &v : values)
+			{
+				auto value = v.load(std::memory_order_relaxed);
+				append(&value, sizeof(value));
+			}
+		};
+		append(&header, sizeof(header));
+		append_all(accumulator);
+		append_all(accumulator_samples);
+		append_all(accumulator_moment);
+		append(region_active.data(), region_active.size());
+		append(pass_done.data(), pass_done.size());
+		append(pixel_active.data(), pixel_active.size());
+		return out;
+	}
+
+	bool Pathtracer::save_checkpoint(std::string const &path)
+	{
+		return write_checkpoint(path, checkpoint());
+	}
+
+	bool Pathtracer::write_checkpoint(std::string const &path, std::vector<uint8_t> const &data)
+	{
+		std::string temp = path + ".tmp";
+		std::ofstream out(temp, std::ios::binary);
+		out.write(reinterpret_cast<const char *>(data.data()), std::streamsize(data.size()));
+		out.close();
+		std::error_code ec;
+		if (out)
+			std::filesystem::rename(temp, path, ec);
+		if (!out || ec)
+		{
+			std::filesystem::remove(temp, ec);
+			return false;
+		}
+		return true;
+	}
+
+	bool Pathtracer::resume(Scene &scene_, std::shared_ptr<::Instance::Camera> camera_,
+													std::function<void(Render_Report &&)> &&f, bool *quit,
+													std::vector<uint8_t> const &data)
+	{
+		std::shared_ptr<Camera> camera_data = camera_->camera.lock();
+		const auto &film = camera_data->film;
+		size_t pixels = size_t(film.width) * film.height;
+
+		Checkpoint_Header header;
+		if (!read_checkpoint_header(data, header))
+			return false;
+		if (header.width != film.width || header.height != film.height || header.sequence != uint32_t(sequence))
+			return false;
+		if (header.shard_index != shard_index || header.shard_count != shard_count)
+			return false;
+		// (checked before start() takes f, so a caller can still render() from scratch with it)
+		size_t n_regions = size_t((film.width + TILE_WIDTH - 1) / TILE_WIDTH) * ((film.height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+		size_t region_tiles = (header.pass_end - header.pass_begin + TILE_SAMPLES - 1) / TILE_SAMPLES;
+		if (header.n_regions != n_regions || header.n_slots != n_regions * region_tiles)
+			return false;
+		if (header.has_pixel_active && !adaptive.enabled)
+			return false;
+
+		start(scene_, camera_, std::move(f), quit, false);
+		assert(regions.size() == n_regions);
+
+		const uint8_t *at = data.data() + sizeof(header);
+		auto read_all = [&](auto &values)
+		{
+			for (auto &v : values)
+			{
+				decltype(v.load()) value;
+				std::memcpy(&value, at, sizeof(value));
+				at += sizeof(value);
+				v.store(value, std::memory_order_relaxed);
+			}
+		};
+		read_all(accumulator);
+		read_all(accumulator_samples);
+		read_all(accumulator_moment);
+		region_active.assign(at, at + header.n_regions);
+		at += header.n_regions;
+		std::vector<uint8_t> done(at, at + header.n_slots);
+		at += header.n_slots;
+		if (header.has_pixel_active)
+			pixel_active.assign(at, at + pixels);
+		for (auto &dirty : region_dirty)
+			dirty = true;
+
+		// the same seeds as the checkpointed render, from where its current pass started:
+		sample_seed = header.sample_seed;
+		seeds_rng.seed(sample_seed);
+		seeds_rng.mt.discard(header.seeds_drawn);
+		seeds_drawn = header.seeds_drawn;
+		pass_seeds = 0;
+		samples_end = std::max(header.samples_end, film.samples);
+
+		std::unique_lock<std::shared_mutex> lock(checkpoint_mut);
+		queue_pass(header.pass_begin, header.pass_end, std::move(done));
+		if (total_tiles == 0)
+		{
+			// (the checkpoint had finished its pass, so go on to the next -- if there is one)
+			lock.unlock();
+			next_pass();
+			if (total_tiles == 0)
+				report(0);
+		}
+		return true;
+	}
+
+	void Pathtracer::set_shard(uint32_t index, uint32_t count)
+	{
+		assert(count > 0 && index < count);
+		shard_index = index;
+		shard_count = count;
+	}
+
+	bool Pathtracer::merge_checkpoints(std::vector<std::vector<uint8_t>> const &shards, std::vector<uint8_t> &merged,
+																		 std::string *error, std::vector<uint32_t> *missing)
+	{
+		auto fail = [&](std::string const &message)
+		{
+			if (error)
+				*error = message;
+			return false;
+		};
+		if (shards.empty())
+			return fail("no checkpoints to merge");
+
+		Checkpoint_Header first;
+		if (!read_checkpoint_header(shards[0], first))
+			return fail("checkpoint 0 is malformed");
+		if (first.has_pixel_active)
+			return fail("checkpoints of adaptive renders can't be merged");
+		merged = shards[0];
+
+		Checkpoint_Header out = first;
+		size_t pixels = size_t(first.width) * first.height;
+		uint8_t *accumulator = merged.data() + sizeof(out);
+		uint8_t *samples = accumulator + 3 * pixels * sizeof(int64_t);
+		uint8_t *moment = samples + pixels * sizeof(uint32_t);
+		uint8_t *done = moment + pixels * sizeof(int64_t) + first.n_regions;
+		// add count values of type T at from to those at to:
+		auto add = [](auto zero, uint8_t *to, const uint8_t *from, size_t count)
+		{
+			for (size_t v = 0; v < count; v++)
+			{
+				decltype(zero) a, b;
+				std::memcpy(&a, to + v * sizeof(a), sizeof(a));
+				std::memcpy(&b, from + v * sizeof(b), sizeof(b));
+				a += b;
+				std::memcpy(to + v * sizeof(a), &a, sizeof(a));
+			}
+		};
+		std::vector<uint8_t> shard_seen(first.shard_count, 0);
+		shard_seen[first.shard_index] = 1;
+
+		for (size_t i = 1; i < shards.size(); i++)
+		{
+			Checkpoint_Header header;
+			std::string which = "checkpoint " + std::to_string(i);
+			if (!read_checkpoint_header(shards[i], header))
+				return fail(which + " is malformed");
+			if (header.width != first.width || header.height != first.height || header.sequence != first.sequence ||
+					header.sample_seed != first.sample_seed || header.seeds_drawn != first.seeds_drawn ||
+					header.pass_begin != first.pass_begin || header.pass_end != first.pass_end ||
+					header.samples_end != first.samples_end || header.n_regions != first.n_regions ||
+					header.n_slots != first.n_slots || header.has_pixel_active || header.shard_count != first.shard_count)
+			{
+				return fail(which + " is not another shard of the same render");
+			}
+			if (shard_seen[header.shard_index])
+				return fail(which + " repeats shard " + std::to_string(header.shard_index));
+			shard_seen[header.shard_index] = 1;
+
+			// (sums of 40.24 fixed point don't depend on order, so this is exactly what one process would have accumulated)
+			const uint8_t *from = shards[i].data() + sizeof(header);
+			add(int64_t(0), accumulator, from, 3 * pixels);
+			from += 3 * pixels * sizeof(int64_t);
+			add(uint32_t(0), samples, from, pixels);
+			from += pixels * sizeof(uint32_t);
+			add(int64_t(0), moment, from, pixels);
+			from += pixels * sizeof(int64_t) + header.n_regions;
+			for (size_t v = 0; v < header.n_slots; v++)
+			{
+				done[v] |= from[v];
+			}
+		}
+
+		if (missing)
+		{
+			missing->clear();
+			for (uint32_t s = 0; s < first.shard_count; s++)
+			{
+				if (!shard_seen[s])
+					missing->emplace_back(s);
+			}
+		}
+
+		// the merged checkpoint is of the whole render (so resuming it traces whatever tiles are missing):
+		out.shard_index = 0;
+		out.shard_count = 1;
+		std::memcpy(merged.data(), &out, sizeof(out));
+		return true;
+	}
+
+	HDR_Image Pathtracer::checkpoint_image(std::vector<uint8_t> const &data)
+	{
+		Checkpoint_Header header;
+		if (!read_checkpoint_header(data, header))
+			return HDR_Image();
+		size_t pixels = size_t(header.width) * header.height;
+		const uint8_t *accumulator = data.data() + sizeof(header);
+		const uint8_t *samples = accumulator + 3 * pixels * sizeof(int64_t);
+
+		HDR_Image image(header.width, header.height);
+		for (size_t i = 0; i < pixels; i++)
+		{
+			uint32_t n;
+			std::memcpy(&n, samples + i * sizeof(uint32_t), sizeof(n));
+			if (n == 0)
+				continue;
+			int64_t c[3];
+			std::memcpy(c, accumulator + 3 * i * sizeof(int64_t), sizeof(c));
+			// (resolved as update_preview does)
+			image.at(uint32_t(i)) = Spectrum(float(c[0] / double(1ll << 24ll) / double(n)),
+																			 float(c[1] / double(1ll << 24ll) / double(n)),
+																			 float(c[2] / double(1ll << 24ll) / double(n)));
+		}
+		return image;
+	}
+
+	void Pathtracer::set_report_rate(float hz)
+	{
+		report_rate = hz;
 	}
 
 	std::pair<float, float> Pathtracer::completion_time() const
@@ -541,14 +1389,24 @@ namespace PT
 		return {build_timer.s(), render_timer.s()};
 	}
 
+	Ray_Stats Pathtracer::ray_stats() const
+	{
+		std::lock_guard<std::mutex> lock(stats_mut);
+		return stats;
+	}
+
+	Thread_Pool &Pathtracer::threads()
+	{
+		return thread_pool;
+	}
+
 	uint32_t Pathtracer::visualize_bvh(GL::Lines &lines, GL::Lines &active, uint32_t depth)
 	{
 		return scene.visualize(lines, active, depth, Mat4::I);
 	}
 
-	void Pathtracer::render(Scene &scene_, std::shared_ptr<::Instance::Camera> camera_,
-													std::function<void(Render_Report &&)> &&f, bool *quit,
-													bool add_samples)
+	void Pathtracer::start(Scene &scene_, std::shared_ptr<::Instance::Camera> camera_,
+												 std::function<void(Render_Report &&)> &&f, bool *quit, bool keep_samples)
 	{
 		assert(camera_);
 		assert(!camera_->camera.expired());
@@ -560,53 +1418,119 @@ namespace PT
 		// copy camera to local camera:
 		set_camera(camera_);
 
-		if (accumulator_w != camera_->camera.lock()->film.width || accumulator_h != camera_->camera.lock()->film.height)
-		{
-			add_samples = false;
-		}
-
-		if (!add_samples)
+		if (!keep_samples)
 		{
 			build_timer.reset();
 			build_scene(scene_);
 			build_timer.pause();
 			accumulator_w = camera.film.width;
 			accumulator_h = camera.film.height;
-			std::array<int64_t, 3> zero;
-			zero.fill(0);
-			accumulator.assign(accumulator_w * accumulator_h, zero);
-			accumulator_samples.assign(accumulator_w * accumulator_h, 0);
+			// (value-initialized, so all zero)
+			accumulator = std::vector<std::atomic<int64_t>>(size_t(3) * accumulator_w * accumulator_h);
+			accumulator_samples = std::vector<std::atomic<uint32_t>>(size_t(accumulator_w) * accumulator_h);
+			accumulator_moment = std::vector<std::atomic<int64_t>>(size_t(accumulator_w) * accumulator_h);
+			preview = HDR_Image(accumulator_w, accumulator_h);
 			ray_log.clear();
 		}
 		render_timer.reset();
+		last_report = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock(stats_mut);
+			stats = Ray_Stats{};
+			if (!keep_samples)
+				stats.build_s = build_timer.s();
+		}
 
-		// divide image into tiles for rendering:
-		//  (feedback will be posted back to the UI after every tile completes)
-		std::vector<Tile> tiles;
+		// divide image into regions, each traced in tiles of samples:
+		//  (feedback will be posted back to the UI as tiles complete, at most report_rate times per second)
+		regions.clear();
+		for (uint32_t y_begin = 0; y_begin < camera.film.height; y_begin += TILE_HEIGHT)
+		{
+			uint32_t y_end = std::min(y_begin + TILE_HEIGHT, camera.film.height);
+			for (uint32_t x_begin = 0; x_begin < camera.film.width; x_begin += TILE_WIDTH)
+			{
+				uint32_t x_end = std::min(x_begin + TILE_WIDTH, camera.film.width);
+				regions.emplace_back(Region{x_begin, x_end, y_begin, y_end});
+			}
+		}
+		region_dirty = std::vector<std::atomic<bool>>(regions.size());
+
+		// every pixel starts out taking samples:
+		pixel_active.clear();
+		region_active.assign(regions.size(), 1);
+	}
+
+	void Pathtracer::render(Scene &scene_, std::shared_ptr<::Instance::Camera> camera_,
+													std::function<void(Render_Report &&)> &&f, bool *quit,
+													bool add_samples)
+	{
+		if (accumulator_w != camera_->camera.lock()->film.width || accumulator_h != camera_->camera.lock()->film.height)
+		{
+			add_samples = false;
+		}
+		start(scene_, camera_, std::move(f), quit, add_samples);
+
+		uint32_t samples_begin = 0;
+		if (add_samples)
+		{
+			// (continuing the seeds and sample indices of the samples already taken, so the new ones differ)
+			samples_begin = samples_end;
+		}
+		else
+		{
+			// get a pseudo-random stream to seed the tiles with:
+			seeds_rng.random_seed();
+			if (RNG::fixed_seed != 0)
+				seeds_rng.seed(RNG::fixed_seed);
+			seeds_drawn = pass_seeds = 0;
+			// (per-sample sequences are seeded per render, so a pixel's samples are the same points whichever tile takes them)
+			sample_seed = seeds_rng.get_seed();
+		}
+		samples_end = samples_begin + camera.film.samples;
 
-		// tune these to your liking:
-		//  lower values == quicker feedback but also generally more overhead
-		constexpr uint32_t tile_width = 100;
-		constexpr uint32_t tile_height = 100;
-		constexpr uint32_t tile_samples = 50;
+		std::unique_lock<std::shared_mutex> lock(checkpoint_mut);
+		if (adaptive.enabled)
+		{
+			// (errors can't be estimated from fewer than two samples)
+			queue_pass(samples_begin, std::min(samples_begin + std::max(adaptive.min_samples, 2u), samples_end));
+		}
+		else
+		{
+			queue_pass(samples_begin, samples_end);
+		}
+		if (total_tiles == 0)
+			report(0); //(nothing to trace -- e.g., a shard with no tiles -- so the image is already final)
+	}
+
+	void Pathtracer::queue_pass(uint32_t s_begin, uint32_t s_end, std::vector<uint8_t> done)
+	{
+		uint32_t region_tiles = (s_end - s_begin + TILE_SAMPLES - 1) / TILE_SAMPLES;
 
-		// get a pseudo-random stream to seed the tiles with:
-		RNG seeds_rng;
-		if (RNG::fixed_seed != 0)
-			seeds_rng.seed(RNG::fixed_seed);
+		pass_begin = s_begin;
+		pass_end = s_end;
+		seeds_drawn += pass_seeds;
+		pass_seeds = 0;
+		pass_done = std::move(done);
+		pass_done.resize(regions.size() * region_tiles, 0);
 
-		for (uint32_t y_begin = 0; y_begin < camera.film.height; y_begin += tile_height)
+		// (tiles already done still draw their seeds, so the rest get the same ones as before)
+		std::vector<Tile> tiles;
+		// (refinement passes -- the ones that have pixel_active -- give up tiles once the time budget runs out)
+		bool budgeted = adaptive.enabled && adaptive.time_budget > 0.0f && !pixel_active.empty();
+		for (uint32_t region = 0; region < uint32_t(regions.size()); region++)
 		{
-			uint32_t y_end = std::min(y_begin + tile_height, camera.film.height);
-			for (uint32_t x_begin = 0; x_begin < camera.film.width; x_begin += tile_width)
+			if (!region_active[region])
+				continue;
+			const Region &r = regions[region];
+			for (uint32_t t = 0; t < region_tiles; t++)
 			{
-				uint32_t x_end = std::min(x_begin + tile_width, camera.film.width);
-				for (uint32_t s_begin = 0; s_begin < camera.film.samples; s_begin += tile_samples)
-				{
-					uint32_t s_end = std::min(s_begin + tile_samples, camera.film.samples);
-					uint32_t seed = seeds_rng.mt();
-					tiles.emplace_back(Tile{seed, x_begin, x_end, y_begin, y_end, s_begin, s_end});
-				}
+				uint32_t seed = seeds_rng.mt();
+				pass_seeds++;
+				uint32_t slot = region * region_tiles + t;
+				if (pass_done[slot] || slot % shard_count != shard_index)
+					continue;
+				uint32_t s = s_begin + t * TILE_SAMPLES;
+				tiles.emplace_back(Tile{seed, r.x_begin, r.x_end, r.y_begin, r.y_end, s, std::min(s + TILE_SAMPLES, s_end), region, slot, budgeted});
 			}
 		}
 
@@ -628,49 +1552,123 @@ namespace PT
 		return a.s_begin < b.s_begin; });
 
 		// actually launch the render jobs:
-		total_tiles = uint32_t(tiles.size());
+		pass_remaining = uint32_t(tiles.size());
+		total_tiles += uint32_t(tiles.size());
 		for (auto const &tile : tiles)
 		{
 			// queue up a render job per-tile:
-			thread_pool.enqueue([tile, this]()
-													{
-			RNG rng(tile.seed);
-			do_trace(rng, tile);
+			render_tasks.run([tile, this]()
+											 {
+			//(a tile skipped for the time budget isn't marked done, and still counts as traced so the render finishes)
+			if (!tile.budgeted || render_timer.s() < adaptive.time_budget) {
+				auto started = Ray_Stats::now();
+				if constexpr (COLLECT_RAY_STATS) Ray_Stats::local = Ray_Stats{};
+				RNG rng(tile.seed);
+				rng.use(sequence);
+				if (wavefront && !RENDER_NORMALS) do_trace_wavefront(rng, tile);
+				else do_trace(rng, tile);
+				if constexpr (COLLECT_RAY_STATS) add_tile_stats(Ray_Stats::seconds_since(started));
+
+				region_dirty[tile.region] = true;
+			}
+			//(the next pass is queued before this tile counts as traced, so the render never looks finished in between)
+			if (pass_remaining.fetch_sub(1) == 1) next_pass();
+			report(traced_tiles.fetch_add(1) + 1);
+			reported_tiles.fetch_add(1); });
+		}
+	}
+
+	bool Pathtracer::cancelled() const
+	{
+		return render_tasks.cancelled() || (cancel_flag && *cancel_flag);
+	}
 
-			uint32_t traced = traced_tiles.fetch_add(1) + 1;
-			if (traced == total_tiles) {
-				std::lock_guard<std::mutex> lock(accumulator_mut);
-				render_timer.pause();
-				report_fn({1.0f, accumulator_to_image()});
-			} else {
-				std::lock_guard<std::mutex> lock(accumulator_mut);
-				report_fn({traced / float(total_tiles), accumulator_to_image()});
-			} });
+	void Pathtracer::next_pass()
+	{
+		std::unique_lock<std::shared_mutex> lock(checkpoint_mut);
+		if (cancelled())
+			return;
+		if (pass_end >= samples_end)
+			return;
+		if (!adaptive.enabled)
+		{
+			// (only a resumed render, with more samples than its checkpoint, gets here)
+			pixel_active.clear();
+			region_active.assign(regions.size(), 1);
+			queue_pass(pass_end, samples_end);
+			return;
 		}
+		if (adaptive.time_budget > 0.0f && render_timer.s() >= adaptive.time_budget)
+			return;
+
+		// keep sampling pixels whose relative error (standard error of the mean luminance over
+		// the mean, with dark pixels held to an absolute error instead) is still too high:
+		constexpr double min_mean = 0.01;
+		if (pixel_active.empty())
+			pixel_active.assign(size_t(accumulator_w) * accumulator_h, 1);
+		bool any_active = false;
+		for (uint32_t r = 0; r < uint32_t(regions.size()); r++)
+		{
+			const Region &region = regions[r];
+			bool region_needs_samples = false;
+			for (uint32_t py = region.y_begin; py < region.y_end; ++py)
+			{
+				for (uint32_t px = region.x_begin; px < region.x_end; ++px)
+				{
+					uint32_t i = py * accumulator_w + px;
+					if (!pixel_active[i])
+						continue;
+					double n = double(accumulator_samples[i].load(std::memory_order_relaxed));
+					double luma = (0.2126 * accumulator[3 * i + 0].load(std::memory_order_relaxed) +
+												 0.7152 * accumulator[3 * i + 1].load(std::memory_order_relaxed) +
+												 0.0722 * accumulator[3 * i + 2].load(std::memory_order_relaxed)) /
+												double(1ll << 24ll);
+					double moment = accumulator_moment[i].load(std::memory_order_relaxed) / double(1ll << 24ll);
+					if (n < 2.0)
+					{
+						region_needs_samples = true;
+						continue;
+					}
+					double mean = luma / n;
+					double variance = std::max(0.0, (moment / n - mean * mean) * n / (n - 1.0));
+					double error = std::sqrt(variance / n) / std::max(mean, min_mean);
+					pixel_active[i] = error > adaptive.max_error;
+					region_needs_samples = region_needs_samples || pixel_active[i];
+				}
+			}
+			region_active[r] = region_needs_samples;
+			any_active = any_active || region_needs_samples;
+		}
+		if (!any_active)
+			return;
+
+		// passes grow with the samples taken so far, so errors are re-estimated a logarithmic number of times:
+		uint32_t pass_samples = std::max(std::max(adaptive.min_samples, 2u), pass_end / 2);
+		queue_pass(pass_end, std::min(pass_end + pass_samples, samples_end));
 	}
 
 	void Pathtracer::cancel()
 	{
-		if (cancel_flag)
-			*cancel_flag = true;
-		thread_pool.clear();
+		// queued tiles are skipped and running ones stop at their next sample; a tile finishing a
+		// pass meanwhile sees the cancellation too, so it doesn't queue another:
+		render_tasks.cancel();
+		render_tasks.wait();
+		render_tasks.reset();
 		traced_tiles = 0;
+		reported_tiles = 0;
 		total_tiles = 0;
-		if (cancel_flag)
-			*cancel_flag = false;
 		render_timer.pause();
 	}
 
 	const std::vector<Pathtracer::Ray_Log> Pathtracer::copy_ray_log()
 	{
-		std::lock_guard<std::mutex> lock(ray_log_mut);
-		return ray_log;
+		return ray_log.snapshot();
 	}
 
 	Vec3 Pathtracer::sample_area_lights(RNG &rng, Vec3 from)
 	{
 
-		size_t n_emissive = emissive_objects.n_primitives();
+		size_t n_emissive = emissive_objects.empty() ? 0 : emissive_objects.n_emitters();
 		size_t n_env = env_lights.size();
 
 		auto sample_env_lights = [&]()
@@ -702,7 +1700,7 @@ namespace PT
 	float Pathtracer::area_lights_pdf(Vec3 from, Vec3 dir)
 	{
 
-		size_t n_emissive = emissive_objects.n_primitives();
+		size_t n_emissive = emissive_objects.empty() ? 0 : emissive_objects.n_emitters();
 		size_t n_env = env_lights.size();
 
 		auto env_lights_pdf = [&]()
@@ -716,7 +1714,7 @@ namespace PT
 		};
 
 		uint32_t n_strategies = (n_emissive > 0) + (n_env > 0);
-		float pdf = emissive_objects.pdf(Ray(from, dir)) + env_lights_pdf();
+		float pdf = emissive_objects.pdf(from, dir) + env_lights_pdf();
 
 		return n_strategies ? pdf / n_strategies : 0.0f;
 	}
@@ -738,9 +1736,15 @@ namespace PT
 				continue;
 
 			Ray shadow_ray(hit.pos, incoming.direction, Vec2{EPS_F, incoming.distance - EPS_F});
+			if constexpr (COLLECT_RAY_STATS)
+				Ray_Stats::local.shadow_rays++;
 
-			Trace shadow = scene.hit(shadow_ray);
-			if (!shadow.hit)
+			bool occluded;
+			{
+				Ray_Stats::Traverse_Timer timer;
+				occluded = scene.occluded(shadow_ray);
+			}
+			if (!occluded)
 			{
 				radiance += attenuation * incoming.radiance;
 			}
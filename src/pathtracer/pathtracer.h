@@ -2,17 +2,23 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 
 #include "../lib/mathlib.h"
 #include "../scene/scene.h"
 
 #include "../util/hdr_image.h"
+#include "../util/reservoir.h"
 #include "../util/thread_pool.h"
 #include "../util/timer.h"
 
 #include "aggregate.h"
+#include "light_sampler.h"
+#include "mesh_cache.h"
+#include "ray_stats.h"
 
 namespace PT {
 
@@ -31,19 +37,78 @@ public:
 		Spectrum color = Spectrum{1.0f};
 	};
 
-	Pathtracer();
+	//(renders with threads threads, or one per hardware thread if 0)
+	explicit Pathtracer(uint32_t threads = 0);
 	~Pathtracer();
 
 	void use_bvh(bool use_bvh);
+	//trace paths breadth-first, a batch at a time, instead of one at a time (same estimator):
+	void use_wavefront(bool wavefront);
+	//sequence that camera rays, materials and light sampling draw random numbers from:
+	void use_sequence(RNG::Sequence sequence);
+	//also keep built mesh BVHs in dir, to be loaded by later runs ("" to disable):
+	void use_bvh_cache(std::string dir);
+	//meshes found in the cache / loaded from disk / built since the last render() that built the scene:
+	Mesh_Cache::Stats bvh_cache_stats() const;
 	uint32_t visualize_bvh(GL::Lines& lines, GL::Lines& active, uint32_t level);
-	const std::vector<Ray_Log> copy_ray_log(); //copy ray log (with proper locking)
+	//a uniform sample (at most ray_log_capacity per thread) of the rays logged by this render so far:
+	const std::vector<Ray_Log> copy_ray_log();
+	static constexpr uint32_t ray_log_capacity = 8192;
 
 	using Render_Report = std::pair<float, HDR_Image>;
 	void render(Scene& scene, std::shared_ptr<::Instance::Camera> camera,
 	            std::function<void(Render_Report &&)>&& f, bool* quit, bool add_samples = false);
-	
+	//report partial images at most hz times per second (0: only report the finished image):
+	void set_report_rate(float hz);
+
+	//Adaptive sampling: every pixel gets min_samples, then further passes of samples go only to
+	// pixels whose estimated relative error (of luminance) is still above max_error, until they
+	// reach the film's sample count or time_budget seconds (0: no limit) have gone by. The budget
+	// is a soft limit: the first pass (min_samples everywhere) always finishes, and after that
+	// tiles stop starting once it runs out, so it is overrun by at most the tiles already running:
+	struct Adaptive {
+		bool enabled = false;
+		uint32_t min_samples = 16;
+		float max_error = 0.02f;
+		float time_budget = 0.0f;
+	};
+	void set_adaptive(Adaptive const &adaptive);
+	//samples taken so far by each pixel (in every channel), to see where they were spent:
+	HDR_Image sample_counts() const;
+
+	//Checkpoints hold the accumulated samples of the current (or just finished) render, which of
+	// its tiles are done, and the seeds to continue with, so a long render can be resumed later
+	// (by another process, even) and end up the same as if it had never stopped:
+	std::vector<uint8_t> checkpoint();
+	//write checkpoint() to path, through a temporary file so path never holds a partial checkpoint:
+	bool save_checkpoint(std::string const &path);
+	static bool write_checkpoint(std::string const &path, std::vector<uint8_t> const &checkpoint);
+	//like render(), but continue from a checkpoint of the same scene and camera. The film's sample
+	// count is the total wanted, so a finished checkpoint gets more samples if it is higher.
+	//Returns false (rendering nothing, and leaving f alone) if the checkpoint is malformed, for another
+	// film size, sequence or shard, or of an adaptive render while adaptive sampling is off:
+	bool resume(Scene& scene, std::shared_ptr<::Instance::Camera> camera,
+	            std::function<void(Render_Report &&)>&& f, bool* quit, std::vector<uint8_t> const &checkpoint);
+
+	//Shards split a render between processes: shard index of count traces every count'th tile
+	// (with the seeds the whole render would give it), so the sum of all shards' checkpoints is
+	// exactly the accumulator of the whole render. (Not meant for adaptive sampling, whose passes
+	// depend on every shard's samples.)
+	void set_shard(uint32_t index, uint32_t count);
+	//sum the checkpoints of a render's shards into a checkpoint of the whole render (shards still
+	// missing, listed in *missing, leave tiles for resume() to trace). On failure, returns false and sets *error:
+	static bool merge_checkpoints(std::vector<std::vector<uint8_t>> const &shards, std::vector<uint8_t> &merged,
+	                              std::string *error = nullptr, std::vector<uint32_t> *missing = nullptr);
+	//the image accumulated in a checkpoint (empty if it is malformed):
+	static HDR_Image checkpoint_image(std::vector<uint8_t> const &checkpoint);
+
 	bool in_progress() const;
+	float progress() const; //fraction of tiles traced so far
 	std::pair<float, float> completion_time() const;
+	//rays traced and time spent by the current (or last) render so far (empty unless COLLECT_RAY_STATS):
+	Ray_Stats ray_stats() const;
+	//the threads renders run on (other work, e.g. a Rasterizer, can share them through Thread_Pool::Group):
+	Thread_Pool& threads();
 
 	Spectrum sample_direct_lighting_task4(RNG &rng, const Shading_Info& hit);
 	Spectrum sample_direct_lighting_task6(RNG &rng, const Shading_Info& hit);
@@ -54,6 +119,10 @@ public:
 
 private:
 	void cancel();
+	//render() and resume(): cancel the previous render and set up for the next one
+	// (rebuilding the scene and clearing the accumulator unless keep_samples):
+	void start(Scene& scene, std::shared_ptr<::Instance::Camera> camera,
+	           std::function<void(Render_Report &&)>&& f, bool* quit, bool keep_samples);
 
 	//a 'Tile' is a region of the image (in both pixel and sample space) to trace:
 	struct Tile {
@@ -61,31 +130,91 @@ private:
 		uint32_t x_begin = 0, x_end = 0;
 		uint32_t y_begin = 0, y_end = 0;
 		uint32_t s_begin = 0, s_end = 0;
+		uint32_t region = 0; //index into regions (shared by tiles covering the same pixels)
+		uint32_t slot = 0;   //index into pass_done
+		bool budgeted = false; //skipped if it starts after adaptive.time_budget has run out
+	};
+	//pixel area covered by tiles (preview is updated one region at a time):
+	struct Region {
+		uint32_t x_begin = 0, x_end = 0;
+		uint32_t y_begin = 0, y_end = 0;
 	};
 
 	//trace [x_begin,x_end)x[y_begin,y_end) region of the image, shooting rays for samples [s_begin,s_end):
 	void do_trace(RNG &rng, Tile const &tile);
-	//accumulate samples from do_trace into the accumulator:
-	void accumulate(Tile const &tile, const HDR_Image& data);
+	//the same, breadth-first (wavefront integrator):
+	void do_trace_wavefront(RNG &rng, Tile const &tile);
+	//accumulate samples from do_trace (tile-sized, row-major) and their summed squared luma into the accumulator:
+	void accumulate(Tile const &tile, const std::vector<Spectrum>& data, const std::vector<float>& moment);
+	//add the calling thread's Ray_Stats::local (counted by a tile that took tile_s seconds) to stats:
+	void add_tile_stats(double tile_s);
 
 	bool* cancel_flag = nullptr;
+	//true once the render is cancelled (by cancel() or through cancel_flag); tiles check it every sample:
+	bool cancelled() const;
 	std::function<void(Render_Report &&)> report_fn;
 
 	Thread_Pool thread_pool;
+	Thread_Pool::Group render_tasks{thread_pool}; //tiles (cancel() cancels and waits on them)
 	bool scene_use_bvh = true;
+	bool wavefront = false;
+	RNG::Sequence sequence = RNG::Sequence::Sobol;
 	Timer render_timer, build_timer;
+	mutable std::mutex stats_mut;
+	Ray_Stats stats; //(guarded by stats_mut)
 
 	std::mutex accumulator_mut;
 	uint32_t accumulator_w = 0, accumulator_h = 0;
 	//accumulator will store spectrums as 40.24 fixed point to avoid order-of-addition nondeterminism:
-	std::vector< std::array< int64_t, 3 > > accumulator;
+	// (three values per pixel; tiles add to it atomically, so no lock is needed)
+	std::vector< std::atomic< int64_t > > accumulator;
 	//accumulator will store sample counts as well:
-	std::vector< uint32_t > accumulator_samples;
-	//compute image (divide spectrums by sample counts):
-	HDR_Image accumulator_to_image() const;
+	std::vector< std::atomic< uint32_t > > accumulator_samples;
+	//...and the sum of squared sample luma per pixel (40.24 fixed point), to estimate errors from:
+	std::vector< std::atomic< int64_t > > accumulator_moment;
+
+	//Partial images are reported from preview, into which only the regions accumulated since
+	// the last report are resolved (divide spectrums by sample counts). Reports are limited to
+	// report_rate per second, and the final report is resolved after all tiles are in.
+	// (preview, last_report: guarded by accumulator_mut)
+	float report_rate = 10.0f;
+	HDR_Image preview;
+	std::vector<Region> regions;
+	std::vector<std::atomic<bool>> region_dirty;
+	std::chrono::steady_clock::time_point last_report;
+	//resolve dirty regions into preview (call with accumulator_mut held):
+	void update_preview();
+	//called after each tile finishes; traced is the number of tiles done:
+	void report(uint32_t traced);
 
-	uint32_t total_tiles = 0;
+	//(with adaptive sampling, total_tiles grows as passes are queued)
+	std::atomic<uint32_t> total_tiles = 0;
 	std::atomic<uint32_t> traced_tiles = 0;
+	std::atomic<uint32_t> reported_tiles = 0; //traced tiles done reporting (in_progress() waits for the final report)
+
+	//Tiles are queued one pass (range of samples) at a time; without adaptive sampling, one pass
+	// covers all samples. seeds_rng seeds tiles in the order they are queued.
+	//(adding samples to a render continues its seeds and sample indices, so samples_end grows)
+	RNG seeds_rng;
+	uint32_t sample_seed = 0; //seed for RNG::start_sample()
+	uint64_t seeds_drawn = 0, pass_seeds = 0; //drawn from seeds_rng before / for the current pass
+	Adaptive adaptive;
+	//(adaptive sampling) pixels / regions still taking samples (pixel_active empty: all are):
+	std::vector<uint8_t> pixel_active, region_active;
+	uint32_t pass_begin = 0, pass_end = 0;    //sample indices [pass_begin,pass_end) of the current pass
+	uint32_t samples_end = 0;                 //end of the render's last pass
+	std::atomic<uint32_t> pass_remaining = 0; //tiles of the current pass not yet traced
+	//per tile of the current pass (by region, then samples): accumulated yet?
+	std::vector<uint8_t> pass_done;
+	uint32_t shard_index = 0, shard_count = 1; //this process only traces tiles with slot % shard_count == shard_index
+	//tiles accumulate (and mark themselves done) holding this shared; checkpoint() and queueing
+	// a pass take it exclusively, so checkpoints never catch a tile half-accumulated:
+	std::shared_mutex checkpoint_mut;
+	//queue tiles for samples [s_begin,s_end) of the active regions, except those marked in done
+	// (tiles a checkpoint already has):
+	void queue_pass(uint32_t s_begin, uint32_t s_end, std::vector<uint8_t> done = {});
+	//called by the tile that finishes a pass; queues the next pass, if any:
+	void next_pass();
 
 	//trace a single ray into the scene,
 	//return (emitted, reflected) light incoming along ray
@@ -99,12 +228,11 @@ private:
 	Vec3 sample_area_lights(RNG &rng, Vec3 from);
 	float area_lights_pdf(Vec3 from, Vec3 dir);
 
-	std::mutex ray_log_mut;
-	std::vector<Ray_Log> ray_log;
+	Reservoir<Ray_Log> ray_log{ray_log_capacity};
 	void log_ray(const Ray& ray, float t, Spectrum color = Spectrum{1.0f});
 
-	Aggregate scene;
-	List<Instance> emissive_objects;
+	Aggregate scene; //top level: instances of the (shared) triangle meshes and shapes
+	Light_Sampler emissive_objects;
 	std::vector<Light_Instance> point_lights;
 
 	Camera camera;
@@ -116,6 +244,21 @@ private:
 	std::unordered_map<std::string, std::shared_ptr<Texture>> textures;
 	std::unordered_map<std::string, std::shared_ptr<Tri_Mesh>> meshes;
 	std::unordered_map<std::string, std::shared_ptr<Shape>> shapes;
+
+	//Triangle meshes (with their BVHs) kept between build_scene() calls, keyed by content:
+	Mesh_Cache mesh_cache;
+	//node_area() of the scene BVH when it was last fully built (refits that grow well past this rebuild):
+	float scene_bvh_area = 0.0f;
+
+	//Importance samplers for environment map images, kept between build_scene() calls and keyed by
+	// the scene's texture (reused while its image's pixels are unchanged, see env_importance()):
+	struct Env_Importance {
+		std::weak_ptr<Texture> texture;
+		uint64_t fingerprint = 0;
+		Samplers::Sphere::Image sampler;
+	};
+	std::unordered_map<const Texture*, Env_Importance> env_importance_cache;
+	Samplers::Sphere::Image env_importance(const std::shared_ptr<Texture>& texture);
 };
 
 } // namespace PT
@@ -0,0 +1,59 @@
+
+#include "ray_stats.h"
+
+#include <sstream>
+
+namespace PT {
+
+Ray_Stats& Ray_Stats::operator+=(Ray_Stats const& other) {
+	camera_rays += other.camera_rays;
+	shadow_rays += other.shadow_rays;
+	indirect_rays += other.indirect_rays;
+	bounces += other.bounces;
+	bvh_nodes += other.bvh_nodes;
+	triangle_tests += other.triangle_tests;
+	build_s += other.build_s;
+	traverse_s += other.traverse_s;
+	shade_s += other.shade_s;
+	accumulate_s += other.accumulate_s;
+	return *this;
+}
+
+std::string Ray_Stats::summary() const {
+	double per_ray = rays() ? 1.0 / double(rays()) : 0.0;
+	double traced_s = traverse_s + shade_s + accumulate_s;
+	auto percent = [&](double s) { return traced_s > 0.0 ? 100.0 * s / traced_s : 0.0; };
+
+	std::ostringstream out;
+	out.precision(3);
+	out << std::fixed;
+	out << "rays: " << rays() << " (" << camera_rays << " camera, " << shadow_rays << " shadow, "
+	    << indirect_rays << " indirect); " << average_depth() << " bounces per path\n";
+	out << "per ray: " << double(bvh_nodes) * per_ray << " BVH nodes, " << double(triangle_tests) * per_ray
+	    << " triangle tests\n";
+	out << "time: " << build_s << "s build; tiles (summed over threads) " << traverse_s << "s traverse ("
+	    << percent(traverse_s) << "%), " << shade_s << "s shade (" << percent(shade_s) << "%), " << accumulate_s
+	    << "s accumulate (" << percent(accumulate_s) << "%)";
+	return out.str();
+}
+
+std::string Ray_Stats::json() const {
+	std::ostringstream out;
+	out.precision(9);
+	out << "{\n";
+	out << "\t\"camera_rays\": " << camera_rays << ",\n";
+	out << "\t\"shadow_rays\": " << shadow_rays << ",\n";
+	out << "\t\"indirect_rays\": " << indirect_rays << ",\n";
+	out << "\t\"bounces\": " << bounces << ",\n";
+	out << "\t\"average_depth\": " << average_depth() << ",\n";
+	out << "\t\"bvh_nodes\": " << bvh_nodes << ",\n";
+	out << "\t\"triangle_tests\": " << triangle_tests << ",\n";
+	out << "\t\"build_s\": " << build_s << ",\n";
+	out << "\t\"traverse_s\": " << traverse_s << ",\n";
+	out << "\t\"shade_s\": " << shade_s << ",\n";
+	out << "\t\"accumulate_s\": " << accumulate_s << "\n";
+	out << "}\n";
+	return out.str();
+}
+
+} // namespace PT
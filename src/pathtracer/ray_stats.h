@@ -0,0 +1,84 @@
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace PT {
+
+//Count rays and time the parts of rendering (set false to compile all of it out):
+constexpr bool COLLECT_RAY_STATS = true;
+
+//What a render spent its time on. Tiles count into their thread's Ray_Stats::local (no
+// atomics or locks in the hot path), and the pathtracer adds each tile's counts to the
+// render's total when the tile is done.
+struct Ray_Stats {
+	uint64_t camera_rays = 0;
+	uint64_t shadow_rays = 0;   //toward lights, for direct lighting (sampled lights and delta lights alike)
+	uint64_t indirect_rays = 0; //continuing paths
+	uint64_t bounces = 0;       //hits that were shaded (scattered), over all paths
+	uint64_t bvh_nodes = 0;     //BVH nodes visited (one box test per binary node, one per wide node)
+	uint64_t triangle_tests = 0;
+
+	double build_s = 0.0;      //building the scene (and its BVHs)
+	double traverse_s = 0.0;   //intersecting rays with the scene (estimated, see Traverse_Timer)
+	double shade_s = 0.0;      //everything else tiles do: cameras, materials, light sampling
+	double accumulate_s = 0.0; //adding tiles to the accumulator
+
+	Ray_Stats& operator+=(Ray_Stats const& other);
+
+	uint64_t rays() const {
+		return camera_rays + shadow_rays + indirect_rays;
+	}
+	//bounces per camera ray:
+	double average_depth() const {
+		return camera_rays ? double(bounces) / double(camera_rays) : 0.0;
+	}
+
+	//multi-line summary for printing, and a JSON object with every field:
+	std::string summary() const;
+	std::string json() const;
+
+	//counts of the tile running on this thread:
+	static thread_local Ray_Stats local;
+
+	//the time now, if collecting stats (to pass to seconds_since() later):
+	static std::chrono::steady_clock::time_point now() {
+		if constexpr (COLLECT_RAY_STATS) return std::chrono::steady_clock::now();
+		else return {};
+	}
+	static double seconds_since(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(now() - start).count();
+	}
+
+	//Times scene intersections (for as long as it exists) into local.traverse_s. Reading the
+	// clock costs about as much as a short traversal, so when timing single rays, only one in
+	// every 'every' timers reads it (and counts for all of them):
+	class Traverse_Timer {
+	public:
+		static constexpr uint32_t every = 16;
+		explicit Traverse_Timer(bool single_ray = true) {
+			if constexpr (COLLECT_RAY_STATS) {
+				weight = !single_ray ? 1 : (counter++ % every) == 0 ? every : 0;
+				if (weight) start = now();
+			}
+		}
+		~Traverse_Timer() {
+			if constexpr (COLLECT_RAY_STATS) {
+				if (weight) local.traverse_s += weight * seconds_since(start);
+			}
+		}
+		Traverse_Timer(const Traverse_Timer&) = delete;
+		Traverse_Timer& operator=(const Traverse_Timer&) = delete;
+
+	private:
+		static inline thread_local uint32_t counter = 0;
+		uint32_t weight = 0;
+		std::chrono::steady_clock::time_point start;
+	};
+};
+
+inline thread_local Ray_Stats Ray_Stats::local;
+
+} // namespace PT
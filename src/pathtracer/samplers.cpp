@@ -1,6 +1,7 @@
 
 #include "samplers.h"
 #include "../util/rand.h"
+#include "../util/thread_pool.h"
 
 namespace Samplers
 {
@@ -123,38 +124,110 @@ namespace Samplers
 		return 1.0f / (4.0f * PI_F);
 	}
 
-	Sphere::Image::Image(const HDR_Image &image)
+	Sphere::Image::Image(const HDR_Image &image, Thread_Pool *thread_pool)
 	{
 		// A3T7 - image sampler init
 
 		// Set up importance sampling data structures for a spherical environment map image.
-		// You may make use of the _pdf, _cdf, and total members, or create your own.
 
 		const auto [_w, _h] = image.dimension();
 		w = _w;
 		h = _h;
-		float pdf_sum = 0.0f;
-		for (uint32_t i = 0; i < h; i++)
+		const size_t n = size_t(w) * size_t(h);
+		if (n == 0)
+			return;
+
+		const std::vector<Spectrum> &pixels = image.data();
+		auto table = std::make_shared<std::vector<Bin>>(n);
+		std::vector<Bin> &out = *table;
+
+		// weigh texels by luminance times (relative) solid angle; weights go in Bin::q until normalized.
+		// Row sums are kept in double precision so dim texels of very large maps aren't lost:
+		std::vector<double> row_sum(h, 0.0);
+		auto weigh_rows = [&](uint32_t begin, uint32_t end, bool use_luma)
 		{
-			for (uint32_t j = 0; j < w; j++)
+			for (uint32_t i = begin; i < end; i++)
 			{
-				float theta = PI_F * (float(i) + 0.5f) / float(h);
-				float luma = image.at(j + i * w).luma();
-				float local_pdf = std::sin(theta) * luma;
-				pdf_sum += local_pdf;
-				_pdf.push_back(local_pdf);
+				float sin_theta = std::sin(PI_F * (float(i) + 0.5f) / float(h));
+				double sum = 0.0;
+				for (uint32_t j = 0; j < w; j++)
+				{
+					size_t t = size_t(i) * w + j;
+					float weight = sin_theta * (use_luma ? pixels[t].luma() : 1.0f);
+					if (!std::isfinite(weight) || weight < 0.0f)
+						weight = 0.0f;
+					out[t].q = weight;
+					sum += weight;
+				}
+				row_sum[i] = sum;
 			}
+		};
+		auto weigh = [&](bool use_luma)
+		{
+			constexpr uint32_t ROWS_PER_TASK = 32;
+			uint32_t tasks = (h + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+			if (!thread_pool || tasks <= 1)
+			{
+				weigh_rows(0, h, use_luma);
+			}
+			else
+			{
+				Thread_Pool::Group group(*thread_pool);
+				for (uint32_t t = 1; t < tasks; t++)
+				{
+					group.run([&, t]()
+					          { weigh_rows(t * ROWS_PER_TASK, std::min(h, (t + 1) * ROWS_PER_TASK), use_luma); });
+				}
+				weigh_rows(0, ROWS_PER_TASK, use_luma);
+				group.wait();
+			}
+			double total = 0.0;
+			for (double sum : row_sum)
+				total += sum;
+			return total;
+		};
+
+		double total = weigh(true);
+		if (!(total > 0.0))
+			total = weigh(false); // (black map: fall back to uniform over the sphere)
+
+		// Vose's alias method. work[0,n_small) holds texels with less than average weight,
+		// work[n_large,n) those with at least average weight:
+		std::vector<uint32_t> work(n);
+		size_t n_small = 0, n_large = n;
+		const double scale = double(n) / total;
+		for (size_t t = 0; t < n; t++)
+		{
+			double weight = out[t].q;
+			out[t].p = float(weight / total);
+			out[t].q = float(weight * scale);
+			out[t].alias = uint32_t(t);
+			if (out[t].q < 1.0f)
+				work[n_small++] = uint32_t(t);
+			else
+				work[--n_large] = uint32_t(t);
 		}
-		float cdf_sum = 0.0f;
-		for (uint32_t i = 0; i < h; i++)
+		while (n_small > 0 && n_large < n)
 		{
-			for (uint32_t j = 0; j < w; j++)
+			uint32_t small = work[--n_small];
+			uint32_t large = work[n_large];
+			out[small].alias = large;
+			// (large gives away the rest of small's column)
+			double rest = (double(out[large].q) + double(out[small].q)) - 1.0;
+			out[large].q = float(rest);
+			if (rest < 1.0)
 			{
-				_pdf[j + i * w] /= pdf_sum;
-				cdf_sum += _pdf[j + i * w];
-				_cdf.push_back(cdf_sum);
+				n_large++;
+				work[n_small++] = large;
 			}
 		}
+		// whatever is left is (up to rounding) exactly average:
+		for (size_t k = 0; k < n_small; k++)
+			out[work[k]].q = 1.0f;
+		for (size_t k = n_large; k < n; k++)
+			out[work[k]].q = 1.0f;
+
+		bins = std::move(table);
 	}
 
 	Vec3 Sphere::Image::sample(RNG &rng) const
@@ -162,15 +235,16 @@ namespace Samplers
 		// A3T7 - image sampler sampling
 
 		// Use your importance sampling data structure to generate a sample direction.
-		// Tip: std::upper_bound
-		auto prob = std::upper_bound(_cdf.begin(), _cdf.end(), rng.unit());
-		if (prob == _cdf.end())
-			prob -= 1;
+		if (!bins)
+			return Vec3{0.0f, 1.0f, 0.0f};
 
-		int idx = int(prob - _cdf.begin());
+		uint32_t idx = uint32_t(rng.integer(0, int32_t(bins->size())));
+		const Bin &bin = (*bins)[idx];
+		if (rng.unit() >= bin.q)
+			idx = bin.alias;
 
-		int y = idx / (int)w;
-		int x = idx - w * y;
+		uint32_t y = idx / w;
+		uint32_t x = idx - w * y;
 		float phi = (float(x) + 0.5f) / float(w) * 2.0f * PI_F;
 		float theta = (float(y) + 0.5f) / float(h) * PI_F;
 
@@ -186,6 +260,8 @@ namespace Samplers
 		// A3T7 - image sampler pdf
 
 		// What is the PDF of this distribution at a particular direction?
+		if (!bins)
+			return 0.0f;
 		float u = std::atan2(dir.z, dir.x) / (2.0f * PI_F);
 		if (u < 0.0f)
 			u += 1.0f;
@@ -200,7 +276,7 @@ namespace Samplers
 		float theta = std::acos(-dir.y);
 
 		float jacobian = float(w) * float(h) / (2 * PI_F * PI_F * std::sin(theta));
-		return jacobian * _pdf[idx];
+		return jacobian * (*bins)[idx].p;
 	}
 
 } // namespace Samplers
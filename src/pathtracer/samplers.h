@@ -3,7 +3,10 @@
 #include "../lib/mathlib.h"
 #include "../util/hdr_image.h"
 
+#include <memory>
+
 struct RNG;
+class Thread_Pool;
 
 namespace Samplers
 {
@@ -92,17 +95,27 @@ namespace Samplers
 		};
 
 		// Sphere::Image importance-samples the surface, with importance given by a lat/lon image with the north pole at (0,1,0):
+		//  texels are picked with an alias table, so both sample() and pdf() take constant time.
 		struct Image
 		{
 			Image() = default;
-			Image(const HDR_Image &image);
+			// (rows are weighed in parallel if a thread pool is supplied)
+			Image(const HDR_Image &image, Thread_Pool *thread_pool = nullptr);
 
 			Vec3 sample(RNG &rng) const;
 			float pdf(Vec3 dir) const;
 
+			// per texel, in image order:
+			struct Bin
+			{
+				float p = 0.0f;     // probability of picking this texel
+				float q = 1.0f;     // picked directly with probability q...
+				uint32_t alias = 0; // ...otherwise alias is picked instead
+			};
+
 			uint32_t w = 0, h = 0;
-			std::vector<float> _pdf, _cdf;
-			float total = 0.0f;
+			// (shared between copies; the table for a large map is hundreds of megabytes)
+			std::shared_ptr<const std::vector<Bin>> bins;
 			Rect jitter;
 		};
 
@@ -0,0 +1,347 @@
+
+#include "tri_kernels.h"
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TRI_KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX
+#else
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+#else
+#define TRI_KERNELS_X86 0
+#endif
+
+namespace PT {
+
+void Tri_SoA::resize(size_t n_) {
+	n = n_;
+	for (uint32_t a = 0; a < 3; a++) {
+		p0[a].assign(n + padding, 0.0f);
+		e1[a].assign(n + padding, 0.0f);
+		e2[a].assign(n + padding, 0.0f);
+	}
+}
+
+void Tri_SoA::set(uint32_t i, Vec3 v0, Vec3 v1, Vec3 v2) {
+	Vec3 v0v1 = v1 - v0;
+	Vec3 v0v2 = v2 - v0;
+	for (uint32_t a = 0; a < 3; a++) {
+		p0[a][i] = v0[a];
+		e1[a][i] = v0v1[a];
+		e2[a][i] = v0v2[a];
+	}
+}
+
+void Tri_SoA::clear() {
+	n = 0;
+	for (uint32_t a = 0; a < 3; a++) {
+		p0[a].clear();
+		e1[a].clear();
+		e2[a].clear();
+	}
+}
+
+size_t Tri_SoA::size() const {
+	return n;
+}
+
+namespace Tri_Kernels {
+
+// - - - - scalar - - - -
+
+// One triangle, in the same order of operations as Triangle::hit:
+static bool test_scalar(const Tri_SoA& tris, uint32_t i, const Ray& ray, float& t, float& u,
+                        float& v) {
+	Vec3 p0(tris.p0[0][i], tris.p0[1][i], tris.p0[2][i]);
+	Vec3 v0v1(tris.e1[0][i], tris.e1[1][i], tris.e1[2][i]);
+	Vec3 v0v2(tris.e2[0][i], tris.e2[1][i], tris.e2[2][i]);
+
+	Vec3 pvec = cross(ray.dir, v0v2);
+	float det = dot(v0v1, pvec);
+	if (std::abs(det) < EPS_F) return false;
+	float invDet = 1.0f / det;
+
+	Vec3 tvec = ray.point - p0;
+	u = dot(tvec, pvec) * invDet;
+	if (u < 0.0f || u > 1.0f) return false;
+
+	Vec3 qvec = cross(tvec, v0v1);
+	v = dot(ray.dir, qvec) * invDet;
+	if (v < 0.0f || u + v > 1.0f) return false;
+
+	t = dot(v0v2, qvec) * invDet;
+	return !(t < ray.dist_bounds.x || t > ray.dist_bounds.y);
+}
+
+static bool closest_scalar(const Tri_SoA& tris, const Ray& ray, uint32_t start, uint32_t end,
+                           Tri_Hit& hit) {
+	bool found = false;
+	for (uint32_t i = start; i < end; i++) {
+		float t, u, v;
+		if (test_scalar(tris, i, ray, t, u, v) && t < hit.t) {
+			hit = Tri_Hit{i, t, u, v};
+			found = true;
+		}
+	}
+	return found;
+}
+
+static bool any_scalar(const Tri_SoA& tris, const Ray& ray, uint32_t start, uint32_t end) {
+	for (uint32_t i = start; i < end; i++) {
+		float t, u, v;
+		if (test_scalar(tris, i, ray, t, u, v)) return true;
+	}
+	return false;
+}
+
+#if TRI_KERNELS_X86
+
+// - - - - SSE (4 triangles at a time; always available on x86-64) - - - -
+
+struct Ray4 {
+	__m128 o[3], d[3], lo, hi;
+};
+
+static Ray4 splat4(const Ray& ray) {
+	Ray4 r;
+	for (uint32_t a = 0; a < 3; a++) {
+		r.o[a] = _mm_set1_ps(ray.point[a]);
+		r.d[a] = _mm_set1_ps(ray.dir[a]);
+	}
+	r.lo = _mm_set1_ps(ray.dist_bounds.x);
+	r.hi = _mm_set1_ps(ray.dist_bounds.y);
+	return r;
+}
+
+// Triangles [i,i+4); returns a bitmask of the lanes that were hit (ignoring whether the lane is in range).
+// Comparisons are written as "reject if" so that NaNs behave as they do in the scalar test.
+static int test_sse(const Tri_SoA& tris, uint32_t i, const Ray4& r, __m128& t, __m128& u, __m128& v) {
+	__m128 p0[3], e1[3], e2[3];
+	for (uint32_t a = 0; a < 3; a++) {
+		p0[a] = _mm_loadu_ps(&tris.p0[a][i]);
+		e1[a] = _mm_loadu_ps(&tris.e1[a][i]);
+		e2[a] = _mm_loadu_ps(&tris.e2[a][i]);
+	}
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+
+	// pvec = cross(dir, e2), det = dot(e1, pvec):
+	__m128 px = _mm_sub_ps(_mm_mul_ps(r.d[1], e2[2]), _mm_mul_ps(r.d[2], e2[1]));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(r.d[2], e2[0]), _mm_mul_ps(r.d[0], e2[2]));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(r.d[0], e2[1]), _mm_mul_ps(r.d[1], e2[0]));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], px), _mm_mul_ps(e1[1], py)), _mm_mul_ps(e1[2], pz));
+	__m128 abs_det = _mm_and_ps(det, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+	__m128 reject = _mm_cmplt_ps(abs_det, _mm_set1_ps(EPS_F));
+	__m128 inv_det = _mm_div_ps(one, det);
+
+	// tvec = origin - p0, u = dot(tvec, pvec) / det:
+	__m128 tx = _mm_sub_ps(r.o[0], p0[0]);
+	__m128 ty = _mm_sub_ps(r.o[1], p0[1]);
+	__m128 tz = _mm_sub_ps(r.o[2], p0[2]);
+	u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+	reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one)));
+
+	// qvec = cross(tvec, e1), v = dot(dir, qvec) / det, t = dot(e2, qvec) / det:
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1[2]), _mm_mul_ps(tz, e1[1]));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1[0]), _mm_mul_ps(tx, e1[2]));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1[1]), _mm_mul_ps(ty, e1[0]));
+	v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r.d[0], qx), _mm_mul_ps(r.d[1], qy)), _mm_mul_ps(r.d[2], qz)), inv_det);
+	reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(v, zero), _mm_cmpgt_ps(_mm_add_ps(u, v), one)));
+
+	t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], qx), _mm_mul_ps(e2[1], qy)), _mm_mul_ps(e2[2], qz)), inv_det);
+	reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(t, r.lo), _mm_cmpgt_ps(t, r.hi)));
+
+	return ~_mm_movemask_ps(reject) & 0xf;
+}
+
+static int lanes_below(uint32_t i, uint32_t end, uint32_t width) {
+	return end - i >= width ? (1 << width) - 1 : (1 << (end - i)) - 1;
+}
+
+static bool closest_sse(const Tri_SoA& tris, const Ray& ray, uint32_t start, uint32_t end, Tri_Hit& hit) {
+	Ray4 r = splat4(ray);
+	bool found = false;
+	for (uint32_t i = start; i < end; i += 4) {
+		__m128 t, u, v;
+		int mask = test_sse(tris, i, r, t, u, v) & lanes_below(i, end, 4);
+		if (!mask) continue;
+		alignas(16) float ts[4], us[4], vs[4];
+		_mm_store_ps(ts, t);
+		_mm_store_ps(us, u);
+		_mm_store_ps(vs, v);
+		for (uint32_t l = 0; l < 4; l++) {
+			if ((mask & (1 << l)) && ts[l] < hit.t) {
+				hit = Tri_Hit{i + l, ts[l], us[l], vs[l]};
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+static bool any_sse(const Tri_SoA& tris, const Ray& ray, uint32_t start, uint32_t end) {
+	Ray4 r = splat4(ray);
+	for (uint32_t i = start; i < end; i += 4) {
+		__m128 t, u, v;
+		if (test_sse(tris, i, r, t, u, v) & lanes_below(i, end, 4)) return true;
+	}
+	return false;
+}
+
+// - - - - AVX (8 triangles at a time; chosen at runtime) - - - -
+
+struct Ray8 {
+	__m256 o[3], d[3], lo, hi;
+};
+
+TARGET_AVX static Ray8 splat8(const Ray& ray) {
+	Ray8 r;
+	for (uint32_t a = 0; a < 3; a++) {
+		r.o[a] = _mm256_set1_ps(ray.point[a]);
+		r.d[a] = _mm256_set1_ps(ray.dir[a]);
+	}
+	r.lo = _mm256_set1_ps(ray.dist_bounds.x);
+	r.hi = _mm256_set1_ps(ray.dist_bounds.y);
+	return r;
+}
+
+// (same as test_sse, eight lanes wide)
+TARGET_AVX static int test_avx(const Tri_SoA& tris, uint32_t i, const Ray8& r, __m256& t, __m256& u, __m256& v) {
+	__m256 p0[3], e1[3], e2[3];
+	for (uint32_t a = 0; a < 3; a++) {
+		p0[a] = _mm256_loadu_ps(&tris.p0[a][i]);
+		e1[a] = _mm256_loadu_ps(&tris.e1[a][i]);
+		e2[a] = _mm256_loadu_ps(&tris.e2[a][i]);
+	}
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+
+	__m256 px = _mm256_sub_ps(_mm256_mul_ps(r.d[1], e2[2]), _mm256_mul_ps(r.d[2], e2[1]));
+	__m256 py = _mm256_sub_ps(_mm256_mul_ps(r.d[2], e2[0]), _mm256_mul_ps(r.d[0], e2[2]));
+	__m256 pz = _mm256_sub_ps(_mm256_mul_ps(r.d[0], e2[1]), _mm256_mul_ps(r.d[1], e2[0]));
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1[0], px), _mm256_mul_ps(e1[1], py)), _mm256_mul_ps(e1[2], pz));
+	__m256 abs_det = _mm256_and_ps(det, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+	__m256 reject = _mm256_cmp_ps(abs_det, _mm256_set1_ps(EPS_F), _CMP_LT_OQ);
+	__m256 inv_det = _mm256_div_ps(one, det);
+
+	__m256 tx = _mm256_sub_ps(r.o[0], p0[0]);
+	__m256 ty = _mm256_sub_ps(r.o[1], p0[1]);
+	__m256 tz = _mm256_sub_ps(r.o[2], p0[2]);
+	u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), inv_det);
+	reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(u, one, _CMP_GT_OQ)));
+
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1[2]), _mm256_mul_ps(tz, e1[1]));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1[0]), _mm256_mul_ps(tx, e1[2]));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1[1]), _mm256_mul_ps(ty, e1[0]));
+	v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r.d[0], qx), _mm256_mul_ps(r.d[1], qy)), _mm256_mul_ps(r.d[2], qz)), inv_det);
+	reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_GT_OQ)));
+
+	t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2[0], qx), _mm256_mul_ps(e2[1], qy)), _mm256_mul_ps(e2[2], qz)), inv_det);
+	reject = _mm256_or_ps(reject, _mm256_or_ps(_mm256_cmp_ps(t, r.lo, _CMP_LT_OQ), _mm256_cmp_ps(t, r.hi, _CMP_GT_OQ)));
+
+	return ~_mm256_movemask_ps(reject) & 0xff;
+}
+
+TARGET_AVX static bool closest_avx(const Tri_SoA& tris, const Ray& ray, uint32_t start, uint32_t end, Tri_Hit& hit) {
+	Ray8 r = splat8(ray);
+	bool found = false;
+	for (uint32_t i = start; i < end; i += 8) {
+		__m256 t, u, v;
+		int mask = test_avx(tris, i, r, t, u, v) & lanes_below(i, end, 8);
+		if (!mask) continue;
+		alignas(32) float ts[8], us[8], vs[8];
+		_mm256_store_ps(ts, t);
+		_mm256_store_ps(us, u);
+		_mm256_store_ps(vs, v);
+		for (uint32_t l = 0; l < 8; l++) {
+			if ((mask & (1 << l)) && ts[l] < hit.t) {
+				hit = Tri_Hit{i + l, ts[l], us[l], vs[l]};
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+TARGET_AVX static bool any_avx(const Tri_SoA& tris, const Ray& ray, uint32_t start, uint32_t end) {
+	Ray8 r = splat8(ray);
+	for (uint32_t i = start; i < end; i += 8) {
+		__m256 t, u, v;
+		if (test_avx(tris, i, r, t, u, v) & lanes_below(i, end, 8)) return true;
+	}
+	return false;
+}
+
+static bool cpu_has_avx() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+	return os_saves_ymm && (info[2] & (1 << 28));
+#else
+	return __builtin_cpu_supports("avx");
+#endif
+}
+
+#endif // TRI_KERNELS_X86
+
+// - - - - dispatch - - - -
+
+static Isa detect() {
+#if TRI_KERNELS_X86
+	return cpu_has_avx() ? Isa::avx : Isa::sse;
+#else
+	return Isa::scalar;
+#endif
+}
+
+static const Isa best = detect();
+//(use() may switch kernels while other threads trace; every kernel set gives the same results, so relaxed is enough)
+static std::atomic<Isa> active = best;
+
+bool closest(const Tri_SoA& tris, const Ray& ray, uint32_t start, uint32_t end, Tri_Hit& hit) {
+	switch (active.load(std::memory_order_relaxed)) {
+#if TRI_KERNELS_X86
+	case Isa::avx: return closest_avx(tris, ray, start, end, hit);
+	case Isa::sse: return closest_sse(tris, ray, start, end, hit);
+#endif
+	default: return closest_scalar(tris, ray, start, end, hit);
+	}
+}
+
+bool any(const Tri_SoA& tris, const Ray& ray, uint32_t start, uint32_t end) {
+	switch (active.load(std::memory_order_relaxed)) {
+#if TRI_KERNELS_X86
+	case Isa::avx: return any_avx(tris, ray, start, end);
+	case Isa::sse: return any_sse(tris, ray, start, end);
+#endif
+	default: return any_scalar(tris, ray, start, end);
+	}
+}
+
+Isa current() {
+	return active.load(std::memory_order_relaxed);
+}
+
+Isa supported() {
+	return best;
+}
+
+void use(Isa isa) {
+	active.store(std::min(isa, best), std::memory_order_relaxed);
+}
+
+const char* name(Isa isa) {
+	switch (isa) {
+	case Isa::avx: return "avx";
+	case Isa::sse: return "sse";
+	default: return "scalar";
+	}
+}
+
+} // namespace Tri_Kernels
+
+} // namespace PT
@@ -0,0 +1,58 @@
+
+#pragma once
+
+#include "../lib/mathlib.h"
+
+#include <limits>
+#include <vector>
+
+namespace PT {
+
+//Triangle positions stored structure-of-arrays, for testing one ray against several
+// triangles at once. Arrays are padded so a kernel may read a full vector past the end.
+struct Tri_SoA {
+	static constexpr uint32_t padding = 8;
+
+	void resize(size_t n);
+	void set(uint32_t i, Vec3 v0, Vec3 v1, Vec3 v2);
+	void clear();
+	size_t size() const;
+
+	std::vector<float> p0[3]; //first vertex
+	std::vector<float> e1[3]; //v1 - v0
+	std::vector<float> e2[3]; //v2 - v0
+
+private:
+	size_t n = 0;
+};
+
+//closest triangle hit found so far (index into the Tri_SoA plus hit parameters):
+struct Tri_Hit {
+	uint32_t index = 0;
+	float t = std::numeric_limits<float>::infinity();
+	float u = 0.0f, v = 0.0f;
+};
+
+namespace Tri_Kernels {
+
+enum class Isa : uint8_t { scalar, sse, avx };
+
+//Test ray against triangles [start,end) of tris. Hits must lie within ray.dist_bounds and
+// be strictly closer than hit.t; returns true (and updates hit) if one was found.
+// (Uses exactly the same arithmetic as Triangle::hit, so results match it bit-for-bit.)
+bool closest(const Tri_SoA& tris, const Ray& ray, uint32_t start, uint32_t end, Tri_Hit& hit);
+
+//true if any of triangles [start,end) of tris is hit within ray.dist_bounds:
+bool any(const Tri_SoA& tris, const Ray& ray, uint32_t start, uint32_t end);
+
+//the kernel set in use (the widest one this CPU supports, unless overridden by use()):
+Isa current();
+//widest kernel set this CPU supports:
+Isa supported();
+//switch kernel sets (clamped to supported(); mostly useful for testing; safe while other threads trace):
+void use(Isa isa);
+const char* name(Isa isa);
+
+} // namespace Tri_Kernels
+
+} // namespace PT
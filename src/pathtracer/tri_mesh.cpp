@@ -97,6 +97,44 @@ Trace Triangle::hit(const Ray& ray) const {
     return ret;
 }
 
+Trace Triangle::shade(const Ray& ray, float t, float u, float v) const {
+	const Tri_Mesh_Vert& v_0 = vertex_list[v0];
+	const Tri_Mesh_Vert& v_1 = vertex_list[v1];
+	const Tri_Mesh_Vert& v_2 = vertex_list[v2];
+
+	Trace ret;
+	ret.origin = ray.point;
+	ret.hit = true;
+	ret.distance = t;
+	ret.position = ray.point + t * ray.dir;
+	ret.normal = u * v_1.normal + v * v_2.normal + (1 - u - v) * v_0.normal;
+	ret.uv = u * v_1.uv + v * v_2.uv + (1 - u - v) * v_0.uv;
+	return ret;
+}
+
+bool Triangle::occluded(const Ray& ray) const {
+	// Same test as hit(), but only positions are read and nothing is interpolated.
+	const Vec3& p0 = vertex_list[v0].position;
+	Vec3 v0v1 = vertex_list[v1].position - p0;
+	Vec3 v0v2 = vertex_list[v2].position - p0;
+
+	Vec3 pvec = cross(ray.dir, v0v2);
+	float det = dot(v0v1, pvec);
+	if (std::abs(det) < EPS_F) return false;
+	float invDet = 1.0f / det;
+
+	Vec3 tvec = ray.point - p0;
+	float u = dot(tvec, pvec) * invDet;
+	if (u < 0.0f || u > 1.0f) return false;
+
+	Vec3 qvec = cross(tvec, v0v1);
+	float v = dot(ray.dir, qvec) * invDet;
+	if (v < 0.0f || u + v > 1.0f) return false;
+
+	float t = dot(v0v2, qvec) * invDet;
+	return t >= ray.dist_bounds.x && t <= ray.dist_bounds.y;
+}
+
 Triangle::Triangle(Tri_Mesh_Vert* verts, uint32_t v0, uint32_t v1, uint32_t v2)
 	: v0(v0), v1(v1), v2(v2), vertex_list(verts) {
 }
@@ -144,7 +182,8 @@ bool Triangle::operator==(const Triangle& rhs) const {
 	return true;
 }
 
-Tri_Mesh::Tri_Mesh(const Indexed_Mesh& mesh, bool use_bvh_) : use_bvh(use_bvh_) {
+Tri_Mesh::Tri_Mesh(const Indexed_Mesh& mesh, bool use_bvh_, Thread_Pool* thread_pool)
+	: use_bvh(use_bvh_) {
 	for (const auto& v : mesh.vertices()) {
 		verts.push_back({v.pos, v.norm, v.uv});
 	}
@@ -157,7 +196,9 @@ Tri_Mesh::Tri_Mesh(const Indexed_Mesh& mesh, bool use_bvh_) : use_bvh(use_bvh_)
 	}
 
 	if (use_bvh) {
-		triangle_bvh.build(std::move(tris), 4);
+		//(leaves of up to 8 triangles: one AVX kernel pass, or two SSE passes; traversed as an 8-wide tree)
+		triangle_bvh.build(std::move(tris), 8, BVH<Triangle>::default_buckets, thread_pool, 8);
+		build_soa();
 	} else {
 		triangle_list = List<Triangle>(std::move(tris));
 	}
@@ -168,6 +209,7 @@ Tri_Mesh Tri_Mesh::copy() const {
 	ret.verts = verts;
 	ret.triangle_bvh = triangle_bvh.copy();
 	ret.triangle_list = triangle_list.copy();
+	ret.triangle_soa = triangle_soa;
 	ret.use_bvh = use_bvh;
 	return ret;
 }
@@ -177,9 +219,62 @@ BBox Tri_Mesh::bbox() const {
 	return triangle_list.bbox();
 }
 
+void Tri_Mesh::build_soa() {
+	const std::vector<Triangle>& tris = triangle_bvh.primitives;
+	triangle_soa.resize(tris.size());
+	for (uint32_t i = 0; i < tris.size(); i++) {
+		const Triangle& tri = tris[i];
+		triangle_soa.set(i, verts[tri.v0].position, verts[tri.v1].position, verts[tri.v2].position);
+	}
+}
+
 Trace Tri_Mesh::hit(const Ray& ray) const {
-	if (use_bvh) return triangle_bvh.hit(ray);
-	return triangle_list.hit(ray);
+	if (!use_bvh) {
+		if constexpr (COLLECT_RAY_STATS) Ray_Stats::local.triangle_tests += triangle_list.n_primitives();
+		return triangle_list.hit(ray);
+	}
+
+	// Leaves are tested several triangles at a time, and only the closest triangle is shaded:
+	Ray r = ray;
+	Tri_Hit best;
+	bool found = false;
+	uint32_t tests = 0; //(added to this thread's stats once, after the traversal)
+	triangle_bvh.traverse(r, [&](uint32_t start, uint32_t end) {
+		tests += end - start;
+		if (Tri_Kernels::closest(triangle_soa, r, start, end, best)) {
+			found = true;
+			r.dist_bounds.y = best.t;
+		}
+		return false;
+	});
+	if constexpr (COLLECT_RAY_STATS) Ray_Stats::local.triangle_tests += tests;
+
+	if (!found) {
+		Trace ret;
+		ret.origin = ray.point;
+		ret.distance = FLT_MAX;
+		return ret;
+	}
+	return triangle_bvh.primitives[best.index].shade(ray, best.t, best.u, best.v);
+}
+
+bool Tri_Mesh::occluded(const Ray& ray) const {
+	if (!use_bvh) {
+		//(counts every triangle, though the list stops at the first that occludes)
+		if constexpr (COLLECT_RAY_STATS) Ray_Stats::local.triangle_tests += triangle_list.n_primitives();
+		return triangle_list.occluded(ray);
+	}
+
+	Ray r = ray;
+	bool blocked = false;
+	uint32_t tests = 0;
+	triangle_bvh.traverse(r, [&](uint32_t start, uint32_t end) {
+		tests += end - start;
+		blocked = Tri_Kernels::any(triangle_soa, r, start, end);
+		return blocked;
+	});
+	if constexpr (COLLECT_RAY_STATS) Ray_Stats::local.triangle_tests += tests;
+	return blocked;
 }
 
 size_t Tri_Mesh::n_triangles() const {
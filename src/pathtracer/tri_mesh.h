@@ -7,6 +7,7 @@
 #include "bvh.h"
 #include "list.h"
 #include "trace.h"
+#include "tri_kernels.h"
 
 namespace PT {
 
@@ -20,6 +21,7 @@ class Triangle {
 public:
 	BBox bbox() const;
 	Trace hit(const Ray& ray) const;
+	bool occluded(const Ray& ray) const;
 
 	uint32_t visualize(GL::Lines&, GL::Lines&, uint32_t, const Mat4&) const {
 		return 0u;
@@ -31,12 +33,17 @@ public:
 
 	Triangle(Tri_Mesh_Vert* verts, uint32_t v0, uint32_t v1, uint32_t v2);
 
+	//fill in the Trace for a hit already found at distance t and barycentrics (u,v):
+	Trace shade(const Ray& ray, float t, float u, float v) const;
+
 	bool operator==(const Triangle& rhs) const;
 
 private:
 	uint32_t v0, v1, v2;
 	Tri_Mesh_Vert* vertex_list;
 	friend class Tri_Mesh;
+	friend class Mesh_Cache;
+	friend class Light_Sampler;
 };
 
 static_assert(std::is_copy_assignable_v<Triangle>);
@@ -45,7 +52,7 @@ class Tri_Mesh {
 public:
 	Tri_Mesh() = default;
 	// You can only build Tri_Mesh from an Indexed_Mesh:
-	Tri_Mesh(const Indexed_Mesh& mesh, bool use_bvh);
+	Tri_Mesh(const Indexed_Mesh& mesh, bool use_bvh, Thread_Pool* thread_pool = nullptr);
 
 	Tri_Mesh(Tri_Mesh&& src) = default;
 	Tri_Mesh& operator=(Tri_Mesh&& src) = default;
@@ -56,6 +63,7 @@ public:
 
 	BBox bbox() const;
 	Trace hit(const Ray& ray) const;
+	bool occluded(const Ray& ray) const;
 
 	uint32_t visualize(GL::Lines& lines, GL::Lines& active, uint32_t level,
 	                   const Mat4& trans) const;
@@ -71,6 +79,13 @@ private:
 	std::vector<Tri_Mesh_Vert> verts;
 	BVH<Triangle> triangle_bvh;
 	List<Triangle> triangle_list;
+
+	//positions of triangle_bvh's primitives (in the same order), for the SIMD kernels:
+	Tri_SoA triangle_soa;
+	void build_soa();
+
+	friend class Mesh_Cache; //saves and loads meshes' BVHs
+	friend class Light_Sampler; //samples emissive meshes by triangle area
 };
 
 } // namespace PT
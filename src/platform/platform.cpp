@@ -13,12 +13,17 @@
 #ifdef _WIN32
 #include <ConsoleApi.h>
 #include <ShellScalingApi.h>
+#include <fcntl.h>
+#include <io.h>
+#include <mutex>
+#include <unordered_map>
 extern "C" {
 __declspec(dllexport) bool NvOptimusEnablement = true;
 __declspec(dllexport) bool AmdPowerXpressRequestHighPerformance = true;
 }
 #else
 #include <sys/ioctl.h>
+#include <sys/wait.h>
 #endif
 
 void Platform::init_console() {
@@ -214,6 +219,114 @@ void Platform::strcpy(char* dst, const char* src, size_t limit) {
 #endif
 }
 
+#ifdef _WIN32
+//quote arg so that CommandLineToArgvW (and so the child's C runtime) reads it back as it is:
+// backslashes are literal, except that 2n of them before a quote stand for n (and 2n+1 for n and a literal quote)
+static std::string quote_argument(std::string const& arg) {
+	std::string quoted = "\"";
+	size_t backslashes = 0;
+	for (char c : arg) {
+		if (c == '\\') {
+			backslashes++;
+			continue;
+		}
+		if (c == '"') quoted.append(2 * backslashes + 1, '\\');
+		else quoted.append(backslashes, '\\');
+		backslashes = 0;
+		quoted += c;
+	}
+	quoted.append(2 * backslashes, '\\'); //(before the closing quote)
+	quoted += '"';
+	return quoted;
+}
+
+//process handles of open children, for close_child:
+static std::mutex children_mut;
+static std::unordered_map<FILE*, HANDLE> children;
+#endif
+
+FILE* Platform::open_child(std::vector<std::string> const& args) {
+#ifdef _WIN32
+	//(started directly rather than through cmd.exe, whose quoting rules differ from the child's)
+	std::string command;
+	for (std::string const& arg : args) {
+		if (!command.empty()) command += ' ';
+		command += quote_argument(arg);
+	}
+
+	SECURITY_ATTRIBUTES security = {sizeof(security), nullptr, TRUE};
+	HANDLE read_end, write_end;
+	if (!CreatePipe(&read_end, &write_end, &security, 0)) return nullptr;
+	SetHandleInformation(read_end, HANDLE_FLAG_INHERIT, 0); //(only the write end goes to the child)
+
+	STARTUPINFOA startup = {};
+	startup.cb = sizeof(startup);
+	startup.dwFlags = STARTF_USESTDHANDLES;
+	startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+	startup.hStdOutput = write_end;
+	startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+	PROCESS_INFORMATION process = {};
+	std::vector<char> line(command.begin(), command.end());
+	line.push_back('\0');
+	BOOL started = CreateProcessA(nullptr, line.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &process);
+	CloseHandle(write_end);
+	if (!started) {
+		CloseHandle(read_end);
+		return nullptr;
+	}
+	CloseHandle(process.hThread);
+
+	int fd = _open_osfhandle(reinterpret_cast<intptr_t>(read_end), _O_RDONLY);
+	FILE* child = fd == -1 ? nullptr : _fdopen(fd, "r");
+	if (!child) {
+		if (fd == -1) CloseHandle(read_end);
+		else _close(fd);
+		WaitForSingleObject(process.hProcess, INFINITE);
+		CloseHandle(process.hProcess);
+		return nullptr;
+	}
+	std::lock_guard<std::mutex> lock(children_mut);
+	children.emplace(child, process.hProcess);
+	return child;
+#else
+	//(through the shell, so each argument is quoted)
+	std::string command;
+	for (std::string const& arg : args) {
+		if (!command.empty()) command += ' ';
+		command += '\'';
+		for (char c : arg) {
+			if (c == '\'') command += "'\\''";
+			else command += c;
+		}
+		command += '\'';
+	}
+	return popen(command.c_str(), "r");
+#endif
+}
+
+int Platform::close_child(FILE* child) {
+#ifdef _WIN32
+	HANDLE process;
+	{
+		std::lock_guard<std::mutex> lock(children_mut);
+		auto found = children.find(child);
+		if (found == children.end()) return -1;
+		process = found->second;
+		children.erase(found);
+	}
+	std::fclose(child);
+	WaitForSingleObject(process, INFINITE);
+	DWORD code;
+	bool exited = GetExitCodeProcess(process, &code);
+	CloseHandle(process);
+	return exited ? int(code) : -1;
+#else
+	int status = pclose(child);
+	if (status == -1 || !WIFEXITED(status)) return -1;
+	return WEXITSTATUS(status);
+#endif
+}
+
 void Platform::loop(App& app) {
 
 	bool running = true;
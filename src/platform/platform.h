@@ -3,6 +3,10 @@
 
 #include <SDL.h>
 
+#include <cstdio>
+#include <string>
+#include <vector>
+
 #include "../app.h"
 #include "../lib/mathlib.h"
 
@@ -30,6 +34,12 @@ public:
 	static uint32_t console_width();
 	static void strcpy(char* dest, const char* src, size_t limit);
 
+	//Run program args[0] with arguments args[1..] as a child process whose standard output is
+	// read through the returned stream (nullptr if it couldn't be started):
+	static FILE* open_child(std::vector<std::string> const& args);
+	//wait for a child from open_child to exit; returns its exit code (-1 if it didn't exit normally):
+	static int close_child(FILE* child);
+
 
 	inline static float force_dpi = std::numeric_limits< float >::quiet_NaN();
 
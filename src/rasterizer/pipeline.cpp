@@ -6,8 +6,16 @@
 #include "../lib/log.h"
 #include "../lib/mathlib.h"
 
+#include <cmath>
 #include <iostream>
 
+#if defined(__x86_64__) || defined(_M_X64)
+#define PIPELINE_SSE2 1
+#include <emmintrin.h>
+#else
+#define PIPELINE_SSE2 0
+#endif
+
 template <PrimitiveType primitive_type, class Program, uint32_t flags>
 void Pipeline<primitive_type, Program, flags>::run(
     std::vector<Vertex> const &vertices,
@@ -18,40 +26,59 @@ void Pipeline<primitive_type, Program, flags>::run(
   assert(framebuffer_);
   auto &framebuffer = *framebuffer_;
 
-  // A1T7: sample loop
-  // TODO: update this function to rasterize to *all* sample locations in the framebuffer.
-  //  This will probably involve inserting a loop of the form:
-  //      std::vector< Vec3 > const &samples = framebuffer.sample_pattern.centers_and_weights;
-  //      for (uint32_t s = 0; s < samples.size(); ++s) { ... }
-  //   around some subset of the code.
-  //  You will also need to transform the input and output of the rasterize_* functions to
-  //    account for the fact they deal with pixels centered at (0.5,0.5).
+  std::vector<ClippedVertex> clipped_vertices;
+  shade_and_clip(vertices, 0, vertices.size(), parameters, framebuffer, &clipped_vertices);
+
+  uint32_t out_of_range = rasterize(clipped_vertices, parameters, &framebuffer);
+  if (out_of_range > 0)
+  {
+    if constexpr (primitive_type == PrimitiveType::Lines)
+    {
+      warn("Produced %d fragments outside framebuffer; this indicates something is likely wrong with the clip_line function.", out_of_range);
+    }
+    else if constexpr (primitive_type == PrimitiveType::Triangles)
+    {
+      warn("Produced %d fragments outside framebuffer; this indicates something is likely wrong with the clip_triangle function.", out_of_range);
+    }
+  }
+}
+
+template <PrimitiveType primitive_type, class Program, uint32_t flags>
+void Pipeline<primitive_type, Program, flags>::shade_and_clip(
+    std::vector<Vertex> const &vertices, size_t begin, size_t end,
+    typename Program::Parameters const &parameters,
+    Framebuffer const &framebuffer,
+    std::vector<ClippedVertex> *clipped_vertices_)
+{
+  assert(clipped_vertices_);
+  assert(begin <= end && end <= vertices.size());
+  auto &clipped_vertices = *clipped_vertices_;
+
   std::vector<ShadedVertex> shaded_vertices;
-  shaded_vertices.reserve(vertices.size());
+  shaded_vertices.reserve(end - begin);
 
   //--------------------------
   // shade vertices:
-  for (auto const &v : vertices)
+  for (size_t i = begin; i < end; ++i)
   {
     ShadedVertex sv;
-    Program::shade_vertex(parameters, v.attributes, &sv.clip_position, &sv.attributes);
+    Program::shade_vertex(parameters, vertices[i].attributes, &sv.clip_position, &sv.attributes);
     shaded_vertices.emplace_back(sv);
   }
 
   //--------------------------
   // assemble + clip + homogeneous divide vertices:
-  std::vector<ClippedVertex> clipped_vertices;
 
   // reserve some space to avoid reallocations later:
   if constexpr (primitive_type == PrimitiveType::Lines)
   {
     // clipping lines can never produce more than one vertex per input vertex:
-    clipped_vertices.reserve(shaded_vertices.size());
+    clipped_vertices.reserve(clipped_vertices.size() + shaded_vertices.size());
   }
   else if constexpr (primitive_type == PrimitiveType::Triangles)
   {
     // clipping triangles can produce up to 8 vertices per input vertex:
-    clipped_vertices.reserve(shaded_vertices.size() * 8);
+    clipped_vertices.reserve(clipped_vertices.size() + shaded_vertices.size() * 8);
   }
 
   // coefficients to map from clip coordinates to framebuffer (i.e., "viewport") coordinates:
@@ -97,26 +124,172 @@ void Pipeline<primitive_type, Program, flags>::run(
   {
     static_assert(primitive_type == PrimitiveType::Lines, "Unsupported primitive type.");
   }
+}
 
-  //--------------------------
-  // rasterize primitives:
+template <PrimitiveType primitive_type, class Program, uint32_t flags>
+uint32_t Pipeline<primitive_type, Program, flags>::rasterize(
+    std::vector<ClippedVertex> &clipped_vertices,
+    typename Program::Parameters const &parameters,
+    Framebuffer *framebuffer_,
+    PixelRect const *tile,
+    CoarseDepth *coarse_depth)
+{
+  assert(framebuffer_);
+  auto &framebuffer = *framebuffer_;
+
+  uint32_t out_of_range = 0; // check if rasterization produced fragments outside framebuffer (indicates something is wrong with clipping)
 
   std::vector<Vec3> const &samples = framebuffer.sample_pattern.centers_and_weights;
+
+  // coverage-mask multisampling rasterizes and shades triangles once per pixel:
+  if constexpr (primitive_type == PrimitiveType::Triangles && (flags & PipelineMask_Sample) == Pipeline_Sample_Coverage)
+  {
+    if (samples.size() <= MaxCoverageSamples)
+    {
+      rasterize_coverage(clipped_vertices, parameters, framebuffer, tile ? *tile : PixelRect{0, 0, int32_t(framebuffer.width), int32_t(framebuffer.height)}, coarse_depth);
+      return out_of_range; // (coverage fragments never leave the framebuffer)
+    }
+  }
+
+  // fragments wait here (with the pixel they are for) until a batch is full, then go on to be depth tested, shaded, and blended:
+  struct BatchedFragment
+  {
+    Fragment fragment;
+    int32_t x, y;
+  };
+  std::array<BatchedFragment, FragmentBatch> batch;
+  uint32_t batched = 0;
+
   for (uint32_t s = 0; s < samples.size(); ++s)
   {
-    std::vector<Fragment> fragments;
-    float xShift, yShift;
+    //--------------------------
+    // depth test + shade + blend fragments:
+    auto process_batch = [&]()
+    {
+      for (uint32_t b = 0; b < batched; ++b)
+      {
+        Fragment const &f = batch[b].fragment;
+        int32_t x = batch[b].x;
+        int32_t y = batch[b].y;
+
+        // fragments of other tiles are theirs to draw:
+        if (tile && !tile->contains(x, y))
+        {
+          continue;
+        }
+
+        // if clipping is working properly, this condition shouldn't be needed;
+        // however, it prevents crashes while you are working on your clipping functions,
+        // so we suggest leaving it in place:
+        if (x < 0 || (uint32_t)x >= framebuffer.width || y < 0 || (uint32_t)y >= framebuffer.height)
+        {
+          ++out_of_range;
+          continue;
+        }
+
+        // local names that refer to destination sample in framebuffer:
+        float &fb_depth = framebuffer.depth_at(x, y, s);
+        Spectrum &fb_color = framebuffer.color_at(x, y, s);
+
+        // depth test:
+        if constexpr ((flags & PipelineMask_Depth) == Pipeline_Depth_Always)
+        {
+          //"Always" means the depth test always passes.
+        }
+        else if constexpr ((flags & PipelineMask_Depth) == Pipeline_Depth_Never)
+        {
+          //"Never" means the depth test never passes.
+          continue; // discard this fragment
+        }
+        else if constexpr ((flags & PipelineMask_Depth) == Pipeline_Depth_Less)
+        {
+          //"Less" means the depth test passes when the new fragment has depth less than the stored depth.
+          // A1T4: Depth_Less
+          // TODO: implement depth test! We want to only emit fragments that have a depth less than the stored depth, hence "Depth_Less"
+          // (the early test during rasterization may have passed fragments in this batch that earlier ones now hide)
+          if (f.fb_position.z >= fb_depth)
+            continue;
+        }
+        else
+        {
+          static_assert((flags & PipelineMask_Depth) <= Pipeline_Depth_Always, "Unknown depth test flag.");
+        }
+
+        // if depth test passes, and depth writes aren't disabled, write depth to depth buffer:
+        if constexpr (!(flags & Pipeline_DepthWriteDisableBit))
+        {
+          fb_depth = f.fb_position.z;
+          // (depths written without Depth_Less may be farther than what was there)
+          if constexpr ((flags & PipelineMask_Depth) != Pipeline_Depth_Less)
+          {
+            if (coarse_depth && coarse_depth->rect.contains(x, y))
+            {
+              float &bound = coarse_depth->at(x, y, s);
+              bound = std::max(bound, fb_depth);
+            }
+          }
+        }
+
+        // shade fragment:
+        ShadedFragment sf;
+        sf.fb_position = f.fb_position;
+        Program::shade_fragment(parameters, f.attributes, f.derivatives, &sf.color, &sf.opacity);
+
+        // write color to framebuffer if color writes aren't disabled:
+        if constexpr (!(flags & Pipeline_ColorWriteDisableBit))
+        {
+
+          // blend fragment:
+          if constexpr ((flags & PipelineMask_Blend) == Pipeline_Blend_Replace)
+          {
+            fb_color = sf.color;
+          }
+          else if constexpr ((flags & PipelineMask_Blend) == Pipeline_Blend_Add)
+          {
+            // A1T4: Blend_Add
+            // TODO: framebuffer color should have fragment color multiplied by fragment opacity added to it.
+            fb_color += sf.opacity * sf.color; //<-- replace this line
+          }
+          else if constexpr ((flags & PipelineMask_Blend) == Pipeline_Blend_Over)
+          {
+            // A1T4: Blend_Over
+            // TODO: set framebuffer color to the result of "over" blending (also called "alpha blending") the fragment color over the framebuffer color, using the fragment's opacity
+            //  		You may assume that the framebuffer color has its alpha premultiplied already, and you just want to compute the resulting composite color
+            fb_color = sf.opacity * sf.color + (1 - sf.opacity) * fb_color; //<-- replace this line
+          }
+          else
+          {
+            static_assert((flags & PipelineMask_Blend) <= Pipeline_Blend_Over, "Unknown blending flag.");
+          }
+        }
+      }
+      batched = 0;
+    };
 
-    // helper used to put output of rasterization functions into fragments:
+    //--------------------------
+    // rasterize primitives:
+
+    float xShift = samples[s].x - 0.5f;
+    float yShift = samples[s].y - 0.5f;
+
+    // helper used to put output of rasterization functions into the batch
+    // (rasterization emits pixel centers, which are moved back to the sample's location):
     auto emit_fragment = [&](Fragment const &f)
     {
-      Fragment newF = f;
-      newF.fb_position.x += xShift;
-      newF.fb_position.y += yShift;
-      fragments.emplace_back(newF);
+      BatchedFragment &bf = batch[batched];
+      bf.x = (int32_t)std::floor(f.fb_position.x);
+      bf.y = (int32_t)std::floor(f.fb_position.y);
+      bf.fragment = f;
+      bf.fragment.fb_position.x += xShift;
+      bf.fragment.fb_position.y += yShift;
+      if (++batched == FragmentBatch)
+        process_batch();
     };
-    xShift = samples[s].x - 0.5f;
-    yShift = samples[s].y - 0.5f;
+
+    // triangles skip fragments that would fail Depth_Less before interpolating their attributes:
+    EarlyDepth early_depth{&framebuffer, s, coarse_depth};
+    EarlyDepth const *early = ((flags & PipelineMask_Depth) == Pipeline_Depth_Less ? &early_depth : nullptr);
+
     // actually do rasterization:
     if constexpr (primitive_type == PrimitiveType::Lines)
     {
@@ -143,7 +316,7 @@ void Pipeline<primitive_type, Program, flags>::run(
         clipped_vertices[i + 1].fb_position.y -= yShift;
         clipped_vertices[i + 2].fb_position.x -= xShift;
         clipped_vertices[i + 2].fb_position.y -= yShift;
-        rasterize_triangle(clipped_vertices[i], clipped_vertices[i + 1], clipped_vertices[i + 2], emit_fragment);
+        rasterize_triangle(clipped_vertices[i], clipped_vertices[i + 1], clipped_vertices[i + 2], emit_fragment, tile, early);
         clipped_vertices[i].fb_position.x += xShift;
         clipped_vertices[i].fb_position.y += yShift;
         clipped_vertices[i + 1].fb_position.x += xShift;
@@ -157,103 +330,164 @@ void Pipeline<primitive_type, Program, flags>::run(
       static_assert(primitive_type == PrimitiveType::Lines, "Unsupported primitive type.");
     }
 
-    //--------------------------
-    // depth test + shade + blend fragments:
-    uint32_t out_of_range = 0; // check if rasterization produced fragments outside framebuffer (indicates something is wrong with clipping)
-    for (auto const &f : fragments)
-    {
+    process_batch();
+  }
 
-      // fragment location (in pixels):
-      int32_t x = (int32_t)std::floor(f.fb_position.x);
-      int32_t y = (int32_t)std::floor(f.fb_position.y);
+  return out_of_range;
+}
 
-      // if clipping is working properly, this condition shouldn't be needed;
-      // however, it prevents crashes while you are working on your clipping functions,
-      // so we suggest leaving it in place:
-      if (x < 0 || (uint32_t)x >= framebuffer.width || y < 0 || (uint32_t)y >= framebuffer.height)
-      {
-        ++out_of_range;
-        continue;
-      }
+template <PrimitiveType primitive_type, class Program, uint32_t flags>
+void Pipeline<primitive_type, Program, flags>::rasterize_coverage(
+    std::vector<ClippedVertex> const &clipped_vertices,
+    typename Program::Parameters const &parameters,
+    Framebuffer &framebuffer,
+    PixelRect const &rect,
+    CoarseDepth *coarse_depth)
+{
+  std::vector<Vec3> const &samples = framebuffer.sample_pattern.centers_and_weights;
 
-      // local names that refer to destination sample in framebuffer:
-      float &fb_depth = framebuffer.depth_at(x, y, s);
-      Spectrum &fb_color = framebuffer.color_at(x, y, s);
+  //--------------------------
+  // depth test covered samples, then shade once and blend into those that passed
+  // (the same tests and blending as the per-sample path), a batch of fragments at a time:
+  std::array<CoverageFragment, FragmentBatch> batch;
+  uint32_t batched = 0;
+  auto process_batch = [&]()
+  {
+    for (uint32_t b = 0; b < batched; ++b)
+    {
+      CoverageFragment const &cf = batch[b];
+      Fragment const &f = cf.fragment;
+      uint32_t x = (uint32_t)std::floor(f.fb_position.x);
+      uint32_t y = (uint32_t)std::floor(f.fb_position.y);
 
-      // depth test:
-      if constexpr ((flags & PipelineMask_Depth) == Pipeline_Depth_Always)
+      uint64_t passed = 0;
+      for (uint32_t s = 0; s < samples.size(); ++s)
       {
-        //"Always" means the depth test always passes.
-      }
-      else if constexpr ((flags & PipelineMask_Depth) == Pipeline_Depth_Never)
-      {
-        //"Never" means the depth test never passes.
-        continue; // discard this fragment
-      }
-      else if constexpr ((flags & PipelineMask_Depth) == Pipeline_Depth_Less)
-      {
-        //"Less" means the depth test passes when the new fragment has depth less than the stored depth.
-        // A1T4: Depth_Less
-        // TODO: implement depth test! We want to only emit fragments that have a depth less than the stored depth, hence "Depth_Less"
-        if (f.fb_position.z >= fb_depth)
+        if (!(cf.coverage & (uint64_t(1) << s)))
           continue;
-      }
-      else
-      {
-        static_assert((flags & PipelineMask_Depth) <= Pipeline_Depth_Always, "Unknown depth test flag.");
-      }
+        float z = f.fb_position.z + cf.depth_slope.x * (samples[s].x - 0.5f) + cf.depth_slope.y * (samples[s].y - 0.5f);
+        float &fb_depth = framebuffer.depth_at(x, y, s);
 
-      // if depth test passes, and depth writes aren't disabled, write depth to depth buffer:
-      if constexpr (!(flags & Pipeline_DepthWriteDisableBit))
-      {
-        fb_depth = f.fb_position.z;
+        if constexpr ((flags & PipelineMask_Depth) == Pipeline_Depth_Always)
+        {
+        }
+        else if constexpr ((flags & PipelineMask_Depth) == Pipeline_Depth_Never)
+        {
+          continue;
+        }
+        else if constexpr ((flags & PipelineMask_Depth) == Pipeline_Depth_Less)
+        {
+          if (z >= fb_depth)
+            continue;
+        }
+        else
+        {
+          static_assert((flags & PipelineMask_Depth) <= Pipeline_Depth_Always, "Unknown depth test flag.");
+        }
+
+        if constexpr (!(flags & Pipeline_DepthWriteDisableBit))
+        {
+          fb_depth = z;
+          if constexpr ((flags & PipelineMask_Depth) != Pipeline_Depth_Less)
+          {
+            if (coarse_depth && coarse_depth->rect.contains(x, y))
+            {
+              float &bound = coarse_depth->at(x, y, s);
+              bound = std::max(bound, fb_depth);
+            }
+          }
+        }
+        passed |= uint64_t(1) << s;
       }
+      if (!passed)
+        continue;
 
-      // shade fragment:
       ShadedFragment sf;
       sf.fb_position = f.fb_position;
       Program::shade_fragment(parameters, f.attributes, f.derivatives, &sf.color, &sf.opacity);
 
-      // write color to framebuffer if color writes aren't disabled:
       if constexpr (!(flags & Pipeline_ColorWriteDisableBit))
       {
-
-        // blend fragment:
-        if constexpr ((flags & PipelineMask_Blend) == Pipeline_Blend_Replace)
-        {
-          fb_color = sf.color;
-        }
-        else if constexpr ((flags & PipelineMask_Blend) == Pipeline_Blend_Add)
-        {
-          // A1T4: Blend_Add
-          // TODO: framebuffer color should have fragment color multiplied by fragment opacity added to it.
-          fb_color += sf.opacity * sf.color; //<-- replace this line
-        }
-        else if constexpr ((flags & PipelineMask_Blend) == Pipeline_Blend_Over)
+        for (uint32_t s = 0; s < samples.size(); ++s)
         {
-          // A1T4: Blend_Over
-          // TODO: set framebuffer color to the result of "over" blending (also called "alpha blending") the fragment color over the framebuffer color, using the fragment's opacity
-          //  		You may assume that the framebuffer color has its alpha premultiplied already, and you just want to compute the resulting composite color
-          fb_color = sf.opacity * sf.color + (1 - sf.opacity) * fb_color; //<-- replace this line
-        }
-        else
-        {
-          static_assert((flags & PipelineMask_Blend) <= Pipeline_Blend_Over, "Unknown blending flag.");
+          if (!(passed & (uint64_t(1) << s)))
+            continue;
+          Spectrum &fb_color = framebuffer.color_at(x, y, s);
+          if constexpr ((flags & PipelineMask_Blend) == Pipeline_Blend_Replace)
+          {
+            fb_color = sf.color;
+          }
+          else if constexpr ((flags & PipelineMask_Blend) == Pipeline_Blend_Add)
+          {
+            fb_color += sf.opacity * sf.color;
+          }
+          else if constexpr ((flags & PipelineMask_Blend) == Pipeline_Blend_Over)
+          {
+            fb_color = sf.opacity * sf.color + (1 - sf.opacity) * fb_color;
+          }
+          else
+          {
+            static_assert((flags & PipelineMask_Blend) <= Pipeline_Blend_Over, "Unknown blending flag.");
+          }
         }
       }
     }
-    if (out_of_range > 0)
+    batched = 0;
+  };
+
+  //--------------------------
+  // rasterize triangles (once each, for all samples):
+  auto emit_fragment = [&](CoverageFragment const &f)
+  {
+    batch[batched] = f;
+    if (++batched == FragmentBatch)
+      process_batch();
+  };
+  for (uint32_t i = 0; i + 2 < clipped_vertices.size(); i += 3)
+  {
+    rasterize_triangle_coverage(clipped_vertices[i], clipped_vertices[i + 1], clipped_vertices[i + 2], samples, emit_fragment, rect);
+  }
+  process_batch();
+}
+
+template <PrimitiveType primitive_type, class Program, uint32_t flags>
+PixelRect Pipeline<primitive_type, Program, flags>::bounds(
+    ClippedVertex const *primitive,
+    Framebuffer const &framebuffer)
+{
+  float min_x = primitive[0].fb_position.x;
+  float min_y = primitive[0].fb_position.y;
+  float max_x = min_x;
+  float max_y = min_y;
+  for (uint32_t i = 1; i < PrimitiveVertices; ++i)
+  {
+    min_x = std::min(min_x, primitive[i].fb_position.x);
+    min_y = std::min(min_y, primitive[i].fb_position.y);
+    max_x = std::max(max_x, primitive[i].fb_position.x);
+    max_y = std::max(max_y, primitive[i].fb_position.y);
+  }
+
+  PixelRect all{0, 0, int32_t(framebuffer.width), int32_t(framebuffer.height)};
+  for (uint32_t i = 0; i < PrimitiveVertices; ++i)
+  {
+    // (rasterizing non-finite positions can go anywhere; leave that to the scissor)
+    if (!std::isfinite(primitive[i].fb_position.x) || !std::isfinite(primitive[i].fb_position.y))
     {
-      if constexpr (primitive_type == PrimitiveType::Lines)
-      {
-        warn("Produced %d fragments outside framebuffer; this indicates something is likely wrong with the clip_line function.", out_of_range);
-      }
-      else if constexpr (primitive_type == PrimitiveType::Triangles)
-      {
-        warn("Produced %d fragments outside framebuffer; this indicates something is likely wrong with the clip_triangle function.", out_of_range);
-      }
+      return all;
     }
   }
+
+  // fragments land within a pixel of the primitive's bounding box (sample offsets are at most
+  // half a pixel), plus another pixel for rounding in the sample offsets themselves:
+  auto clamp_to = [](float v, int32_t end)
+  {
+    return int32_t(std::clamp(v, 0.0f, float(end)));
+  };
+  return PixelRect{
+      clamp_to(std::floor(min_x) - 2.0f, all.x_end),
+      clamp_to(std::floor(min_y) - 2.0f, all.y_end),
+      clamp_to(std::floor(max_x) + 3.0f, all.x_end),
+      clamp_to(std::floor(max_y) + 3.0f, all.y_end)};
 }
 
 //-------------------------------------------------------------------------
@@ -285,9 +519,10 @@ auto Pipeline<p, P, F>::lerp(ShadedVertex const &a, ShadedVertex const &b, float
  *
  */
 template <PrimitiveType p, class P, uint32_t flags>
+template <typename EmitVertex>
 void Pipeline<p, P, flags>::clip_line(
     ShadedVertex const &va, ShadedVertex const &vb,
-    std::function<void(ShadedVertex const &)> const &emit_vertex)
+    EmitVertex &&emit_vertex)
 {
   // Determine portion of line over which:
   //  pt = (b-a) * t + a
@@ -390,9 +625,10 @@ void Pipeline<p, P, flags>::clip_line(
  *
  */
 template <PrimitiveType p, class P, uint32_t flags>
+template <typename EmitVertex>
 void Pipeline<p, P, flags>::clip_triangle(
     ShadedVertex const &va, ShadedVertex const &vb, ShadedVertex const &vc,
-    std::function<void(ShadedVertex const &)> const &emit_vertex)
+    EmitVertex &&emit_vertex)
 {
   // A1EC: clip_triangle
   // TODO: correct code!
@@ -437,16 +673,17 @@ void Pipeline<p, P, flags>::clip_triangle(
  */
 
 template <PrimitiveType p, class P, uint32_t flags>
+template <typename EmitFragment>
 void Pipeline<p, P, flags>::rasterize_line(
     ClippedVertex const &va, ClippedVertex const &vb,
-    std::function<void(Fragment const &)> const &emit_fragment)
+    EmitFragment &&emit_fragment)
 {
   if constexpr ((flags & PipelineMask_Interp) != Pipeline_Interp_Flat)
   {
     assert(0 && "rasterize_line should only be invoked in flat interpolation mode.");
   }
   // A1T2: rasterize_line
-  auto xmajor = [](ClippedVertex const &a, ClippedVertex const &b, ClippedVertex const &attributes, std::function<void(Fragment const &)> const &emit_fragment)
+  auto xmajor = [](ClippedVertex const &a, ClippedVertex const &b, ClippedVertex const &attributes, auto &emit_fragment)
   {
     float dx, dy;
     dx = b.fb_position.x - a.fb_position.x;
@@ -467,7 +704,7 @@ void Pipeline<p, P, flags>::rasterize_line(
     return;
   };
 
-  auto ymajor = [](ClippedVertex const &a, ClippedVertex const &b, ClippedVertex const &attributes, std::function<void(Fragment const &)> const &emit_fragment)
+  auto ymajor = [](ClippedVertex const &a, ClippedVertex const &b, ClippedVertex const &attributes, auto &emit_fragment)
   {
     float dx, dy;
     dx = b.fb_position.x - a.fb_position.x;
@@ -488,7 +725,7 @@ void Pipeline<p, P, flags>::rasterize_line(
     return;
   };
 
-  if (abs(vb.fb_position.y - va.fb_position.y) < abs(vb.fb_position.x - va.fb_position.x))
+  if (std::abs(vb.fb_position.y - va.fb_position.y) < std::abs(vb.fb_position.x - va.fb_position.x))
   {
     if (va.fb_position.x > vb.fb_position.x)
       xmajor(vb, va, va, emit_fragment);
@@ -602,6 +839,227 @@ void Pipeline<p, P, flags>::rasterize_line(
   }
 }
 
+//-------------------------------------------------------------------------
+// fixed-point triangle traversal, used by rasterize_triangle
+
+namespace FixedPoint
+{
+  // positions are snapped to 1/256th of a pixel, which makes edge functions exact integers:
+  constexpr int32_t SubpixelBits = 8;
+  constexpr int64_t HalfPixel = int64_t(1) << (SubpixelBits - 1);
+  // triangles with a vertex farther than this from the origin (in pixels) are not rasterized
+  // (clipped triangles are within the framebuffer, which is at most Framebuffer::MaxWidth x MaxHeight):
+  constexpr float MaxCoordinate = 16384.0f;
+  // blocks of BlockSize x BlockSize pixels that no edge crosses are skipped or filled without testing pixels
+  // (the same blocks that CoarseDepth keeps bounds for):
+  constexpr int32_t BlockSize = CoarseDepth::BlockSize;
+
+  // A counter-clockwise triangle's edge functions at pixel centers. Edge i is opposite vertex i:
+  //  edge_i(x,y) = step_x[i] * x + step_y[i] * y + origin[i] for the center of pixel (x,y),
+  //  which is vertex i's barycentric weight times area.
+  struct Triangle
+  {
+    uint32_t order[3]; // vertex i is vertex order[i] of those passed to setup()
+    int64_t step_x[3], step_y[3], origin[3];
+    int64_t bias[3];   // -1 if centers exactly on edge i are not covered (fill rule), else 0
+    int64_t area;      // twice the triangle's area, in subpixels squared
+    PixelRect pixels;  // pixels with centers in the triangle's bounding box
+  };
+
+  // A 2x2 quad of pixels (x,y), (x+1,y), (x,y+1), (x+1,y+1) (lanes 0-3), mask bit l set if lane l is covered.
+  // edge[i][l] is edge_i + bias[i] at lane l:
+  struct Quad
+  {
+    int32_t x, y;
+    uint32_t mask;
+    int64_t edge[3][4];
+  };
+
+  // Snap positions and set up edge functions; false if the triangle covers no area or is out of range.
+  // A center exactly on an edge is covered if the edge is a left edge, or a horizontal top edge
+  // (so that of two triangles sharing an edge, exactly one covers it):
+  inline bool setup(Vec2 const (&positions)[3], Triangle *triangle_)
+  {
+    Triangle &t = *triangle_;
+    int64_t x[3], y[3];
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+      // (also rejects non-finite positions)
+      if (!(std::abs(positions[i].x) <= MaxCoordinate && std::abs(positions[i].y) <= MaxCoordinate))
+        return false;
+      x[i] = std::llround(double(positions[i].x) * (1 << SubpixelBits));
+      y[i] = std::llround(double(positions[i].y) * (1 << SubpixelBits));
+    }
+
+    t.area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (t.area == 0)
+      return false;
+    t.order[0] = 0;
+    t.order[1] = 1;
+    t.order[2] = 2;
+    if (t.area < 0)
+    {
+      std::swap(t.order[1], t.order[2]);
+      std::swap(x[1], x[2]);
+      std::swap(y[1], y[2]);
+      t.area = -t.area;
+    }
+
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+      uint32_t from = (i + 1) % 3;
+      uint32_t to = (i + 2) % 3;
+      int64_t ex = x[to] - x[from];
+      int64_t ey = y[to] - y[from];
+      // edge_i(px,py) = ex * (py - y[from]) - ey * (px - x[from]), at px = (x << SubpixelBits) + HalfPixel (and py likewise):
+      t.step_x[i] = -ey << SubpixelBits;
+      t.step_y[i] = ex << SubpixelBits;
+      t.origin[i] = ex * (HalfPixel - y[from]) - ey * (HalfPixel - x[from]);
+      t.bias[i] = (ey < 0 || (ey == 0 && ex < 0)) ? 0 : -1;
+    }
+
+    // pixel x's center is inside [min,max] when (x << SubpixelBits) + HalfPixel is:
+    int64_t min_x = std::min({x[0], x[1], x[2]}) - HalfPixel;
+    int64_t min_y = std::min({y[0], y[1], y[2]}) - HalfPixel;
+    int64_t max_x = std::max({x[0], x[1], x[2]}) - HalfPixel;
+    int64_t max_y = std::max({y[0], y[1], y[2]}) - HalfPixel;
+    int64_t round_up = (int64_t(1) << SubpixelBits) - 1;
+    t.pixels = PixelRect{
+        int32_t((min_x + round_up) >> SubpixelBits),
+        int32_t((min_y + round_up) >> SubpixelBits),
+        int32_t((max_x >> SubpixelBits) + 1),
+        int32_t((max_y >> SubpixelBits) + 1)};
+    return true;
+  }
+
+  // Call emit_quad(quad) for every quad with a covered pixel in t.pixels (only those pixels are in quad.mask).
+  // Quads are aligned to even pixel coordinates, and visited in blocks of BlockSize x BlockSize pixels;
+  // visit_block(bx, by, inside) is called for each block that is not outside the triangle before its
+  // quads are, and returning false skips it ('inside' is true if the triangle covers the whole block):
+  template <typename VisitBlock, typename EmitQuad>
+  void traverse(Triangle const &t, VisitBlock &&visit_block, EmitQuad &&emit_quad)
+  {
+    PixelRect const &r = t.pixels;
+    if (r.x_begin >= r.x_end || r.y_begin >= r.y_end)
+      return;
+
+    // (masking with ~(n-1) rounds down, also for negative coordinates)
+    for (int32_t by = r.y_begin & ~(BlockSize - 1); by < r.y_end; by += BlockSize)
+    {
+      for (int32_t bx = r.x_begin & ~(BlockSize - 1); bx < r.x_end; bx += BlockSize)
+      {
+        // reject the block if it is outside an edge; accept it if it is inside all of them:
+        bool inside = true;
+        bool outside = false;
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+          int64_t corner = t.step_x[i] * bx + t.step_y[i] * by + t.origin[i] + t.bias[i];
+          int64_t across_x = t.step_x[i] * (BlockSize - 1);
+          int64_t across_y = t.step_y[i] * (BlockSize - 1);
+          int64_t lowest = corner + std::min(across_x, int64_t(0)) + std::min(across_y, int64_t(0));
+          int64_t highest = corner + std::max(across_x, int64_t(0)) + std::max(across_y, int64_t(0));
+          outside = outside || highest < 0;
+          inside = inside && lowest >= 0;
+        }
+        if (outside || !visit_block(bx, by, inside))
+          continue;
+
+        int32_t qx_begin = std::max(bx, r.x_begin & ~1);
+        int32_t qx_end = std::min(bx + BlockSize, r.x_end);
+        int32_t qy_begin = std::max(by, r.y_begin & ~1);
+        int32_t qy_end = std::min(by + BlockSize, r.y_end);
+        for (int32_t qy = qy_begin; qy < qy_end; qy += 2)
+        {
+          // lanes of the quad row that are within t.pixels:
+          uint32_t row_mask = 0xf;
+          if (qy < r.y_begin)
+            row_mask &= 0xc;
+          if (qy + 1 >= r.y_end)
+            row_mask &= 0x3;
+
+          Quad quad;
+          quad.y = qy;
+#if PIPELINE_SSE2
+          // edge values of the quad's top and bottom rows, two pixels (64-bit lanes) each:
+          __m128i top[3], bottom[3], step[3];
+          for (uint32_t i = 0; i < 3; ++i)
+          {
+            int64_t e = t.step_x[i] * qx_begin + t.step_y[i] * qy + t.origin[i] + t.bias[i];
+            top[i] = _mm_set_epi64x(e + t.step_x[i], e);
+            bottom[i] = _mm_add_epi64(top[i], _mm_set1_epi64x(t.step_y[i]));
+            step[i] = _mm_set1_epi64x(2 * t.step_x[i]);
+          }
+#else
+          int64_t row[3];
+          for (uint32_t i = 0; i < 3; ++i)
+          {
+            row[i] = t.step_x[i] * qx_begin + t.step_y[i] * qy + t.origin[i] + t.bias[i];
+          }
+#endif
+          for (int32_t qx = qx_begin; qx < qx_end; qx += 2)
+          {
+            uint32_t mask = row_mask;
+            if (qx < r.x_begin)
+              mask &= 0xa;
+            if (qx + 1 >= r.x_end)
+              mask &= 0x5;
+
+#if PIPELINE_SSE2
+            if (!inside)
+            {
+              // a pixel is covered when none of its edge values is negative (has its sign bit set):
+              __m128i top_any = _mm_or_si128(_mm_or_si128(top[0], top[1]), top[2]);
+              __m128i bottom_any = _mm_or_si128(_mm_or_si128(bottom[0], bottom[1]), bottom[2]);
+              uint32_t negative = uint32_t(_mm_movemask_pd(_mm_castsi128_pd(top_any))) | (uint32_t(_mm_movemask_pd(_mm_castsi128_pd(bottom_any))) << 2);
+              mask &= ~negative;
+            }
+            if (mask)
+            {
+              quad.x = qx;
+              quad.mask = mask;
+              for (uint32_t i = 0; i < 3; ++i)
+              {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(&quad.edge[i][0]), top[i]);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(&quad.edge[i][2]), bottom[i]);
+              }
+              emit_quad(quad);
+            }
+            for (uint32_t i = 0; i < 3; ++i)
+            {
+              top[i] = _mm_add_epi64(top[i], step[i]);
+              bottom[i] = _mm_add_epi64(bottom[i], step[i]);
+            }
+#else
+            for (uint32_t i = 0; i < 3; ++i)
+            {
+              quad.edge[i][0] = row[i];
+              quad.edge[i][1] = row[i] + t.step_x[i];
+              quad.edge[i][2] = row[i] + t.step_y[i];
+              quad.edge[i][3] = row[i] + t.step_x[i] + t.step_y[i];
+              row[i] += 2 * t.step_x[i];
+            }
+            if (!inside)
+            {
+              for (uint32_t l = 0; l < 4; ++l)
+              {
+                if ((quad.edge[0][l] | quad.edge[1][l] | quad.edge[2][l]) < 0)
+                  mask &= ~(1u << l);
+              }
+            }
+            if (mask)
+            {
+              quad.x = qx;
+              quad.mask = mask;
+              emit_quad(quad);
+            }
+#endif
+          }
+        }
+      }
+    }
+  }
+} // namespace FixedPoint
+
 /*
  *
  * rasterize_triangle(a,b,c,emit) calls 'emit(frag)' at every location
@@ -641,394 +1099,390 @@ void Pipeline<p, P, flags>::rasterize_line(
  *
  */
 template <PrimitiveType p, class P, uint32_t flags>
+template <typename EmitFragment>
 void Pipeline<p, P, flags>::rasterize_triangle(
     ClippedVertex const &va, ClippedVertex const &vb, ClippedVertex const &vc,
-    std::function<void(Fragment const &)> const &emit_fragment)
+    EmitFragment &&emit_fragment,
+    PixelRect const *scissor,
+    EarlyDepth const *early_depth)
 {
-  auto TriArea = [](float ax, float ay, float bx, float by, float cx, float cy)
+  // Coverage comes from fixed-point edge functions stepped over 2x2 quads; attributes are
+  // interpolated with the barycentric weights they give, and derivatives are differences
+  // across the quad (which are exact for attributes linear in screen space).
+  FixedPoint::Triangle triangle;
+  if (!FixedPoint::setup({va.fb_position.xy(), vb.fb_position.xy(), vc.fb_position.xy()}, &triangle))
+    return;
+  if (scissor)
   {
-    double abx = (double)bx - (double)ax;
-    double aby = (double)by - (double)ay;
-    double acx = (double)cx - (double)ax;
-    double acy = (double)cy - (double)ay;
-    return abs(abx*acy - aby*acx) / 2.0f;
-  };
+    PixelRect &pixels = triangle.pixels;
+    pixels.x_begin = std::max(pixels.x_begin, scissor->x_begin);
+    pixels.y_begin = std::max(pixels.y_begin, scissor->y_begin);
+    pixels.x_end = std::min(pixels.x_end, scissor->x_end);
+    pixels.y_end = std::min(pixels.y_end, scissor->y_end);
+  }
 
-  auto TriAreaOrdered = [](float ax, float ay, float bx, float by, float cx, float cy)
+  ClippedVertex const *const given[3] = {&va, &vb, &vc};
+  ClippedVertex const *v[3];
+  for (uint32_t i = 0; i < 3; ++i)
   {
-    double abx = (double)bx - (double)ax;
-    double aby = (double)by - (double)ay;
-    double acx = (double)cx - (double)ax;
-    double acy = (double)cy - (double)ay;
-    return (abx * acy - aby * acx) / 2.0f;
-  };
-  // Test edge va-vb is a left edge or top edge
-  auto TestLeftOrTopEdge = [](ClippedVertex const &va, ClippedVertex const &vb, ClippedVertex const &vc)
+    v[i] = given[triangle.order[i]];
+  }
+  double const inv_area = 1.0 / double(triangle.area);
+
+  // With early depth, parts of the triangle that are behind what is already drawn are skipped:
+  // the whole triangle or blocks of it by coarse depth bounds, and single pixels by the depth buffer.
+  CoarseDepth *const coarse = (early_depth ? early_depth->coarse : nullptr);
+  uint32_t const sample = (early_depth ? early_depth->sample : 0);
+
+  // conservative range [*min_z, *max_z] of the float depths of pixels with centers in [x0,x1]x[y0,y1]
+  // (depth is linear, so its extremes are at the corners; computed as emit_quad does, and padded for rounding):
+  auto depth_range = [&](int32_t x0, int32_t y0, int32_t x1, int32_t y1, float *min_z, float *max_z)
   {
-    // If edge is horizontal
-    if (va.fb_position.y == vb.fb_position.y)
+    double lo = std::numeric_limits<double>::infinity();
+    double hi = -lo;
+    for (int32_t y : {y0, y1})
     {
-      if (va.fb_position.y > vc.fb_position.y)
-        return true;
-      else
-        return false;
-    } else {
-      float slope;
-      if (va.fb_position.x < vb.fb_position.x) {
-        slope = (vb.fb_position.y - va.fb_position.y) / (vb.fb_position.x - va.fb_position.x);
-        if (slope > 0.0f) {
-          if ((vc.fb_position.y - va.fb_position.y) < slope * (vc.fb_position.x - va.fb_position.x))
-            return true;
-          else 
-            return false;
-        } else {
-          if ((vc.fb_position.y - va.fb_position.y) > slope * (vc.fb_position.x - va.fb_position.x))
-            return true;
-          else
-            return false;
-        }
-      } else if (va.fb_position.x > vb.fb_position.x) {
-        slope = (va.fb_position.y - vb.fb_position.y) / (va.fb_position.x - vb.fb_position.x);
-        if (slope > 0.0f)
-        {
-          if ((vc.fb_position.y - vb.fb_position.y) < slope * (vc.fb_position.x - vb.fb_position.x))
-            return true;
-          else
-            return false;
-        }
-        else
+      for (int32_t x : {x0, x1})
+      {
+        double z = 0.0, magnitude = 0.0;
+        for (uint32_t i = 0; i < 3; ++i)
         {
-          if ((vc.fb_position.y - vb.fb_position.y) > slope * (vc.fb_position.x - vb.fb_position.x))
-            return true;
-          else
-            return false;
+          double term = double(triangle.step_x[i] * x + triangle.step_y[i] * y + triangle.origin[i]) * inv_area * v[i]->fb_position.z;
+          z += term;
+          magnitude += std::abs(term);
         }
-      } else {
-        if (vc.fb_position.x > va.fb_position.x)
-          return true;
-        else
-          return false;
+        lo = std::min(lo, z - 1e-12 * magnitude);
+        hi = std::max(hi, z + 1e-12 * magnitude);
       }
     }
+    *min_z = std::nextafter(float(lo), -std::numeric_limits<float>::infinity());
+    *max_z = std::nextafter(float(hi), std::numeric_limits<float>::infinity());
   };
 
-  auto CalculateScreenSpaceDerivatives = [TriAreaOrdered](ClippedVertex const &va, ClippedVertex const &vb, ClippedVertex const &vc, double totalArea, Fragment &f, float deltaX, float deltaY)
+  PixelRect const &pixels = triangle.pixels;
+  if (coarse && pixels.x_begin < pixels.x_end && pixels.y_begin < pixels.y_end)
   {
-    double subArea1 = TriAreaOrdered(f.fb_position.x + deltaX, f.fb_position.y + deltaY, va.fb_position.x, va.fb_position.y, vb.fb_position.x, vb.fb_position.y);
-    double subArea2 = TriAreaOrdered(f.fb_position.x + deltaX, f.fb_position.y + deltaY, vc.fb_position.x, vc.fb_position.y, va.fb_position.x, va.fb_position.y);
-    double subArea3 = TriAreaOrdered(f.fb_position.x + deltaX, f.fb_position.y + deltaY, vb.fb_position.x, vb.fb_position.y, vc.fb_position.x, vc.fb_position.y);
-    double u = subArea1 / totalArea;
-    double v = subArea2 / totalArea;
-    double w = subArea3 / totalArea;
-    for (uint32_t i = 0; i < f.derivatives.size(); ++i)
+    // skip the triangle if it is behind the bounds of every block it touches:
+    PixelRect const &rect = coarse->rect;
+    if (pixels.x_begin >= rect.x_begin && pixels.y_begin >= rect.y_begin && pixels.x_end <= rect.x_end && pixels.y_end <= rect.y_end)
     {
-      float deltaAttribute = (float)((double)va.attributes[i] * w + (double)vb.attributes[i] * v + (double)vc.attributes[i] * u);
-      if (deltaX != 0.0f)
+      float nearest = std::min({v[0]->fb_position.z, v[1]->fb_position.z, v[2]->fb_position.z});
+      float farthest = std::max({std::abs(v[0]->fb_position.z), std::abs(v[1]->fb_position.z), std::abs(v[2]->fb_position.z)});
+      nearest = std::nextafter(nearest - 1e-6f * farthest, -std::numeric_limits<float>::infinity());
+      bool hidden = true;
+      for (int32_t y = pixels.y_begin; hidden && y < pixels.y_end; y = (y & ~(CoarseDepth::BlockSize - 1)) + CoarseDepth::BlockSize)
       {
-        if (deltaX > 0.0f)
-          f.derivatives[i].x += deltaAttribute - f.attributes[i];
-        else
-          f.derivatives[i].x += f.attributes[i] - deltaAttribute;
-      }
-      else
-      {
-        if (deltaY > 0.0f)
-          f.derivatives[i].y += deltaAttribute - f.attributes[i];
-        else
-          f.derivatives[i].y += f.attributes[i] - deltaAttribute;
+        for (int32_t x = pixels.x_begin; hidden && x < pixels.x_end; x = (x & ~(CoarseDepth::BlockSize - 1)) + CoarseDepth::BlockSize)
+        {
+          hidden = nearest >= coarse->at(x, y, sample);
+        }
       }
+      if (hidden)
+        return;
     }
-    return;
+  }
+
+  // skip blocks behind their bounds, and lower the bounds of blocks the triangle covers
+  // (pixels there will end up at or in front of the triangle):
+  auto visit_block = [&](int32_t bx, int32_t by, bool inside)
+  {
+    if (!coarse || !coarse->rect.contains(bx, by))
+      return true;
+    float min_z, max_z;
+    depth_range(std::max(bx, pixels.x_begin), std::max(by, pixels.y_begin), std::min(bx + CoarseDepth::BlockSize, pixels.x_end) - 1, std::min(by + CoarseDepth::BlockSize, pixels.y_end) - 1, &min_z, &max_z);
+    float &bound = coarse->at(bx, by, sample);
+    if (min_z >= bound)
+      return false;
+    if constexpr (!(flags & Pipeline_DepthWriteDisableBit))
+    {
+      // (the bound only covers the part of the block in coarse->rect)
+      int32_t x_end = std::min(bx + CoarseDepth::BlockSize, coarse->rect.x_end);
+      int32_t y_end = std::min(by + CoarseDepth::BlockSize, coarse->rect.y_end);
+      if (inside && bx >= pixels.x_begin && by >= pixels.y_begin && x_end <= pixels.x_end && y_end <= pixels.y_end)
+        bound = std::min(bound, max_z);
+    }
+    return true;
   };
 
-  auto CalculateCorrectDerivatives = [TriAreaOrdered](ClippedVertex const &va, ClippedVertex const &vb, ClippedVertex const &vc, double totalArea, Fragment &f, float deltaX, float deltaY)
+  auto emit_quad = [&](FixedPoint::Quad const &quad)
   {
-    double subArea1 = TriAreaOrdered(f.fb_position.x + deltaX, f.fb_position.y + deltaY, va.fb_position.x, va.fb_position.y, vb.fb_position.x, vb.fb_position.y);
-    double subArea2 = TriAreaOrdered(f.fb_position.x + deltaX, f.fb_position.y + deltaY, vc.fb_position.x, vc.fb_position.y, va.fb_position.x, va.fb_position.y);
-    double subArea3 = TriAreaOrdered(f.fb_position.x + deltaX, f.fb_position.y + deltaY, vb.fb_position.x, vb.fb_position.y, vc.fb_position.x, vc.fb_position.y);
-    double u = subArea1 / totalArea;
-    double v = subArea2 / totalArea;
-    double w = subArea3 / totalArea;
-    float fbw = (float)((double)va.inv_w * w + (double)vb.inv_w * v + (double)vc.inv_w * u);
-    for (uint32_t i = 0; i < f.derivatives.size(); ++i)
+    // barycentric weights of v[0..2] at each pixel of the quad:
+    double weight[4][3];
+    for (uint32_t l = 0; l < 4; ++l)
     {
-      float deltaAttribute = (float)(((double)va.attributes[i] * va.inv_w * w + (double)vb.attributes[i] * vb.inv_w * v + (double)vc.attributes[i] * vc.inv_w * u) / fbw);
-      if (deltaX != 0.0f)
+      for (uint32_t i = 0; i < 3; ++i)
       {
-        if (deltaX > 0.0f)
-          f.derivatives[i].x += deltaAttribute - f.attributes[i];
-        else
-          f.derivatives[i].x += f.attributes[i] - deltaAttribute;
+        weight[l][i] = double(quad.edge[i][l] - triangle.bias[i]) * inv_area;
       }
-      else
+    }
+
+    Fragment f[4];
+    for (uint32_t l = 0; l < 4; ++l)
+    {
+      double z = weight[l][0] * v[0]->fb_position.z + weight[l][1] * v[1]->fb_position.z + weight[l][2] * v[2]->fb_position.z;
+      f[l].fb_position = Vec3(float(quad.x + int32_t(l & 1)) + 0.5f, float(quad.y + int32_t(l >> 1)) + 0.5f, float(z));
+      f[l].derivatives.fill(Vec2(0.0f, 0.0f));
+    }
+
+    // depth test early (pixels outside the framebuffer are left to rasterize() to count):
+    uint32_t mask = quad.mask;
+    if (early_depth)
+    {
+      Framebuffer const &framebuffer = *early_depth->framebuffer;
+      for (uint32_t l = 0; l < 4; ++l)
       {
-        if (deltaY > 0.0f)
-          f.derivatives[i].y += deltaAttribute - f.attributes[i];
-        else
-          f.derivatives[i].y += f.attributes[i] - deltaAttribute;
+        uint32_t x = uint32_t(quad.x + int32_t(l & 1));
+        uint32_t y = uint32_t(quad.y + int32_t(l >> 1));
+        if ((mask & (1u << l)) && x < framebuffer.width && y < framebuffer.height && !(f[l].fb_position.z < framebuffer.depth_at(x, y, sample)))
+          mask &= ~(1u << l);
       }
+      if (!mask)
+        return;
     }
-    return;
-  };
-  // NOTE: it is okay to restructure this function to allow these tasks to use the
-  //  same code paths. Be aware, however, that all of them need to remain working!
-  //  (e.g., if you break Flat while implementing Correct, you won't get points
-  //   for Flat.)
-  if constexpr ((flags & PipelineMask_Interp) == Pipeline_Interp_Flat)
-  {
-    // A1T3: flat triangles
-    float bottomLeftX, bottomLeftY, topRightX, topRightY;
-    // Find bottom left corner
-    bottomLeftX = va.fb_position.x;
-    if (vb.fb_position.x < bottomLeftX)
-      bottomLeftX = vb.fb_position.x;
-    if (vc.fb_position.x < bottomLeftX)
-      bottomLeftX = vc.fb_position.x;
-    bottomLeftY = va.fb_position.y;
-    if (vb.fb_position.y < bottomLeftY)
-      bottomLeftY = vb.fb_position.y;
-    if (vc.fb_position.y < bottomLeftY)
-      bottomLeftY = vc.fb_position.y;
-    // Find topottom reft corner
-    topRightX = va.fb_position.x;
-    if (vb.fb_position.x > topRightX)
-      topRightX = vb.fb_position.x;
-    if (vc.fb_position.x > topRightX)
-      topRightX = vc.fb_position.x;
-    topRightY = va.fb_position.y;
-    if (vb.fb_position.y > topRightY)
-      topRightY = vb.fb_position.y;
-    if (vc.fb_position.y > topRightY)
-      topRightY = vc.fb_position.y;
-
-    // Find centers
-    bottomLeftX = floor(bottomLeftX) + 0.5f;
-    bottomLeftY = floor(bottomLeftY) + 0.5f;
-    topRightX = floor(topRightX) + 0.5f;
-    topRightY = floor(topRightY) + 0.5f;
-
-    double totalArea = TriArea(va.fb_position.x, va.fb_position.y, vb.fb_position.x, vb.fb_position.y, vc.fb_position.x, vc.fb_position.y);
-    for (float i = bottomLeftX; i <= topRightX; i = i + 1.0f) 
+
+    if constexpr ((flags & PipelineMask_Interp) == Pipeline_Interp_Flat)
     {
-      for (float j = bottomLeftY; j <= topRightY; j = j + 1.0f)
+      for (uint32_t l = 0; l < 4; ++l)
       {
-        double subArea1 = TriArea(va.fb_position.x, va.fb_position.y, vb.fb_position.x, vb.fb_position.y, i, j);
-        double subArea2 = TriArea(va.fb_position.x, va.fb_position.y, vc.fb_position.x, vc.fb_position.y, i, j);
-        double subArea3 = TriArea(vb.fb_position.x, vb.fb_position.y, vc.fb_position.x, vc.fb_position.y, i, j);
-        float fbz = (float) ((double)va.fb_position.z * subArea3 / totalArea + (double)vb.fb_position.z * subArea2 / totalArea + (double) vc.fb_position.z * subArea1 / totalArea);
-        if (subArea1 + subArea2 + subArea3 == totalArea)
-        {
-          if (subArea1 == 0.0f)
-          {
-            if (TestLeftOrTopEdge(va, vb, vc))
-            {
-              Fragment f;
-              f.fb_position = Vec3(i, j, fbz);
-              f.attributes = va.attributes;
-              f.derivatives.fill(Vec2(0.0f, 0.0f));
-              emit_fragment(f);
-            }
-          }
-          else if (subArea2 == 0.0f)
-          {
-            if (TestLeftOrTopEdge(va, vc, vb))
-            {
-              Fragment f;
-              f.fb_position = Vec3(i, j, fbz);
-              f.attributes = va.attributes;
-              f.derivatives.fill(Vec2(0.0f, 0.0f));
-              emit_fragment(f);
-            }
-          }
-          else if (subArea3 == 0.0f)
-          {
-            if (TestLeftOrTopEdge(vb, vc, va))
-            {
-              Fragment f;
-              f.fb_position = Vec3(i, j, fbz);
-              f.attributes = va.attributes;
-              f.derivatives.fill(Vec2(0.0f, 0.0f));
-              emit_fragment(f);
-            }
-          }
-          else
-          {
-            Fragment f;
-            f.fb_position = Vec3(i, j, fbz);
-            f.attributes = va.attributes;
-            f.derivatives.fill(Vec2(0.0f, 0.0f));
-            emit_fragment(f);
-          }
-        }
+        f[l].attributes = va.attributes;
       }
     }
-  }
-  else if constexpr ((flags & PipelineMask_Interp) == Pipeline_Interp_Screen)
-  {
-    // A1T5: screen-space smooth triangles
-    // TODO: rasterize triangle (see block comment above this function).
-    float bottomLeftX, bottomLeftY, topRightX, topRightY;
-    // Find bottom left corner
-    bottomLeftX = va.fb_position.x;
-    if (vb.fb_position.x < bottomLeftX)
-      bottomLeftX = vb.fb_position.x;
-    if (vc.fb_position.x < bottomLeftX)
-      bottomLeftX = vc.fb_position.x;
-    bottomLeftY = va.fb_position.y;
-    if (vb.fb_position.y < bottomLeftY)
-      bottomLeftY = vb.fb_position.y;
-    if (vc.fb_position.y < bottomLeftY)
-      bottomLeftY = vc.fb_position.y;
-    // Find topottom reft corner
-    topRightX = va.fb_position.x;
-    if (vb.fb_position.x > topRightX)
-      topRightX = vb.fb_position.x;
-    if (vc.fb_position.x > topRightX)
-      topRightX = vc.fb_position.x;
-    topRightY = va.fb_position.y;
-    if (vb.fb_position.y > topRightY)
-      topRightY = vb.fb_position.y;
-    if (vc.fb_position.y > topRightY)
-      topRightY = vc.fb_position.y;
-
-    // Find centers
-    bottomLeftX = floor(bottomLeftX) + 0.5f;
-    bottomLeftY = floor(bottomLeftY) + 0.5f;
-    topRightX = floor(topRightX) + 0.5f;
-    topRightY = floor(topRightY) + 0.5f;
-
-    double totalArea = TriArea(va.fb_position.x, va.fb_position.y, vb.fb_position.x, vb.fb_position.y, vc.fb_position.x, vc.fb_position.y);
-    for (float i = bottomLeftX; i <= topRightX; i = i + 1.0f)
+    else if constexpr ((flags & PipelineMask_Interp) == Pipeline_Interp_Screen || (flags & PipelineMask_Interp) == Pipeline_Interp_Correct)
     {
-      for (float j = bottomLeftY; j <= topRightY; j = j + 1.0f)
+      // (uncovered pixels of the quad are interpolated too, for the derivatives of covered ones)
+      bool valid[4] = {true, true, true, true};
+      for (uint32_t l = 0; l < 4; ++l)
       {
-        double subArea1 = TriArea(va.fb_position.x, va.fb_position.y, vb.fb_position.x, vb.fb_position.y, i, j);
-        double subArea2 = TriArea(va.fb_position.x, va.fb_position.y, vc.fb_position.x, vc.fb_position.y, i, j);
-        double subArea3 = TriArea(vb.fb_position.x, vb.fb_position.y, vc.fb_position.x, vc.fb_position.y, i, j);
-        double u = subArea1 / totalArea;
-        double v = subArea2 / totalArea;
-        double w = subArea3 / totalArea;
-        if (subArea1 + subArea2 + subArea3 == totalArea)
+        if constexpr ((flags & PipelineMask_Interp) == Pipeline_Interp_Screen)
         {
-          Fragment f;
-          float fbz = (float)((double)va.fb_position.z * w + (double)vb.fb_position.z * v + (double)vc.fb_position.z * u);
-          for (uint32_t k = 0; k < f.attributes.size(); ++k)
+          for (uint32_t k = 0; k < f[l].attributes.size(); ++k)
           {
-            f.attributes[k] = (float)((double)va.attributes[k] * w + (double)vb.attributes[k] * v + (double)vc.attributes[k] * u);
+            f[l].attributes[k] = float(weight[l][0] * v[0]->attributes[k] + weight[l][1] * v[1]->attributes[k] + weight[l][2] * v[2]->attributes[k]);
           }
-          f.fb_position = Vec3(i, j, fbz);
-          f.derivatives.fill(Vec2(0.0f, 0.0f));
-          CalculateScreenSpaceDerivatives(va, vb, vc, totalArea, f, 1.0f, 0.0f);
-          CalculateScreenSpaceDerivatives(va, vb, vc, totalArea, f, -1.0f, 0.0f);
-          CalculateScreenSpaceDerivatives(va, vb, vc, totalArea, f, 0.0f, 1.0f);
-          CalculateScreenSpaceDerivatives(va, vb, vc, totalArea, f, 0.0f, -1.0f);
-          for (uint32_t k = 0; k < f.derivatives.size(); ++k)
+        }
+        else
+        {
+          double inv_w = weight[l][0] * v[0]->inv_w + weight[l][1] * v[1]->inv_w + weight[l][2] * v[2]->inv_w;
+          // (outside the triangle, 1/w may extrapolate to or past zero; don't take derivatives across such pixels)
+          valid[l] = inv_w > 0.0;
+          for (uint32_t k = 0; k < f[l].attributes.size(); ++k)
           {
-            f.derivatives[k].x = f.derivatives[k].x / 2.0f;
-            f.derivatives[k].y = f.derivatives[k].y / 2.0f;
-          }
-          if (subArea1 == 0.0f) {
-            if (TestLeftOrTopEdge(va, vb, vc))
-              emit_fragment(f);
+            double numerator = weight[l][0] * v[0]->attributes[k] * v[0]->inv_w + weight[l][1] * v[1]->attributes[k] * v[1]->inv_w + weight[l][2] * v[2]->attributes[k] * v[2]->inv_w;
+            f[l].attributes[k] = float(numerator / inv_w);
           }
-          else if (subArea2 == 0.0f) {
-            if (TestLeftOrTopEdge(va, vc, vb))
-              emit_fragment(f);
-          }
-          else if (subArea3 == 0.0f) {
-            if (TestLeftOrTopEdge(vb, vc, va))
-              emit_fragment(f);
-          }
-          else
-            emit_fragment(f);
         }
       }
+      for (uint32_t l = 0; l < 4; ++l)
+      {
+        uint32_t left = l & ~1u, right = l | 1u;
+        uint32_t below = l & ~2u, above = l | 2u;
+        for (uint32_t k = 0; k < f[l].derivatives.size(); ++k)
+        {
+          if (valid[left] && valid[right])
+            f[l].derivatives[k].x = f[right].attributes[k] - f[left].attributes[k];
+          if (valid[below] && valid[above])
+            f[l].derivatives[k].y = f[above].attributes[k] - f[below].attributes[k];
+        }
+      }
+    }
+    else
+    {
+      static_assert((flags & PipelineMask_Interp) <= Pipeline_Interp_Correct, "Unknown interpolation flag.");
+    }
+
+    for (uint32_t l = 0; l < 4; ++l)
+    {
+      if (mask & (1u << l))
+        emit_fragment(f[l]);
     }
+  };
+  FixedPoint::traverse(triangle, visit_block, emit_quad);
+}
+
+/*
+ * rasterize_triangle_coverage(a,b,c,samples,emit,bounds) rasterizes triangle (a,b,c) for all
+ *  sample locations at once: it calls 'emit(frag)' for every pixel (x,y) within bounds where the
+ *  triangle covers at least one of the locations (x,y) + samples[s].xy, with:
+ * - frag.coverage = bit s set for each covered sample location
+ * - frag.fragment.fb_position = (x+0.5, y+0.5, depth there)
+ * - frag.fragment.attributes = interpolated as rasterize_triangle does, at the pixel center if
+ *   the center is inside the triangle, else at the first covered sample (so that attributes are
+ *   never extrapolated past the triangle's edges)
+ * - frag.fragment.derivatives = exact derivatives at that point
+ * - frag.depth_slope = derivatives of depth, so depths at samples follow from fb_position.z
+ *
+ * Coverage is decided with edge functions; a sample exactly on an edge is covered only if the
+ *  edge is a left or top edge (as in rasterize_triangle), so triangles sharing an edge cover samples along it exactly once.
+ */
+template <PrimitiveType p, class P, uint32_t flags>
+template <typename EmitFragment>
+void Pipeline<p, P, flags>::rasterize_triangle_coverage(
+    ClippedVertex const &va, ClippedVertex const &vb, ClippedVertex const &vc,
+    std::vector<Vec3> const &samples,
+    EmitFragment &&emit_fragment,
+    PixelRect const &bounds)
+{
+  assert(samples.size() <= MaxCoverageSamples);
+
+  // edge function: positive when (x,y) is left of the edge from->to
+  // (evaluated with the endpoints in a fixed order, so triangles sharing an edge get exactly opposite values):
+  auto Edge = [](ClippedVertex const *from, ClippedVertex const *to, double x, double y)
+  {
+    bool flip = to->fb_position.x < from->fb_position.x || (to->fb_position.x == from->fb_position.x && to->fb_position.y < from->fb_position.y);
+    if (flip)
+      std::swap(from, to);
+    double e = ((double)to->fb_position.x - from->fb_position.x) * (y - from->fb_position.y) - ((double)to->fb_position.y - from->fb_position.y) * (x - from->fb_position.x);
+    return flip ? -e : e;
+  };
+
+  // wind counter-clockwise (attributes for Interp_Flat still come from va):
+  ClippedVertex const *v[3] = {&va, &vb, &vc};
+  double area = Edge(v[0], v[1], vc.fb_position.x, vc.fb_position.y);
+  if (!std::isfinite(area) || area == 0.0)
+    return;
+  if (area < 0.0)
+  {
+    std::swap(v[1], v[2]);
+    area = -area;
   }
-  else if constexpr ((flags & PipelineMask_Interp) == Pipeline_Interp_Correct)
+
+  // edge i is opposite v[i]; its edge function over area is v[i]'s barycentric weight:
+  bool include[3];
+  Vec2 weight_slope[3];
+  for (uint32_t i = 0; i < 3; ++i)
   {
-    // A1T5: perspective correct triangles
-    // TODO: rasterize triangle (block comment above this function).
-    float bottomLeftX, bottomLeftY, topRightX, topRightY;
-    // Find bottom left corner
-    bottomLeftX = va.fb_position.x;
-    if (vb.fb_position.x < bottomLeftX)
-      bottomLeftX = vb.fb_position.x;
-    if (vc.fb_position.x < bottomLeftX)
-      bottomLeftX = vc.fb_position.x;
-    bottomLeftY = va.fb_position.y;
-    if (vb.fb_position.y < bottomLeftY)
-      bottomLeftY = vb.fb_position.y;
-    if (vc.fb_position.y < bottomLeftY)
-      bottomLeftY = vc.fb_position.y;
-    // Find topottom reft corner
-    topRightX = va.fb_position.x;
-    if (vb.fb_position.x > topRightX)
-      topRightX = vb.fb_position.x;
-    if (vc.fb_position.x > topRightX)
-      topRightX = vc.fb_position.x;
-    topRightY = va.fb_position.y;
-    if (vb.fb_position.y > topRightY)
-      topRightY = vb.fb_position.y;
-    if (vc.fb_position.y > topRightY)
-      topRightY = vc.fb_position.y;
-
-    // Find centers
-    bottomLeftX = floor(bottomLeftX) + 0.5f;
-    bottomLeftY = floor(bottomLeftY) + 0.5f;
-    topRightX = floor(topRightX) + 0.5f;
-    topRightY = floor(topRightY) + 0.5f;
-
-    double totalArea = TriArea(va.fb_position.x, va.fb_position.y, vb.fb_position.x, vb.fb_position.y, vc.fb_position.x, vc.fb_position.y);
-    for (float i = bottomLeftX; i <= topRightX; i = i + 1.0f)
+    ClippedVertex const &from = *v[(i + 1) % 3];
+    ClippedVertex const &to = *v[(i + 2) % 3];
+    float ex = to.fb_position.x - from.fb_position.x;
+    float ey = to.fb_position.y - from.fb_position.y;
+    include[i] = ey < 0.0f || (ey == 0.0f && ex < 0.0f);
+    weight_slope[i] = Vec2(float(-(double)ey / area), float((double)ex / area));
+  }
+
+  // pixels the triangle's bounding box overlaps:
+  float min_x = std::min({va.fb_position.x, vb.fb_position.x, vc.fb_position.x});
+  float min_y = std::min({va.fb_position.y, vb.fb_position.y, vc.fb_position.y});
+  float max_x = std::max({va.fb_position.x, vb.fb_position.x, vc.fb_position.x});
+  float max_y = std::max({va.fb_position.y, vb.fb_position.y, vc.fb_position.y});
+  auto ClampTo = [](float value, int32_t lo, int32_t hi)
+  {
+    return (int32_t)std::clamp(value, (float)lo, (float)hi);
+  };
+  int32_t x_begin = ClampTo(std::floor(min_x), bounds.x_begin, bounds.x_end);
+  int32_t y_begin = ClampTo(std::floor(min_y), bounds.y_begin, bounds.y_end);
+  int32_t x_end = ClampTo(std::floor(max_x) + 1.0f, bounds.x_begin, bounds.x_end);
+  int32_t y_end = ClampTo(std::floor(max_y) + 1.0f, bounds.y_begin, bounds.y_end);
+
+  auto Covers = [&](double px, double py)
+  {
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+      double e = Edge(v[(i + 1) % 3], v[(i + 2) % 3], px, py);
+      if (e < 0.0 || (e == 0.0 && !include[i]))
+        return false;
+    }
+    return true;
+  };
+
+  for (int32_t y = y_begin; y < y_end; ++y)
+  {
+    for (int32_t x = x_begin; x < x_end; ++x)
     {
-      for (float j = bottomLeftY; j <= topRightY; j = j + 1.0f)
+      CoverageFragment cf;
+      cf.coverage = 0;
+      uint32_t first = -1U;
+      for (uint32_t s = 0; s < samples.size(); ++s)
       {
-        double subArea1 = TriArea(va.fb_position.x, va.fb_position.y, vb.fb_position.x, vb.fb_position.y, i, j);
-        double subArea2 = TriArea(va.fb_position.x, va.fb_position.y, vc.fb_position.x, vc.fb_position.y, i, j);
-        double subArea3 = TriArea(vb.fb_position.x, vb.fb_position.y, vc.fb_position.x, vc.fb_position.y, i, j);
-        double u = subArea1 / totalArea;
-        double v = subArea2 / totalArea;
-        double w = subArea3 / totalArea;
-        if (subArea1 + subArea2 + subArea3 == totalArea)
+        if (Covers(x + (double)samples[s].x, y + (double)samples[s].y))
         {
-          Fragment f;
-          float fbz = (float)((double)va.fb_position.z * w + (double)vb.fb_position.z * v + (double)vc.fb_position.z * u);
-          float fbw = (float)((double)va.inv_w * w + (double)vb.inv_w * v + (double)vc.inv_w * u);
-          for (uint32_t k = 0; k < f.attributes.size(); ++k)
-          {
-            f.attributes[k] = (float)(((double)va.attributes[k] * va.inv_w * w + (double)vb.attributes[k] * vb.inv_w * v + (double)vc.attributes[k] * vc.inv_w * u) / fbw);
-          }
-          f.fb_position = Vec3(i, j, fbz);
-          f.derivatives.fill(Vec2(0.0f, 0.0f));
-          CalculateCorrectDerivatives(va, vb, vc, totalArea, f, 1.0f, 0.0f);
-          CalculateCorrectDerivatives(va, vb, vc, totalArea, f, -1.0f, 0.0f);
-          CalculateCorrectDerivatives(va, vb, vc, totalArea, f, 0.0f, 1.0f);
-          CalculateCorrectDerivatives(va, vb, vc, totalArea, f, 0.0f, -1.0f);
-          for (uint32_t k = 0; k < f.derivatives.size(); ++k)
-          {
-            f.derivatives[k].x = f.derivatives[k].x / 2.0f;
-            f.derivatives[k].y = f.derivatives[k].y / 2.0f;
-          }
-          if (subArea1 == 0.0f)
-          {
-            if (TestLeftOrTopEdge(va, vb, vc))
-              emit_fragment(f);
-          }
-          else if (subArea2 == 0.0f)
+          cf.coverage |= uint64_t(1) << s;
+          if (first == -1U)
+            first = s;
+        }
+      }
+      if (!cf.coverage)
+        continue;
+
+      // barycentric weights at the center (or, if it is outside, at the first covered sample):
+      double cx = x + 0.5;
+      double cy = y + 0.5;
+      double at_x = cx, at_y = cy;
+      if (!Covers(cx, cy))
+      {
+        at_x = x + (double)samples[first].x;
+        at_y = y + (double)samples[first].y;
+      }
+      double weight[3];
+      for (uint32_t i = 0; i < 3; ++i)
+      {
+        weight[i] = Edge(v[(i + 1) % 3], v[(i + 2) % 3], at_x, at_y) / area;
+      }
+
+      Fragment &f = cf.fragment;
+      // depth is linear in screen space; extend its plane to the center:
+      double z = 0.0;
+      Vec2 dz = Vec2(0.0f, 0.0f);
+      for (uint32_t i = 0; i < 3; ++i)
+      {
+        z += weight[i] * v[i]->fb_position.z;
+        dz += weight_slope[i] * v[i]->fb_position.z;
+      }
+      z += dz.x * (cx - at_x) + dz.y * (cy - at_y);
+      f.fb_position = Vec3((float)cx, (float)cy, (float)z);
+      cf.depth_slope = dz;
+
+      f.derivatives.fill(Vec2(0.0f, 0.0f));
+      if constexpr ((flags & PipelineMask_Interp) == Pipeline_Interp_Flat)
+      {
+        f.attributes = va.attributes;
+      }
+      else if constexpr ((flags & PipelineMask_Interp) == Pipeline_Interp_Screen)
+      {
+        for (uint32_t k = 0; k < f.attributes.size(); ++k)
+        {
+          double attribute = 0.0;
+          Vec2 slope = Vec2(0.0f, 0.0f);
+          for (uint32_t i = 0; i < 3; ++i)
           {
-            if (TestLeftOrTopEdge(va, vc, vb))
-              emit_fragment(f);
+            attribute += weight[i] * v[i]->attributes[k];
+            slope += weight_slope[i] * v[i]->attributes[k];
           }
-          else if (subArea3 == 0.0f)
+          f.attributes[k] = (float)attribute;
+          if (k < f.derivatives.size())
+            f.derivatives[k] = slope;
+        }
+      }
+      else if constexpr ((flags & PipelineMask_Interp) == Pipeline_Interp_Correct)
+      {
+        // attribute = sum(weight * attribute * inv_w) / sum(weight * inv_w), differentiated by the quotient rule:
+        double inv_w = 0.0;
+        Vec2 inv_w_slope = Vec2(0.0f, 0.0f);
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+          inv_w += weight[i] * v[i]->inv_w;
+          inv_w_slope += weight_slope[i] * v[i]->inv_w;
+        }
+        for (uint32_t k = 0; k < f.attributes.size(); ++k)
+        {
+          double numerator = 0.0;
+          Vec2 numerator_slope = Vec2(0.0f, 0.0f);
+          for (uint32_t i = 0; i < 3; ++i)
           {
-            if (TestLeftOrTopEdge(vb, vc, va))
-              emit_fragment(f);
+            numerator += weight[i] * v[i]->attributes[k] * v[i]->inv_w;
+            numerator_slope += weight_slope[i] * (v[i]->attributes[k] * v[i]->inv_w);
           }
-          else
-            emit_fragment(f);
+          double attribute = numerator / inv_w;
+          f.attributes[k] = (float)attribute;
+          if (k < f.derivatives.size())
+            f.derivatives[k] = (numerator_slope - (float)attribute * inv_w_slope) / (float)inv_w;
         }
       }
+      else
+      {
+        static_assert((flags & PipelineMask_Interp) <= Pipeline_Interp_Correct, "Unknown interpolation flag.");
+      }
+
+      emit_fragment(cf);
     }
   }
 }
@@ -1043,3 +1497,6 @@ template struct Pipeline<PrimitiveType::Lines, Programs::Lambertian, Pipeline_Bl
 template struct Pipeline<PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat>;
 template struct Pipeline<PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Screen>;
 template struct Pipeline<PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Correct>;
+template struct Pipeline<PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat | Pipeline_Sample_Coverage>;
+template struct Pipeline<PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Screen | Pipeline_Sample_Coverage>;
+template struct Pipeline<PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Correct | Pipeline_Sample_Coverage>;
@@ -6,7 +6,8 @@
  */
 
 #include <array>
-#include <functional>
+#include <limits>
+#include <vector>
 #include "../lib/vec2.h"
 #include "../lib/vec3.h"
 #include "../lib/vec4.h"
@@ -38,10 +39,48 @@ enum PipelineFlags : uint32_t {
 	Pipeline_Interp_Screen  = 0x100, //attributes are interpolated linearly in screen space
 	Pipeline_Interp_Correct = 0x200, //attributes are interpolated perspective-correctly
 
+	Pipeline_Sample_Super    = 0x00000, //every sample is rasterized and shaded on its own
+	Pipeline_Sample_Coverage = 0x10000, //triangles are rasterized and shaded once per pixel, and written to the samples they cover
+
 	//used when reading flags:
 	PipelineMask_Blend      = 0x000f, //low four bits for blending function
 	PipelineMask_Depth      = 0x00f0, //next four bits for depth function
 	PipelineMask_Interp     = 0x0f00, //next four bits for interpolation mode
+	PipelineMask_Sample     = 0xf0000, //four bits (above the write disable bits) for sampling mode
+};
+
+//A rectangle of pixels [x_begin,x_end)x[y_begin,y_end), used to rasterize one part of the framebuffer at a time:
+struct PixelRect {
+	int32_t x_begin, y_begin, x_end, y_end;
+	bool contains(int32_t x, int32_t y) const { return x >= x_begin && x < x_end && y >= y_begin && y < y_end; }
+};
+
+//Coarse depth ("hi-Z"): an upper bound on the depth stored at each sample of each BlockSize x BlockSize
+// block of pixels in rect. Pipelines with Pipeline_Depth_Less skip triangles, or blocks of them, that
+// are behind these bounds, and lower a block's bound when a triangle covers all of it; other pipelines
+// raise bounds where they write depth. (So bounds stay valid as long as every pipeline that writes
+// depths in rect is given this CoarseDepth.)
+struct CoarseDepth {
+	static constexpr int32_t BlockSize = 8;
+
+	//start with unknown (infinite) bounds for rect, whose corner must be a multiple of BlockSize:
+	void reset(PixelRect const &rect_, uint32_t samples_) {
+		rect = rect_;
+		samples = samples_;
+		blocks_x = (rect.x_end - rect.x_begin + BlockSize - 1) / BlockSize;
+		int32_t blocks_y = (rect.y_end - rect.y_begin + BlockSize - 1) / BlockSize;
+		max_depth.assign(size_t(blocks_x) * size_t(blocks_y) * samples, std::numeric_limits< float >::infinity());
+	}
+
+	//bound for sample s of the block containing pixel (x,y) (which must be in rect):
+	float &at(int32_t x, int32_t y, uint32_t s) {
+		return max_depth[(size_t((y - rect.y_begin) / BlockSize) * blocks_x + size_t((x - rect.x_begin) / BlockSize)) * samples + s];
+	}
+
+	PixelRect rect = PixelRect{0, 0, 0, 0};
+	uint32_t samples = 0;
+	int32_t blocks_x = 0;
+	std::vector< float > max_depth;
 };
 
 //A Pipeline processes vertices (fixed-length packets of opaque attributes):
@@ -76,6 +115,15 @@ struct Fragment {
 	std::array< Vec2, FD > derivatives; //derivatives of first FD attributes w.r.t. fb_position.x and fb_position.y
 };
 
+//With Pipeline_Sample_Coverage, triangles produce one fragment per pixel instead, which also
+// says which of the pixel's samples the triangle covers and how depth varies between them:
+template< uint32_t FA, uint32_t FD >
+struct CoverageFragment {
+	Fragment< FA, FD > fragment; //fragment at the pixel center
+	uint64_t coverage; //bit s is set if sample s is covered
+	Vec2 depth_slope; //derivatives of fb_position.z w.r.t. fb_position.x and fb_position.y
+};
+
 //And fragments are passed to a fragment program to create shaded fragments:
 struct ShadedFragment {
 	Vec3 fb_position; //position in "viewport" coordinates
@@ -112,14 +160,18 @@ struct Pipeline {
 
 	//(3) assembles these vertices into primitives of type primitive_type
 	//(4) clips the primitives (possibly producing more/fewer output primitives)
-	//uses one of these helpers, depending on the primitive type:
+	//uses one of these helpers, depending on the primitive type.
+	//NOTE: the helpers below take their callbacks as template functors (so that they inline into each
+	// pipeline's loops); they are defined in pipeline.cpp, so code that calls them must include it.
+	template< typename EmitVertex >
 	static void clip_line(
 		ShadedVertex const &a, ShadedVertex const &b, //input line (a,b)
-		std::function< void(ShadedVertex const &) > const &emit_vertex //called with vertices of clipped line (if non-empty)
+		EmitVertex &&emit_vertex //called as emit_vertex(ShadedVertex const &) with vertices of clipped line (if non-empty)
 	);
+	template< typename EmitVertex >
 	static void clip_triangle(
 		ShadedVertex const &a, ShadedVertex const &b, ShadedVertex const &c, //input triangle (a,b,c)
-		std::function< void(ShadedVertex const &) > const &emit_vertex //called with vertices of clipped triangle(s)
+		EmitVertex &&emit_vertex //called as emit_vertex(ShadedVertex const &) with vertices of clipped triangle(s)
 	);
 
 	//(5) divides by w and scales to compute positions in the framebuffer:
@@ -128,14 +180,37 @@ struct Pipeline {
 	//(6) rasterizes the primitives to produce Fragments:
 	using Fragment = ::Fragment< FA, FD >;
 
+	//With Pipeline_Depth_Less, rasterize() depth tests triangles' fragments before interpolating
+	// their attributes, against sample 'sample' of each pixel (and coarse depth, if given):
+	struct EarlyDepth {
+		Framebuffer const *framebuffer;
+		uint32_t sample;
+		CoarseDepth *coarse; //(may be null)
+	};
+
 	//rasterization uses one of these helper functions, depending on primitive type:
+	template< typename EmitFragment >
 	static void rasterize_line(
 		ClippedVertex const &a, ClippedVertex const &b, //line (a,b)
-		std::function< void(Fragment const &) > const &emit_fragment //call with every fragment covered by the line
+		EmitFragment &&emit_fragment //call as emit_fragment(Fragment const &) with every fragment covered by the line
 	);
+	template< typename EmitFragment >
 	static void rasterize_triangle(
 		ClippedVertex const &a, ClippedVertex const &b, ClippedVertex const &c, //triangle (a,b,c)
-		std::function< void(Fragment const &) > const &emit_fragment //call with every fragment covered by the triangle
+		EmitFragment &&emit_fragment, //call as emit_fragment(Fragment const &) with every fragment covered by the triangle
+		PixelRect const *scissor = nullptr, //if not null, only consider fragment centers within scissor
+		EarlyDepth const *early_depth = nullptr //if not null, skip fragments that would fail its depth test
+	);
+
+	//with Pipeline_Sample_Coverage, triangles are rasterized once for all samples instead:
+	using CoverageFragment = ::CoverageFragment< FA, FD >;
+	static constexpr uint32_t MaxCoverageSamples = 64; //(patterns with more samples are supersampled)
+	template< typename EmitFragment >
+	static void rasterize_triangle_coverage(
+		ClippedVertex const &a, ClippedVertex const &b, ClippedVertex const &c, //triangle (a,b,c)
+		std::vector< Vec3 > const &samples, //sample positions within a pixel (framebuffer.sample_pattern.centers_and_weights)
+		EmitFragment &&emit_fragment, //call as emit_fragment(CoverageFragment const &) for every pixel with a sample covered by the triangle
+		PixelRect const &bounds //only consider pixels within bounds
 	);
 
 	//(7) tests fragment depths vs depth buffer (based on flags)
@@ -150,4 +225,25 @@ struct Pipeline {
 	// parameters: global parameters for vertex and fragment programs
 	// framebuffer (must not be null): framebuffer to write results into
 	static void run(std::vector< Vertex > const &vertices, typename Program::Parameters const &parameters, Framebuffer *framebuffer);
+
+	//The tiled rasterizer (rasterizer.cpp) runs the same steps in two parts, so that each part can be split over threads:
+
+	//vertices per assembled primitive:
+	static constexpr uint32_t PrimitiveVertices = (primitive_type == PrimitiveType::Lines ? 2 : 3);
+
+	//(2-5) for vertices [begin,end) (a whole number of primitives), appending results to clipped_vertices:
+	static void shade_and_clip(std::vector< Vertex > const &vertices, size_t begin, size_t end, typename Program::Parameters const &parameters, Framebuffer const &framebuffer, std::vector< ClippedVertex > *clipped_vertices);
+
+	//(6-9) for clipped_vertices, in order; if tile is not null, only pixels within tile are written.
+	// Fragments are depth tested, shaded, and blended in batches of FragmentBatch as they are rasterized.
+	// coarse_depth (if not null) must cover the pixels written, and is kept up to date with them.
+	// (sample offsets are applied to clipped_vertices in place and undone again after each sample)
+	// returns the number of fragments that fell outside the framebuffer:
+	static constexpr uint32_t FragmentBatch = 64;
+	static uint32_t rasterize(std::vector< ClippedVertex > &clipped_vertices, typename Program::Parameters const &parameters, Framebuffer *framebuffer, PixelRect const *tile = nullptr, CoarseDepth *coarse_depth = nullptr);
+	// (rasterize() for triangles with Pipeline_Sample_Coverage, writing only to pixels in rect:)
+	static void rasterize_coverage(std::vector< ClippedVertex > const &clipped_vertices, typename Program::Parameters const &parameters, Framebuffer &framebuffer, PixelRect const &rect, CoarseDepth *coarse_depth);
+
+	//pixels that fragments of the primitive starting at clipped vertex 'primitive' may land in (conservative, clamped to the framebuffer):
+	static PixelRect bounds(ClippedVertex const *primitive, Framebuffer const &framebuffer);
 };
@@ -5,12 +5,13 @@
 #include "../scene/scene.h"
 #include "../geometry/util.h"
 #include "../util/timer.h"
+#include "../util/thread_pool.h"
 #include "pipeline.h"
 #include "programs.h"
 
 struct RasterJob {
-	//used to tell the job to quit early:
-	bool quit = false;
+	//used to tell the job to quit early (set by the caller's thread, read by the thread pool's):
+	std::atomic< bool > quit = false;
 
 	//scene data:
 	using Image = Textures::Image;
@@ -28,6 +29,9 @@ struct RasterJob {
 	using Lambertian_Triangles_Flat_Pipeline = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat >;
 	using Lambertian_Triangles_Smooth_Pipeline = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Screen >;
 	using Lambertian_Triangles_Correct_Pipeline = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Correct >;
+	using Lambertian_Triangles_Flat_MSAA_Pipeline = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat | Pipeline_Sample_Coverage >;
+	using Lambertian_Triangles_Smooth_MSAA_Pipeline = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Screen | Pipeline_Sample_Coverage >;
+	using Lambertian_Triangles_Correct_MSAA_Pipeline = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Correct | Pipeline_Sample_Coverage >;
 	using Lambertian_Lines_Pipeline = Pipeline< PrimitiveType::Lines, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat >;
 	using Lambertian_Vertex = Lambertian_Triangles_Correct_Pipeline::Vertex;
 
@@ -57,16 +61,111 @@ struct RasterJob {
 	//camera info:
 	Mat4 world_to_clip; //camera.proj() * camera.world_to_local()
 
+	//triangles use the *_MSAA_Pipelines when multisampling:
+	Rasterizer::Sampling sampling;
+
 	//reporting function:
 	std::function< void(Rasterizer::Render_Report) > report_fn;
 
 	//output:
 	Framebuffer framebuffer; //camera.film_width x camera.film_height with sampling pattern camera.film_sampling_pattern
-	
+
+	//Instances are drawn sort-middle: their primitives are shaded and clipped in chunks (in
+	// parallel), binned by the screen tiles they touch, and then each tile is rasterized, depth
+	// tested, and shaded by a task of its own (tiles share no pixels, so nothing is locked).
+	// Tiles draw their primitives in submission order, so the result is the same as drawing
+	// instances one after another.
+	static constexpr uint32_t TileSize = 64; //(pixels on a side)
+	static_assert(TileSize % CoarseDepth::BlockSize == 0, "Tiles are made of whole coarse depth blocks.");
+	static constexpr uint32_t ChunkPrimitives = 1024;
+	uint32_t tile_columns, tile_rows;
+
+	PixelRect tile_rect(uint32_t t) const {
+		int32_t x = int32_t(t % tile_columns * TileSize);
+		int32_t y = int32_t(t / tile_columns * TileSize);
+		return PixelRect{x, y, std::min(x + int32_t(TileSize), int32_t(framebuffer.width)), std::min(y + int32_t(TileSize), int32_t(framebuffer.height))};
+	}
+
+	//A run of primitives from one instance:
+	struct Chunk {
+		virtual ~Chunk() = default;
+		//shade and clip the chunk's primitives, and bin them by tile:
+		virtual void shade_and_clip(RasterJob const &job) = 0;
+		//draw the chunk's primitives that touch tile t (keeping the tile's coarse depth up to date):
+		virtual void rasterize(RasterJob &job, uint32_t t, CoarseDepth *coarse_depth) = 0;
+
+		//primitives touching tile t are binned[tile_begin[t] .. tile_begin[t+1]) (as the index of their first clipped vertex):
+		std::vector< uint32_t > tile_begin;
+		std::vector< uint32_t > binned;
+	};
+	template< typename P >
+	struct Pipeline_Chunk : Chunk {
+		Pipeline_Chunk(std::vector< typename P::Vertex > const &vertices_, size_t begin_, size_t end_, Programs::Lambertian::Parameters const &parameters_)
+			: vertices(vertices_), begin(begin_), end(end_), parameters(parameters_) {
+		}
+		std::vector< typename P::Vertex > const &vertices; //(in a Mesh, unchanged while drawing)
+		size_t begin, end;
+		Programs::Lambertian::Parameters parameters;
+		std::vector< typename P::ClippedVertex > clipped_vertices;
+
+		void shade_and_clip(RasterJob const &job) override {
+			P::shade_and_clip(vertices, begin, end, parameters, job.framebuffer, &clipped_vertices);
+
+			//count primitives per tile, then place them:
+			uint32_t primitives = uint32_t(clipped_vertices.size() / P::PrimitiveVertices);
+			std::vector< PixelRect > bounds;
+			bounds.reserve(primitives);
+			tile_begin.assign(job.tile_columns * job.tile_rows + 1, 0);
+			for (uint32_t p = 0; p < primitives; ++p) {
+				bounds.emplace_back(P::bounds(&clipped_vertices[p * P::PrimitiveVertices], job.framebuffer));
+				job.for_each_tile(bounds.back(), [&](uint32_t t) { tile_begin[t + 1] += 1; });
+			}
+			for (uint32_t t = 1; t < tile_begin.size(); ++t) {
+				tile_begin[t] += tile_begin[t - 1];
+			}
+			binned.resize(tile_begin.back());
+			std::vector< uint32_t > next(tile_begin.begin(), tile_begin.end() - 1);
+			for (uint32_t p = 0; p < primitives; ++p) {
+				job.for_each_tile(bounds[p], [&](uint32_t t) { binned[next[t]++] = p * P::PrimitiveVertices; });
+			}
+		}
+
+		void rasterize(RasterJob &job, uint32_t t, CoarseDepth *coarse_depth) override {
+			if (tile_begin.empty() || tile_begin[t] == tile_begin[t + 1]) return; //(empty if the job quit before binning)
+			//(copied, since rasterizing shifts vertices to each sample in turn)
+			thread_local std::vector< typename P::ClippedVertex > tile_vertices;
+			tile_vertices.clear();
+			for (uint32_t i = tile_begin[t]; i < tile_begin[t + 1]; ++i) {
+				auto first = clipped_vertices.begin() + binned[i];
+				tile_vertices.insert(tile_vertices.end(), first, first + P::PrimitiveVertices);
+			}
+			PixelRect tile = job.tile_rect(t);
+			P::rasterize(tile_vertices, parameters, &job.framebuffer, &tile, coarse_depth);
+		}
+	};
+
+	//call f(t) for each tile t that overlaps rect:
+	template< typename F >
+	void for_each_tile(PixelRect const &rect, F const &f) const {
+		if (rect.x_begin >= rect.x_end || rect.y_begin >= rect.y_end) return;
+		for (uint32_t ty = uint32_t(rect.y_begin) / TileSize; ty <= uint32_t(rect.y_end - 1) / TileSize; ++ty) {
+			for (uint32_t tx = uint32_t(rect.x_begin) / TileSize; tx <= uint32_t(rect.x_end - 1) / TileSize; ++tx) {
+				f(ty * tile_columns + tx);
+			}
+		}
+	}
+
+	//threads that shade, clip, and rasterize chunks and tiles (shared with the rest of the app; each step's tasks are a Group):
+	Thread_Pool &thread_pool;
+
 	//copy data into this raster job:
-	RasterJob(Scene const &scene, ::Instance::Camera const &camera, std::function< void(Rasterizer::Render_Report) > &&report_fn_)
-		: report_fn(report_fn_),
-		  framebuffer(camera.camera.lock()->film.width, camera.camera.lock()->film.height, *SamplePattern::from_id(camera.camera.lock()->film.sample_pattern)) {
+	RasterJob(Scene const &scene, ::Instance::Camera const &camera, std::function< void(Rasterizer::Render_Report) > &&report_fn_, Rasterizer::Sampling sampling_, Thread_Pool &thread_pool_)
+		: sampling(sampling_),
+		  report_fn(report_fn_),
+		  framebuffer(camera.camera.lock()->film.width, camera.camera.lock()->film.height, *SamplePattern::from_id(camera.camera.lock()->film.sample_pattern)),
+		  tile_columns((framebuffer.width + TileSize - 1) / TileSize),
+		  tile_rows((framebuffer.height + TileSize - 1) / TileSize),
+		  thread_pool(thread_pool_) {
 
 		//copy scene data:
 
@@ -294,8 +393,42 @@ struct RasterJob {
 		parameters.ground_energy = ground_energy;
 		parameters.sky_direction = sky_direction;
 
-		uint32_t done = 0;
-		uint32_t count = static_cast<uint32_t>(instances.size());
+		//convert meshes for drawing (each one once, in parallel):
+		std::vector< Mesh * > need_triangles, need_edges;
+		{
+			std::unordered_set< Mesh * > seen_triangles, seen_edges;
+			for (auto const &instance : instances) {
+				if (instance.material->type != Material::Type::Lambertian) continue;
+				if (instance.style == DrawStyle::Wireframe) {
+					if (seen_edges.emplace(instance.mesh).second) need_edges.emplace_back(instance.mesh);
+				} else {
+					if (seen_triangles.emplace(instance.mesh).second) need_triangles.emplace_back(instance.mesh);
+				}
+			}
+			Thread_Pool::Group mesh_tasks(thread_pool);
+			for (Mesh *mesh : need_edges) {
+				mesh_tasks.run([=]() { make_lamb_edges(mesh); });
+			}
+			for (Mesh *mesh : need_triangles) {
+				if (seen_edges.count(mesh)) continue; //(make_lamb_edges also makes triangles)
+				mesh_tasks.run([=]() { make_lamb_triangles(mesh); });
+			}
+		}
+
+		//split instances into chunks, in drawing order:
+		std::vector< std::unique_ptr< Chunk > > chunks;
+		auto add_chunks = [&](auto pipeline, std::vector< Lambertian_Vertex > const &vertices) {
+			using P = decltype(pipeline);
+			size_t const step = size_t(ChunkPrimitives) * P::PrimitiveVertices;
+			size_t const end = vertices.size() - vertices.size() % P::PrimitiveVertices;
+			for (size_t begin = 0; begin < end; begin += step) {
+				chunks.emplace_back(std::make_unique< Pipeline_Chunk< P > >(vertices, begin, std::min(begin + step, end), parameters));
+			}
+		};
+		auto add_triangle_chunks = [&](auto supersampled, auto multisampled, std::vector< Lambertian_Vertex > const &vertices) {
+			if (sampling == Rasterizer::Sampling::Multisample) add_chunks(multisampled, vertices);
+			else add_chunks(supersampled, vertices);
+		};
 
 		for (auto const &instance : instances) {
 			if (quit) break;
@@ -307,43 +440,72 @@ struct RasterJob {
 
 				std::string desc = "Rasterizing instance '" + instance.name + "'"; //DEBUG
 				if (instance.style == DrawStyle::Wireframe) {
-					make_lamb_edges(instance.mesh);
 					desc += " as wireframe (" + std::to_string(instance.mesh->source.faces.size()) + " faces converted to " + std::to_string(instance.mesh->lamb_edges.size()/2) + " lines)"; //DEBUG
 					info("%s",desc.c_str()); //DEBUG
-					Lambertian_Lines_Pipeline::run(instance.mesh->lamb_edges, parameters, &framebuffer);
+					add_chunks(Lambertian_Lines_Pipeline(), instance.mesh->lamb_edges);
 				} else if (instance.style == DrawStyle::Flat) {
-					make_lamb_triangles(instance.mesh);
 					desc += " as flat triangles (" + std::to_string(instance.mesh->source.faces.size()) + " faces converted to " + std::to_string(instance.mesh->lamb_triangles.size()/3) + " triangles)"; //DEBUG
 					info("%s",desc.c_str()); //DEBUG
-					Lambertian_Triangles_Flat_Pipeline::run(instance.mesh->lamb_triangles, parameters, &framebuffer);
+					add_triangle_chunks(Lambertian_Triangles_Flat_Pipeline(), Lambertian_Triangles_Flat_MSAA_Pipeline(), instance.mesh->lamb_triangles);
 				} else if (instance.style == DrawStyle::Smooth) {
-					make_lamb_triangles(instance.mesh);
 					desc += " as smooth triangles (" + std::to_string(instance.mesh->source.faces.size()) + " faces converted to " + std::to_string(instance.mesh->lamb_triangles.size()/3) + " triangles)"; //DEBUG
 					info("%s",desc.c_str()); //DEBUG
-					Lambertian_Triangles_Smooth_Pipeline::run(instance.mesh->lamb_triangles, parameters, &framebuffer);
+					add_triangle_chunks(Lambertian_Triangles_Smooth_Pipeline(), Lambertian_Triangles_Smooth_MSAA_Pipeline(), instance.mesh->lamb_triangles);
 				} else if (instance.style == DrawStyle::Correct) {
-					make_lamb_triangles(instance.mesh);
 					desc += " as perspective-correct triangles (" + std::to_string(instance.mesh->source.faces.size()) + " faces converted to " + std::to_string(instance.mesh->lamb_triangles.size()/3) + " triangles)"; //DEBUG
 					info("%s",desc.c_str()); //DEBUG
-					Lambertian_Triangles_Correct_Pipeline::run(instance.mesh->lamb_triangles, parameters, &framebuffer);
+					add_triangle_chunks(Lambertian_Triangles_Correct_Pipeline(), Lambertian_Triangles_Correct_MSAA_Pipeline(), instance.mesh->lamb_triangles);
 				} else {
 					desc = "!!!SKIPPING!!! instance '" + instance.name + "' (unknown draw style)"; //DEBUG
 				}
 			} else {
 				//TODO: other material types!
 			}
-			done += 1;
-			report_fn(std::make_pair(done / float(count), framebuffer.resolve_colors()));
 		}
+
+		//shade, clip, and bin chunks:
+		{
+			Thread_Pool::Group chunk_tasks(thread_pool);
+			for (auto &chunk : chunks) {
+				chunk_tasks.run([this, chunk = chunk.get()]() {
+					if (!quit) chunk->shade_and_clip(*this);
+				});
+			}
+		}
+
+		//rasterize tiles, each drawing the chunks in order; tiles go in batches of whole rows
+		// (at least one tile per thread), with a progress report after each batch:
+		uint32_t const tiles = tile_columns * tile_rows;
+		uint32_t const batch_rows = std::max(1u, (thread_pool.size() + tile_columns - 1) / std::max(tile_columns, 1u));
+		for (uint32_t begin = 0; begin < tiles; begin += batch_rows * tile_columns) {
+			uint32_t end = std::min(begin + batch_rows * tile_columns, tiles);
+			{
+				Thread_Pool::Group tile_tasks(thread_pool);
+				for (uint32_t t = begin; t < end; ++t) {
+					tile_tasks.run([this, t, &chunks]() {
+						//(lets triangles behind what the tile's earlier chunks drew be skipped)
+						CoarseDepth coarse_depth;
+						coarse_depth.reset(tile_rect(t), uint32_t(framebuffer.sample_pattern.centers_and_weights.size()));
+						for (auto &chunk : chunks) {
+							if (quit) return;
+							chunk->rasterize(*this, t, &coarse_depth);
+						}
+					});
+				}
+			}
+			if (quit) return; //(the image is incomplete, so don't report it as done)
+			if (end < tiles) report_fn(std::make_pair(end / float(tiles), framebuffer.resolve_colors()));
+		}
+
+		if (quit) return;
 		report_fn(std::make_pair(1.0f, framebuffer.resolve_colors()));
-		
 	}
 };
 
-Rasterizer::Rasterizer(Scene const &scene, Instance::Camera const &camera, std::function< void(Render_Report) > &&report_fn) {
+Rasterizer::Rasterizer(Scene const &scene, Instance::Camera const &camera, std::function< void(Render_Report) > &&report_fn, Thread_Pool &thread_pool, Sampling sampling) {
 
 	//copy data into the rasterization job:
-	job = std::make_unique< RasterJob >(scene, camera, std::move(report_fn));
+	job = std::make_unique< RasterJob >(scene, camera, std::move(report_fn), sampling, thread_pool);
 
 	//get pointer to output framebuffer (for later use):
 	framebuffer = &job->framebuffer;
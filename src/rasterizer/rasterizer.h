@@ -11,6 +11,7 @@
  */
 
 #include <string>
+#include <functional>
 #include <future>
 
 #include "../util/hdr_image.h"
@@ -18,6 +19,7 @@
 class Scene;
 struct RasterJob;
 struct Framebuffer;
+class Thread_Pool;
 namespace Instance { class Camera; };
 
 class Rasterizer {
@@ -32,12 +34,20 @@ public:
 	};
 	*/
 
+	//how triangles are drawn to the film's sample pattern:
+	enum class Sampling {
+		Supersample, //rasterize and shade every sample separately
+		Multisample, //rasterize and shade once per pixel, writing to the samples covered (coverage-mask MSAA)
+	};
+
 	//to start rendering a scene, construct a Rasterizer and pass the scene and camera through which to render it.
 	// relevant data from scene and camera will be copied (you can delete or modify them during the render)
 	// camera does not need to be member of the scene
 	// report_fn will be called with updates on progress and copies of the image produced so far.
 	//    (report_fn will run in a separate thread! be careful to synchronize.)
-	Rasterizer(Scene const &scene, Instance::Camera const &camera, std::function< void(Render_Report) > &&report_fn);
+	// thread_pool runs the rasterization work; it should outlive the Rasterizer, and is meant to be
+	//    a long-lived pool shared with the rest of the app (e.g., the Pathtracer's), not one per render.
+	Rasterizer(Scene const &scene, Instance::Camera const &camera, std::function< void(Render_Report) > &&report_fn, Thread_Pool &thread_pool, Sampling sampling = Sampling::Supersample);
 
 	//Destroying the rasterizer will cancel rasterization:
 	~Rasterizer();
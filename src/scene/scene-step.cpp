@@ -47,22 +47,25 @@ Scene::Collision Scene::build_collision(bool use_bvh, Thread_Pool *thread_pool)
 
 	//first, convert all meshes -> PT::Tri_Mesh
 	if (thread_pool) {
-		std::vector<std::future<std::pair<Halfedge_Mesh const *, PT::Tri_Mesh>>> mesh_futs;
+		//(each task converts into its own slot of converted)
+		std::vector<std::pair<Halfedge_Mesh const *, PT::Tri_Mesh>> converted(meshes.size() + skinned_meshes.size());
+		Thread_Pool::Group mesh_tasks(*thread_pool);
+		size_t slot = 0;
 
 		for (const auto& [name, mesh] : meshes) {
-			mesh_futs.emplace_back(thread_pool->enqueue([name=name,mesh=mesh,use_bvh]() {
-				return std::pair{const_cast< const Halfedge_Mesh * >(mesh.get()), PT::Tri_Mesh(Indexed_Mesh::from_halfedge_mesh(*mesh, Indexed_Mesh::SplitEdges), use_bvh)};
-			}));
+			mesh_tasks.run([&out=converted[slot++],mesh=mesh,use_bvh,thread_pool]() {
+				out = std::pair{const_cast< const Halfedge_Mesh * >(mesh.get()), PT::Tri_Mesh(Indexed_Mesh::from_halfedge_mesh(*mesh, Indexed_Mesh::SplitEdges), use_bvh, thread_pool)};
+			});
 		}
 
 		for (const auto& [name, mesh] : skinned_meshes) {
-			mesh_futs.emplace_back(thread_pool->enqueue([name=name,mesh=mesh,use_bvh]() {
-				return std::pair{const_cast< const Halfedge_Mesh * >(&mesh->mesh), PT::Tri_Mesh(mesh->posed_mesh(), use_bvh)};
-			}));
+			mesh_tasks.run([&out=converted[slot++],mesh=mesh,use_bvh,thread_pool]() {
+				out = std::pair{const_cast< const Halfedge_Mesh * >(&mesh->mesh), PT::Tri_Mesh(mesh->posed_mesh(), use_bvh, thread_pool)};
+			});
 		}
 
-		for (auto& f : mesh_futs) {
-			auto [ptr, mesh] = f.get();
+		mesh_tasks.wait();
+		for (auto& [ptr, mesh] : converted) {
 			collision.meshes.emplace(ptr, std::move(mesh));
 		}
 	} else {
@@ -114,7 +117,7 @@ Scene::Collision Scene::build_collision(bool use_bvh, Thread_Pool *thread_pool)
 	}
 
 	if (use_bvh) {
-		collision.world = PT::Aggregate(PT::BVH<PT::Instance>(std::move(objects)));
+		collision.world = PT::Aggregate(PT::BVH<PT::Instance>(std::move(objects), 1, PT::BVH<PT::Instance>::default_buckets, thread_pool));
 	} else {
 		collision.world = PT::Aggregate(PT::List<PT::Instance>(std::move(objects)));
 	}
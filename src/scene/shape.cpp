@@ -76,6 +76,21 @@ PT::Trace Sphere::hit(Ray ray) const {
   return ret;
 }
 
+bool Sphere::occluded(Ray ray) const {
+	float a = ray.dir.norm_squared();
+	float b = 2.0f * dot(ray.point, ray.dir);
+	float c = ray.point.norm_squared() - radius * radius;
+
+	float discriminant = b * b - 4.0f * a * c;
+	if (discriminant <= 0.0f) return false;
+
+	float root = std::sqrt(discriminant);
+	float t1 = (-b - root) / (2.0f * a);
+	float t2 = (-b + root) / (2.0f * a);
+	return (t1 >= ray.dist_bounds.x && t1 <= ray.dist_bounds.y) ||
+	       (t2 >= ray.dist_bounds.x && t2 <= ray.dist_bounds.y);
+}
+
 Vec3 Sphere::sample(RNG &rng, Vec3 from) const {
 	die("Sampling sphere area lights is not implemented yet.");
 }
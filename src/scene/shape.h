@@ -22,6 +22,7 @@ public:
 
 	BBox bbox() const;
 	PT::Trace hit(Ray ray) const;
+	bool occluded(Ray ray) const;
 	Vec3 sample(RNG &rng, Vec3 from) const;
 	float pdf(Ray ray, Mat4 pdf_T = Mat4::I, Mat4 pdf_iT = Mat4::I) const;
 
@@ -55,6 +56,10 @@ public:
 		return std::visit([&](auto& s) { return s.hit(ray); }, shape);
 	}
 
+	bool occluded(Ray ray) const {
+		return std::visit([&](auto& s) { return s.occluded(ray); }, shape);
+	}
+
 	Vec3 sample(RNG &rng, Vec3 from) const {
 		return std::visit([&](auto& s) { return s.sample(rng, from); }, shape);
 	}
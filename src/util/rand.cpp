@@ -15,15 +15,19 @@ RNG::RNG(uint32_t seed) {
 }
 
 float RNG::unit() {
+	//(24 bits, so the result is always below 1)
+	if (_sequence != Sequence::Mersenne) return float(next() >> 8) * 0x1p-24f;
 	//not using std::uniform_real_distribution because it has different behavior on different standard libraries
 	static_assert(decltype(mt)::min() == 0 && decltype(mt)::max() == 0xffffffff, "Mersenne Twister has the expected range.");
 	return std::scalbn(float(mt()), -32);
 }
 
 int32_t RNG::integer(int32_t min, int32_t max) {
+	uint64_t size = int64_t(max) - int64_t(min);
+	//(one draw per call, so each call is one dimension)
+	if (_sequence != Sequence::Mersenne) return int32_t(int64_t((uint64_t(next()) * size) >> 32) + int64_t(min));
 	//not using std::uniform_int_distribution because it has different behavior on different standard libraries
 	static_assert(decltype(mt)::min() == 0 && decltype(mt)::max() == 0xffffffff, "Mersenne Twister has the expected range.");
-	uint64_t size = int64_t(max) - int64_t(min);
 	//true, but for readability will not do it: static_assert(int64_t(std::numeric_limits< int32_t >::max()) - int64_t(std::numeric_limits< int32_t >::min()) == std::numeric_limits< uint32_t >::max(), "range size fits into uint32_t");
 	//maximum value such that (max_val + 1) is a multiple of size:
 	uint32_t max_val = static_cast<uint32_t>(0x100000000ull / size * size - 1ull);
@@ -58,3 +62,122 @@ void RNG::random_seed() {
 uint32_t RNG::get_seed() {
 	return _seed;
 }
+
+//- - - - - - - - - - - - - - - - - - - -
+//Independent and Sobol sequences.
+//Sobol points are scrambled and shuffled as in Burley, "Practical Hash-based Owen Scrambling" (JCGT 2020).
+
+//PCG-based 32-bit hash (Jarzynski and Olano, "Hash Functions for GPU Rendering"):
+static uint32_t pcg_hash(uint32_t v) {
+	uint32_t state = v * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+static uint32_t hash_combine(uint32_t seed, uint32_t v) {
+	return seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+static uint32_t reverse_bits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+//Owen scramble of x's bits (each bit flipped depending on the bits above it):
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+	x = reverse_bits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverse_bits(x);
+}
+
+//direction numbers for the first four Sobol dimensions (primitive polynomials and initial
+// values from Joe and Kuo's table):
+struct Sobol_Directions {
+	uint32_t v[4][32];
+	Sobol_Directions() {
+		struct Polynomial {
+			uint32_t s, a;
+			uint32_t m[3];
+		};
+		const Polynomial polynomials[3] = {{1, 0, {1}}, {2, 1, {1, 3}}, {3, 1, {1, 3, 1}}};
+		for (uint32_t i = 0; i < 32; i++) v[0][i] = 1u << (31 - i);
+		for (uint32_t d = 1; d < 4; d++) {
+			const Polynomial& p = polynomials[d - 1];
+			for (uint32_t i = 0; i < 32; i++) {
+				if (i < p.s) {
+					v[d][i] = p.m[i] << (31 - i);
+				} else {
+					v[d][i] = v[d][i - p.s] ^ (v[d][i - p.s] >> p.s);
+					for (uint32_t k = 1; k < p.s; k++) {
+						if ((p.a >> (p.s - 1 - k)) & 1) v[d][i] ^= v[d][i - k];
+					}
+				}
+			}
+		}
+	}
+};
+//the same, as xor tables for each byte of the index (so a point takes four lookups per dimension):
+struct Sobol_Tables {
+	uint32_t t[4][4][256];
+	Sobol_Tables() {
+		Sobol_Directions directions;
+		for (uint32_t d = 0; d < 4; d++) {
+			for (uint32_t byte = 0; byte < 4; byte++) {
+				for (uint32_t b = 0; b < 256; b++) {
+					uint32_t x = 0;
+					for (uint32_t bit = 0; bit < 8; bit++) {
+						if (b & (1u << bit)) x ^= directions.v[d][8 * byte + bit];
+					}
+					t[d][byte][b] = x;
+				}
+			}
+		}
+	}
+};
+static const Sobol_Tables sobol_tables;
+
+static uint32_t sobol(uint32_t index, uint32_t dimension) {
+	const auto& t = sobol_tables.t[dimension];
+	return t[0][index & 0xff] ^ t[1][(index >> 8) & 0xff] ^ t[2][(index >> 16) & 0xff] ^ t[3][index >> 24];
+}
+
+void RNG::use(Sequence sequence) {
+	_sequence = sequence;
+}
+
+RNG::Sequence RNG::sequence() const {
+	return _sequence;
+}
+
+void RNG::start_sample(uint32_t seed, uint32_t px, uint32_t py, uint32_t index) {
+	_sample.seed = pcg_hash(hash_combine(hash_combine(pcg_hash(seed), px), py));
+	_sample.index = index;
+	_sample.dimension = 0;
+}
+
+const RNG::Sample& RNG::sample() const {
+	return _sample;
+}
+
+void RNG::resume(const Sample& sample) {
+	_sample = sample;
+}
+
+uint32_t RNG::next() {
+	uint32_t dimension = _sample.dimension++;
+	if (_sequence == Sequence::Independent) {
+		return pcg_hash(pcg_hash(hash_combine(_sample.seed, _sample.index)) ^ pcg_hash(dimension));
+	}
+	//each group of four dimensions is a 4D Sobol point, with the sample index shuffled
+	// (differently per group, so groups aren't correlated) and its components scrambled:
+	uint32_t group_seed = pcg_hash(hash_combine(_sample.seed, dimension / 4));
+	uint32_t index = nested_uniform_scramble(_sample.index, group_seed);
+	return nested_uniform_scramble(sobol(index, dimension % 4), hash_combine(group_seed, dimension % 4));
+}
@@ -28,7 +28,35 @@ struct RNG {
 
 	static inline uint32_t fixed_seed = 0; //0 = 'pick a new seed every render', otherwise use as seed
 
+	//Sequences unit(), integer() and coin_flip() can draw from:
+	enum class Sequence : uint8_t {
+		Mersenne,    //the mt19937 stream set up by seed() (the default)
+		Independent, //uniform numbers hashed (PCG-style) from sample and dimension
+		Sobol,       //Owen-scrambled, index-shuffled Sobol points, in groups of four dimensions
+	};
+	//Independent and Sobol draws are points of a sample, one dimension per draw, starting from
+	// start_sample(). Their whole state is this (vs. mt19937's 624 words), so callers interleaving
+	// many samples can keep one per sample and resume() it:
+	struct Sample {
+		uint32_t seed = 0;      //hash of render seed and pixel
+		uint32_t index = 0;     //index of the sample within its pixel
+		uint32_t dimension = 0; //next dimension to draw
+	};
+
+	void use(Sequence sequence);
+	Sequence sequence() const;
+	//start drawing sample 'index' of pixel (px,py) for a render with the given seed:
+	// (does nothing for the Mersenne sequence)
+	void start_sample(uint32_t seed, uint32_t px, uint32_t py, uint32_t index);
+	const Sample& sample() const;
+	void resume(const Sample& sample);
+
 	std::mt19937 mt;
 private:
 	uint32_t _seed = 0;
+	Sequence _sequence = Sequence::Mersenne;
+	Sample _sample;
+
+	//next 32 random bits from a non-Mersenne sequence:
+	uint32_t next();
 };
@@ -0,0 +1,161 @@
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//A bounded, uniformly random subset of everything add()ed, for logs that may be fed without
+// limit from many threads. Each thread adds to its own ring of slots without locking, choosing
+// which slot a new item replaces by reservoir sampling; snapshot() copies the slots out while
+// adds go on, skipping any slot being written at that moment (each slot is a small seqlock).
+template<typename T> class Reservoir {
+	static_assert(std::is_trivially_copyable_v<T>, "reservoir items are copied word by word");
+
+public:
+	explicit Reservoir(uint32_t capacity_per_thread) : capacity(capacity_per_thread) {
+	}
+	Reservoir(const Reservoir&) = delete;
+	Reservoir& operator=(const Reservoir&) = delete;
+
+	//keep item (or not) in the calling thread's ring:
+	void add(T const& item) {
+		Ring& ring = local_ring();
+		uint64_t seen = ring.seen.load(std::memory_order_relaxed) + 1;
+		ring.seen.store(seen, std::memory_order_relaxed);
+		uint64_t slot = seen - 1;
+		if (slot >= capacity) {
+			//(the n'th item replaces a random slot with probability capacity/n)
+			slot = ring.random() % seen;
+			if (slot >= capacity) return;
+		}
+		ring.slots[slot].write(item);
+		if (slot >= ring.filled.load(std::memory_order_relaxed)) {
+			ring.filled.store(uint32_t(slot) + 1, std::memory_order_release);
+		}
+	}
+
+	//Copy out the kept items. Threads that added more items keep a smaller fraction of them, so
+	// the other threads' items are thinned to the same fraction, keeping the result uniform:
+	std::vector<T> snapshot() const {
+		std::lock_guard<std::mutex> lock(rings_mut);
+		double fraction = 1.0;
+		for (auto const& ring : rings) {
+			uint64_t seen = ring->seen.load(std::memory_order_relaxed);
+			if (seen > capacity) fraction = std::min(fraction, double(capacity) / double(seen));
+		}
+
+		std::vector<T> items;
+		for (auto const& ring : rings) {
+			uint64_t seen = ring->seen.load(std::memory_order_relaxed);
+			uint32_t filled = ring->filled.load(std::memory_order_acquire);
+			//keep each slot with probability fraction / (fraction of this ring's items kept):
+			double keep = seen > capacity ? fraction * double(seen) / double(capacity) : fraction;
+			uint64_t state = 0x9e3779b97f4a7c15ull;
+			for (uint32_t s = 0; s < filled; s++) {
+				if (keep < 1.0 && double(next_random(state) >> 11) * 0x1.0p-53 >= keep) continue;
+				T item;
+				if (ring->slots[s].read(item)) items.emplace_back(item);
+			}
+		}
+		return items;
+	}
+
+	//number of items add()ed (kept or not) since the last clear():
+	uint64_t seen() const {
+		std::lock_guard<std::mutex> lock(rings_mut);
+		uint64_t total = 0;
+		for (auto const& ring : rings) total += ring->seen.load(std::memory_order_relaxed);
+		return total;
+	}
+
+	//drop everything (not while other threads add()):
+	void clear() {
+		std::lock_guard<std::mutex> lock(rings_mut);
+		rings.clear();
+		id = next_id();
+	}
+
+private:
+	//One item, stored as atomic words so that reading it during a write is merely a retry
+	// (odd sequence: being written; changed sequence: was written while read):
+	struct Slot {
+		static constexpr size_t n_words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+		std::atomic<uint32_t> sequence{0};
+		std::atomic<uint64_t> words[n_words] = {};
+
+		void write(T const& item) {
+			uint64_t buffer[n_words] = {};
+			std::memcpy(buffer, &item, sizeof(T));
+			uint32_t s = sequence.load(std::memory_order_relaxed);
+			sequence.store(s + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			for (size_t w = 0; w < n_words; w++) words[w].store(buffer[w], std::memory_order_relaxed);
+			sequence.store(s + 2, std::memory_order_release);
+		}
+		bool read(T& item) const {
+			uint32_t before = sequence.load(std::memory_order_acquire);
+			if (before & 1) return false;
+			uint64_t buffer[n_words];
+			for (size_t w = 0; w < n_words; w++) buffer[w] = words[w].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence.load(std::memory_order_relaxed) != before) return false;
+			std::memcpy(&item, buffer, sizeof(T));
+			return true;
+		}
+	};
+
+	struct Ring {
+		Ring(uint32_t capacity, uint64_t seed) : slots(new Slot[capacity]), state(seed) {
+		}
+		std::thread::id owner = std::this_thread::get_id();
+		std::unique_ptr<Slot[]> slots;
+		std::atomic<uint64_t> seen{0};   //(written by the owner only)
+		std::atomic<uint32_t> filled{0}; //slots [0,filled) hold items
+		uint64_t state;                  //(the owner's random numbers)
+		uint64_t random() {
+			return next_random(state);
+		}
+	};
+
+	//xorshift64*:
+	static uint64_t next_random(uint64_t& state) {
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545f4914f6cdd1dull;
+	}
+
+	static uint64_t next_id() {
+		static std::atomic<uint64_t> ids{0};
+		return ++ids;
+	}
+
+	//the calling thread's ring (found once per thread, then remembered until clear()):
+	Ring& local_ring() {
+		thread_local struct {
+			uint64_t id = 0;
+			Ring* ring = nullptr;
+		} cached;
+		if (cached.id == id && cached.ring) return *cached.ring;
+
+		std::lock_guard<std::mutex> lock(rings_mut);
+		cached.id = id;
+		for (auto const& ring : rings) {
+			if (ring->owner == std::this_thread::get_id()) return *(cached.ring = ring.get());
+		}
+		rings.emplace_back(std::make_unique<Ring>(capacity, 0x853c49e6748fea9bull + 0x9e3779b97f4a7c15ull * rings.size()));
+		return *(cached.ring = rings.back().get());
+	}
+
+	const uint32_t capacity;
+	uint64_t id = next_id(); //(distinguishes this reservoir, and each clear() of it, in threads' caches)
+	mutable std::mutex rings_mut;
+	std::vector<std::unique_ptr<Ring>> rings;
+};
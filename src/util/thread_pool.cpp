@@ -1,71 +1,157 @@
 
 #include "thread_pool.h"
-#include "../util/rand.h"
 
-Thread_Pool::Thread_Pool(uint32_t threads) {
-	start(threads);
+//the pool (if any) whose worker this thread is, and its index there:
+static thread_local const Thread_Pool* worker_pool = nullptr;
+static thread_local uint32_t worker_index = 0;
+
+Thread_Pool::Thread_Pool(uint32_t threads) : n_threads(threads) {
+	for (uint32_t i = 0; i <= threads; i++) queues.emplace_back(std::make_unique<Queue>());
+	for (uint32_t i = 0; i < threads; i++) workers.emplace_back([this, i] { work(i); });
 }
 
 Thread_Pool::~Thread_Pool() {
 	stop();
 }
 
-void Thread_Pool::start(uint32_t threads) {
-	n_threads = threads;
-	stop_now = false;
-	stop_when_done = false;
-	for (uint32_t i = 0; i < threads; i++)
-		workers.emplace_back([this] {
-			for (;;) {
-				std::function<void()> task;
-				{
-					std::unique_lock<std::mutex> lock(this->queue_mutex);
-					this->condition.wait(lock, [this] {
-						return this->stop_now || this->stop_when_done || !this->tasks.empty();
-					});
-					if (this->stop_now || (this->stop_when_done && this->tasks.empty())) return;
-					task = std::move(this->tasks.front());
-					this->tasks.pop();
-				}
-				task();
-			}
-		});
+void Thread_Pool::push(Task&& task) {
+	assert(!stopping);
+	Queue& queue = *queues[worker_pool == this ? worker_index : n_threads];
+	queued.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> lock(queue.mut);
+		queue.tasks.emplace_back(std::move(task));
+	}
+	//(sleeping workers re-check queued under sleep_mut before waiting, so this can't miss them)
+	if (sleeping.load() > 0) {
+		std::lock_guard<std::mutex> lock(sleep_mut);
+		wake.notify_one();
+	}
 }
 
-void Thread_Pool::clear() {
-	stop();
-	start(n_threads);
+bool Thread_Pool::pop(Task& task) {
+	if (queued.load() == 0) return false;
+
+	auto take = [&](Queue& queue, bool newest) {
+		std::lock_guard<std::mutex> lock(queue.mut);
+		if (queue.tasks.empty()) return false;
+		if (newest) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		} else {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		running.fetch_add(1);
+		queued.fetch_sub(1);
+		return true;
+	};
+
+	uint32_t self = worker_pool == this ? worker_index : n_threads;
+	if (self < n_threads && take(*queues[self], true)) return true;
+	if (take(*queues[n_threads], false)) return true;
+	for (uint32_t i = 1; i <= n_threads; i++) {
+		uint32_t victim = (self + i) % (n_threads + 1);
+		if (victim != n_threads && take(*queues[victim], false)) return true;
+	}
+	return false;
+}
+
+void Thread_Pool::execute(Task& task) {
+	task();
+	task.reset();
+	if (running.fetch_sub(1) == 1) {
+		std::lock_guard<std::mutex> lock(sleep_mut);
+		idle.notify_all();
+	}
+}
+
+void Thread_Pool::work(uint32_t index) {
+	worker_pool = this;
+	worker_index = index;
+	Task task;
+	while (!stopping) {
+		if (pop(task)) {
+			execute(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mut);
+		sleeping.fetch_add(1);
+		wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+		sleeping.fetch_sub(1);
+	}
+}
+
+bool Thread_Pool::run_one() {
+	Task task;
+	if (!pop(task)) return false;
+	execute(task);
+	return true;
+}
+
+void Thread_Pool::drop_queued() {
+	for (auto& queue : queues) {
+		std::deque<Task> dropped;
+		{
+			std::lock_guard<std::mutex> lock(queue->mut);
+			std::swap(dropped, queue->tasks);
+			queued.fetch_sub(uint32_t(dropped.size()));
+		}
+		//(dropped tasks are destroyed outside the lock, since that may mark group tasks done)
+	}
 }
 
 void Thread_Pool::wait() {
+	for (;;) {
+		if (run_one()) continue;
+		std::unique_lock<std::mutex> lock(sleep_mut);
+		if (idle.wait_for(lock, std::chrono::microseconds(100), [this] { return running.load() == 0; }) &&
+		    queued.load() == 0) {
+			return;
+		}
+	}
+}
 
+void Thread_Pool::stop() {
 	{
-		std::unique_lock<std::mutex> lock(queue_mutex);
-		stop_when_done = true;
+		std::lock_guard<std::mutex> lock(sleep_mut);
+		stopping = true;
 	}
-
-	condition.notify_all();
+	wake.notify_all();
 	for (std::thread& worker : workers) {
 		worker.join();
 	}
 	workers.clear();
+	drop_queued();
+}
 
-	start(n_threads);
+void Thread_Pool::Group::finish() {
+	std::lock_guard<std::mutex> lock(mut);
+	if (--pending == 0) finished.notify_all();
 }
 
-void Thread_Pool::stop() {
+void Thread_Pool::Group::fail(std::exception_ptr error_) {
+	std::lock_guard<std::mutex> lock(mut);
+	if (!error) error = error_;
+}
 
+void Thread_Pool::Group::wait() {
+	join();
+	std::exception_ptr thrown;
 	{
-		std::unique_lock<std::mutex> lock(queue_mutex);
-		stop_now = true;
+		std::lock_guard<std::mutex> lock(mut);
+		std::swap(thrown, error);
 	}
+	if (thrown) std::rethrow_exception(thrown);
+}
 
-	condition.notify_all();
-	for (std::thread& worker : workers) {
-		worker.join();
+void Thread_Pool::Group::join() {
+	std::unique_lock<std::mutex> lock(mut);
+	while (pending > 0) {
+		lock.unlock();
+		bool ran = pool.run_one();
+		lock.lock();
+		//(the timeout lets this go back to helping if the tasks it waits on are stuck behind queued ones)
+		if (!ran && pending > 0) finished.wait_for(lock, std::chrono::microseconds(100));
 	}
-	workers.clear();
-
-	std::queue<std::function<void()>> empty;
-	std::swap(tasks, empty);
 }
@@ -1,50 +1,247 @@
 
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <thread>
 
 #include "../lib/log.h"
 
+//Work-stealing thread pool: each worker has its own deque of tasks, runs the newest of them
+// first (so nested tasks stay cache-warm), and steals the oldest tasks of other workers when
+// it runs out. Tasks queued from threads outside the pool go to a shared queue.
 class Thread_Pool {
 public:
 	Thread_Pool(uint32_t threads);
 	~Thread_Pool();
 
+	//drop queued tasks and join the workers (the pool can't be used afterward):
 	void stop();
+	//run queued tasks (and any they queue) until none are left or running:
 	void wait();
-	void clear();
+
+	//A queued callable; small ones (most tasks) are stored inline, so queueing them doesn't allocate:
+	class Task {
+	public:
+		Task() = default;
+		template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+		Task(F&& f) {
+			using T = std::decay_t<F>;
+			if constexpr (sizeof(T) <= sizeof(storage) && alignof(T) <= alignof(std::max_align_t) &&
+			              std::is_nothrow_move_constructible_v<T>) {
+				new (storage) T(std::forward<F>(f));
+				ops = &inline_ops<T>;
+			} else {
+				new (storage) T*(new T(std::forward<F>(f)));
+				ops = &heap_ops<T>;
+			}
+		}
+		Task(Task&& src) noexcept {
+			take(src);
+		}
+		Task& operator=(Task&& src) noexcept {
+			if (this != &src) {
+				reset();
+				take(src);
+			}
+			return *this;
+		}
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+		~Task() {
+			reset();
+		}
+
+		void operator()() {
+			ops->call(storage);
+		}
+		explicit operator bool() const {
+			return ops != nullptr;
+		}
+		//destroy the callable (and whatever it captured):
+		void reset() {
+			if (ops) ops->destroy(storage);
+			ops = nullptr;
+		}
+
+	private:
+		struct Ops {
+			void (*call)(void*);
+			void (*move)(void* from, void* to);
+			void (*destroy)(void*);
+		};
+		template<typename T> static void call_inline(void* at) {
+			(*static_cast<T*>(at))();
+		}
+		template<typename T> static void move_inline(void* from, void* to) {
+			new (to) T(std::move(*static_cast<T*>(from)));
+			static_cast<T*>(from)->~T();
+		}
+		template<typename T> static void destroy_inline(void* at) {
+			static_cast<T*>(at)->~T();
+		}
+		template<typename T> static void call_heap(void* at) {
+			(**static_cast<T**>(at))();
+		}
+		template<typename T> static void move_heap(void* from, void* to) {
+			*static_cast<T**>(to) = *static_cast<T**>(from);
+		}
+		template<typename T> static void destroy_heap(void* at) {
+			delete *static_cast<T**>(at);
+		}
+		template<typename T> static constexpr Ops inline_ops = {call_inline<T>, move_inline<T>, destroy_inline<T>};
+		template<typename T> static constexpr Ops heap_ops = {call_heap<T>, move_heap<T>, destroy_heap<T>};
+
+		void take(Task& src) {
+			if (src.ops) src.ops->move(src.storage, storage);
+			ops = src.ops;
+			src.ops = nullptr;
+		}
+
+		alignas(std::max_align_t) unsigned char storage[56];
+		const Ops* ops = nullptr;
+	};
+
+	//Tasks that are waited on together, without futures. The group also serves as their
+	// cancellation token: after cancel(), tasks that haven't started are skipped, and running
+	// ones may poll cancelled() to stop early. Cancelling a group never affects other groups.
+	// An exception thrown by a task is caught and rethrown (the first one, if several throw) by
+	// the next wait(); the destructor waits too, but drops any exception nobody waited for.
+	class Group {
+	public:
+		explicit Group(Thread_Pool& pool) : pool(pool) {
+		}
+		~Group() {
+			join();
+		}
+		Group(const Group&) = delete;
+		Group& operator=(const Group&) = delete;
+
+		template<typename F> void run(F&& f) {
+			{
+				std::lock_guard<std::mutex> lock(mut);
+				pending++;
+			}
+			pool.push(Task(Group_Task<std::decay_t<F>>{Done{this}, std::forward<F>(f)}));
+		}
+
+		//wait until every task run() so far has finished (or been skipped or dropped),
+		// running queued tasks meanwhile (so tasks may safely wait on groups of their own),
+		// then rethrow the first exception one of them threw:
+		void wait();
+
+		void cancel() {
+			cancel_flag.store(true, std::memory_order_relaxed);
+		}
+		bool cancelled() const {
+			return cancel_flag.load(std::memory_order_relaxed);
+		}
+		//clear the cancellation (call once the group is waited on, to use it again):
+		void reset() {
+			cancel_flag.store(false, std::memory_order_relaxed);
+		}
+
+	private:
+		//marks a task done when destroyed -- after running, or when dropped from the queue:
+		struct Done {
+			Group* group;
+			Done(Group* group) : group(group) {
+			}
+			Done(Done&& src) noexcept : group(src.group) {
+				src.group = nullptr;
+			}
+			Done(const Done&) = delete;
+			~Done() {
+				if (group) group->finish();
+			}
+		};
+		//(done is declared first, so it is destroyed last, after anything f captured)
+		template<typename F> struct Group_Task {
+			Done done;
+			F f;
+			void operator()() {
+				if (done.group->cancelled()) return;
+				try {
+					f();
+				} catch (...) {
+					done.group->fail(std::current_exception());
+				}
+			}
+		};
+		void finish();
+		void fail(std::exception_ptr error);
+		void join();
+
+		Thread_Pool& pool;
+		std::mutex mut;
+		std::condition_variable finished;
+		uint32_t pending = 0; //(guarded by mut)
+		std::exception_ptr error; //first exception a task threw (guarded by mut)
+		std::atomic<bool> cancel_flag = false;
+	};
 
 	template<class F, class... Args>
 	auto enqueue(F&& f, Args&&... args)
 		-> std::future<typename std::invoke_result<F, Args...>::type> {
 
 		using return_type = typename std::invoke_result<F, Args...>::type;
-		assert(!stop_now && !stop_when_done);
 
 		auto task = std::make_shared<std::packaged_task<return_type()>>(
 			std::bind(std::forward<F>(f), std::forward<Args>(args)...));
 
 		std::future<return_type> res = task->get_future();
-		{
-			std::unique_lock<std::mutex> lock(queue_mutex);
-			tasks.emplace([task]() { (*task)(); });
-		}
-		condition.notify_one();
+		push(Task([task]() { (*task)(); }));
 		return res;
 	}
 
+	//pop and run one queued task on the calling thread; returns false if the queue was empty:
+	bool run_one();
+
+	//wait for a future, running queued tasks meanwhile
+	// (so tasks may safely wait on tasks they enqueue themselves):
+	template<typename T>
+	T wait_on(std::future<T>& fut) {
+		while (fut.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			if (!run_one()) fut.wait_for(std::chrono::microseconds(100));
+		}
+		return fut.get();
+	}
+
+	uint32_t size() const {
+		return n_threads;
+	}
+
 private:
-	void start(uint32_t);
-	uint32_t n_threads;
-	bool stop_now = true;
-	bool stop_when_done = true;
-	std::mutex queue_mutex;
-	std::condition_variable condition;
+	struct Queue {
+		std::mutex mut;
+		std::deque<Task> tasks;
+	};
+
+	void push(Task&& task);
+	//take a task: the newest from this worker's own queue, else the oldest from the shared
+	// queue or another worker's queue (counts it as running):
+	bool pop(Task& task);
+	void execute(Task& task);
+	void work(uint32_t index);
+	void drop_queued();
+
+	uint32_t n_threads = 0;
+	std::vector<std::unique_ptr<Queue>> queues; //one per worker, then the shared queue
 	std::vector<std::thread> workers;
-	std::queue<std::function<void()>> tasks;
+
+	std::atomic<uint32_t> queued = 0;  //tasks in queues (counted before they're pushed)
+	std::atomic<uint32_t> running = 0; //tasks taken from queues and not yet finished
+	std::atomic<uint32_t> sleeping = 0;
+	std::atomic<bool> stopping = false;
+	std::mutex sleep_mut;
+	std::condition_variable wake; //workers: there are tasks, or the pool is stopping
+	std::condition_variable idle; //running dropped to zero
 };
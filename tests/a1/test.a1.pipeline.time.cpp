@@ -0,0 +1,103 @@
+#include "test.h"
+#include "scene/texture.h"
+#include "util/timer.h"
+
+//Actually include the *definitions*, to count fragments with the rasterization helpers:
+#include "rasterizer/pipeline.cpp"
+
+using Lambertian_Vertex = Vertex< Programs::Lambertian::VA >;
+
+//layers of squares covering clip space (as triangles) or of one line through each row's pixel centers,
+// drawn back to front so that every fragment passes the depth test:
+static std::vector< Lambertian_Vertex > layer_vertices(PrimitiveType type, uint32_t height, uint32_t layers) {
+	std::vector< Lambertian_Vertex > vertices;
+	auto add = [&](float x, float y, float z) {
+		vertices.emplace_back(Lambertian_Vertex{ std::array< float, Programs::Lambertian::VA >{
+			x, y, z, 0.6f * x, 0.8f * y, 1.0f, 0.5f * x + 0.5f, 0.5f * y + 0.5f
+		} });
+	};
+	for (uint32_t l = 0; l < layers; ++l) {
+		float z = 0.5f - 0.5f * float(l) / float(layers);
+		if (type == PrimitiveType::Triangles) {
+			add(-1.0f, -1.0f, z); add( 1.0f, -1.0f, z); add( 1.0f, 1.0f, z);
+			add(-1.0f, -1.0f, z); add( 1.0f,  1.0f, z); add(-1.0f, 1.0f, z);
+		} else {
+			for (uint32_t y = 0; y < height; ++y) {
+				float at = (float(y) + 0.5f) / float(height) * 2.0f - 1.0f;
+				add(-1.0f, at, z); add(1.0f, at, z);
+			}
+		}
+	}
+	return vertices;
+}
+
+template< PrimitiveType type, uint32_t flags >
+static void measure(char const *name, uint32_t pattern, Programs::Lambertian::Parameters const &parameters) {
+	using P = Pipeline< type, Programs::Lambertian, flags >;
+	constexpr uint32_t size = 256, layers = 4, runs = 5;
+	SamplePattern const *sample_pattern = SamplePattern::from_id(pattern);
+	assert(sample_pattern && "benchmark sample pattern exists");
+	Framebuffer fb(size, size, *sample_pattern);
+	std::vector< Lambertian_Vertex > vertices = layer_vertices(type, size, layers);
+
+	//count the fragments one run rasterizes (and shades):
+	std::vector< typename P::ClippedVertex > clipped;
+	P::shade_and_clip(vertices, 0, vertices.size(), parameters, fb, &clipped);
+	uint64_t fragments = 0;
+	auto count = [&](auto const &) { ++fragments; };
+	for (uint32_t i = 0; i + P::PrimitiveVertices <= clipped.size(); i += P::PrimitiveVertices) {
+		if constexpr (type == PrimitiveType::Lines) {
+			P::rasterize_line(clipped[i], clipped[i + 1], count);
+		} else if constexpr ((flags & PipelineMask_Sample) == Pipeline_Sample_Coverage) {
+			P::rasterize_triangle_coverage(clipped[i], clipped[i + 1], clipped[i + 2], fb.sample_pattern.centers_and_weights, count, PixelRect{0, 0, int32_t(size), int32_t(size)});
+		} else {
+			P::rasterize_triangle(clipped[i], clipped[i + 1], clipped[i + 2], count);
+		}
+	}
+	//(supersampled pipelines rasterize every sample; the squares cover each sample of each pixel once)
+	if constexpr (type == PrimitiveType::Lines || (flags & PipelineMask_Sample) != Pipeline_Sample_Coverage) {
+		fragments *= fb.sample_pattern.centers_and_weights.size();
+	}
+
+	//(best of several runs, since timings are noisy)
+	float ms = std::numeric_limits< float >::infinity();
+	for (uint32_t r = 0; r < runs; ++r) {
+		fb.depths.assign(fb.depths.size(), 1.0f);
+		Timer timer;
+		P::run(vertices, parameters, &fb);
+		ms = std::min(ms, timer.ms());
+	}
+
+	log("\t%-30s %2zu samples: %7.3f Mfragments/s (%llu fragments)\n", name, fb.sample_pattern.centers_and_weights.size(),
+	    double(fragments) / (double(ms) * 1000.0), (unsigned long long)fragments);
+}
+
+Test test_a1_pipeline_time_benchmark("a1.pipeline.time.benchmark", []() {
+	// Report fragment throughput (rasterize, depth test, shade, write) of the Lambertian pipelines
+	// instantiated at the bottom of pipeline.cpp.
+	// (Not a pass/fail check; useful for comparing pipeline changes.)
+	Textures::Image texture(Textures::Image::Sampler::trilinear, HDR_Image(64, 64, Spectrum(0.5f, 0.25f, 0.75f)));
+
+	Programs::Lambertian::Parameters parameters;
+	parameters.local_to_clip = Mat4::I;
+	parameters.normal_to_world = Mat4::I;
+	parameters.image = &texture;
+	parameters.sun_energy = Spectrum(1.0f, 1.0f, 1.0f);
+	parameters.sun_direction = Vec3(0.0f, 0.0f, 1.0f);
+	parameters.sky_energy = Spectrum(0.5f, 0.5f, 0.5f);
+	parameters.ground_energy = Spectrum(0.1f, 0.1f, 0.1f);
+	parameters.sky_direction = Vec3(0.0f, 1.0f, 0.0f);
+
+	log("\n");
+	measure< PrimitiveType::Lines, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat >("lines, depth less", 1, parameters);
+	measure< PrimitiveType::Lines, Pipeline_Blend_Replace | Pipeline_Depth_Always | Pipeline_Interp_Flat >("lines, depth always", 1, parameters);
+	for (uint32_t pattern : {1u, 16u}) {
+		measure< PrimitiveType::Triangles, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat >("triangles, flat", pattern, parameters);
+		measure< PrimitiveType::Triangles, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Screen >("triangles, screen", pattern, parameters);
+		measure< PrimitiveType::Triangles, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Correct >("triangles, correct", pattern, parameters);
+	}
+	measure< PrimitiveType::Triangles, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat | Pipeline_Sample_Coverage >("triangles, flat, coverage", 16, parameters);
+	measure< PrimitiveType::Triangles, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Screen | Pipeline_Sample_Coverage >("triangles, screen, coverage", 16, parameters);
+	measure< PrimitiveType::Triangles, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Correct | Pipeline_Sample_Coverage >("triangles, correct, coverage", 16, parameters);
+	log("\t");
+});
@@ -0,0 +1,177 @@
+#include "test.h"
+#include "geometry/util.h"
+#include "rasterizer/rasterizer.h"
+#include "rasterizer/framebuffer.h"
+#include "rasterizer/pipeline.h"
+#include "rasterizer/programs.h"
+#include "scene/scene.h"
+#include "util/thread_pool.h"
+
+#include <unordered_map>
+
+namespace {
+
+//meshes in several draw styles that cross the rasterizer's 64x64 tiles (but stay on screen), seen by a 150x100 camera with a 4x4 sample grid:
+Scene test_scene() {
+	Scene scene;
+
+	Camera camera;
+	camera.vertical_fov = 50.0f;
+	camera.aspect_ratio = 1.5f;
+	camera.film.width = 150;
+	camera.film.height = 100;
+	camera.film.sample_pattern = 16;
+	std::string camera_transform = scene.create("Camera Transform", Transform(Vec3{0.0f, 1.0f, 3.0f}, Vec3{-10.0f, 0.0f, 0.0f}, Vec3{1.0f}));
+	std::string camera_name = scene.create("Camera", std::move(camera));
+	Instance::Camera camera_instance;
+	camera_instance.transform = scene.get<Transform>(camera_transform);
+	camera_instance.camera = scene.get<Camera>(camera_name);
+	scene.create("Camera Instance", std::move(camera_instance));
+
+	auto lambertian = [&](std::string const &name, Spectrum albedo) {
+		std::weak_ptr<Texture> texture = scene.get<Texture>(scene.create(name + " Albedo", Texture(Textures::Constant(albedo, 1.0f))));
+		return scene.get<Material>(scene.create(name, Material(Materials::Lambertian(texture))));
+	};
+	auto add_mesh = [&](std::string const &name, Indexed_Mesh const &mesh, Transform &&transform, Spectrum albedo, DrawStyle style) {
+		Instance::Mesh instance;
+		instance.transform = scene.get<Transform>(scene.create(name + " Transform", std::move(transform)));
+		instance.mesh = scene.get<Halfedge_Mesh>(scene.create(name, Halfedge_Mesh::from_indexed_mesh(mesh)));
+		instance.material = lambertian(name + " Material", albedo);
+		instance.settings.style = style;
+		scene.create(name + " Instance", std::move(instance));
+	};
+
+	add_mesh("Floor", Util::square_mesh(1.0f), Transform(), Spectrum{0.8f, 0.7f, 0.6f}, DrawStyle::Flat);
+	add_mesh("Sphere", Util::sphere_mesh(0.4f, 2), Transform(Vec3{-0.4f, 0.4f, 0.0f}, Vec3{0.0f}, Vec3{1.0f}), Spectrum{0.2f, 0.4f, 0.9f}, DrawStyle::Correct);
+	add_mesh("Torus", Util::torus_mesh(0.2f, 0.4f), Transform(Vec3{0.5f, 0.4f, 0.3f}, Vec3{60.0f, 0.0f, 20.0f}, Vec3{1.0f}), Spectrum{0.9f, 0.3f, 0.2f}, DrawStyle::Smooth);
+	add_mesh("Cube", Util::cube_mesh(0.3f), Transform(Vec3{0.1f, 1.1f, -0.5f}, Vec3{30.0f, 45.0f, 0.0f}, Vec3{1.0f}), Spectrum{0.3f, 0.9f, 0.3f}, DrawStyle::Wireframe);
+
+	return scene;
+}
+
+//draw scene's mesh instances the way Rasterizer does, but with one Pipeline::run per instance:
+Framebuffer reference(Scene &scene, Instance::Camera const &camera, Rasterizer::Sampling sampling) {
+	using Flat = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat >;
+	using Smooth = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Screen >;
+	using Correct = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Correct >;
+	using Flat_MSAA = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat | Pipeline_Sample_Coverage >;
+	using Smooth_MSAA = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Screen | Pipeline_Sample_Coverage >;
+	using Correct_MSAA = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Correct | Pipeline_Sample_Coverage >;
+	using Lines = Pipeline< PrimitiveType::Lines, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat >;
+	using Vertex = Correct::Vertex;
+
+	std::shared_ptr< Camera > film = camera.camera.lock();
+	Framebuffer framebuffer(film->film.width, film->film.height, *SamplePattern::from_id(film->film.sample_pattern));
+
+	Programs::Lambertian::Parameters parameters;
+	parameters.sun_energy = Spectrum{1.0f, 1.0f, 1.0f};
+	parameters.sun_direction = (camera.transform.lock()->local_to_world() * Vec4(0.0f, 0.0f, -1.0f, 0.0f)).xyz().unit();
+	parameters.sky_energy = Spectrum{0.5f, 0.5f, 0.5f};
+	parameters.ground_energy = Spectrum{0.01f, 0.01f, 0.01f};
+	parameters.sky_direction = Vec3{0.0f, 0.0f, 1.0f};
+	Mat4 world_to_clip = film->projection() * camera.transform.lock()->world_to_local();
+
+	bool multisample = (sampling == Rasterizer::Sampling::Multisample);
+	for (auto const &[name, instance] : scene.instances.meshes) {
+		Materials::Lambertian const &material = std::get< Materials::Lambertian >(instance->material.lock()->material);
+		Textures::Constant const &albedo = std::get< Textures::Constant >(material.albedo.lock()->texture);
+		Textures::Image image(Textures::Image::Sampler::nearest, HDR_Image(1, 1, {albedo.color * albedo.scale}));
+
+		Mat4 local_to_world = instance->transform.lock()->local_to_world();
+		parameters.local_to_clip = world_to_clip * local_to_world;
+		parameters.normal_to_world = Mat4(
+			local_to_world[0][0], local_to_world[0][1], local_to_world[0][2], 0.0f,
+			local_to_world[1][0], local_to_world[1][1], local_to_world[1][2], 0.0f,
+			local_to_world[2][0], local_to_world[2][1], local_to_world[2][2], 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f
+		).T().inverse();
+		parameters.image = &image;
+
+		Indexed_Mesh indexed = Indexed_Mesh::from_halfedge_mesh(*instance->mesh.lock(), Indexed_Mesh::SplitEdges);
+		std::vector< Vertex > triangles;
+		for (auto i : indexed.indices()) {
+			Indexed_Mesh::Vert const &iv = indexed.vertices()[i];
+			Vertex v;
+			v.attributes[Programs::Lambertian::VA_PositionX] = iv.pos.x;
+			v.attributes[Programs::Lambertian::VA_PositionY] = iv.pos.y;
+			v.attributes[Programs::Lambertian::VA_PositionZ] = iv.pos.z;
+			v.attributes[Programs::Lambertian::VA_NormalX] = iv.norm.x;
+			v.attributes[Programs::Lambertian::VA_NormalY] = iv.norm.y;
+			v.attributes[Programs::Lambertian::VA_NormalZ] = iv.norm.z;
+			v.attributes[Programs::Lambertian::VA_TexCoordU] = iv.uv.x;
+			v.attributes[Programs::Lambertian::VA_TexCoordV] = iv.uv.y;
+			triangles.emplace_back(v);
+		}
+
+		DrawStyle style = instance->settings.style;
+		if (style == DrawStyle::Wireframe) {
+			std::vector< Vertex > edges;
+			for (uint32_t i = 0; i + 2 < triangles.size(); i += 3) {
+				for (uint32_t j = 0; j < 3; ++j) {
+					edges.emplace_back(triangles[i + j]);
+					edges.emplace_back(triangles[i + (j + 1) % 3]);
+				}
+			}
+			Lines::run(edges, parameters, &framebuffer);
+		} else if (style == DrawStyle::Flat) {
+			if (multisample) Flat_MSAA::run(triangles, parameters, &framebuffer);
+			else Flat::run(triangles, parameters, &framebuffer);
+		} else if (style == DrawStyle::Smooth) {
+			if (multisample) Smooth_MSAA::run(triangles, parameters, &framebuffer);
+			else Smooth::run(triangles, parameters, &framebuffer);
+		} else {
+			if (multisample) Correct_MSAA::run(triangles, parameters, &framebuffer);
+			else Correct::run(triangles, parameters, &framebuffer);
+		}
+	}
+	return framebuffer;
+}
+
+//render the test scene both ways, and check that every sample has the same color and depth:
+void check_tiles(Rasterizer::Sampling sampling) {
+	Scene scene = test_scene();
+	Instance::Camera const &camera = *scene.instances.cameras.begin()->second;
+
+	Framebuffer expected = reference(scene, camera, sampling);
+
+	//(one pool for both tests, as the app shares one between renders)
+	static Thread_Pool thread_pool(4);
+	float last_progress = 0.0f;
+	Rasterizer rasterizer(scene, camera, [&](Rasterizer::Render_Report report) {
+		last_progress = report.first;
+	}, thread_pool, sampling);
+	rasterizer.wait();
+	if (last_progress != 1.0f) {
+		throw Test::error("The last progress report was " + std::to_string(last_progress) + ", expected 1.");
+	}
+	Framebuffer const &tiled = *rasterizer.framebuffer;
+
+	uint32_t drawn = 0;
+	for (uint32_t y = 0; y < expected.height; ++y) {
+		for (uint32_t x = 0; x < expected.width; ++x) {
+			for (uint32_t s = 0; s < expected.sample_pattern.centers_and_weights.size(); ++s) {
+				Spectrum a = tiled.color_at(x, y, s), b = expected.color_at(x, y, s);
+				float da = tiled.depth_at(x, y, s), db = expected.depth_at(x, y, s);
+				if (a.r != b.r || a.g != b.g || a.b != b.b || da != db) {
+					throw Test::error("Sample " + std::to_string(s) + " of pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") is " + to_string(a) +
+					                  " at depth " + std::to_string(da) + " when tiled, but " + to_string(b) + " at depth " + std::to_string(db) + " when drawn per instance.");
+				}
+				if (db < 1.0f) drawn += 1;
+			}
+		}
+	}
+	//(make sure the comparison isn't vacuous)
+	if (drawn < expected.depths.size() / 8) {
+		throw Test::error("Only " + std::to_string(drawn) + " of " + std::to_string(expected.depths.size()) + " samples were drawn.");
+	}
+}
+
+} // namespace
+
+Test test_a1_rasterizer_tiles_supersample("a1.rasterizer.tiles.supersample", []() {
+	check_tiles(Rasterizer::Sampling::Supersample);
+});
+
+Test test_a1_rasterizer_tiles_multisample("a1.rasterizer.tiles.multisample", []() {
+	check_tiles(Rasterizer::Sampling::Multisample);
+});
@@ -1,5 +1,6 @@
 #include "test.h"
-#include "rasterizer/pipeline.h"
+//Actually include the *definitions*, since the rasterization helpers are templates:
+#include "rasterizer/pipeline.cpp"
 #include "rasterizer/programs.h"
 
 #include <limits>
@@ -1,11 +1,13 @@
 #include "test.h"
-#include "rasterizer/pipeline.h"
+//Actually include the *definitions*, since the rasterization helpers are templates:
+#include "rasterizer/pipeline.cpp"
 #include "rasterizer/programs.h"
 #include "rasterizer/framebuffer.h"
 
 #include <limits>
 #include <iomanip>
 #include <algorithm>
+#include <functional>
 #include <iostream>
 
 using FlatPipeline = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat >;
@@ -347,3 +349,105 @@ Test test_a1_task3_left_right("a1.task3.raster.left.right", []()
                                      FPFragment{Vec3{1.5f, 0.5f, 0.5f}, {1.0f}, {Vec2{0.0f}}},
                                      FPFragment{Vec3{2.5f, 0.5f, 0.5f}, {1.0f}, {Vec2{0.0f}}},
                                      FPFragment{Vec3{1.5f, 2.5f, 0.5f}, {1.0f}, {Vec2{0.0f}}}}); });
+
+Test test_a1_task3_raster_fan("a1.task3.raster.fan", []() {
+	//a fan of (alternately wound) triangles around pixel center (18.5,18.5) covering [1,36]x[1,36];
+	// its spokes run through pixel centers, and it is large enough to contain whole blocks of pixels:
+	Vec2 center(18.5f, 18.5f);
+	std::vector< Vec2 > rim{
+		Vec2(1.0f, 1.0f), Vec2(18.5f, 1.0f), Vec2(36.0f, 1.0f), Vec2(36.0f, 18.5f),
+		Vec2(36.0f, 36.0f), Vec2(18.5f, 36.0f), Vec2(1.0f, 36.0f), Vec2(1.0f, 18.5f)
+	};
+	auto vertex = [](Vec2 at) {
+		return FPClippedVertex{ Vec3{ at.x, at.y, 0.5f }, 1.0f, { 1.0f } };
+	};
+
+	PixelRect const part{5, 7, 30, 20};
+	for (PixelRect const *scissor : { (PixelRect const *)nullptr, &part }) {
+		std::vector< uint32_t > count(40 * 40, 0);
+		uint32_t outside = 0;
+		auto emit_fragment = [&](FPFragment const &f) {
+			int32_t x = int32_t(std::floor(f.fb_position.x));
+			int32_t y = int32_t(std::floor(f.fb_position.y));
+			if (x < 0 || x >= 40 || y < 0 || y >= 40) ++outside;
+			else ++count[y * 40 + x];
+		};
+		for (uint32_t i = 0; i < rim.size(); ++i) {
+			Vec2 a = rim[i], b = rim[(i + 1) % rim.size()];
+			if (i % 2) std::swap(a, b);
+			FlatPipeline::rasterize_triangle(vertex(center), vertex(a), vertex(b), emit_fragment, scissor);
+		}
+
+		std::string desc = scissor ? "with scissor [5,30)x[7,20)" : "without scissor";
+		if (outside) throw Test::error("Fan " + desc + " emitted " + std::to_string(outside) + " fragments outside of it.");
+		for (int32_t y = 0; y < 40; ++y) {
+			for (int32_t x = 0; x < 40; ++x) {
+				bool inside = x >= 1 && x < 36 && y >= 1 && y < 36;
+				if (scissor) inside = inside && scissor->contains(x, y);
+				if (count[y * 40 + x] != (inside ? 1u : 0u)) {
+					throw Test::error("Fan " + desc + " emitted " + std::to_string(count[y * 40 + x]) + " fragments at pixel (" + std::to_string(x) + ", " + std::to_string(y) + ").");
+				}
+			}
+		}
+	}
+});
+
+Test test_a1_task3_raster_early_depth("a1.task3.raster.early_depth", []() {
+	//with early depth, fragments behind the depth buffer or behind coarse depth bounds are not emitted:
+	SamplePattern const *center = SamplePattern::from_id(1);
+	assert(center && "center sample pattern exists");
+	Framebuffer fb(40, 40, *center);
+	for (uint32_t y = 0; y < fb.height; ++y) {
+		for (uint32_t x = 0; x < fb.width; ++x) {
+			fb.depth_at(x, y, 0) = (x < 20 ? 0.25f : 1.0f);
+		}
+	}
+	CoarseDepth coarse;
+	coarse.reset(PixelRect{0, 0, 40, 40}, 1);
+	FlatPipeline::EarlyDepth early{&fb, 0, &coarse};
+
+	auto draw = [&](std::vector< Vec2 > const &corners, float depth) {
+		std::vector< uint32_t > count(40 * 40, 0);
+		auto emit_fragment = [&](FPFragment const &f) {
+			int32_t x = int32_t(std::floor(f.fb_position.x));
+			int32_t y = int32_t(std::floor(f.fb_position.y));
+			if (x >= 0 && x < 40 && y >= 0 && y < 40) ++count[y * 40 + x];
+		};
+		for (uint32_t i = 1; i + 1 < corners.size(); ++i) {
+			auto vertex = [depth](Vec2 at) { return FPClippedVertex{ Vec3{ at.x, at.y, depth }, 1.0f, { 1.0f } }; };
+			FlatPipeline::rasterize_triangle(vertex(corners[0]), vertex(corners[i]), vertex(corners[i + 1]), emit_fragment, nullptr, &early);
+		}
+		return count;
+	};
+	auto check = [](std::string const &desc, std::vector< uint32_t > const &count, auto &&expected) {
+		for (int32_t y = 0; y < 40; ++y) {
+			for (int32_t x = 0; x < 40; ++x) {
+				if (count[y * 40 + x] != (expected(x, y) ? 1u : 0u)) {
+					throw Test::error(desc + " emitted " + std::to_string(count[y * 40 + x]) + " fragments at pixel (" + std::to_string(x) + ", " + std::to_string(y) + ").");
+				}
+			}
+		}
+	};
+	std::vector< Vec2 > square{ Vec2(1.0f, 1.0f), Vec2(36.0f, 1.0f), Vec2(36.0f, 36.0f), Vec2(1.0f, 36.0f) };
+	auto in_square = [](int32_t x, int32_t y) { return x >= 1 && x < 36 && y >= 1 && y < 36; };
+
+	//the square at depth 0.5 is behind the left half of the depth buffer; its triangles each cover whole blocks
+	// in [8,32)x[8,32), except along the diagonal they share:
+	auto covers_block = [](int32_t x, int32_t y) { return x >= 8 && x < 32 && y >= 8 && y < 32 && x / 8 != y / 8; };
+	check("Square at 0.5", draw(square, 0.5f), [&](int32_t x, int32_t y) { return in_square(x, y) && x >= 20; });
+	for (int32_t y = 0; y < 40; y += CoarseDepth::BlockSize) {
+		for (int32_t x = 0; x < 40; x += CoarseDepth::BlockSize) {
+			if (covers_block(x, y) != (coarse.at(x, y, 0) < 0.75f)) {
+				throw Test::error("Coarse depth bound of block (" + std::to_string(x) + ", " + std::to_string(y) + ") is " + std::to_string(coarse.at(x, y, 0)) + ".");
+			}
+		}
+	}
+
+	//(the depth buffer isn't written here, so only the bounds hide the square at depth 0.75 from itself)
+	check("Square at 0.75", draw(square, 0.75f), [&](int32_t x, int32_t y) { return in_square(x, y) && x >= 20 && !covers_block(x, y); });
+	std::vector< Vec2 > small{ Vec2(18.0f, 9.0f), Vec2(30.0f, 9.0f), Vec2(30.0f, 15.0f), Vec2(18.0f, 15.0f) };
+	auto in_small = [](int32_t x, int32_t y) { return x >= 18 && x < 30 && y >= 9 && y < 15; };
+	//(a square within blocks (16,8) and (24,8) is hidden by their bounds as a whole)
+	check("Small square at 0.75", draw(small, 0.75f), [](int32_t, int32_t) { return false; });
+	check("Small square at 0.125", draw(small, 0.125f), in_small);
+});
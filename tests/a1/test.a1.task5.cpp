@@ -1,11 +1,13 @@
 #include "test.h"
-#include "rasterizer/pipeline.h"
+//Actually include the *definitions*, since the rasterization helpers are templates:
+#include "rasterizer/pipeline.cpp"
 #include "rasterizer/programs.h"
 #include "rasterizer/framebuffer.h"
 
 #include <limits>
 #include <iomanip>
 #include <algorithm>
+#include <functional>
 #include <iostream>
 
 using ScreenPipeline = Pipeline< PrimitiveType::Triangles, Programs::Lambertian, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Screen >;
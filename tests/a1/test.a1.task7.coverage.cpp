@@ -0,0 +1,128 @@
+#include "test.h"
+
+//Actually include the *definitions*, to instantiate pipelines with Pipeline_Sample_Coverage:
+#include "rasterizer/pipeline.cpp"
+
+//helper that makes vertices for the Copy program from framebuffer positions (x, y, depth) on a width x height framebuffer:
+template< typename P >
+static std::vector< typename P::Vertex > copy_vertices(uint32_t width, uint32_t height, std::initializer_list< std::pair< Vec3, Spectrum > > const &positions_and_colors) {
+	std::vector< typename P::Vertex > vertices;
+	for (auto const &[at, color] : positions_and_colors) {
+		vertices.emplace_back(typename P::Vertex{ std::array< float, 8 >{
+			at.x / width * 2.0f - 1.0f, at.y / height * 2.0f - 1.0f, at.z * 2.0f - 1.0f, 1.0f,
+			color.r, color.g, color.b, 1.0f
+		} });
+	}
+	return vertices;
+}
+
+static SamplePattern const &grid_4x4() {
+	SamplePattern const *grid = SamplePattern::from_id(16);
+	assert(grid && grid->centers_and_weights.size() == 16 && "4x4 grid sample pattern exists");
+	return *grid;
+}
+
+Test test_a1_task7_coverage_samples("a1.task7.coverage.samples", []() {
+	//a triangle under the line x + y = 1.2 covers the samples of pixel (0,0) with (i + j) * 0.25 + 0.25 < 1.2, and depths follow its plane:
+	using Multi = Pipeline< PrimitiveType::Triangles, Programs::Copy, Pipeline_Blend_Replace | Pipeline_Depth_Less | Pipeline_Interp_Flat | Pipeline_Sample_Coverage >;
+
+	Spectrum color(0.25f, 0.5f, 0.75f);
+	std::vector< Multi::Vertex > vertices = copy_vertices< Multi >(2, 2, {
+		{Vec3(0.0f, 0.0f, 0.5f), color}, {Vec3(1.2f, 0.0f, 0.8f), color}, {Vec3(0.0f, 1.2f, 0.5f), color},
+	});
+
+	Framebuffer fb(2, 2, grid_4x4());
+	fb.colors.assign(fb.colors.size(), Spectrum());
+	fb.depths.assign(fb.depths.size(), 1.0f);
+	Multi::run(vertices, Programs::Copy::Parameters(), &fb);
+
+	std::vector< Vec3 > const &samples = fb.sample_pattern.centers_and_weights;
+	for (uint32_t y = 0; y < fb.height; ++y) {
+		for (uint32_t x = 0; x < fb.width; ++x) {
+			for (uint32_t s = 0; s < samples.size(); ++s) {
+				Vec2 at = Vec2(float(x), float(y)) + samples[s].xy();
+				bool covered = at.x + at.y < 1.2f;
+				Spectrum expected_color = covered ? color : Spectrum();
+				float expected_depth = covered ? 0.5f + 0.25f * at.x : 1.0f;
+				if (Test::differs(fb.color_at(x, y, s), expected_color) || Test::differs(fb.depth_at(x, y, s), expected_depth)) {
+					throw Test::error("Sample " + std::to_string(s) + " of pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") is " + to_string(fb.color_at(x, y, s)) +
+					                  " at depth " + std::to_string(fb.depth_at(x, y, s)) + ", expected " + to_string(expected_color) + " at depth " + std::to_string(expected_depth) + ".");
+				}
+			}
+		}
+	}
+});
+
+Test test_a1_task7_coverage_watertight("a1.task7.coverage.watertight", []() {
+	//triangles that tile the framebuffer, with shared edges through sample locations, add to every sample exactly once:
+	using Multi = Pipeline< PrimitiveType::Triangles, Programs::Copy, Pipeline_Blend_Add | Pipeline_Depth_Always | Pipeline_Interp_Flat | Pipeline_Sample_Coverage >;
+
+	Spectrum one(1.0f, 1.0f, 1.0f);
+	//a fan around (4.125, 4.125) (on a sample location) and a diagonal split through samples:
+	std::vector< Multi::Vertex > vertices = copy_vertices< Multi >(8, 8, {
+		{Vec3(4.125f, 4.125f, 0.5f), one}, {Vec3(0.0f, 0.0f, 0.5f), one}, {Vec3(8.0f, 0.0f, 0.5f), one},
+		{Vec3(4.125f, 4.125f, 0.5f), one}, {Vec3(8.0f, 0.0f, 0.5f), one}, {Vec3(8.0f, 8.0f, 0.5f), one},
+		{Vec3(4.125f, 4.125f, 0.5f), one}, {Vec3(8.0f, 8.0f, 0.5f), one}, {Vec3(0.0f, 8.0f, 0.5f), one},
+		{Vec3(4.125f, 4.125f, 0.5f), one}, {Vec3(0.0f, 8.0f, 0.5f), one}, {Vec3(0.0f, 4.125f, 0.5f), one},
+		{Vec3(4.125f, 4.125f, 0.5f), one}, {Vec3(0.0f, 4.125f, 0.5f), one}, {Vec3(0.0f, 0.0f, 0.5f), one},
+	});
+
+	Framebuffer fb(8, 8, grid_4x4());
+	fb.colors.assign(fb.colors.size(), Spectrum());
+	Multi::run(vertices, Programs::Copy::Parameters(), &fb);
+
+	for (uint32_t y = 0; y < fb.height; ++y) {
+		for (uint32_t x = 0; x < fb.width; ++x) {
+			for (uint32_t s = 0; s < fb.sample_pattern.centers_and_weights.size(); ++s) {
+				if (Test::differs(fb.color_at(x, y, s), one)) {
+					throw Test::error("Sample " + std::to_string(s) + " of pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") was drawn " +
+					                  std::to_string(fb.color_at(x, y, s).r) + " times.");
+				}
+			}
+		}
+	}
+});
+
+Test test_a1_task7_coverage_center("a1.task7.coverage.center", []() {
+	//with only a center sample, coverage and supersampling must agree about pixels on shared edges (so the tie rules match):
+	using Single = Pipeline< PrimitiveType::Triangles, Programs::Copy, Pipeline_Blend_Add | Pipeline_Depth_Always | Pipeline_Interp_Flat >;
+	using Multi = Pipeline< PrimitiveType::Triangles, Programs::Copy, Pipeline_Blend_Add | Pipeline_Depth_Always | Pipeline_Interp_Flat | Pipeline_Sample_Coverage >;
+
+	//triangles with corners on pixel centers, and horizontal, vertical, diagonal, and shallow edges through pixel centers
+	// (each adds a different power of two, so a pixel's sum says which triangles covered it):
+	std::vector< Vec2 > corners{
+		Vec2(0.5f, 0.5f), Vec2(6.5f, 3.5f), Vec2(0.5f, 6.5f),
+		Vec2(0.5f, 0.5f), Vec2(7.5f, 0.5f), Vec2(6.5f, 3.5f),
+		Vec2(7.5f, 0.5f), Vec2(7.5f, 7.5f), Vec2(6.5f, 3.5f),
+		Vec2(6.5f, 3.5f), Vec2(7.5f, 7.5f), Vec2(0.5f, 6.5f),
+		Vec2(0.5f, 6.5f), Vec2(7.5f, 7.5f), Vec2(0.5f, 7.5f),
+		Vec2(2.5f, 1.5f), Vec2(5.5f, 4.5f), Vec2(2.5f, 4.5f),
+		Vec2(2.5f, 4.5f), Vec2(5.5f, 4.5f), Vec2(2.5f, 1.5f),
+	};
+	std::vector< Single::Vertex > vertices;
+	for (uint32_t i = 0; i < corners.size(); ++i) {
+		Vec2 at = corners[i] / 8.0f * 2.0f - Vec2(1.0f);
+		float weight = float(1u << (i / 3));
+		vertices.emplace_back(Single::Vertex{ std::array< float, 8 >{ at.x, at.y, 0.0f, 1.0f, weight, 0.0f, 0.0f, 1.0f } });
+	}
+
+	SamplePattern const *center = SamplePattern::from_id(1);
+	assert(center && center->centers_and_weights.size() == 1 && "center sample pattern exists");
+
+	Framebuffer single(8, 8, *center);
+	single.colors.assign(single.colors.size(), Spectrum());
+	Single::run(vertices, Programs::Copy::Parameters(), &single);
+
+	Framebuffer multi(8, 8, *center);
+	multi.colors.assign(multi.colors.size(), Spectrum());
+	Multi::run(vertices, Programs::Copy::Parameters(), &multi);
+
+	for (uint32_t y = 0; y < 8; ++y) {
+		for (uint32_t x = 0; x < 8; ++x) {
+			if (single.color_at(x, y, 0).r != multi.color_at(x, y, 0).r) {
+				throw Test::error("Pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") was covered by triangles " + std::to_string(uint32_t(multi.color_at(x, y, 0).r)) +
+				                  " (as bits) with coverage, but " + std::to_string(uint32_t(single.color_at(x, y, 0).r)) + " with supersampling.");
+			}
+		}
+	}
+});
@@ -0,0 +1,455 @@
+#include "test.h"
+#include "geometry/util.h"
+#include "pathtracer/pathtracer.h"
+#include "util/rand.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+//a lambertian sphere on a floor, lit by a sky and an emissive square overhead, seen by a width x height camera:
+Scene test_scene(uint32_t width, uint32_t height, uint32_t samples) {
+	Scene scene;
+
+	Camera camera;
+	camera.vertical_fov = 50.0f;
+	camera.aspect_ratio = float(width) / float(height);
+	camera.film.width = width;
+	camera.film.height = height;
+	camera.film.samples = samples;
+	camera.film.max_ray_depth = 4;
+	std::string camera_transform = scene.create("Camera Transform", Transform(Vec3{0.0f, 1.0f, 3.0f}, Vec3{-10.0f, 0.0f, 0.0f}, Vec3{1.0f}));
+	std::string camera_name = scene.create("Camera", std::move(camera));
+	Instance::Camera camera_instance;
+	camera_instance.transform = scene.get<Transform>(camera_transform);
+	camera_instance.camera = scene.get<Camera>(camera_name);
+	scene.create("Camera Instance", std::move(camera_instance));
+
+	auto texture = [&](std::string const &name, Spectrum color, float scale) {
+		return scene.get<Texture>(scene.create(name, Texture(Textures::Constant(color, scale))));
+	};
+	auto lambertian = [&](std::string const &name, Spectrum albedo) {
+		return scene.get<Material>(scene.create(name, Material(Materials::Lambertian(texture(name + " Albedo", albedo, 1.0f)))));
+	};
+	auto add_mesh = [&](std::string const &name, Indexed_Mesh const &mesh, Transform &&transform, std::weak_ptr<Material> material) {
+		Instance::Mesh instance;
+		instance.transform = scene.get<Transform>(scene.create(name + " Transform", std::move(transform)));
+		instance.mesh = scene.get<Halfedge_Mesh>(scene.create(name, Halfedge_Mesh::from_indexed_mesh(mesh)));
+		instance.material = material;
+		scene.create(name + " Instance", std::move(instance));
+	};
+
+	add_mesh("Floor", Util::square_mesh(2.0f), Transform(), lambertian("Floor Material", Spectrum{0.8f, 0.7f, 0.6f}));
+	Materials::Emissive emissive;
+	emissive.emissive = texture("Light Emission", Spectrum{1.0f, 0.9f, 0.8f}, 8.0f);
+	add_mesh("Light", Util::square_mesh(0.3f), Transform(Vec3{0.5f, 2.0f, 0.0f}, Vec3{180.0f, 0.0f, 0.0f}, Vec3{1.0f}),
+	         scene.get<Material>(scene.create("Light Material", Material(std::move(emissive)))));
+
+	Instance::Shape sphere;
+	sphere.transform = scene.get<Transform>(scene.create("Sphere Transform", Transform(Vec3{-0.3f, 0.5f, 0.0f}, Vec3{0.0f}, Vec3{1.0f})));
+	sphere.shape = scene.get<Shape>(scene.create("Sphere", Shape(Shapes::Sphere(0.5f))));
+	sphere.material = lambertian("Sphere Material", Spectrum{0.2f, 0.4f, 0.9f});
+	scene.create("Sphere Instance", std::move(sphere));
+
+	Environment_Lights::Hemisphere sky;
+	sky.radiance = texture("Sky Radiance", Spectrum{0.5f, 0.6f, 0.8f}, 1.0f);
+	Instance::Environment_Light sky_instance;
+	sky_instance.transform = scene.get<Transform>(scene.create("Sky Transform", Transform()));
+	sky_instance.light = scene.get<Environment_Light>(scene.create("Sky", Environment_Light{std::move(sky)}));
+	scene.create("Sky Instance", std::move(sky_instance));
+
+	return scene;
+}
+
+//render scene through its camera with pathtracer (set up by the caller), and wait for the final image:
+HDR_Image render(PT::Pathtracer &pathtracer, Scene &scene) {
+	static bool quit = false;
+	HDR_Image image;
+	pathtracer.render(scene, scene.instances.cameras.begin()->second, [&](PT::Pathtracer::Render_Report &&report) {
+		if (report.first == 1.0f) image = std::move(report.second);
+	}, &quit);
+	while (pathtracer.in_progress()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return image;
+}
+
+//mean luma of the pixels in [x_begin,x_end)x[y_begin,y_end):
+double mean_luma(HDR_Image const &image, uint32_t x_begin, uint32_t x_end, uint32_t y_begin, uint32_t y_end) {
+	double sum = 0.0;
+	for (uint32_t y = y_begin; y < y_end; y++) {
+		for (uint32_t x = x_begin; x < x_end; x++) sum += image.at(x, y).luma();
+	}
+	return sum / double((x_end - x_begin) * (y_end - y_begin));
+}
+
+//renders use RNG::fixed_seed while this is in scope:
+struct Fixed_Seed {
+	uint32_t before = RNG::fixed_seed;
+	Fixed_Seed(uint32_t seed) {
+		RNG::fixed_seed = seed;
+	}
+	~Fixed_Seed() {
+		RNG::fixed_seed = before;
+	}
+};
+
+//adaptive sampling as the tests below use it:
+PT::Pathtracer::Adaptive test_adaptive() {
+	PT::Pathtracer::Adaptive adaptive;
+	adaptive.enabled = true;
+	adaptive.min_samples = 16;
+	adaptive.max_error = 0.01f;
+	return adaptive;
+}
+
+} // namespace
+
+Test test_a3_pathtracer_wavefront("a3.pathtracer.wavefront", []() {
+	// The wavefront integrator evaluates the same estimator as the depth-first one (only the order
+	// of work differs), so at the same seed the images agree closely, overall and in each quadrant:
+	constexpr uint32_t size = 32;
+	Fixed_Seed seed(1234);
+	Scene scene = test_scene(size, size, 64);
+
+	HDR_Image images[2];
+	for (bool wavefront : {false, true}) {
+		PT::Pathtracer pathtracer;
+		pathtracer.use_wavefront(wavefront);
+		images[wavefront] = render(pathtracer, scene);
+		if (images[wavefront].w != size || images[wavefront].h != size) {
+			throw Test::error(std::string(wavefront ? "Wavefront" : "Depth-first") + " render returned no image.");
+		}
+	}
+
+	auto check = [&](std::string const &where, uint32_t x_begin, uint32_t x_end, uint32_t y_begin, uint32_t y_end, double tolerance) {
+		double depth_first = mean_luma(images[0], x_begin, x_end, y_begin, y_end);
+		double wavefront = mean_luma(images[1], x_begin, x_end, y_begin, y_end);
+		if (!(depth_first > 0.0) || std::abs(wavefront - depth_first) > tolerance * depth_first) {
+			throw Test::error("Mean luma of " + where + " is " + std::to_string(wavefront) + " with the wavefront integrator, but " +
+			                  std::to_string(depth_first) + " depth-first.");
+		}
+	};
+	check("the image", 0, size, 0, size, 0.01);
+	for (uint32_t q = 0; q < 4; q++) {
+		uint32_t x = (q % 2) * size / 2, y = (q / 2) * size / 2;
+		check("quadrant " + std::to_string(q), x, x + size / 2, y, y + size / 2, 0.02);
+	}
+});
+
+Test test_a3_pathtracer_adaptive_converged("a3.pathtracer.adaptive.converged", []() {
+	// Pixels that see only the (constant) sky or nothing at all have no variance, so they stop
+	// after the first pass of min_samples:
+	constexpr uint32_t size = 32, samples = 256;
+	Fixed_Seed seed(1234);
+	Scene scene = test_scene(size, size, samples);
+	PT::Pathtracer pathtracer;
+	PT::Pathtracer::Adaptive adaptive = test_adaptive();
+	pathtracer.set_adaptive(adaptive);
+	HDR_Image image = render(pathtracer, scene);
+	HDR_Image counts = pathtracer.sample_counts();
+
+	const Spectrum sky{0.5f, 0.6f, 0.8f};
+	uint32_t constant = 0;
+	for (uint32_t y = 0; y < size; y++) {
+		for (uint32_t x = 0; x < size; x++) {
+			Spectrum pixel = image.at(x, y);
+			if (Test::differs(pixel, sky) && pixel != Spectrum{0.0f}) continue;
+			constant++;
+			if (counts.at(x, y).r != float(adaptive.min_samples)) {
+				throw Test::error("Pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") has no variance but took " +
+				                  std::to_string(counts.at(x, y).r) + " samples, not " + std::to_string(adaptive.min_samples) + ".");
+			}
+		}
+	}
+	if (constant < size * size / 8) {
+		throw Test::error("Only " + std::to_string(constant) + " pixels see just the sky or nothing; the test scene is off.");
+	}
+});
+
+Test test_a3_pathtracer_adaptive_noisy("a3.pathtracer.adaptive.noisy", []() {
+	// Pixels whose estimates from min_samples samples vary a lot between seeds are still far from
+	// max_error after the first passes, so they take every sample the film allows. (Except where the
+	// first pass -- the same samples as first_pass[0] -- only saw the sky or nothing, so it found no variance.)
+	constexpr uint32_t size = 32, samples = 256;
+	PT::Pathtracer::Adaptive adaptive = test_adaptive();
+
+	const Spectrum sky{0.5f, 0.6f, 0.8f};
+	HDR_Image first_pass[2];
+	for (uint32_t s = 0; s < 2; s++) {
+		Fixed_Seed seed(1234 + s);
+		Scene scene = test_scene(size, size, adaptive.min_samples);
+		PT::Pathtracer pathtracer;
+		first_pass[s] = render(pathtracer, scene);
+	}
+
+	Fixed_Seed seed(1234);
+	Scene scene = test_scene(size, size, samples);
+	PT::Pathtracer pathtracer;
+	pathtracer.set_adaptive(adaptive);
+	render(pathtracer, scene);
+	HDR_Image counts = pathtracer.sample_counts();
+
+	uint32_t noisy = 0;
+	for (uint32_t y = 0; y < size; y++) {
+		for (uint32_t x = 0; x < size; x++) {
+			Spectrum first = first_pass[0].at(x, y);
+			if (!Test::differs(first, sky) || first == Spectrum{0.0f}) continue;
+			float a = first.luma(), b = first_pass[1].at(x, y).luma();
+			if (!(std::abs(a - b) > 0.2f * std::max(0.5f * (a + b), 0.01f))) continue;
+			noisy++;
+			if (counts.at(x, y).r != float(samples)) {
+				throw Test::error("Noisy pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") stopped after " +
+				                  std::to_string(counts.at(x, y).r) + " of " + std::to_string(samples) + " samples.");
+			}
+		}
+	}
+	if (noisy < size * size / 16) {
+		throw Test::error("Only " + std::to_string(noisy) + " pixels are noisy; the test scene is off.");
+	}
+});
+
+Test test_a3_pathtracer_adaptive_unbiased("a3.pathtracer.adaptive.unbiased", []() {
+	// Stopping converged pixels early leaves their estimates where they were, so the adaptive image
+	// agrees with a fixed sample count render (at another seed) overall and in each quadrant:
+	constexpr uint32_t size = 32, samples = 256;
+	HDR_Image images[2];
+	for (bool adaptive : {false, true}) {
+		Fixed_Seed seed(adaptive ? 1234 : 4321);
+		Scene scene = test_scene(size, size, samples);
+		PT::Pathtracer pathtracer;
+		if (adaptive) pathtracer.set_adaptive(test_adaptive());
+		images[adaptive] = render(pathtracer, scene);
+	}
+
+	auto check = [&](std::string const &where, uint32_t x_begin, uint32_t x_end, uint32_t y_begin, uint32_t y_end, double tolerance) {
+		double fixed = mean_luma(images[0], x_begin, x_end, y_begin, y_end);
+		double adaptive = mean_luma(images[1], x_begin, x_end, y_begin, y_end);
+		if (!(fixed > 0.0) || std::abs(adaptive - fixed) > tolerance * fixed) {
+			throw Test::error("Mean luma of " + where + " is " + std::to_string(adaptive) + " with adaptive sampling, but " +
+			                  std::to_string(fixed) + " with " + std::to_string(samples) + " samples per pixel.");
+		}
+	};
+	check("the image", 0, size, 0, size, 0.01);
+	for (uint32_t q = 0; q < 4; q++) {
+		uint32_t x = (q % 2) * size / 2, y = (q / 2) * size / 2;
+		check("quadrant " + std::to_string(q), x, x + size / 2, y, y + size / 2, 0.02);
+	}
+});
+
+Test test_a3_pathtracer_checkpoint_round_trip("a3.pathtracer.checkpoint.round_trip", []() {
+	// Resuming a finished render's checkpoint traces nothing more: it reports the checkpointed
+	// image and checkpoints to the same bytes (header and accumulator):
+	Fixed_Seed seed(1234);
+	Scene scene = test_scene(110, 10, 100);
+	std::vector<uint8_t> checkpoint;
+	{
+		PT::Pathtracer pathtracer;
+		render(pathtracer, scene);
+		checkpoint = pathtracer.checkpoint();
+	}
+	HDR_Image expected = PT::Pathtracer::checkpoint_image(checkpoint);
+	if (expected.w != 110 || expected.h != 10) throw Test::error("Checkpoint of a finished render holds no image.");
+
+	PT::Pathtracer pathtracer;
+	bool quit = false;
+	HDR_Image image;
+	bool resumed = pathtracer.resume(scene, scene.instances.cameras.begin()->second, [&](PT::Pathtracer::Render_Report &&report) {
+		if (report.first == 1.0f) image = std::move(report.second);
+	}, &quit, checkpoint);
+	if (!resumed) throw Test::error("Could not resume from the checkpoint of a finished render.");
+	while (pathtracer.in_progress()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	if (image.w != expected.w || image.h != expected.h || image.data() != expected.data()) {
+		throw Test::error("Resumed render reported a different image than its checkpoint holds.");
+	}
+	if (pathtracer.checkpoint() != checkpoint) {
+		throw Test::error("Resumed render checkpoints differently than the render it resumed.");
+	}
+});
+
+Test test_a3_pathtracer_checkpoint_interrupted("a3.pathtracer.checkpoint.interrupted", []() {
+	// A render stopped after its first tile and resumed from a checkpoint ends up with exactly the
+	// (fixed point) accumulator of the same render left to finish:
+	Fixed_Seed seed(1234);
+	Scene scene = test_scene(110, 10, 400);
+	std::shared_ptr<Instance::Camera> camera = scene.instances.cameras.begin()->second;
+
+	std::vector<uint8_t> expected;
+	{
+		PT::Pathtracer pathtracer;
+		render(pathtracer, scene);
+		expected = pathtracer.checkpoint();
+	}
+
+	std::vector<uint8_t> interrupted;
+	{
+		// (partial reports come after tiles finish; the first one stops the render)
+		PT::Pathtracer pathtracer;
+		pathtracer.set_report_rate(1e6f);
+		bool quit = false;
+		pathtracer.render(scene, camera, [&](PT::Pathtracer::Render_Report &&report) {
+			if (report.first < 1.0f) quit = true;
+		}, &quit);
+		while (pathtracer.in_progress()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (!quit) throw Test::error("Render finished without a partial report to interrupt it at.");
+		interrupted = pathtracer.checkpoint();
+	}
+	if (interrupted == expected) throw Test::error("Interrupted render checkpointed the whole render.");
+
+	PT::Pathtracer pathtracer;
+	bool quit = false;
+	if (!pathtracer.resume(scene, camera, [](PT::Pathtracer::Render_Report &&) {}, &quit, interrupted)) {
+		throw Test::error("Could not resume the interrupted render.");
+	}
+	while (pathtracer.in_progress()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	if (pathtracer.checkpoint() != expected) {
+		throw Test::error("Resumed render accumulated differently than the uninterrupted one.");
+	}
+});
+
+Test test_a3_pathtracer_checkpoint_rejected("a3.pathtracer.checkpoint.rejected", []() {
+	// resume() refuses checkpoints that are truncated, padded, from another version, laid out for
+	// another film size, or of an adaptive render while adaptive sampling is off -- before it takes
+	// the report function, which is still there to render() with:
+	Fixed_Seed seed(1234);
+	Scene scene = test_scene(110, 10, 100);
+	std::shared_ptr<Instance::Camera> camera = scene.instances.cameras.begin()->second;
+	std::vector<uint8_t> checkpoint, adaptive_checkpoint;
+	{
+		PT::Pathtracer pathtracer;
+		render(pathtracer, scene);
+		checkpoint = pathtracer.checkpoint();
+		pathtracer.set_adaptive(test_adaptive());
+		render(pathtracer, scene);
+		adaptive_checkpoint = pathtracer.checkpoint();
+	}
+
+	auto expect_rejected = [&](std::string const &what, std::vector<uint8_t> const &data, bool adaptive = false) {
+		PT::Pathtracer pathtracer;
+		if (adaptive) pathtracer.set_adaptive(test_adaptive());
+		bool quit = false;
+		std::function<void(PT::Pathtracer::Render_Report &&)> f = [](PT::Pathtracer::Render_Report &&) {};
+		if (pathtracer.resume(scene, camera, std::move(f), &quit, data)) {
+			while (pathtracer.in_progress()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			throw Test::error("Resumed from a checkpoint " + what + ".");
+		}
+		if (!f) throw Test::error("Rejecting a checkpoint " + what + " took the report function.");
+	};
+
+	// (the header starts with char magic[8], then uint32_t version, width, height, sequence, sample_seed,
+	//  pass_begin, pass_end, samples_end, n_regions, n_slots)
+	auto with_field = [&](uint32_t index, uint32_t value) {
+		std::vector<uint8_t> data = checkpoint;
+		std::memcpy(data.data() + 8 + 4 * index, &value, sizeof(value));
+		return data;
+	};
+	uint32_t version, n_slots;
+	std::memcpy(&version, checkpoint.data() + 8, sizeof(version));
+	std::memcpy(&n_slots, checkpoint.data() + 8 + 4 * 9, sizeof(n_slots));
+
+	expect_rejected("with its last byte cut off", std::vector<uint8_t>(checkpoint.begin(), checkpoint.end() - 1));
+	expect_rejected("with just its first half", std::vector<uint8_t>(checkpoint.begin(), checkpoint.begin() + checkpoint.size() / 2));
+	std::vector<uint8_t> padded = checkpoint;
+	padded.push_back(0);
+	expect_rejected("with an extra byte", padded);
+	expect_rejected("from another version", with_field(0, version + 1));
+	//(one more pass_done slot, with the byte for it, so the data is as long as its header says)
+	std::vector<uint8_t> extra_slot = with_field(9, n_slots + 1);
+	extra_slot.push_back(0);
+	expect_rejected("with more tiles than its film has", extra_slot);
+	expect_rejected("of an adaptive render", adaptive_checkpoint);
+
+	Scene wider = test_scene(111, 10, 100);
+	camera = wider.instances.cameras.begin()->second;
+	expect_rejected("for a narrower film", checkpoint);
+	camera = scene.instances.cameras.begin()->second;
+
+	// (and the checkpoints themselves are fine)
+	for (bool adaptive : {false, true}) {
+		PT::Pathtracer pathtracer;
+		if (adaptive) pathtracer.set_adaptive(test_adaptive());
+		bool quit = false;
+		if (!pathtracer.resume(scene, camera, [](PT::Pathtracer::Render_Report &&) {}, &quit, adaptive ? adaptive_checkpoint : checkpoint)) {
+			throw Test::error(std::string("Could not resume from the ") + (adaptive ? "adaptive" : "fixed") + " checkpoint.");
+		}
+		while (pathtracer.in_progress()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+});
+
+Test test_a3_pathtracer_shards_merge("a3.pathtracer.shards.merge", []() {
+	// The checkpoints of a render's shards merge (in any order) into exactly the checkpoint of the
+	// whole render, and merging only some of them lists the rest as missing:
+	Fixed_Seed seed(1234);
+	Scene scene = test_scene(110, 10, 100);
+	auto shard = [&](uint32_t index, uint32_t count) {
+		PT::Pathtracer pathtracer;
+		pathtracer.set_shard(index, count);
+		render(pathtracer, scene);
+		return pathtracer.checkpoint();
+	};
+	std::vector<uint8_t> whole = shard(0, 1);
+	std::vector<std::vector<uint8_t>> shards{shard(0, 2), shard(1, 2)};
+
+	for (bool reversed : {false, true}) {
+		std::vector<std::vector<uint8_t>> in = shards;
+		if (reversed) std::swap(in[0], in[1]);
+		std::vector<uint8_t> merged;
+		std::string error;
+		std::vector<uint32_t> missing{7};
+		if (!PT::Pathtracer::merge_checkpoints(in, merged, &error, &missing)) {
+			throw Test::error("Could not merge two shards: " + error);
+		}
+		if (!missing.empty()) throw Test::error("Merging every shard reported some as missing.");
+		if (merged != whole) {
+			throw Test::error(std::string("Merged shards") + (reversed ? " (in reverse)" : "") + " differ from the whole render.");
+		}
+	}
+
+	std::vector<uint8_t> merged;
+	std::vector<uint32_t> missing;
+	if (!PT::Pathtracer::merge_checkpoints({shards[1]}, merged, nullptr, &missing)) {
+		throw Test::error("Could not merge a single shard.");
+	}
+	if (missing != std::vector<uint32_t>{0}) throw Test::error("Merging only shard 1 of 2 didn't report shard 0 as missing.");
+});
+
+Test test_a3_pathtracer_shards_rejected("a3.pathtracer.shards.rejected", []() {
+	// merge_checkpoints() refuses repeated shards, shards of different renders, and adaptive renders:
+	Scene scene = test_scene(110, 10, 100);
+	auto shard = [&](uint32_t index, uint32_t count, uint32_t seed, bool adaptive = false) {
+		Fixed_Seed fixed(seed);
+		PT::Pathtracer pathtracer;
+		pathtracer.set_shard(index, count);
+		if (adaptive) pathtracer.set_adaptive(test_adaptive());
+		render(pathtracer, scene);
+		return pathtracer.checkpoint();
+	};
+	std::vector<uint8_t> first = shard(0, 2, 1234), second = shard(1, 2, 1234);
+
+	auto expect_rejected = [&](std::string const &what, std::vector<std::vector<uint8_t>> const &shards) {
+		std::vector<uint8_t> merged;
+		std::string error;
+		if (PT::Pathtracer::merge_checkpoints(shards, merged, &error)) throw Test::error("Merged " + what + ".");
+		if (error.empty()) throw Test::error("Rejected " + what + " without saying why.");
+	};
+	expect_rejected("no checkpoints", {});
+	expect_rejected("the same shard twice", {first, second, first});
+	expect_rejected("shards of renders with different seeds", {first, shard(1, 2, 4321)});
+	expect_rejected("shards of renders split differently", {first, shard(1, 3, 1234)});
+	std::vector<uint8_t> truncated(second.begin(), second.end() - 1);
+	expect_rejected("a truncated shard", {first, truncated});
+	std::vector<uint8_t> adaptive = shard(1, 2, 1234, true);
+	expect_rejected("an adaptive shard", {first, adaptive});
+	expect_rejected("an adaptive shard (first)", {adaptive, first});
+
+	Scene narrow = test_scene(100, 10, 100);
+	{
+		Fixed_Seed fixed(1234);
+		PT::Pathtracer pathtracer;
+		pathtracer.set_shard(1, 2);
+		render(pathtracer, narrow);
+		expect_rejected("shards of different film sizes", {first, pathtracer.checkpoint()});
+	}
+});
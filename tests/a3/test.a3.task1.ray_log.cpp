@@ -0,0 +1,68 @@
+#include "test.h"
+#include "util/reservoir.h"
+
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Logged {
+	uint32_t thread, index;
+	uint32_t check; //(thread ^ index, to catch torn copies)
+};
+} // namespace
+
+Test test_a3_task1_ray_log_reservoir("a3.task1.ray_log.reservoir", []() {
+	// Threads logging different numbers of items end up represented in proportion, and the items
+	// kept from each thread are spread evenly over everything it logged:
+	constexpr uint32_t capacity = 2000;
+	const uint32_t counts[3] = {200000, 50000, 1000};
+	Reservoir<Logged> log(capacity);
+
+	std::vector<std::thread> threads;
+	for (uint32_t t = 0; t < 3; t++) {
+		threads.emplace_back([&, t]() {
+			for (uint32_t i = 0; i < counts[t]; i++) log.add(Logged{t, i, t ^ i});
+		});
+	}
+	// (snapshots taken meanwhile only hold whole items)
+	for (uint32_t s = 0; s < 20; s++) {
+		for (Logged const& l : log.snapshot()) {
+			if ((l.thread ^ l.index) != l.check) throw Test::error("Snapshot during add() returned a torn item!");
+		}
+	}
+	for (auto& thread : threads) thread.join();
+
+	if (log.seen() != counts[0] + counts[1] + counts[2]) {
+		throw Test::error("Reservoir saw " + std::to_string(log.seen()) + " items.");
+	}
+	std::vector<Logged> kept = log.snapshot();
+	// every thread's items are thinned to the fraction kept from the busiest one, capacity / counts[0]:
+	double fraction = double(capacity) / counts[0];
+	for (uint32_t t = 0; t < 3; t++) {
+		uint32_t n = 0;
+		double mean = 0.0;
+		for (Logged const& l : kept) {
+			if (l.thread != t) continue;
+			n++;
+			mean += l.index;
+		}
+		double expected = fraction * counts[t];
+		if (std::abs(n - expected) > 5.0 * std::sqrt(expected) + 1.0) {
+			throw Test::error("Kept " + std::to_string(n) + " items of thread " + std::to_string(t) + ", expected about " +
+			                  std::to_string(expected) + ".");
+		}
+		if (n > 20) {
+			mean /= n;
+			if (std::abs(mean / counts[t] - 0.5) > 0.1) {
+				throw Test::error("Items kept from thread " + std::to_string(t) + " are not spread evenly (mean index " +
+				                  std::to_string(mean) + " of " + std::to_string(counts[t]) + ").");
+			}
+		}
+	}
+
+	log.clear();
+	if (!log.snapshot().empty() || log.seen() != 0) throw Test::error("clear() left items in the reservoir.");
+	log.add(Logged{7, 7, 0});
+	if (log.snapshot().size() != 1) throw Test::error("Reservoir lost an item added after clear().");
+});
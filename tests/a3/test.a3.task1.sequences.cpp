@@ -0,0 +1,93 @@
+#include "test.h"
+#include "util/rand.h"
+
+#include <vector>
+
+Test test_a3_task1_sequences_sobol_stratified("a3.task1.sequences.sobol.stratified", []() {
+	// The first 2^k samples of a pixel should put exactly one value in each of 2^k equal intervals of
+	// every dimension, and exactly one point in each cell of a 2^(k/2) x 2^(k/2) grid of the first
+	// two dimensions of each group of four:
+	constexpr uint32_t n = 256, grid = 16, dims = 8;
+	std::vector<std::vector<float>> points(n);
+	RNG rng;
+	rng.use(RNG::Sequence::Sobol);
+	for (uint32_t i = 0; i < n; i++) {
+		rng.start_sample(1234, 17, 5, i);
+		for (uint32_t d = 0; d < dims; d++) points[i].push_back(rng.unit());
+	}
+	for (uint32_t d = 0; d < dims; d++) {
+		std::vector<uint32_t> bins(n, 0);
+		for (auto& p : points) {
+			if (!(p[d] >= 0.0f && p[d] < 1.0f)) throw Test::error("Sobol value out of [0,1)!");
+			bins[uint32_t(p[d] * n)]++;
+		}
+		for (uint32_t b : bins) {
+			if (b != 1) throw Test::error("Dimension " + std::to_string(d) + " is not stratified!");
+		}
+	}
+	for (uint32_t d = 0; d < dims; d += 4) {
+		std::vector<uint32_t> cells(grid * grid, 0);
+		for (auto& p : points) cells[uint32_t(p[d] * grid) * grid + uint32_t(p[d + 1] * grid)]++;
+		for (uint32_t c : cells) {
+			if (c != 1) throw Test::error("Dimensions " + std::to_string(d) + "," + std::to_string(d + 1) + " are not stratified!");
+		}
+	}
+});
+
+Test test_a3_task1_sequences_resume("a3.task1.sequences.resume", []() {
+	// A sample's draws depend only on the seed, pixel, index and dimension, so samples can be
+	// interleaved by saving and resuming their state:
+	for (RNG::Sequence sequence : {RNG::Sequence::Independent, RNG::Sequence::Sobol}) {
+		RNG rng;
+		rng.use(sequence);
+		std::vector<float> a, b;
+		rng.start_sample(99, 3, 4, 7);
+		for (uint32_t d = 0; d < 10; d++) a.push_back(rng.unit());
+		rng.start_sample(99, 3, 4, 8);
+		for (uint32_t d = 0; d < 10; d++) b.push_back(rng.unit());
+
+		RNG other(5);
+		other.use(sequence);
+		other.start_sample(99, 3, 4, 7);
+		RNG::Sample sa = other.sample();
+		other.start_sample(99, 3, 4, 8);
+		RNG::Sample sb = other.sample();
+		for (uint32_t d = 0; d < 10; d++) {
+			other.resume(sa);
+			float va = other.unit();
+			sa = other.sample();
+			other.resume(sb);
+			float vb = other.unit();
+			sb = other.sample();
+			if (va != a[d] || vb != b[d]) throw Test::error("Resumed samples drew different values!");
+		}
+		if (a == b) throw Test::error("Different samples drew the same values!");
+	}
+});
+
+Test test_a3_task1_sequences_independent("a3.task1.sequences.independent", []() {
+	// Independent draws should look uniform, including integer():
+	RNG rng;
+	rng.use(RNG::Sequence::Independent);
+	constexpr uint32_t n = 100000;
+	double sum = 0.0;
+	std::vector<uint32_t> counts(6, 0);
+	for (uint32_t i = 0; i < n; i++) {
+		rng.start_sample(42, i % 64, i / 64, i);
+		float u = rng.unit();
+		if (!(u >= 0.0f && u < 1.0f)) throw Test::error("Value out of [0,1)!");
+		sum += u;
+		int32_t k = rng.integer(-2, 4);
+		if (k < -2 || k >= 4) throw Test::error("integer() out of range!");
+		counts[k + 2]++;
+	}
+	if (std::abs(sum / n - 0.5) > 0.005) throw Test::error("Mean of unit() is " + std::to_string(sum / n) + "!");
+	for (uint32_t c : counts) {
+		if (std::abs(c - n / 6.0) > 5.0 * std::sqrt(n / 6.0)) throw Test::error("integer() is not uniform!");
+	}
+
+	// (the default sequence is untouched by start_sample)
+	RNG a(1), b(1);
+	b.start_sample(42, 1, 2, 3);
+	if (a.unit() != b.unit()) throw Test::error("start_sample changed the Mersenne sequence!");
+});
@@ -1,6 +1,8 @@
 #include "test.h"
 #include "pathtracer/bvh.h"
 #include "pathtracer/tri_mesh.h"
+#include "util/rand.h"
+#include "util/thread_pool.h"
 
 // Construct a triangle
 static PT::Triangle add_triangle(std::vector<PT::Tri_Mesh_Vert>& verts, Vec3 v0, Vec3 v1, Vec3 v2, uint32_t i) {
@@ -211,4 +213,45 @@ Test test_a3_task3_bvh_build_overlap_1("a3.task3.bvh.build.overlap.1", []() {
     expect_bvh(verts, 2, 1);
     expect_bvh(verts, 3, 1.5f);
     expect_bvh(verts, 4, 2);
-});
\ No newline at end of file
+});
+
+Test test_a3_task3_bvh_build_parallel("a3.task3.bvh.build.parallel", []() {
+	// A BVH built with a thread pool must match one built serially, node for node.
+	// (Enough triangles that the top levels bin and partition in parallel chunks.)
+	RNG gen(1234);
+	constexpr uint32_t triangles = 50000;
+	constexpr size_t max_leaf_size = 4;
+
+	std::vector<PT::Tri_Mesh_Vert> verts;
+	verts.reserve(triangles * 3);
+	auto random_triangles = [&]() {
+		std::vector<PT::Triangle> tris;
+		for (uint32_t i = 0; i < triangles; i++) {
+			Vec3 o = Vec3{gen.unit(), gen.unit(), gen.unit()} * 10.0f;
+			Vec3 v0 = Vec3{gen.unit(), gen.unit(), gen.unit()} + o;
+			Vec3 v1 = Vec3{gen.unit(), gen.unit(), gen.unit()} + o;
+			Vec3 v2 = Vec3{gen.unit(), gen.unit(), gen.unit()} + o;
+			tris.push_back(add_triangle(verts, v0, v1, v2, i * 3));
+		}
+		return tris;
+	};
+	std::vector<PT::Triangle> tris = random_triangles();
+	std::vector<PT::Triangle> tris_copy = tris;
+
+	PT::BVH<PT::Triangle> serial(std::move(tris), max_leaf_size);
+	Thread_Pool pool(4);
+	PT::BVH<PT::Triangle> parallel(std::move(tris_copy), max_leaf_size, PT::BVH<PT::Triangle>::default_buckets, &pool);
+
+	if (serial.nodes.size() != parallel.nodes.size() || serial.root_idx != parallel.root_idx) {
+		throw Test::error("Parallel build produced a different number of nodes than serial build!");
+	}
+	for (size_t i = 0; i < serial.nodes.size(); i++) {
+		const auto& a = serial.nodes[i];
+		const auto& b = parallel.nodes[i];
+		if (a.start != b.start || a.size != b.size || a.l != b.l || a.r != b.r ||
+		    Test::differs(a.bbox.min, b.bbox.min) || Test::differs(a.bbox.max, b.bbox.max)) {
+			throw Test::error("Parallel build produced node " + std::to_string(i) + " differently than serial build!");
+		}
+	}
+	check_invariants(parallel, parallel.nodes.at(parallel.root_idx), max_leaf_size);
+});
@@ -0,0 +1,41 @@
+#include "test.h"
+#include "geometry/util.h"
+#include "pathtracer/tri_mesh.h"
+#include "util/timer.h"
+
+Test test_a3_task3_bvh_build_time_loglinear("a3.task3.bvh.build.time.loglinear", []() {
+	// BVH construction should scale roughly as O(n log n) in the number of triangles:
+	Test::check_loglinear_time([](Indexed_Mesh& mesh) {
+		PT::Tri_Mesh tri_mesh(mesh, true);
+		(void)tri_mesh;
+	});
+});
+
+Test test_a3_task3_bvh_build_time_benchmark("a3.task3.bvh.build.time.benchmark", []() {
+	// Report build times for progressively subdivided spheres.
+	// (Not a pass/fail check; useful for comparing builders and bucket counts.)
+	log("\n");
+	for (uint32_t subdivisions = 2; subdivisions <= 6; subdivisions++) {
+		Indexed_Mesh mesh = Util::sphere_mesh(1.0f, subdivisions);
+		for (size_t buckets : {size_t(8), size_t(16), size_t(32)}) {
+			std::vector<PT::Tri_Mesh_Vert> verts;
+			for (const auto& v : mesh.vertices()) {
+				verts.push_back({v.pos, v.norm, v.uv});
+			}
+			const auto& idxs = mesh.indices();
+			std::vector<PT::Triangle> tris;
+			for (size_t i = 0; i + 2 < idxs.size(); i += 3) {
+				tris.emplace_back(verts.data(), idxs[i], idxs[i + 1], idxs[i + 2]);
+			}
+			size_t n_tris = tris.size();
+
+			Timer timer;
+			PT::BVH<PT::Triangle> bvh(std::move(tris), 4, buckets);
+			float ms = timer.ms();
+
+			log("\tsubdivisions %u: %8zu triangles, %2zu buckets -> %9.3fms (%zu nodes)\n",
+			    subdivisions, n_tris, buckets, ms, bvh.nodes.size());
+		}
+	}
+	log("\t");
+});
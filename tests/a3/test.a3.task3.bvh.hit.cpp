@@ -1,6 +1,10 @@
 #include "test.h"
 #include "geometry/util.h"
+#include "pathtracer/mesh_cache.h"
 #include "pathtracer/tri_mesh.h"
+#include "util/rand.h"
+
+#include <cstring>
 
 Test test_a3_task3_bvh_hit_simple_triangle("a3.task3.bvh.hit.simple.triangle", []() {
 	std::vector<Indexed_Mesh::Vert> verts;
@@ -34,3 +38,242 @@ Test test_a3_task3_bvh_hit_simple_sphere("a3.task3.bvh.hit.simple.sphere", []()
 		throw Test::error("Trace does not match expected: " + diff.value());
 	}
 });
+
+Test test_a3_task3_bvh_occluded_matches_hit("a3.task3.bvh.occluded.matches_hit", []() {
+	// occluded() must agree with hit().hit for every ray, including rays whose bounds
+	// end before (or start after) the surface.
+	PT::Tri_Mesh bvh_mesh = PT::Tri_Mesh(Util::sphere_mesh(1.0f, 3), true);
+	PT::Tri_Mesh list_mesh = PT::Tri_Mesh(Util::sphere_mesh(1.0f, 3), false);
+
+	RNG gen(2187);
+	for (uint32_t i = 0; i < 2000; i++) {
+		Vec3 from = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * 2.0f;
+		Vec3 to = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * 2.0f;
+		float near = gen.unit(), far = near + 3.0f * gen.unit();
+		Ray ray(from, (to - from).unit(), Vec2{near, far});
+
+		bool expected = bvh_mesh.hit(ray).hit;
+		if (bvh_mesh.occluded(ray) != expected || list_mesh.occluded(ray) != expected) {
+			throw Test::error("occluded() disagrees with hit() for ray " + std::to_string(i) + ".");
+		}
+	}
+});
+
+Test test_a3_task3_bvh_hit_kernels("a3.task3.bvh.hit.kernels", []() {
+	// Every available triangle kernel must return the same hits as the scalar list path.
+	PT::Tri_Mesh bvh_mesh = PT::Tri_Mesh(Util::sphere_mesh(1.0f, 3), true);
+	PT::Tri_Mesh list_mesh = PT::Tri_Mesh(Util::sphere_mesh(1.0f, 3), false);
+
+	using PT::Tri_Kernels::Isa;
+	Isa before = PT::Tri_Kernels::current();
+	for (Isa isa : {Isa::scalar, Isa::sse, Isa::avx}) {
+		if (isa > PT::Tri_Kernels::supported()) continue;
+		PT::Tri_Kernels::use(isa);
+
+		RNG gen(4404);
+		for (uint32_t i = 0; i < 2000; i++) {
+			Vec3 from = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * 2.0f;
+			Vec3 to = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * 2.0f;
+			float near = gen.unit(), far = near + 3.0f * gen.unit();
+			Ray ray(from, to - from, Vec2{near, far});
+
+			PT::Trace got = bvh_mesh.hit(ray), exp = list_mesh.hit(ray);
+			bool mismatch = got.hit != exp.hit || bvh_mesh.occluded(ray) != exp.hit;
+			if (!mismatch && exp.hit) {
+				if (auto diff = Test::differs(got, exp)) mismatch = true;
+			}
+			if (mismatch) {
+				PT::Tri_Kernels::use(before);
+				throw Test::error("The " + std::string(PT::Tri_Kernels::name(isa)) +
+				                  " kernel disagrees with Triangle::hit for ray " + std::to_string(i) + ".");
+			}
+		}
+	}
+	PT::Tri_Kernels::use(before);
+});
+
+Test test_a3_task3_bvh_hit_wide("a3.task3.bvh.hit.wide", []() {
+	// 4- and 8-wide traversal must find the same closest hits as the binary tree.
+	Indexed_Mesh sphere = Util::sphere_mesh(1.0f, 3);
+	std::vector<PT::Tri_Mesh_Vert> verts;
+	for (const auto& v : sphere.vertices()) verts.push_back({v.pos, v.norm, v.uv});
+	auto triangles = [&]() {
+		std::vector<PT::Triangle> tris;
+		const auto& idxs = sphere.indices();
+		for (size_t i = 0; i < idxs.size(); i += 3) {
+			tris.emplace_back(verts.data(), idxs[i], idxs[i + 1], idxs[i + 2]);
+		}
+		return tris;
+	};
+
+	PT::BVH<PT::Triangle> binary(triangles(), 2, PT::BVH<PT::Triangle>::default_buckets, nullptr, 2);
+	for (uint32_t width : {4u, 8u}) {
+		PT::BVH<PT::Triangle> wide(triangles(), 2, PT::BVH<PT::Triangle>::default_buckets, nullptr, width);
+
+		RNG gen(width);
+		for (uint32_t i = 0; i < 2000; i++) {
+			Vec3 from = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * 2.0f;
+			Vec3 to = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * 2.0f;
+			Ray ray(from, to - from, Vec2{gen.unit(), 4.0f});
+
+			PT::Trace got = wide.hit(ray), exp = binary.hit(ray);
+			bool mismatch = got.hit != exp.hit || wide.occluded(ray) != exp.hit;
+			if (!mismatch && exp.hit && Test::differs(got, exp)) mismatch = true;
+			if (mismatch) {
+				throw Test::error(std::to_string(width) + "-wide traversal disagrees with the binary tree for ray " +
+				                  std::to_string(i) + ".");
+			}
+		}
+	}
+});
+
+Test test_a3_task3_bvh_refit("a3.task3.bvh.refit", []() {
+	// after the triangles move, a refit tree must find the same closest hits as a fresh build.
+	Indexed_Mesh sphere = Util::sphere_mesh(1.0f, 3);
+	std::vector<PT::Tri_Mesh_Vert> verts;
+	for (const auto& v : sphere.vertices()) verts.push_back({v.pos, v.norm, v.uv});
+	auto triangles = [&]() {
+		std::vector<PT::Triangle> tris;
+		const auto& idxs = sphere.indices();
+		for (size_t i = 0; i < idxs.size(); i += 3) {
+			tris.emplace_back(verts.data(), idxs[i], idxs[i + 1], idxs[i + 2]);
+		}
+		return tris;
+	};
+
+	for (uint32_t width : {2u, 8u}) {
+		for (auto& v : verts) v.position = sphere.vertices()[&v - verts.data()].pos;
+		PT::BVH<PT::Triangle> refit(triangles(), 2, PT::BVH<PT::Triangle>::default_buckets, nullptr, width);
+
+		for (auto& v : verts) v.position = Vec3{v.position.x * 1.5f, v.position.y + v.position.x, v.position.z};
+		if (!refit.refit(triangles())) {
+			throw Test::error("Refit rejected the same number of primitives.");
+		}
+		if (refit.refit({})) {
+			throw Test::error("Refit accepted a different number of primitives.");
+		}
+		PT::BVH<PT::Triangle> fresh(triangles(), 2, PT::BVH<PT::Triangle>::default_buckets, nullptr, width);
+
+		RNG gen(width);
+		for (uint32_t i = 0; i < 2000; i++) {
+			Vec3 from = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * 3.0f;
+			Vec3 to = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * 3.0f;
+			Ray ray(from, to - from, Vec2{gen.unit(), 6.0f});
+
+			PT::Trace got = refit.hit(ray), exp = fresh.hit(ray);
+			bool mismatch = got.hit != exp.hit || refit.occluded(ray) != exp.hit;
+			if (!mismatch && exp.hit && Test::differs(got, exp)) mismatch = true;
+			if (mismatch) {
+				throw Test::error("Refit " + std::to_string(width) + "-wide tree disagrees with a fresh build for ray " +
+				                  std::to_string(i) + ".");
+			}
+		}
+	}
+});
+
+Test test_a3_task3_bvh_cache("a3.task3.bvh.cache", []() {
+	// a mesh saved in the BVH cache layout must load back to the same hits; damaged data, or data
+	// for another key (even one with the same hash), must not load.
+	Indexed_Mesh sphere = Util::sphere_mesh(1.0f, 3);
+	PT::Mesh_Cache::Key key = PT::Mesh_Cache::key(sphere);
+	PT::Tri_Mesh built(sphere, true);
+	std::vector<uint8_t> data = PT::Mesh_Cache::save(built, key);
+
+	PT::Tri_Mesh loaded;
+	if (!PT::Mesh_Cache::load(data.data(), data.size(), key, loaded)) {
+		throw Test::error("Could not load a freshly saved mesh.");
+	}
+	for (uint32_t field = 0; field < 4; field++) {
+		PT::Mesh_Cache::Key other = key;
+		if (field < 2) other.hash[field] += 1;
+		else if (field == 2) other.n_verts += 1;
+		else other.n_indices += 3;
+		PT::Tri_Mesh ignored;
+		if (PT::Mesh_Cache::load(data.data(), data.size(), other, ignored)) {
+			throw Test::error("Loaded a mesh saved for another key (field " + std::to_string(field) + " differs).");
+		}
+	}
+	if (PT::Mesh_Cache::load(data.data(), data.size() - 4, key, loaded)) {
+		throw Test::error("Loaded a mesh from truncated data.");
+	}
+	std::vector<uint8_t> damaged = data;
+	damaged[damaged.size() - 8] ^= 0xff; //(last node's child index)
+	PT::Tri_Mesh ignored;
+	if (PT::Mesh_Cache::load(damaged.data(), damaged.size(), key, ignored)) {
+		throw Test::error("Loaded a mesh whose BVH nodes were damaged.");
+	}
+
+	//leaves that are empty, or that overlap another leaf, must be rejected too (rather than tripping asserts later):
+	// (the nodes end the file, 40 bytes each; the header stores their count at byte 56)
+	uint64_t n_nodes;
+	std::memcpy(&n_nodes, data.data() + 56, 8);
+	size_t node_bytes = 40, nodes_begin = data.size() - size_t(n_nodes) * node_bytes;
+	auto field = [&](std::vector<uint8_t> &bytes, size_t node, uint32_t index) -> uint8_t * {
+		return bytes.data() + nodes_begin + node * node_bytes + 24 + 4 * index; //(start, size, l, r follow the bbox)
+	};
+	auto read = [&](std::vector<uint8_t> &bytes, size_t node, uint32_t index) {
+		uint32_t value;
+		std::memcpy(&value, field(bytes, node, index), 4);
+		return value;
+	};
+	size_t leaf = 0;
+	while (read(data, leaf, 2) != read(data, leaf, 3)) leaf++;
+	for (uint32_t change = 0; change < 2; change++) {
+		damaged = data;
+		uint32_t value = (change == 0 ? 0 : read(data, leaf, 1) + 1); //(empty, or grown into the next leaf)
+		std::memcpy(field(damaged, leaf, 1), &value, 4);
+		if (change == 1 && read(data, leaf, 0) != 0) {
+			value = read(data, leaf, 0) - 1;
+			std::memcpy(field(damaged, leaf, 0), &value, 4);
+		}
+		if (PT::Mesh_Cache::load(damaged.data(), damaged.size(), key, ignored)) {
+			throw Test::error(std::string("Loaded a mesh with ") + (change == 0 ? "an empty" : "an overlapping") + " BVH leaf.");
+		}
+	}
+
+	RNG gen(8);
+	for (uint32_t i = 0; i < 2000; i++) {
+		Vec3 from = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * 2.0f;
+		Vec3 to = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * 2.0f;
+		Ray ray(from, to - from, Vec2{gen.unit(), 4.0f});
+
+		PT::Trace got = loaded.hit(ray), exp = built.hit(ray);
+		if (got.hit != exp.hit || (exp.hit && Test::differs(got, exp))) {
+			throw Test::error("Loaded mesh disagrees with the built mesh for ray " + std::to_string(i) + ".");
+		}
+	}
+});
+
+Test test_a3_task3_bvh_hit_stats("a3.task3.bvh.hit.stats", []() {
+	// Traversals count the nodes they visit and the triangles they test into Ray_Stats::local.
+	if constexpr (!PT::COLLECT_RAY_STATS) return;
+	PT::Tri_Mesh bvh_mesh = PT::Tri_Mesh(Util::sphere_mesh(1.0f, 3), true);
+	PT::Tri_Mesh list_mesh = PT::Tri_Mesh(Util::sphere_mesh(1.0f, 3), false);
+	PT::Ray_Stats before = PT::Ray_Stats::local;
+
+	// a ray that misses the mesh's bounds only visits the root:
+	PT::Ray_Stats::local = PT::Ray_Stats{};
+	bvh_mesh.hit(Ray(Vec3(0, 5, -2), Vec3(0, 0, 1)));
+	if (PT::Ray_Stats::local.bvh_nodes != 1 || PT::Ray_Stats::local.triangle_tests != 0) {
+		throw Test::error("A ray missing the mesh visited " + std::to_string(PT::Ray_Stats::local.bvh_nodes) +
+		                  " nodes and tested " + std::to_string(PT::Ray_Stats::local.triangle_tests) + " triangles.");
+	}
+
+	// one that hits it tests some, but not all, of the triangles (the list tests them all):
+	PT::Ray_Stats::local = PT::Ray_Stats{};
+	bvh_mesh.hit(Ray(Vec3(0, 0, -2), Vec3(0, 0, 1)));
+	PT::Ray_Stats bvh = PT::Ray_Stats::local;
+	PT::Ray_Stats::local = PT::Ray_Stats{};
+	list_mesh.hit(Ray(Vec3(0, 0, -2), Vec3(0, 0, 1)));
+	PT::Ray_Stats list = PT::Ray_Stats::local;
+	PT::Ray_Stats::local = before;
+
+	if (bvh.bvh_nodes < 2 || bvh.triangle_tests == 0 || bvh.triangle_tests >= bvh_mesh.n_triangles()) {
+		throw Test::error("A ray hitting the mesh visited " + std::to_string(bvh.bvh_nodes) + " nodes and tested " +
+		                  std::to_string(bvh.triangle_tests) + " of " + std::to_string(bvh_mesh.n_triangles()) +
+		                  " triangles.");
+	}
+	if (list.triangle_tests != list_mesh.n_triangles() || list.bvh_nodes != 0) {
+		throw Test::error("The list tested " + std::to_string(list.triangle_tests) + " triangles.");
+	}
+});
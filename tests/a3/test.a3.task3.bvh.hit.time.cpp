@@ -0,0 +1,54 @@
+#include "test.h"
+#include "geometry/util.h"
+#include "pathtracer/tri_mesh.h"
+#include "util/rand.h"
+#include "util/timer.h"
+
+using PT::Tri_Mesh;
+
+static Tri_Mesh random_soup(RNG& gen, uint32_t n_tris) {
+	std::vector<Indexed_Mesh::Vert> verts(n_tris * 3);
+	std::vector<Indexed_Mesh::Index> inds(n_tris * 3);
+	for (uint32_t i = 0; i < n_tris; i++) {
+		Vec3 o = Vec3{gen.unit(), gen.unit(), gen.unit()} * 10.0f;
+		for (uint32_t j = 0; j < 3; j++) {
+			Vec3 v = Vec3{gen.unit(), gen.unit(), gen.unit()} + o;
+			verts[i * 3 + j] = Indexed_Mesh::Vert{v, Vec3{0, 1, 0}, Vec2{}, 0};
+			inds[i * 3 + j] = i * 3 + j;
+		}
+	}
+	return Tri_Mesh(Indexed_Mesh(std::move(verts), std::move(inds)), true);
+}
+
+Test test_a3_task3_bvh_hit_time_benchmark("a3.task3.bvh.hit.time.benchmark", []() {
+	// Report closest-hit throughput on a subdivided sphere and on a random triangle soup.
+	// (Not a pass/fail check; useful for comparing traversal changes.)
+	constexpr uint32_t rays = 200000;
+
+	auto measure = [&](const char* name, const Tri_Mesh& mesh, float scale) {
+		RNG gen(1337);
+		std::vector<Ray> batch;
+		batch.reserve(rays);
+		for (uint32_t i = 0; i < rays; i++) {
+			Vec3 from = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * scale;
+			Vec3 to = (Vec3{gen.unit(), gen.unit(), gen.unit()} * 2.0f - Vec3{1.0f}) * scale;
+			batch.emplace_back(from, to - from);
+		}
+
+		uint32_t hits = 0;
+		Timer timer;
+		for (const Ray& ray : batch) {
+			if (mesh.hit(ray).hit) hits++;
+		}
+		float ms = timer.ms();
+
+		log("\t%-20s %7zu triangles: %7.3f Mrays/s (%u hits)\n", name, mesh.n_triangles(),
+		    rays / (ms * 1000.0f), hits);
+	};
+
+	log("\n");
+	RNG gen(462);
+	measure("sphere (6 subdiv)", Tri_Mesh(Util::sphere_mesh(1.0f, 6), true), 2.0f);
+	measure("random soup", random_soup(gen, 50000), 12.0f);
+	log("\t");
+});
@@ -0,0 +1,65 @@
+#include "test.h"
+#include "geometry/util.h"
+#include "pathtracer/light_sampler.h"
+#include "scene/material.h"
+#include "scene/texture.h"
+#include "util/rand.h"
+
+static std::shared_ptr<Material> emissive_material(std::shared_ptr<Texture> const &texture) {
+	Materials::Emissive emissive;
+	emissive.emissive = texture;
+	return std::make_shared<Material>(emissive);
+}
+
+Test test_a3_task6_light_sampler_pdf("a3.task6.light_sampler.pdf", []() {
+	// a bright sphere and a dim, squashed one; directions must be picked by power and the pdf must
+	// integrate to one over the sphere of directions:
+	auto bright_tex = std::make_shared<Texture>(Textures::Constant{Spectrum{1.0f}, 4.0f});
+	auto dim_tex = std::make_shared<Texture>(Textures::Constant{Spectrum{1.0f}, 1.0f});
+	auto bright = emissive_material(bright_tex), dim = emissive_material(dim_tex);
+	PT::Tri_Mesh sphere(Util::sphere_mesh(1.0f, 2), true);
+
+	std::vector<PT::Instance> emitters;
+	emitters.emplace_back(&sphere, bright.get(), Mat4::translate(Vec3{3.0f, 0.0f, 0.0f}));
+	emitters.emplace_back(&sphere, dim.get(),
+	                      Mat4::translate(Vec3{-3.0f, 0.0f, 0.0f}) * Mat4::scale(Vec3{0.5f, 2.0f, 0.5f}));
+	PT::Light_Sampler lights(std::move(emitters));
+
+	float p_bright = 0.0f;
+	for (size_t i = 0; i < lights.n_emitters(); i++) {
+		if (lights.emitters()[i].surface() == bright.get()) p_bright = lights.probability(i);
+	}
+	if (!(p_bright > 0.8f && p_bright < 0.9f)) {
+		throw Test::error("Bright emitter should be picked with probability ~0.86, not " + std::to_string(p_bright) + ".");
+	}
+
+	RNG rng(1);
+	Vec3 from{0.0f, 0.5f, 0.0f};
+	uint32_t toward_bright = 0;
+	constexpr uint32_t samples = 20000;
+	for (uint32_t i = 0; i < samples; i++) {
+		Vec3 dir = lights.sample(rng, from);
+		if (dir.x > 0.0f) toward_bright++;
+		if (!(lights.pdf(from, dir) > 0.0f)) {
+			throw Test::error("Sampled direction " + std::to_string(i) + " has zero pdf.");
+		}
+	}
+	float fraction = toward_bright / float(samples);
+	if (std::abs(fraction - p_bright) > 0.02f) {
+		throw Test::error("Sampled the bright emitter " + std::to_string(fraction) + " of the time, expected " +
+		                  std::to_string(p_bright) + ".");
+	}
+
+	double integral = 0.0;
+	constexpr uint32_t directions = 200000;
+	for (uint32_t i = 0; i < directions; i++) {
+		float z = 1.0f - 2.0f * rng.unit();
+		float phi = 2.0f * PI_F * rng.unit();
+		float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+		integral += lights.pdf(from, Vec3{r * std::cos(phi), r * std::sin(phi), z}) * (4.0f * PI_F);
+	}
+	integral /= directions;
+	if (std::abs(integral - 1.0) > 0.05) {
+		throw Test::error("Light pdf integrates to " + std::to_string(integral) + ", not 1.");
+	}
+});
@@ -1,6 +1,8 @@
 #include "test.h"
 #include "scene/env_light.h"
 #include "util/rand.h"
+#include "util/thread_pool.h"
+#include "pathtracer/samplers.h"
 #include <iostream>
 
 using Environment_Lights::Sphere;
@@ -75,3 +77,60 @@ Test test_a3_task7_env_light_map_simple_evaluate("a3.task7.env_light.map.simple.
 	}
 });
 
+
+Test test_a3_task7_env_light_map_alias("a3.task7.env_light.map.alias", []() {
+	HDR_Image img = test_img();
+	Samplers::Sphere::Image importance(img);
+	Thread_Pool pool(4);
+	Samplers::Sphere::Image threaded(img, &pool);
+
+	const std::vector<Samplers::Sphere::Image::Bin>& bins = *importance.bins;
+	size_t n = bins.size();
+	if (n != 12 * 6) throw Test::error("Table has the wrong number of entries!");
+
+	//the alias table should pick every texel with probability p:
+	std::vector<double> picked(n, 0.0);
+	double total = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		picked[i] += bins[i].q / double(n);
+		picked[bins[i].alias] += (1.0 - bins[i].q) / double(n);
+		total += bins[i].p;
+		if (bins[i].p != (*threaded.bins)[i].p || bins[i].q != (*threaded.bins)[i].q) {
+			throw Test::error("Table built with a thread pool differs!");
+		}
+	}
+	if (std::abs(total - 1.0) > 1e-5) throw Test::error("Texel probabilities sum to " + std::to_string(total) + ", not 1!");
+	for (size_t i = 0; i < n; i++) {
+		if (std::abs(picked[i] - bins[i].p) > 1e-6) {
+			throw Test::error("Alias table picks texel " + std::to_string(i) + " with probability " +
+			                  std::to_string(picked[i]) + ", not " + std::to_string(bins[i].p) + "!");
+		}
+	}
+
+	//sampled directions land in texels at the expected rates, and pdf() agrees with them:
+	RNG rng(3);
+	constexpr uint32_t samples = 200000;
+	std::vector<uint32_t> counts(n, 0);
+	for (uint32_t s = 0; s < samples; s++) {
+		Vec3 dir = importance.sample(rng);
+		float u = std::atan2(dir.z, dir.x) / (2.0f * PI_F);
+		if (u < 0.0f) u += 1.0f;
+		float v = std::acos(-std::clamp(dir.y, -1.0f, 1.0f)) / PI_F;
+		uint32_t x = std::min(uint32_t(u * 12), 11u), y = std::min(uint32_t(v * 6), 5u);
+		counts[x + y * 12]++;
+
+		float theta = PI_F * (float(y) + 0.5f) / 6.0f;
+		float texel_area = (2.0f * PI_F / 12.0f) * (PI_F / 6.0f) * std::sin(theta);
+		float expected = bins[x + y * 12].p / texel_area;
+		if (std::abs(importance.pdf(dir) - expected) > 1e-3f * expected) {
+			throw Test::error("pdf() disagrees with the texel probability!");
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		double expected = bins[i].p * samples;
+		if (std::abs(counts[i] - expected) > 5.0 * std::sqrt(expected) + 1.0) {
+			throw Test::error("Texel " + std::to_string(i) + " sampled " + std::to_string(counts[i]) +
+			                  " times, expected about " + std::to_string(expected) + "!");
+		}
+	}
+});
@@ -0,0 +1,105 @@
+#include "test.h"
+#include "util/thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+Test test_a3_thread_pool("a3.thread_pool", []() {
+	Thread_Pool pool(4);
+
+	// nested groups (tasks waiting on tasks they run, as parallel builds do) finish every task:
+	std::atomic<uint32_t> count = 0;
+	std::function<void(uint32_t)> fork = [&](uint32_t depth) {
+		count++;
+		if (depth == 0) return;
+		Thread_Pool::Group group(pool);
+		group.run([&, depth]() { fork(depth - 1); });
+		fork(depth - 1);
+		group.wait();
+	};
+	fork(12);
+	if (count != (1u << 13) - 1) {
+		throw Test::error("Nested task groups ran " + std::to_string(count) + " tasks instead of " + std::to_string((1u << 13) - 1) + "!");
+	}
+
+	// futures from enqueue still work:
+	auto fut = pool.enqueue([](uint32_t x) { return x * 2; }, 21u);
+	if (pool.wait_on(fut) != 42) {
+		throw Test::error("Enqueued task returned the wrong value!");
+	}
+
+	// cancelled groups skip the tasks that haven't started:
+	{
+		std::atomic<uint32_t> ran = 0;
+		Thread_Pool::Group group(pool);
+		group.cancel();
+		for (uint32_t i = 0; i < 100; i++) group.run([&]() { ran++; });
+		group.wait();
+		if (ran != 0) {
+			throw Test::error("Cancelled group ran " + std::to_string(ran) + " tasks!");
+		}
+		group.reset();
+		group.run([&]() { ran++; });
+		group.wait();
+		if (ran != 1) {
+			throw Test::error("Group didn't run tasks after reset!");
+		}
+	}
+
+	// cancelling a group skips only its own queued tasks; other groups' tasks still all run:
+	{
+		std::atomic<bool> release = false;
+		std::atomic<uint32_t> ran = 0, other_ran = 0;
+		Thread_Pool::Group group(pool), other(pool);
+		for (uint32_t i = 0; i < 1000; i++) {
+			group.run([&]() {
+				while (!release) std::this_thread::yield();
+				ran++;
+			});
+			other.run([&]() { other_ran++; });
+		}
+		group.cancel();
+		release = true;
+		group.wait();
+		other.wait();
+		if (ran > 4) {
+			throw Test::error("Cancelled group still ran " + std::to_string(ran) + " queued tasks!");
+		}
+		if (other_ran != 1000) {
+			throw Test::error("Cancelling one group left another with " + std::to_string(other_ran) + " of 1000 tasks run!");
+		}
+	}
+
+	// a task's exception is rethrown by its group's wait() (once), and doesn't stop the pool:
+	{
+		std::atomic<uint32_t> ran = 0;
+		Thread_Pool::Group group(pool);
+		for (uint32_t i = 0; i < 100; i++) {
+			group.run([&, i]() {
+				ran++;
+				if (i == 50) throw std::runtime_error("task 50");
+			});
+		}
+		bool caught = false;
+		try {
+			group.wait();
+		} catch (std::runtime_error const &e) {
+			caught = std::string(e.what()) == "task 50";
+		}
+		if (!caught) {
+			throw Test::error("Group::wait() didn't rethrow its task's exception!");
+		}
+		if (ran != 100) {
+			throw Test::error("A throwing task kept others in its group from running (" + std::to_string(ran) + " of 100 ran)!");
+		}
+		group.wait(); //(already reported, so this doesn't throw again)
+		auto after = pool.enqueue([]() { return 1; });
+		if (pool.wait_on(after) != 1) {
+			throw Test::error("Pool didn't run tasks after one threw!");
+		}
+	}
+});